@@ -0,0 +1,201 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Allocator benchmark. Runs the same two phases on several threads under
+*		the allocator chosen by --alloc:
+*		  churn       sqlite3_malloc/sqlite3_free of SQLite-like sizes with a
+*		              window of live blocks, some freed by another thread
+*		  statements  prepare, bind, step and finalize of small queries, one
+*		              connection per thread, through WinRTVFS
+*		SQLite can be configured only once per process, so run once per
+*		allocator and compare the outputs.
+*
+*		Build (POSIX):
+*			g++ -std=c++14 -O2 -I../Source AllocBench.cpp ../Source/WinRT*.cpp \
+*				-lsqlite3 -lpthread -o allocbench
+*
+*		Options:
+*			--alloc=NAME     winrt (default), system (SQLite's default, with
+*			                 memory statistics) or system-nostats
+*			--threads=N      threads (default 4)
+*			--ops=N          operations per thread per phase (default 200000)
+*			--out=PATH       write JSON to PATH instead of stdout
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "WinRTVFS.h"
+#include "WinRTAllocator.h"
+#include "BenchUtil.h"
+
+
+/*
+** Mostly small blocks, as SQLite's are: a quarter of them up to 64 bytes,
+** then up to 512, some to 4 KB and a few page-sized buffers.
+*/
+static int ChurnSize(BenchRandom &rng)
+{
+	uint64_t r = rng.Below(100);
+	if (r < 40) return 8 + (int)rng.Below(56);
+	if (r < 85) return 64 + (int)rng.Below(448);
+	if (r < 98) return 512 + (int)rng.Below(3584);
+	return 4096 + (int)rng.Below(4096);
+}
+
+/*
+** Each thread keeps 256 live blocks, replacing one at random per
+** operation; every 16th block is handed to the next thread to free.
+*/
+static double Churn(int nThreads, int ops)
+{
+	std::vector<std::vector<void*>> inbox(nThreads);
+	std::vector<std::mutex> inboxMutex(nThreads);
+	std::vector<std::thread> threads;
+	uint64_t start = BenchNowNs();
+	for (int t = 0; t < nThreads; t++)
+	{
+		threads.emplace_back([&, t] {
+			BenchRandom rng(t + 1);
+			std::vector<void*> live(256, nullptr);
+			std::vector<void*> mine;
+			for (int i = 0; i < ops; i++)
+			{
+				size_t slot = (size_t)rng.Below(live.size());
+				void *p = live[slot];
+				if (p != nullptr && i % 16 == 0 && nThreads > 1)
+				{
+					std::lock_guard<std::mutex> lock(inboxMutex[(t + 1) % nThreads]);
+					inbox[(t + 1) % nThreads].push_back(p);
+				}
+				else
+				{
+					::sqlite3_free(p);
+				}
+				live[slot] = ::sqlite3_malloc(ChurnSize(rng));
+				if (i % 1024 == 0)
+				{
+					{
+						std::lock_guard<std::mutex> lock(inboxMutex[t]);
+						mine.swap(inbox[t]);
+					}
+					for (void *q : mine)
+						::sqlite3_free(q);
+					mine.clear();
+				}
+			}
+			for (void *p : live)
+				::sqlite3_free(p);
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	for (auto &box : inbox)
+	{
+		for (void *p : box)
+			::sqlite3_free(p);
+	}
+	return (double)(BenchNowNs() - start) / ((double)ops * nThreads);
+}
+
+static double Statements(int nThreads, int ops)
+{
+	std::vector<std::thread> threads;
+	uint64_t start = BenchNowNs();
+	for (int t = 0; t < nThreads; t++)
+	{
+		threads.emplace_back([&, t] {
+			std::string path = "allocbench" + std::to_string(t) + ".db";
+			::remove(path.c_str());
+			sqlite3 *db = nullptr;
+			::sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, "WinRTVFS");
+			::sqlite3_exec(db,
+				"CREATE TABLE t(k INTEGER PRIMARY KEY, v TEXT);"
+				"WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x<1000)"
+				" INSERT INTO t SELECT x, hex(randomblob(20)) FROM c;",
+				nullptr, nullptr, nullptr);
+			BenchRandom rng(t + 1);
+			for (int i = 0; i < ops; i++)
+			{
+				sqlite3_stmt *stmt = nullptr;
+				::sqlite3_prepare_v2(db, "SELECT v, length(v) FROM t WHERE k = ?1", -1, &stmt, nullptr);
+				::sqlite3_bind_int64(stmt, 1, 1 + (sqlite3_int64)rng.Below(1000));
+				while (::sqlite3_step(stmt) == SQLITE_ROW)
+					;
+				::sqlite3_finalize(stmt);
+			}
+			::sqlite3_close(db);
+			::remove(path.c_str());
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	return (double)(BenchNowNs() - start) / ((double)ops * nThreads);
+}
+
+
+int main(int argc, char **argv)
+{
+	std::string alloc = BenchArg(argc, argv, "alloc", "winrt");
+	int nThreads = atoi(BenchArg(argc, argv, "threads", "4"));
+	int ops = atoi(BenchArg(argc, argv, "ops", "200000"));
+	const char *zOut = BenchArg(argc, argv, "out", nullptr);
+
+	int rc = SQLITE_OK;
+	if (alloc == "winrt")
+		rc = ::WinRTAllocatorInstall();
+	else if (alloc == "system-nostats")
+		rc = ::sqlite3_config(SQLITE_CONFIG_MEMSTATUS, 0);
+	else if (alloc != "system")
+		rc = SQLITE_ERROR;
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, "cannot configure allocator %s\n", alloc.c_str());
+		return 1;
+	}
+	::WinRTVFSRegister("WinRTVFS", ::WinRTPosixBackend(), 0);
+
+	FILE *out = zOut ? fopen(zOut, "w") : stdout;
+	if (out == nullptr)
+	{
+		fprintf(stderr, "cannot write %s\n", zOut);
+		return 1;
+	}
+
+	BenchJson json(out);
+	json.BeginObject();
+	json.Field("benchmark", "alloc");
+	json.Field("alloc", alloc);
+	json.Field("threads", nThreads);
+	json.Field("churn_ns_per_op", Churn(nThreads, ops));
+	json.Field("statement_ns_per_op", Statements(nThreads, ops / 10));
+	if (alloc == "winrt")
+	{
+		WinRTAllocatorStats stats;
+		::WinRTAllocatorStatus(&stats);
+		json.BeginObject("stats");
+		json.Field("highwater", (uint64_t)stats.highwater);
+		json.Field("footprint", (uint64_t)stats.footprint);
+		json.Field("footprint_highwater", (uint64_t)stats.footprintHighwater);
+		json.Field("mallocs", (uint64_t)stats.mallocs);
+		json.Field("spans", (uint64_t)stats.spans);
+		json.Field("internal_fragmentation", stats.internalFragmentation);
+		json.Field("external_fragmentation", stats.externalFragmentation);
+		json.EndObject();
+	}
+	json.EndObject();
+	json.Finish();
+
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
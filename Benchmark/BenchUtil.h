@@ -0,0 +1,192 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Timing, latency percentile and JSON helpers shared by the benchmarks.
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "WinRTStorage.h"
+#include "WinRTSimStorage.h"
+
+
+inline uint64_t BenchNowNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+/*
+** Deterministic xorshift generator, so every run touches the same keys.
+*/
+class BenchRandom
+{
+public:
+	BenchRandom(uint64_t seed) : state(seed ? seed : 0x9E3779B97F4A7C15ull) {}
+
+	uint64_t Next()
+	{
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		return state;
+	}
+
+	// Uniform value in [0, n)
+	uint64_t Below(uint64_t n) { return Next() % n; }
+
+private:
+	uint64_t state;
+};
+
+/*
+** Collects per-operation latencies and reports percentiles.
+*/
+class BenchLatency
+{
+public:
+	void Add(uint64_t ns) { samples.push_back(ns); total += ns; }
+	size_t Count() const { return samples.size(); }
+	uint64_t TotalNs() const { return total; }
+
+	uint64_t Percentile(double pct)
+	{
+		if (samples.empty())
+			return 0;
+		if (!sorted)
+		{
+			std::sort(samples.begin(), samples.end());
+			sorted = true;
+		}
+		size_t idx = (size_t)(pct / 100.0 * (samples.size() - 1) + 0.5);
+		return samples[idx];
+	}
+
+private:
+	std::vector<uint64_t> samples;
+	uint64_t total = 0;
+	bool sorted = false;
+};
+
+/*
+** Minimal streaming JSON writer. Keys and string values are assumed not to
+** need escaping beyond quotes and backslashes.
+*/
+class BenchJson
+{
+public:
+	BenchJson(FILE *out) : out(out) {}
+
+	void BeginObject(const char *key = nullptr) { Open(key, '{'); }
+	void EndObject() { Close('}'); }
+	void BeginArray(const char *key = nullptr) { Open(key, '['); }
+	void EndArray() { Close(']'); }
+
+	void Field(const char *key, const char *value)
+	{
+		Key(key);
+		fputc('"', out);
+		for (const char *c = value; *c; c++)
+		{
+			if (*c == '"' || *c == '\\') fputc('\\', out);
+			fputc(*c, out);
+		}
+		fputc('"', out);
+	}
+	void Field(const char *key, const std::string &value) { Field(key, value.c_str()); }
+	void Field(const char *key, double value) { Key(key); fprintf(out, "%.6g", value); }
+	void Field(const char *key, uint64_t value) { Key(key); fprintf(out, "%llu", (unsigned long long)value); }
+	void Field(const char *key, int value) { Key(key); fprintf(out, "%d", value); }
+
+	/*
+	** Emit {"p50":..,"p90":..,"p99":..,"max":..} in microseconds.
+	*/
+	void Latencies(const char *key, BenchLatency &lat)
+	{
+		BeginObject(key);
+		Field("p50", lat.Percentile(50) / 1000.0);
+		Field("p90", lat.Percentile(90) / 1000.0);
+		Field("p99", lat.Percentile(99) / 1000.0);
+		Field("max", lat.Percentile(100) / 1000.0);
+		EndObject();
+	}
+
+	void Finish() { fputc('\n', out); fflush(out); }
+
+private:
+	void Key(const char *key)
+	{
+		if (needComma) fputc(',', out);
+		needComma = true;
+		if (key) fprintf(out, "\"%s\":", key);
+	}
+	void Open(const char *key, char c)
+	{
+		Key(key);
+		fputc(c, out);
+		needComma = false;
+	}
+	void Close(char c)
+	{
+		fputc(c, out);
+		needComma = true;
+	}
+
+	FILE *out;
+	bool needComma = false;
+};
+
+/*
+** Returns the value of "--name=value" from argv, or def if absent.
+*/
+inline const char *BenchArg(int argc, char **argv, const char *name, const char *def)
+{
+	size_t n = strlen(name);
+	for (int i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--", 2) == 0 && strncmp(argv[i] + 2, name, n) == 0 && argv[i][2 + n] == '=')
+			return argv[i] + 3 + n;
+	}
+	return def;
+}
+
+/*
+** Storage backend named by --backend (posix, uring, sim), or nullptr if
+** unknown. sim keeps files in memory on the device named by --device
+** (WinRTSimPreset, default sdcard), its stalls and failures drawn from
+** --seed.
+*/
+inline WinRTBackend *BenchBackend(int argc, char **argv)
+{
+	std::string name = BenchArg(argc, argv, "backend", "posix");
+	if (name == "posix")
+		return ::WinRTPosixBackend();
+	if (name == "sim")
+	{
+		WinRTSimModel model;
+		if (::WinRTSimPreset(BenchArg(argc, argv, "device", "sdcard"), &model) != SQLITE_OK)
+			return nullptr;
+		model.seed = strtoull(BenchArg(argc, argv, "seed", "1"), nullptr, 10);
+		return ::WinRTSimBackend(&model);
+	}
+#if defined(__linux__)
+	if (name == "uring")
+		return ::WinRTUringBackend();
+#endif
+	return nullptr;
+}
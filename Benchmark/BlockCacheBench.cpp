@@ -0,0 +1,252 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Block cache benchmark. Drives WinRTBlockCache (WinRTBlockCache.h)
+*		directly with a mix of point lookups on a hot set of blocks, as an
+*		OLTP workload's index pages, and large sequential scans, as analytic
+*		queries or VACUUM, and reports the hit ratio of each. A miss is
+*		filled as WinRTRead would fill it after reading storage, with a
+*		block that is part random bytes and part zeros, as a page with free
+*		space, so that the compressed second tier sees realistic ratios;
+*		every hit is checked against what was filled.
+*
+*		Phases:
+*		  lookups     the hot set alone, after warming
+*		  mixed       rounds of lookups, each followed by a scan
+*		  shifted     the same, with a hot set elsewhere in the file, to see
+*		              how fast the cache adapts
+*
+*		Build (POSIX):
+*			g++ -std=c++14 -O2 -I../Source BlockCacheBench.cpp ../Source/WinRT*.cpp \
+*				-lsqlite3 -lpthread -o blockcachebench
+*
+*		Options:
+*			--hot=N          blocks in the hot set (default half the cache)
+*			--scan=N         blocks per scan (default four times the cache)
+*			--lookups=N      lookups per round (default 20000)
+*			--free=PCT       zero bytes in each block, percent (default 60)
+*			--rounds=N       rounds per phase (default 10)
+*			--file=PATH      scratch database for the coherence check (default
+*			                 blockcachebench.db, recreated)
+*			--out=PATH       write JSON to PATH instead of stdout
+*
+*		It also checks, as "external_check", that a database written through
+*		the VFS, closed, then written by another VFS (as another process
+*		would) is read back as the other VFS left it when reopened, although
+*		its blocks are still cached.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "WinRTVFS.h"
+#include "WinRTBlockCache.h"
+#include "BenchUtil.h"
+
+
+struct BenchCounts
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t hitNs = 0;
+	uint64_t corrupt = 0;
+
+	double Ratio() const { return hits + misses ? (double)hits / (hits + misses) : 0; }
+};
+
+static int freePercent = 60;
+
+static void Content(sqlite_int64 index, std::vector<char> &buf)
+{
+	BenchRandom rng((uint64_t)index + 1);
+	int nRandom = WINRT_BLOCK_BYTES - WINRT_BLOCK_BYTES / 100 * freePercent;
+	for (int i = 0; i < nRandom; i += 8)
+	{
+		uint64_t r = rng.Next();
+		::memcpy(&buf[i], &r, std::min(8, nRandom - i));
+	}
+	::memset(&buf[nRandom], 0, WINRT_BLOCK_BYTES - nRandom);
+}
+
+static void Access(WinRTBlockCache *cache, sqlite_int64 index, std::vector<char> &buf, std::vector<char> &expect, BenchCounts *pCounts)
+{
+	int nRead = 0;
+	uint64_t start = BenchNowNs();
+	if (cache->Read(&buf[0], WINRT_BLOCK_BYTES, index * WINRT_BLOCK_BYTES, &nRead))
+	{
+		pCounts->hitNs += BenchNowNs() - start;
+		pCounts->hits++;
+		Content(index, expect);
+		if (nRead != WINRT_BLOCK_BYTES || ::memcmp(&buf[0], &expect[0], WINRT_BLOCK_BYTES) != 0)
+			pCounts->corrupt++;
+		return;
+	}
+	pCounts->misses++;
+	unsigned generation = cache->Generation();
+	Content(index, buf);
+	cache->Fill(generation, &buf[0], WINRT_BLOCK_BYTES, WINRT_BLOCK_BYTES, index * WINRT_BLOCK_BYTES);
+}
+
+/*
+** Lookups skewed towards the start of the hot set: half of them go to its
+** first eighth.
+*/
+static sqlite_int64 HotBlock(BenchRandom &rng, sqlite_int64 first, sqlite_int64 nHot)
+{
+	if (rng.Below(2) == 0)
+		return first + (sqlite_int64)rng.Below((uint64_t)(nHot / 8 > 0 ? nHot / 8 : 1));
+	return first + (sqlite_int64)rng.Below((uint64_t)nHot);
+}
+
+static void Phase(BenchJson &json, const char *key, WinRTBlockCache *cache, sqlite_int64 hotFirst, sqlite_int64 nHot,
+	sqlite_int64 scanFirst, sqlite_int64 nScan, int lookups, int rounds, BenchRandom &rng)
+{
+	std::vector<char> buf(WINRT_BLOCK_BYTES), expect(WINRT_BLOCK_BYTES);
+	BenchCounts hot, scan;
+	WinRTBlockCacheStats before, after;
+	WinRTBlockCache::Status(&before);
+	for (int round = 0; round < rounds; round++)
+	{
+		for (int i = 0; i < lookups; i++)
+			Access(cache, HotBlock(rng, hotFirst, nHot), buf, expect, &hot);
+		for (sqlite_int64 i = 0; i < nScan; i++)
+			Access(cache, scanFirst + i, buf, expect, &scan);
+	}
+	WinRTBlockCache::Status(&after);
+
+	json.BeginObject(key);
+	json.Field("lookup_hit_ratio", hot.Ratio());
+	json.Field("lookup_misses", hot.misses);
+	if (nScan > 0)
+		json.Field("scan_hit_ratio", scan.Ratio());
+	json.Field("ns_per_hit", hot.hits ? (double)hot.hitNs / hot.hits : 0.0);
+	json.Field("tier1_hits", (uint64_t)(after.hits - before.hits));
+	json.Field("tier2_hits", (uint64_t)(after.packedHits - before.packedHits));
+	json.Field("tier1_bytes", (uint64_t)after.bytes);
+	json.Field("tier2_bytes", (uint64_t)after.packedBytes);
+	json.Field("tier2_blocks", (uint64_t)after.packedBlocks);
+	json.Field("corrupt", hot.corrupt + scan.corrupt);
+	json.EndObject();
+}
+
+static int Query(const char *zFile, const char *zVfs, int flags, const char *zSql, int *pValue)
+{
+	sqlite3 *db = nullptr;
+	int rc = ::sqlite3_open_v2(zFile, &db, flags, zVfs);
+	sqlite3_stmt *stmt = nullptr;
+	if (rc == SQLITE_OK)
+		rc = ::sqlite3_prepare_v2(db, zSql, -1, &stmt, nullptr);
+	if (rc == SQLITE_OK)
+	{
+		rc = ::sqlite3_step(stmt);
+		if (rc == SQLITE_ROW && pValue != nullptr)
+			*pValue = ::sqlite3_column_int(stmt, 0);
+		rc = rc == SQLITE_ROW || rc == SQLITE_DONE ? SQLITE_OK : rc;
+	}
+	::sqlite3_finalize(stmt);
+	::sqlite3_close(db);
+	return rc;
+}
+
+/*
+** Write a row through the VFS and close, so that its block stays cached;
+** change it through SQLite's own VFS; then read it back through the VFS.
+** Returns "ok" or what went wrong.
+*/
+static const char *ExternalCheck(const char *zFile)
+{
+	static char zResult[100];
+	const int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+	const char *zVfs = "blockcachebench";
+	::WinRTVFSRegister(zVfs, ::WinRTPosixBackend(), 0);
+	::unlink(zFile);
+	::unlink((std::string(zFile) + "-journal").c_str());
+	::unlink((std::string(zFile) + "-hot").c_str());
+
+	int value = 0;
+	int rc = Query(zFile, zVfs, flags, "CREATE TABLE t(x)", nullptr);
+	if (rc == SQLITE_OK)
+		rc = Query(zFile, zVfs, flags, "INSERT INTO t VALUES(1)", nullptr);
+	if (rc == SQLITE_OK)
+		rc = Query(zFile, zVfs, flags, "SELECT x FROM t", &value);
+	if (rc == SQLITE_OK)
+		rc = Query(zFile, zVfs, flags, "UPDATE t SET x = 5", nullptr);
+	if (rc == SQLITE_OK)
+		rc = Query(zFile, nullptr, flags, "UPDATE t SET x = 2", nullptr);
+	if (rc == SQLITE_OK)
+		rc = Query(zFile, zVfs, flags, "SELECT x FROM t", &value);
+
+	::unlink(zFile);
+	::unlink((std::string(zFile) + "-hot").c_str());
+	if (rc != SQLITE_OK)
+		return ::sqlite3_errstr(rc);
+	if (value != 2)
+	{
+		::sqlite3_snprintf(sizeof(zResult), zResult, "read %d after another VFS wrote 2", value);
+		return zResult;
+	}
+	return "ok";
+}
+
+
+int main(int argc, char **argv)
+{
+	sqlite_int64 capacity = WINRT_BLOCK_CACHE_BYTES / WINRT_BLOCK_BYTES;
+	sqlite_int64 nHot = atoll(BenchArg(argc, argv, "hot", std::to_string(capacity / 2).c_str()));
+	sqlite_int64 nScan = atoll(BenchArg(argc, argv, "scan", std::to_string(capacity * 4).c_str()));
+	int lookups = atoi(BenchArg(argc, argv, "lookups", "20000"));
+	int rounds = atoi(BenchArg(argc, argv, "rounds", "10"));
+	freePercent = atoi(BenchArg(argc, argv, "free", "60"));
+	const char *zFile = BenchArg(argc, argv, "file", "blockcachebench.db");
+	const char *zOut = BenchArg(argc, argv, "out", nullptr);
+
+	FILE *out = zOut ? fopen(zOut, "w") : stdout;
+	if (out == nullptr)
+	{
+		fprintf(stderr, "cannot write %s\n", zOut);
+		return 1;
+	}
+
+	static const char backend = 0;
+	WinRTBlockCache *cache = WinRTBlockCache::Acquire(&backend, "blockcachebench");
+	BenchRandom rng(1);
+
+	// The file: the hot set, a second hot set, then the scanned range.
+	sqlite_int64 hotA = 0;
+	sqlite_int64 hotB = nHot;
+	sqlite_int64 scanFirst = 2 * nHot;
+
+	BenchJson json(out);
+	json.BeginObject();
+	json.Field("benchmark", "blockcache");
+	json.Field("capacity_blocks", (uint64_t)capacity);
+	json.Field("hot_blocks", (uint64_t)nHot);
+	json.Field("scan_blocks", (uint64_t)nScan);
+
+	Phase(json, "warm", cache, hotA, nHot, 0, 0, lookups, 2, rng);
+	Phase(json, "lookups", cache, hotA, nHot, 0, 0, lookups, rounds, rng);
+	Phase(json, "mixed", cache, hotA, nHot, scanFirst, nScan, lookups, rounds, rng);
+	Phase(json, "shifted", cache, hotB, nHot, scanFirst, nScan, lookups, rounds, rng);
+
+	WinRTBlockCache::Forget(&backend, "blockcachebench");
+	WinRTBlockCache::Release(cache);
+	const char *zExternal = ExternalCheck(zFile);
+	json.Field("external_check", zExternal);
+
+	json.EndObject();
+	json.Finish();
+
+	if (out != stdout)
+		fclose(out);
+	return ::strcmp(zExternal, "ok") != 0;
+}
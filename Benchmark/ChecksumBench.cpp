@@ -0,0 +1,262 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Page checksum benchmark. Measures the CRC-32C kernel (WinRTCrc32c.cpp)
+*		per page size, hardware and table-driven, and the cost of verified
+*		against unverified random page reads through the storage layer
+*		(WinRTChecksumStorage.cpp), reporting the checksum overhead in percent.
+*
+*		Build (POSIX):
+*			g++ -std=c++14 -O2 -I../Source ChecksumBench.cpp ../Source/WinRT*.cpp \
+*				-lsqlite3 -lpthread -o checksumbench
+*
+*		Options:
+*			--file=PATH      scratch file (default checksumbench.dat, recreated)
+*			--pages=N        pages in the scratch file (default 4096)
+*			--iters=N        kernel iterations per page size (default 200000)
+*			--reads=N        page reads per size (default 100000)
+*			--backend=NAME   storage backend: posix (default), uring, or sim for a
+*			                 simulated device in memory
+*			--device=NAME    with sim: ssd, sdcard (default), usb or network
+*			--seed=N         with sim: seed for its stalls and failures
+*			--out=PATH       write JSON to PATH instead of stdout
+*
+*		Reads hit the OS page cache, the fastest storage the VFS can see, so
+*		the overhead reported is an upper bound.
+*
+*		It also checks, as "crash_check", that a database reopens after a
+*		crash left its sidecar behind the data, and that a page changed
+*		behind the checksums of a cleanly closed database is still caught.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+
+#include "WinRTStorage.h"
+#include "WinRTCrc32c.h"
+#include "BenchUtil.h"
+
+
+static const int pageSizes[] = { 512, 1024, 4096, 8192, 16384, 65536 };
+
+/*
+** Nanoseconds per call of crc over a page, cycling through a buffer larger
+** than L1 so the data is not always hot.
+*/
+static double KernelNs(uint32_t(*crc)(uint32_t, const void*, size_t),
+	const std::vector<unsigned char> &buf, int pageSize, int iters, uint32_t *pSink)
+{
+	size_t nPages = buf.size() / pageSize;
+	uint32_t sink = 0;
+	uint64_t start = BenchNowNs();
+	for (int i = 0; i < iters; i++)
+		sink ^= crc(0, &buf[(i % nPages) * pageSize], pageSize);
+	uint64_t ns = BenchNowNs() - start;
+	*pSink ^= sink;
+	return (double)ns / iters;
+}
+
+/*
+** Nanoseconds per random page read from a freshly written file.
+*/
+static double ReadNs(WinRTBackend *backend, const char *zFile, int pageSize, int nPages, int reads, int *pRc)
+{
+	std::string sums = std::string(zFile) + "-crc";
+	::unlink(zFile);
+	::unlink(sums.c_str());
+
+	WinRTStorage *storage = nullptr;
+	int rc = backend->Open(zFile, SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, &storage);
+	if (rc != SQLITE_OK)
+	{
+		*pRc = rc;
+		return 0;
+	}
+
+	std::vector<unsigned char> page(pageSize);
+	BenchRandom rng(7);
+	for (int i = 0; i < nPages && rc == SQLITE_OK; i++)
+	{
+		for (int k = 0; k < pageSize; k += 8)
+		{
+			uint64_t v = rng.Next();
+			::memcpy(&page[k], &v, 8);
+		}
+		rc = storage->Write(&page[0], pageSize, (sqlite_int64)i * pageSize);
+	}
+	if (rc == SQLITE_OK)
+		rc = storage->Sync(SQLITE_SYNC_NORMAL);
+
+	uint64_t start = BenchNowNs();
+	for (int i = 0; i < reads && rc == SQLITE_OK; i++)
+	{
+		int nRead = 0;
+		rc = storage->Read(&page[0], pageSize, (sqlite_int64)rng.Below(nPages) * pageSize, &nRead);
+	}
+	uint64_t ns = BenchNowNs() - start;
+
+	delete storage;
+	::unlink(zFile);
+	::unlink(sums.c_str());
+	*pRc = rc;
+	return (double)ns / reads;
+}
+
+/*
+** Reopen a file whose storage was abandoned, as by a crash, after pages
+** were rewritten but before the sync that would have saved their
+** checksums. Each checksum backend has tables of its own, so the reopen
+** through a second one reads the sidecar from storage. Then, once closed
+** cleanly, damage the file under the checksums and reopen it again.
+** Returns "ok" or what went wrong.
+*/
+static const char *CrashCheck(WinRTBackend *plain, const char *zFile)
+{
+	const int pageSize = 4096;
+	const int nPages = 16;
+	const int flags = SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+	WinRTBackend *crashed = ::WinRTChecksumBackend(plain);
+	crashed->Delete(zFile, 0);
+
+	std::vector<unsigned char> page(pageSize);
+	WinRTStorage *storage = nullptr;
+	int rc = crashed->Open(zFile, flags, &storage);
+	for (int i = 0; i < nPages && rc == SQLITE_OK; i++)
+	{
+		::memset(&page[0], i, pageSize);
+		rc = storage->Write(&page[0], pageSize, (sqlite_int64)i * pageSize);
+	}
+	if (rc == SQLITE_OK)
+		rc = storage->Sync(SQLITE_SYNC_NORMAL);
+	for (int i = 0; i < 4 && rc == SQLITE_OK; i++)
+	{
+		::memset(&page[0], 0x80 + i, pageSize);
+		rc = storage->Write(&page[0], pageSize, (sqlite_int64)i * pageSize);
+	}
+	if (rc != SQLITE_OK)
+		return sqlite3_errstr(rc);
+	storage = nullptr;	// abandoned unsynced, and never closed
+
+	WinRTBackend *reopened = ::WinRTChecksumBackend(plain);
+	rc = reopened->Open(zFile, flags, &storage);
+	for (int i = 0; i < nPages && rc == SQLITE_OK; i++)
+	{
+		int nRead = 0;
+		rc = storage->Read(&page[0], pageSize, (sqlite_int64)i * pageSize, &nRead);
+		if (rc == SQLITE_OK && (nRead != pageSize || page[0] != (i < 4 ? 0x80 + i : i)))
+			return "wrong data after reopen";
+	}
+	delete storage;
+	if (rc != SQLITE_OK)
+		return rc == SQLITE_CORRUPT ? "stale sidecar reported as corruption" : sqlite3_errstr(rc);
+
+	rc = plain->Open(zFile, flags, &storage);
+	if (rc == SQLITE_OK)
+	{
+		page[0] = 0xFF;
+		rc = storage->Write(&page[0], 1, 5 * pageSize);
+		delete storage;
+	}
+	WinRTBackend *checked = ::WinRTChecksumBackend(plain);
+	if (rc == SQLITE_OK)
+		rc = checked->Open(zFile, flags, &storage);
+	if (rc != SQLITE_OK)
+		return sqlite3_errstr(rc);
+	int nRead = 0;
+	rc = storage->Read(&page[0], pageSize, 5 * pageSize, &nRead);
+	delete storage;
+	checked->Delete(zFile, 0);
+	return rc == SQLITE_CORRUPT ? "ok" : "damaged page not caught";
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *zFile = BenchArg(argc, argv, "file", "checksumbench.dat");
+	const char *zOut = BenchArg(argc, argv, "out", nullptr);
+	int nPages = atoi(BenchArg(argc, argv, "pages", "4096"));
+	int iters = atoi(BenchArg(argc, argv, "iters", "200000"));
+	int reads = atoi(BenchArg(argc, argv, "reads", "100000"));
+
+	WinRTBackend *plain = BenchBackend(argc, argv);
+	if (plain == nullptr)
+	{
+		fprintf(stderr, "unknown backend\n");
+		return 1;
+	}
+	WinRTBackend *checked = ::WinRTChecksumBackend(plain);
+
+	FILE *out = zOut ? fopen(zOut, "w") : stdout;
+	if (out == nullptr)
+	{
+		fprintf(stderr, "cannot write %s\n", zOut);
+		return 1;
+	}
+
+	// 1 MB of random data for the kernel runs
+	std::vector<unsigned char> buf(1 << 20);
+	BenchRandom rng(3);
+	for (size_t i = 0; i < buf.size(); i += 8)
+	{
+		uint64_t v = rng.Next();
+		::memcpy(&buf[i], &v, 8);
+	}
+
+	BenchJson json(out);
+	json.BeginObject();
+	json.Field("benchmark", "checksum");
+	json.Field("backend", BenchArg(argc, argv, "backend", "posix"));
+	json.Field("hardware_crc", WinRTCrc32cHardware());
+	json.BeginArray("page_sizes");
+
+	int failed = 0;
+	uint32_t sink = 0;
+	for (int pageSize : pageSizes)
+	{
+		double hwNs = KernelNs(WinRTCrc32c, buf, pageSize, iters, &sink);
+		double swNs = KernelNs(WinRTCrc32cSoftware, buf, pageSize, iters / 4, &sink);
+
+		int rcPlain, rcChecked;
+		int pages = (int)std::min<int64_t>(nPages, (256 << 20) / pageSize);
+		double plainNs = ReadNs(plain, zFile, pageSize, pages, reads, &rcPlain);
+		double checkedNs = ReadNs(checked, zFile, pageSize, pages, reads, &rcChecked);
+
+		json.BeginObject();
+		json.Field("page_size", pageSize);
+		json.Field("crc_ns", hwNs);
+		json.Field("crc_gb_per_sec", pageSize / hwNs);
+		json.Field("table_crc_ns", swNs);
+		json.Field("table_crc_gb_per_sec", pageSize / swNs);
+		json.Field("read_ns", plainNs);
+		json.Field("verified_read_ns", checkedNs);
+		json.Field("kernel_overhead_pct", plainNs > 0 ? 100.0 * hwNs / plainNs : 0.0);
+		json.Field("measured_overhead_pct", plainNs > 0 ? 100.0 * (checkedNs - plainNs) / plainNs : 0.0);
+		json.Field("status", rcPlain != SQLITE_OK ? sqlite3_errstr(rcPlain) :
+			rcChecked != SQLITE_OK ? sqlite3_errstr(rcChecked) : "ok");
+		json.EndObject();
+
+		if (rcPlain != SQLITE_OK || rcChecked != SQLITE_OK)
+			failed = 1;
+	}
+
+	json.EndArray();
+	const char *zCrash = CrashCheck(plain, zFile);
+	json.Field("crash_check", zCrash);
+	if (::strcmp(zCrash, "ok") != 0)
+		failed = 1;
+	json.Field("sink", (uint64_t)sink);
+	json.EndObject();
+	json.Finish();
+
+	if (out != stdout)
+		fclose(out);
+	return failed;
+}
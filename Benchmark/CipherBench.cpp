@@ -0,0 +1,199 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Page encryption benchmark. Measures the XTS-AES kernel (WinRTAes.cpp)
+*		per page size, with the AES instructions and table-driven, and random
+*		page reads and sequential page writes through the storage layer with
+*		and without encryption (WinRTCipherStorage.cpp), reporting the
+*		encryption overhead in percent.
+*
+*		Build (POSIX):
+*			g++ -std=c++14 -O2 -I../Source CipherBench.cpp ../Source/WinRT*.cpp \
+*				-lsqlite3 -lpthread -o cipherbench
+*
+*		Options:
+*			--file=PATH      scratch file (default cipherbench.dat, recreated)
+*			--pages=N        pages in the scratch file (default 4096)
+*			--iters=N        kernel iterations per page size (default 100000)
+*			--reads=N        page reads per size (default 100000)
+*			--key-bits=N     128 (default) or 256
+*			--backend=NAME   storage backend: posix (default), uring, or sim for a
+*			                 simulated device in memory
+*			--device=NAME    with sim: ssd, sdcard (default), usb or network
+*			--seed=N         with sim: seed for its stalls and failures
+*			--out=PATH       write JSON to PATH instead of stdout
+*
+*		Reads hit the OS page cache, the fastest storage the VFS can see, so
+*		the overhead reported is an upper bound.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "WinRTStorage.h"
+#include "WinRTAes.h"
+#include "BenchUtil.h"
+
+
+static const int pageSizes[] = { 512, 1024, 4096, 8192, 16384, 65536 };
+
+/*
+** Nanoseconds to encrypt one page as 512-byte data units, the way the
+** storage layer does, cycling through a buffer larger than L1.
+*/
+static double KernelNs(const WinRTXtsKey *key, std::vector<unsigned char> &buf, int pageSize, int iters)
+{
+	size_t nPages = buf.size() / pageSize;
+	uint64_t start = BenchNowNs();
+	for (int i = 0; i < iters; i++)
+	{
+		unsigned char *p = &buf[(i % nPages) * pageSize];
+		WinRTXtsEncryptUnits(key, (uint64_t)i * (pageSize / 512), 512, p, p, pageSize);
+	}
+	return (double)(BenchNowNs() - start) / iters;
+}
+
+/*
+** Nanoseconds per page written sequentially to a new file, and per random
+** page read back.
+*/
+static void StorageNs(WinRTBackend *backend, const char *zFile, int pageSize, int nPages, int reads,
+	double *pWriteNs, double *pReadNs, int *pRc)
+{
+	::unlink(zFile);
+	*pWriteNs = *pReadNs = 0;
+
+	WinRTStorage *storage = nullptr;
+	int rc = backend->Open(zFile, SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, &storage);
+	if (rc != SQLITE_OK)
+	{
+		*pRc = rc;
+		return;
+	}
+
+	std::vector<unsigned char> page(pageSize);
+	BenchRandom rng(7);
+	for (int k = 0; k < pageSize; k += 8)
+	{
+		uint64_t v = rng.Next();
+		::memcpy(&page[k], &v, 8);
+	}
+
+	uint64_t start = BenchNowNs();
+	for (int i = 0; i < nPages && rc == SQLITE_OK; i++)
+		rc = storage->Write(&page[0], pageSize, (sqlite_int64)i * pageSize);
+	*pWriteNs = (double)(BenchNowNs() - start) / nPages;
+	if (rc == SQLITE_OK)
+		rc = storage->Sync(SQLITE_SYNC_NORMAL);
+
+	start = BenchNowNs();
+	for (int i = 0; i < reads && rc == SQLITE_OK; i++)
+	{
+		int nRead = 0;
+		rc = storage->Read(&page[0], pageSize, (sqlite_int64)rng.Below(nPages) * pageSize, &nRead);
+	}
+	*pReadNs = (double)(BenchNowNs() - start) / reads;
+
+	delete storage;
+	::unlink(zFile);
+	*pRc = rc;
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *zFile = BenchArg(argc, argv, "file", "cipherbench.dat");
+	const char *zOut = BenchArg(argc, argv, "out", nullptr);
+	int nPages = atoi(BenchArg(argc, argv, "pages", "4096"));
+	int iters = atoi(BenchArg(argc, argv, "iters", "100000"));
+	int reads = atoi(BenchArg(argc, argv, "reads", "100000"));
+	int keyBits = atoi(BenchArg(argc, argv, "key-bits", "128"));
+
+	unsigned char raw[64];
+	for (int i = 0; i < 64; i++)
+		raw[i] = (unsigned char)(i * 37 + 11);
+	int nKey = keyBits == 256 ? 64 : 32;
+	WinRTXtsKey key;
+	::WinRTXtsSetKey(&key, raw, nKey);
+
+	WinRTBackend *plain = BenchBackend(argc, argv);
+	if (plain == nullptr)
+	{
+		fprintf(stderr, "unknown backend\n");
+		return 1;
+	}
+	WinRTBackend *encrypted = ::WinRTCipherBackend(plain, raw, nKey);
+
+	FILE *out = zOut ? fopen(zOut, "w") : stdout;
+	if (out == nullptr)
+	{
+		fprintf(stderr, "cannot write %s\n", zOut);
+		return 1;
+	}
+
+	std::vector<unsigned char> buf(1 << 20);
+	BenchRandom rng(3);
+	for (size_t i = 0; i < buf.size(); i += 8)
+	{
+		uint64_t v = rng.Next();
+		::memcpy(&buf[i], &v, 8);
+	}
+
+	BenchJson json(out);
+	json.BeginObject();
+	json.Field("benchmark", "cipher");
+	json.Field("backend", BenchArg(argc, argv, "backend", "posix"));
+	json.Field("key_bits", keyBits == 256 ? 256 : 128);
+	json.Field("hardware_aes", WinRTAesHardware());
+	json.BeginArray("page_sizes");
+
+	int failed = 0;
+	for (int pageSize : pageSizes)
+	{
+		double hwNs = KernelNs(&key, buf, pageSize, iters);
+		int hardware = ::WinRTAesSetHardware(0);
+		double swNs = KernelNs(&key, buf, pageSize, iters / 8);
+		::WinRTAesSetHardware(hardware);
+
+		int rcPlain, rcEncrypted;
+		double plainWriteNs, plainReadNs, encWriteNs, encReadNs;
+		int pages = (int)std::min<int64_t>(nPages, (256 << 20) / pageSize);
+		StorageNs(plain, zFile, pageSize, pages, reads, &plainWriteNs, &plainReadNs, &rcPlain);
+		StorageNs(encrypted, zFile, pageSize, pages, reads, &encWriteNs, &encReadNs, &rcEncrypted);
+
+		json.BeginObject();
+		json.Field("page_size", pageSize);
+		json.Field("xts_ns", hwNs);
+		json.Field("xts_gb_per_sec", pageSize / hwNs);
+		json.Field("table_xts_ns", swNs);
+		json.Field("table_xts_gb_per_sec", pageSize / swNs);
+		json.Field("read_ns", plainReadNs);
+		json.Field("encrypted_read_ns", encReadNs);
+		json.Field("read_overhead_pct", plainReadNs > 0 ? 100.0 * (encReadNs - plainReadNs) / plainReadNs : 0.0);
+		json.Field("write_ns", plainWriteNs);
+		json.Field("encrypted_write_ns", encWriteNs);
+		json.Field("write_overhead_pct", plainWriteNs > 0 ? 100.0 * (encWriteNs - plainWriteNs) / plainWriteNs : 0.0);
+		json.Field("status", rcPlain != SQLITE_OK ? sqlite3_errstr(rcPlain) :
+			rcEncrypted != SQLITE_OK ? sqlite3_errstr(rcEncrypted) : "ok");
+		json.EndObject();
+
+		if (rcPlain != SQLITE_OK || rcEncrypted != SQLITE_OK)
+			failed = 1;
+	}
+
+	json.EndArray();
+	json.Field("sink", (uint64_t)buf[12345]);
+	json.EndObject();
+	json.Finish();
+
+	if (out != stdout)
+		fclose(out);
+	return failed;
+}
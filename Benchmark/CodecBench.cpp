@@ -0,0 +1,354 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Page codec benchmark. Runs the same workload through WinRTVFS with and
+*		without the LZ codec (WinRTCodecStorage.cpp) and reports, per phase,
+*		throughput and the bytes that actually reached the backend, plus the
+*		size of the database on disk.
+*
+*		Build (POSIX):
+*			g++ -std=c++14 -O2 -I../Source CodecBench.cpp ../Source/WinRT*.cpp \
+*				-lsqlite3 -lpthread -o codecbench
+*
+*		Options:
+*			--db=PATH        database file (default codecbench.db, recreated)
+*			--rows=N         rows to load (default 50000)
+*			--ops=N          lookups and updates per phase (default 10000)
+*			--cache=N        SQLite page cache in pages (default 100), kept small
+*			                 so lookups go to storage
+*			--backend=NAME   storage backend: posix (default), uring, or sim for a
+*			                 simulated device in memory
+*			--device=NAME    with sim: ssd, sdcard (default), usb or network
+*			--seed=N         with sim: seed for its stalls and failures
+*			--out=PATH       write JSON to PATH instead of stdout
+*
+*		Row text is built from English number names, as in speedtest1, so it
+*		compresses roughly like real text rather than random bytes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+#include "WinRTVFS.h"
+#include "BenchUtil.h"
+
+
+/*
+** Byte and call counters for everything passing through one backend.
+*/
+struct CodecCounters
+{
+	uint64_t bytesRead;
+	uint64_t bytesWritten;
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t syncs;
+};
+
+class CountingStorage : public WinRTStorage
+{
+public:
+	CountingStorage(WinRTStorage *inner, CodecCounters &counters) : inner(inner), counters(counters) {}
+	virtual ~CountingStorage() { delete inner; }
+
+	virtual int Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead)
+	{
+		int rc = inner->Read(zBuf, iAmt, iOfst, pnRead);
+		counters.reads++;
+		counters.bytesRead += *pnRead;
+		return rc;
+	}
+
+	virtual int Write(const void *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		counters.writes++;
+		counters.bytesWritten += iAmt;
+		return inner->Write(zBuf, iAmt, iOfst);
+	}
+
+	virtual int WriteBatch(WinRTIoVec *aVec, int nVec)
+	{
+		counters.writes++;
+		for (int i = 0; i < nVec; i++)
+			counters.bytesWritten += aVec[i].iAmt;
+		return inner->WriteBatch(aVec, nVec);
+	}
+
+	virtual int Truncate(sqlite_int64 size) { return inner->Truncate(size); }
+	virtual int Sync(int flags) { counters.syncs++; return inner->Sync(flags); }
+	virtual int FileSize(sqlite_int64 *pSize) { return inner->FileSize(pSize); }
+
+private:
+	WinRTStorage *inner;
+	CodecCounters &counters;
+};
+
+class CountingBackend : public WinRTBackend
+{
+public:
+	CountingBackend(WinRTBackend *inner) : inner(inner), counters() {}
+
+	virtual int Open(const char *zName, int flags, WinRTStorage **ppStorage)
+	{
+		WinRTStorage *storage = nullptr;
+		int rc = inner->Open(zName, flags, &storage);
+		if (rc == SQLITE_OK)
+			*ppStorage = new CountingStorage(storage, counters);
+		return rc;
+	}
+
+	virtual int Delete(const char *zName, int dirSync) { return inner->Delete(zName, dirSync); }
+
+	CodecCounters Take()
+	{
+		CodecCounters c = counters;
+		counters = CodecCounters();
+		return c;
+	}
+
+private:
+	WinRTBackend *inner;
+	CodecCounters counters;
+};
+
+
+static int Exec(sqlite3 *db, const char *zSql)
+{
+	char *zErr = nullptr;
+	int rc = sqlite3_exec(db, zSql, nullptr, nullptr, &zErr);
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, "%s: %s\n", zSql, zErr ? zErr : sqlite3_errstr(rc));
+		sqlite3_free(zErr);
+	}
+	return rc;
+}
+
+static int Step(sqlite3_stmt *stmt)
+{
+	int rc;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {}
+	sqlite3_reset(stmt);
+	return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+/*
+** English name of n, as speedtest1's numbername.
+*/
+static std::string NumberName(unsigned n)
+{
+	static const char *ones[] = { "zero", "one", "two", "three", "four", "five", "six", "seven", "eight", "nine",
+		"ten", "eleven", "twelve", "thirteen", "fourteen", "fifteen", "sixteen", "seventeen", "eighteen", "nineteen" };
+	static const char *tens[] = { "", "ten", "twenty", "thirty", "forty", "fifty", "sixty", "seventy", "eighty", "ninety" };
+	std::string s;
+	if (n >= 1000000000) { s += NumberName(n / 1000000000) + " billion "; n %= 1000000000; }
+	if (n >= 1000000) { s += NumberName(n / 1000000) + " million "; n %= 1000000; }
+	if (n >= 1000) { s += NumberName(n / 1000) + " thousand "; n %= 1000; }
+	if (n >= 100) { s += std::string(ones[n / 100]) + " hundred "; n %= 100; }
+	if (n >= 20) { s += tens[n / 10]; n %= 10; if (n) s += " "; }
+	if (n > 0 || s.empty()) s += ones[n];
+	return s;
+}
+
+struct CodecPhase
+{
+	const char *name;
+	uint64_t ops;
+	double seconds;
+	CodecCounters io;
+};
+
+/*
+** Run every phase on a fresh database through the named VFS.
+*/
+static int RunPhases(const char *zDb, const char *zVfs, CountingBackend &counting,
+	int rows, int ops, int cache, std::vector<CodecPhase> &phases)
+{
+	sqlite3 *db = nullptr;
+	int rc = sqlite3_open_v2(zDb, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, zVfs);
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, "open %s: %s\n", zDb, sqlite3_errstr(rc));
+		return rc;
+	}
+	Exec(db, "PRAGMA temp_store=MEMORY");
+	std::string pragma = "PRAGMA cache_size=" + std::to_string(cache);
+	Exec(db, pragma.c_str());
+
+	BenchRandom rng(1);
+	sqlite3_stmt *stmt;
+	counting.Take();
+
+	// load
+	uint64_t start = BenchNowNs();
+	rc = Exec(db, "CREATE TABLE t1(a INTEGER PRIMARY KEY, b INTEGER, c TEXT); BEGIN");
+	sqlite3_prepare_v2(db, "INSERT INTO t1 VALUES(?1, ?2, ?3)", -1, &stmt, nullptr);
+	for (int i = 1; i <= rows && rc == SQLITE_OK; i++)
+	{
+		unsigned b = (unsigned)rng.Below(1000000000);
+		std::string c = NumberName(b);
+		sqlite3_bind_int(stmt, 1, i);
+		sqlite3_bind_int64(stmt, 2, b);
+		sqlite3_bind_text(stmt, 3, c.c_str(), -1, SQLITE_TRANSIENT);
+		rc = Step(stmt);
+	}
+	sqlite3_finalize(stmt);
+	if (rc == SQLITE_OK) rc = Exec(db, "COMMIT");
+	phases.push_back(CodecPhase{ "load", (uint64_t)rows, (BenchNowNs() - start) / 1e9, counting.Take() });
+
+	// point lookups
+	start = BenchNowNs();
+	sqlite3_prepare_v2(db, "SELECT b, c FROM t1 WHERE a = ?1", -1, &stmt, nullptr);
+	for (int i = 0; i < ops && rc == SQLITE_OK; i++)
+	{
+		sqlite3_bind_int(stmt, 1, 1 + (int)rng.Below(rows));
+		rc = Step(stmt);
+	}
+	sqlite3_finalize(stmt);
+	phases.push_back(CodecPhase{ "lookup", (uint64_t)ops, (BenchNowNs() - start) / 1e9, counting.Take() });
+
+	// updates, committed every 100
+	start = BenchNowNs();
+	sqlite3_prepare_v2(db, "UPDATE t1 SET b = ?2, c = ?3 WHERE a = ?1", -1, &stmt, nullptr);
+	for (int i = 0; i < ops && rc == SQLITE_OK; i++)
+	{
+		if (i % 100 == 0)
+			rc = Exec(db, i == 0 ? "BEGIN" : "COMMIT; BEGIN");
+		unsigned b = (unsigned)rng.Below(1000000000);
+		std::string c = NumberName(b);
+		sqlite3_bind_int(stmt, 1, 1 + (int)rng.Below(rows));
+		sqlite3_bind_int64(stmt, 2, b);
+		sqlite3_bind_text(stmt, 3, c.c_str(), -1, SQLITE_TRANSIENT);
+		if (rc == SQLITE_OK) rc = Step(stmt);
+	}
+	sqlite3_finalize(stmt);
+	if (rc == SQLITE_OK) rc = Exec(db, "COMMIT");
+	phases.push_back(CodecPhase{ "update", (uint64_t)ops, (BenchNowNs() - start) / 1e9, counting.Take() });
+
+	// full scans
+	start = BenchNowNs();
+	for (int i = 0; i < 5 && rc == SQLITE_OK; i++)
+		rc = Exec(db, "SELECT count(*), sum(length(c)) FROM t1 WHERE c LIKE '%seven%'");
+	phases.push_back(CodecPhase{ "scan", 5, (BenchNowNs() - start) / 1e9, counting.Take() });
+
+	if (rc == SQLITE_OK)
+	{
+		sqlite3_prepare_v2(db, "PRAGMA integrity_check", -1, &stmt, nullptr);
+		if (sqlite3_step(stmt) != SQLITE_ROW || strcmp((const char*)sqlite3_column_text(stmt, 0), "ok") != 0)
+			rc = SQLITE_CORRUPT;
+		sqlite3_finalize(stmt);
+	}
+	sqlite3_close(db);
+	return rc;
+}
+
+static uint64_t FileBytes(const std::string &path)
+{
+	FILE *f = fopen(path.c_str(), "rb");
+	if (f == nullptr)
+		return 0;
+	fseek(f, 0, SEEK_END);
+	long n = ftell(f);
+	fclose(f);
+	return n < 0 ? 0 : (uint64_t)n;
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *zDb = BenchArg(argc, argv, "db", "codecbench.db");
+	const char *zOut = BenchArg(argc, argv, "out", nullptr);
+	int rows = atoi(BenchArg(argc, argv, "rows", "50000"));
+	int ops = atoi(BenchArg(argc, argv, "ops", "10000"));
+	int cache = atoi(BenchArg(argc, argv, "cache", "100"));
+
+	WinRTBackend *pBackend = BenchBackend(argc, argv);
+	if (pBackend == nullptr)
+	{
+		fprintf(stderr, "unknown backend\n");
+		return 1;
+	}
+	CountingBackend plain(pBackend);
+	CountingBackend packed(pBackend);
+	if (::WinRTVFSRegister("WinRTVFS-plain", &plain, 0) != SQLITE_OK ||
+		::WinRTVFSRegister("WinRTVFS-lz", ::WinRTCodecBackend(&packed), 0) != SQLITE_OK)
+	{
+		fprintf(stderr, "could not register WinRTVFS\n");
+		return 1;
+	}
+
+	FILE *out = zOut ? fopen(zOut, "w") : stdout;
+	if (out == nullptr)
+	{
+		fprintf(stderr, "cannot write %s\n", zOut);
+		return 1;
+	}
+
+	BenchJson json(out);
+	json.BeginObject();
+	json.Field("benchmark", "codec");
+	json.Field("backend", BenchArg(argc, argv, "backend", "posix"));
+	json.Field("sqlite", sqlite3_libversion());
+	json.Field("rows", rows);
+	json.Field("cache_pages", cache);
+	json.BeginArray("runs");
+
+	struct { const char *vfs; const char *codec; CountingBackend *counting; } configs[] =
+	{
+		{ "WinRTVFS-plain", "none", &plain },
+		{ "WinRTVFS-lz", "lz", &packed },
+	};
+
+	int failed = 0;
+	std::string map = std::string(zDb) + "-lzmap";
+	std::string journal = std::string(zDb) + "-journal";
+	for (auto &config : configs)
+	{
+		::unlink(zDb);
+		::unlink(map.c_str());
+		::unlink(journal.c_str());
+
+		std::vector<CodecPhase> phases;
+		int rc = RunPhases(zDb, config.vfs, *config.counting, rows, ops, cache, phases);
+
+		json.BeginObject();
+		json.Field("codec", config.codec);
+		json.Field("status", rc == SQLITE_OK ? "ok" : sqlite3_errstr(rc));
+		json.Field("db_bytes", FileBytes(zDb));
+		json.Field("map_bytes", FileBytes(map));
+		json.BeginArray("phases");
+		for (CodecPhase &p : phases)
+		{
+			json.BeginObject();
+			json.Field("name", p.name);
+			json.Field("seconds", p.seconds);
+			json.Field("ops_per_sec", p.seconds > 0 ? p.ops / p.seconds : 0.0);
+			json.Field("bytes_read", p.io.bytesRead);
+			json.Field("bytes_written", p.io.bytesWritten);
+			json.Field("reads", p.io.reads);
+			json.Field("writes", p.io.writes);
+			json.Field("syncs", p.io.syncs);
+			json.EndObject();
+		}
+		json.EndArray();
+		json.EndObject();
+
+		if (rc != SQLITE_OK)
+			failed = 1;
+	}
+
+	json.EndArray();
+	json.EndObject();
+	json.Finish();
+
+	if (out != stdout)
+		fclose(out);
+	return failed;
+}
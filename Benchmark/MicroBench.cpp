@@ -0,0 +1,280 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Per-call microbenchmarks for the VFS methods. Each io_method is called
+*		directly (no SQLite pager in between) and, where possible, the same call
+*		is made straight against a WinRTStorage handle on the same file, so the
+*		fixed VFS cost per call can be read off as the difference. The file is
+*		opened as a journal, which the VFS does not cache, so that both sides
+*		reach storage on every call; open_close opens it as a main database.
+*		Sequential writes are compared with the same writes gathered into runs
+*		the way the VFS gathers them, so the difference is the VFS's copy and
+*		bookkeeping rather than the saving from batching. file_size may still
+*		come out below the storage figure, since the VFS keeps the size.
+*
+*		Build (POSIX):
+*			g++ -std=c++14 -O2 -I../Source MicroBench.cpp ../Source/WinRT*.cpp \
+*				-lsqlite3 -lpthread -o microbench
+*
+*		Options:
+*			--file=PATH      scratch file (default microbench.dat)
+*			--iters=N        iterations per read/write case (default 20000)
+*			--backend=NAME   storage backend: posix (default), uring, or sim for a
+*			                 simulated device in memory
+*			--device=NAME    with sim: ssd, sdcard (default), usb or network
+*			--seed=N         with sim: seed for its stalls and failures
+*			--out=PATH       write JSON to PATH instead of stdout
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "WinRTVFS.h"
+#include "BenchUtil.h"
+
+
+/*
+** Count every operator new in the process so allocations per call can be
+** reported. The VFS allocates exclusively through new.
+*/
+static std::atomic<uint64_t> allocCount(0);
+
+void *operator new(size_t n)
+{
+	allocCount.fetch_add(1, std::memory_order_relaxed);
+	void *p = malloc(n ? n : 1);
+	if (p == nullptr) throw std::bad_alloc();
+	return p;
+}
+void *operator new[](size_t n) { return operator new(n); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+
+struct MicroResult
+{
+	double nsPerCall;
+	double allocsPerCall;
+};
+
+template<typename Fn>
+static MicroResult Measure(int iters, Fn fn)
+{
+	// One untimed warm-up pass over a tenth of the iterations.
+	for (int i = 0; i < iters / 10; i++) fn(i);
+
+	uint64_t allocs = allocCount.load();
+	uint64_t start = BenchNowNs();
+	for (int i = 0; i < iters; i++) fn(i);
+	uint64_t elapsed = BenchNowNs() - start;
+	allocs = allocCount.load() - allocs;
+
+	MicroResult r = { (double)elapsed / iters, (double)allocs / iters };
+	return r;
+}
+
+static void Report(BenchJson &json, const char *op, int size, const char *pattern,
+	const MicroResult &vfs, const MicroResult *storage)
+{
+	json.BeginObject();
+	json.Field("op", op);
+	if (size > 0) json.Field("size", size);
+	if (pattern) json.Field("pattern", pattern);
+	json.Field("ns_per_call", vfs.nsPerCall);
+	json.Field("allocs_per_call", vfs.allocsPerCall);
+	if (storage)
+	{
+		json.Field("storage_ns_per_call", storage->nsPerCall);
+		json.Field("vfs_overhead_ns", vfs.nsPerCall - storage->nsPerCall);
+		json.Field("storage_allocs_per_call", storage->allocsPerCall);
+	}
+	json.EndObject();
+}
+
+
+/*
+** Baseline for sequential writes: adjacent writes gathered, without copying,
+** into runs of up to WINRT_WRITE_RUN_BYTES and sent with one WriteBatch, as
+** WinRTWrite sends them.
+*/
+struct RawRun
+{
+	std::vector<WinRTIoVec> vecs;
+	sqlite_int64 end = 0;
+	int bytes = 0;
+
+	void Write(WinRTStorage *storage, char *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		if (!vecs.empty() && (iOfst != end || bytes + iAmt > WINRT_WRITE_RUN_BYTES))
+			Flush(storage);
+		WinRTIoVec v = { zBuf, iAmt, iOfst, 0 };
+		vecs.push_back(v);
+		end = iOfst + iAmt;
+		bytes += iAmt;
+	}
+
+	void Flush(WinRTStorage *storage)
+	{
+		if (!vecs.empty())
+			storage->WriteBatch(&vecs[0], (int)vecs.size());
+		vecs.clear();
+		bytes = 0;
+	}
+};
+
+
+int main(int argc, char **argv)
+{
+	const char *zFile = BenchArg(argc, argv, "file", "microbench.dat");
+	const char *zOut = BenchArg(argc, argv, "out", nullptr);
+	int iters = atoi(BenchArg(argc, argv, "iters", "20000"));
+
+	WinRTBackend *pBackend = BenchBackend(argc, argv);
+	if (pBackend == nullptr || ::WinRTVFSRegister("WinRTVFS", pBackend, 0) != SQLITE_OK)
+	{
+		fprintf(stderr, "could not register WinRTVFS\n");
+		return 1;
+	}
+	sqlite3_vfs *pVfs = sqlite3_vfs_find("WinRTVFS");
+
+	FILE *out = zOut ? fopen(zOut, "w") : stdout;
+	if (out == nullptr)
+	{
+		fprintf(stderr, "cannot write %s\n", zOut);
+		return 1;
+	}
+
+	std::string hot = std::string(zFile) + "-hot";
+	pBackend->Delete(zFile, 0);
+	pBackend->Delete(hot.c_str(), 0);
+	const int ioFlags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_MAIN_JOURNAL;
+	const int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_MAIN_DB;
+	std::vector<char> fileBuf(pVfs->szOsFile);
+	sqlite3_file *pFile = (sqlite3_file*)&fileBuf[0];
+	WinRTStorage *storage = nullptr;
+	if (::WinRTOpen(pVfs, zFile, pFile, ioFlags, nullptr) != SQLITE_OK
+		|| pBackend->Open(zFile, ioFlags, &storage) != SQLITE_OK)
+	{
+		fprintf(stderr, "cannot open %s\n", zFile);
+		return 1;
+	}
+
+	// 16 MB file so random offsets land on real data.
+	const sqlite_int64 fileSize = 16 << 20;
+	std::vector<char> page(65536, 'x');
+	for (sqlite_int64 ofst = 0; ofst < fileSize; ofst += page.size())
+		::WinRTWrite(pFile, &page[0], (int)page.size(), ofst);
+	::WinRTSync(pFile, SQLITE_SYNC_NORMAL);
+
+	BenchJson json(out);
+	json.BeginObject();
+	json.Field("benchmark", "micro");
+	json.Field("backend", BenchArg(argc, argv, "backend", "posix"));
+	json.Field("iters", iters);
+	json.BeginArray("results");
+
+	static const int sizes[] = { 100, 512, 1024, 4096, 16384, 65536 };
+	std::vector<char> buf(65536);
+	int nRead;
+
+	for (int size : sizes)
+	{
+		const sqlite_int64 slots = fileSize / size;
+
+		// Sequential: each call at the next aligned offset.
+		MicroResult vfs = Measure(iters, [&](int i) {
+			::WinRTRead(pFile, &buf[0], size, (i % slots) * size);
+		});
+		MicroResult raw = Measure(iters, [&](int i) {
+			storage->Read(&buf[0], size, (i % slots) * size, &nRead);
+		});
+		Report(json, "read", size, "sequential", vfs, &raw);
+
+		// Random: aligned offsets drawn from a fixed sequence.
+		BenchRandom rngVfs(size), rngRaw(size);
+		vfs = Measure(iters, [&](int) {
+			::WinRTRead(pFile, &buf[0], size, rngVfs.Below(slots) * size);
+		});
+		raw = Measure(iters, [&](int) {
+			storage->Read(&buf[0], size, rngRaw.Below(slots) * size, &nRead);
+		});
+		Report(json, "read", size, "random", vfs, &raw);
+
+		// Sequential writes are coalesced on both sides; the final flush is
+		// included in both figures.
+		vfs = Measure(iters, [&](int i) {
+			::WinRTWrite(pFile, &buf[0], size, (i % slots) * size);
+			if (i == iters - 1) ::WinRTUnlock(pFile, SQLITE_LOCK_NONE);
+		});
+		RawRun run;
+		raw = Measure(iters, [&](int i) {
+			run.Write(storage, &buf[0], size, (i % slots) * size);
+			if (i == iters - 1) run.Flush(storage);
+		});
+		Report(json, "write", size, "sequential", vfs, &raw);
+
+		BenchRandom wrngVfs(size), wrngRaw(size);
+		vfs = Measure(iters, [&](int) {
+			::WinRTWrite(pFile, &buf[0], size, wrngVfs.Below(slots) * size);
+		});
+		raw = Measure(iters, [&](int) {
+			storage->Write(&buf[0], size, wrngRaw.Below(slots) * size);
+		});
+		Report(json, "write", size, "random", vfs, &raw);
+	}
+
+	sqlite_int64 size;
+	MicroResult vfs = Measure(iters, [&](int) { ::WinRTFileSize(pFile, &size); });
+	MicroResult raw = Measure(iters, [&](int) { storage->FileSize(&size); });
+	Report(json, "file_size", 0, nullptr, vfs, &raw);
+
+	// Sync is dominated by the device; dirty one page before each call.
+	int syncIters = iters / 100 > 10 ? iters / 100 : 10;
+	vfs = Measure(syncIters, [&](int i) {
+		::WinRTWrite(pFile, &buf[0], 4096, (sqlite_int64)(i % 64) * 4096);
+		::WinRTSync(pFile, SQLITE_SYNC_NORMAL);
+	});
+	raw = Measure(syncIters, [&](int i) {
+		storage->Write(&buf[0], 4096, (sqlite_int64)(i % 64) * 4096);
+		storage->Sync(SQLITE_SYNC_NORMAL);
+	});
+	Report(json, "write_sync", 4096, nullptr, vfs, &raw);
+
+	::WinRTClose(pFile);
+	delete storage;
+
+	// Open/close pairs. The storage-only figure is the path resolution and
+	// handle cost of the backend; the rest is the VFS shell around it.
+	int openIters = iters / 10 > 10 ? iters / 10 : 10;
+	vfs = Measure(openIters, [&](int) {
+		if (::WinRTOpen(pVfs, zFile, pFile, flags, nullptr) == SQLITE_OK)
+			::WinRTClose(pFile);
+	});
+	raw = Measure(openIters, [&](int) {
+		WinRTStorage *s = nullptr;
+		if (pBackend->Open(zFile, flags, &s) == SQLITE_OK)
+			delete s;
+	});
+	Report(json, "open_close", 0, nullptr, vfs, &raw);
+
+	json.EndArray();
+	json.EndObject();
+	json.Finish();
+
+	pBackend->Delete(zFile, 0);
+	pBackend->Delete(hot.c_str(), 0);
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
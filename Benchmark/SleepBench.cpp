@@ -0,0 +1,147 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Sleep benchmark. For a range of requested durations, measures how long
+*		WinRTTimerSleep (WinRTTimer.cpp) actually sleeps and how much CPU it
+*		uses, next to std::this_thread::sleep_for, then runs many threads
+*		sleeping at once through the shared timer wheel.
+*
+*		Build (POSIX):
+*			g++ -std=c++14 -O2 -I../Source SleepBench.cpp ../Source/WinRT*.cpp \
+*				-lsqlite3 -lpthread -o sleepbench
+*
+*		Options:
+*			--samples=N      sleeps per duration (default 200)
+*			--threads=N      concurrent sleepers in the last phase (default 16)
+*			--out=PATH       write JSON to PATH instead of stdout
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <time.h>
+
+#include "WinRTTimer.h"
+#include "BenchUtil.h"
+
+
+static const int durations[] = { 1, 10, 50, 100, 250, 500, 1000, 2000, 5000, 20000 };
+
+static uint64_t CpuNs()
+{
+	return (uint64_t)((double)clock() * 1e9 / CLOCKS_PER_SEC);
+}
+
+/*
+** Sleep samples times for nMicro each; report the overshoot past the
+** request and the CPU time spent per sleep.
+*/
+static void Measure(BenchJson &json, const char *key, void(*sleep)(int), int nMicro, int samples)
+{
+	BenchLatency over;
+	uint64_t cpuStart = CpuNs();
+	uint64_t under = 0;
+	for (int i = 0; i < samples; i++)
+	{
+		uint64_t start = BenchNowNs();
+		sleep(nMicro);
+		uint64_t slept = BenchNowNs() - start;
+		uint64_t want = nMicro * 1000ull;
+		if (slept < want)
+			under++;
+		over.Add(slept > want ? slept - want : 0);
+	}
+	uint64_t cpu = CpuNs() - cpuStart;
+
+	json.BeginObject(key);
+	json.Latencies("overshoot_us", over);
+	json.Field("mean_overshoot_us", over.TotalNs() / 1000.0 / samples);
+	json.Field("undershoot_count", under);
+	json.Field("cpu_us_per_sleep", cpu / 1000.0 / samples);
+	json.EndObject();
+}
+
+static void TimerSleep(int nMicro)
+{
+	::WinRTTimerSleep(nMicro);
+}
+
+static void OsSleep(int nMicro)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(nMicro));
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *zOut = BenchArg(argc, argv, "out", nullptr);
+	int samples = atoi(BenchArg(argc, argv, "samples", "200"));
+	int nThreads = atoi(BenchArg(argc, argv, "threads", "16"));
+
+	FILE *out = zOut ? fopen(zOut, "w") : stdout;
+	if (out == nullptr)
+	{
+		fprintf(stderr, "cannot write %s\n", zOut);
+		return 1;
+	}
+
+	BenchJson json(out);
+	json.BeginObject();
+	json.Field("benchmark", "sleep");
+	json.BeginArray("durations");
+	for (int nMicro : durations)
+	{
+		int n = std::max(4, std::min(samples, 2000000 / (nMicro + 100)));
+		json.BeginObject();
+		json.Field("requested_us", nMicro);
+		json.Field("samples", n);
+		Measure(json, "timer", TimerSleep, nMicro, n);
+		Measure(json, "os", OsSleep, nMicro, n);
+		json.EndObject();
+	}
+	json.EndArray();
+
+	// Many threads backing off at once, as under lock contention.
+	BenchLatency over;
+	std::mutex overMutex;
+	std::vector<std::thread> threads;
+	uint64_t cpuStart = CpuNs();
+	for (int t = 0; t < nThreads; t++)
+	{
+		threads.emplace_back([&, t] {
+			BenchRandom rng(t + 1);
+			for (int i = 0; i < 50; i++)
+			{
+				int nMicro = 500 + (int)rng.Below(4500);
+				uint64_t start = BenchNowNs();
+				::WinRTTimerSleep(nMicro);
+				uint64_t slept = BenchNowNs() - start;
+				std::lock_guard<std::mutex> lock(overMutex);
+				over.Add(slept > nMicro * 1000ull ? slept - nMicro * 1000ull : 0);
+			}
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	uint64_t cpu = CpuNs() - cpuStart;
+
+	json.BeginObject("concurrent");
+	json.Field("threads", nThreads);
+	json.Field("sleeps", (uint64_t)over.Count());
+	json.Latencies("overshoot_us", over);
+	json.Field("cpu_us_per_sleep", cpu / 1000.0 / over.Count());
+	json.EndObject();
+
+	json.EndObject();
+	json.Finish();
+
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
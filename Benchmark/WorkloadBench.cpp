@@ -0,0 +1,399 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Workload benchmark for WinRTVFS, modeled on SQLite's speedtest1. Registers
+*		the VFS on a portable backend and runs a fixed sequence of workload mixes
+*		against one database, printing one JSON document with ops/sec and latency
+*		percentiles per workload.
+*
+*		Build (POSIX):
+*			g++ -std=c++14 -O2 -I../Source WorkloadBench.cpp ../Source/WinRT*.cpp \
+*				-lsqlite3 -lpthread -o workloadbench
+*
+*		Options:
+*			--db=PATH        database file (default workloadbench.db, recreated)
+*			--rows=N         rows in the main table (default 100000)
+*			--ops=N          operations for lookup/update/scan mixes (default 20000)
+*			--txns=N         number of small transactions (default 500)
+*			--vfs=NAME       "WinRTVFS" (default) or any built-in VFS such as "unix",
+*			                 to measure the VFS against SQLite's own
+*			--backend=NAME   storage backend: posix (default), uring, or sim for a
+*			                 simulated device in memory
+*			--device=NAME    with sim: ssd, sdcard (default), usb or network
+*			--seed=N         with sim: seed for its stalls and failures
+*			--deadline-ms=N  fail reads, writes and syncs that wait on storage
+*			                 longer than N ms (WinRTDeadline.h); default none
+*			--out=PATH       write JSON to PATH instead of stdout
+*			--trace=PATH     write a Chrome trace of the VFS's operations to PATH,
+*			                 each tagged with its workload (WinRTIoLog.h)
+*			--trace-events=N events to keep in the trace (default 200000)
+*
+*		The VFS does not create temp files, so the benchmark runs with
+*		PRAGMA temp_store=MEMORY (VACUUM and large sorts need it).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "WinRTVFS.h"
+#include "WinRTIoLog.h"
+#include "WinRTDeadline.h"
+#include "BenchUtil.h"
+
+
+struct BenchContext
+{
+	sqlite3 *db;
+	int rows;
+	int ops;
+	int txns;
+	BenchRandom rng;
+};
+
+/*
+** One workload mix. Each fills lat with one sample per operation and
+** returns SQLITE_OK or the first error.
+*/
+struct BenchWorkload
+{
+	const char *name;
+	int(*run)(BenchContext &ctx, BenchLatency &lat);
+};
+
+
+static int Exec(sqlite3 *db, const char *zSql)
+{
+	char *zErr = nullptr;
+	int rc = sqlite3_exec(db, zSql, nullptr, nullptr, &zErr);
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, "%s: %s\n", zSql, zErr ? zErr : sqlite3_errstr(rc));
+		sqlite3_free(zErr);
+	}
+	return rc;
+}
+
+/*
+** Step a prepared statement to completion and reset it, timing the whole
+** execution as one operation.
+*/
+static int StepTimed(sqlite3_stmt *stmt, BenchLatency &lat)
+{
+	uint64_t start = BenchNowNs();
+	int rc;
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {}
+	lat.Add(BenchNowNs() - start);
+	sqlite3_reset(stmt);
+	return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+static void RandomText(BenchRandom &rng, char *zBuf, int n)
+{
+	static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz ";
+	for (int i = 0; i < n; i++)
+		zBuf[i] = alphabet[rng.Below(sizeof(alphabet) - 1)];
+	zBuf[n] = 0;
+}
+
+static int BulkInsert(BenchContext &ctx, BenchLatency &lat)
+{
+	int rc = Exec(ctx.db, "CREATE TABLE t1(a INTEGER PRIMARY KEY, b INTEGER, c TEXT)");
+	if (rc != SQLITE_OK) return rc;
+
+	sqlite3_stmt *stmt;
+	sqlite3_prepare_v2(ctx.db, "INSERT INTO t1 VALUES(?1, ?2, ?3)", -1, &stmt, nullptr);
+	Exec(ctx.db, "BEGIN");
+	char zText[101];
+	for (int i = 1; i <= ctx.rows && rc == SQLITE_OK; i++)
+	{
+		RandomText(ctx.rng, zText, 20 + (int)ctx.rng.Below(80));
+		sqlite3_bind_int(stmt, 1, i);
+		sqlite3_bind_int64(stmt, 2, (sqlite3_int64)ctx.rng.Below(1000000000));
+		sqlite3_bind_text(stmt, 3, zText, -1, SQLITE_STATIC);
+		rc = StepTimed(stmt, lat);
+	}
+	sqlite3_finalize(stmt);
+	if (rc != SQLITE_OK) return rc;
+
+	// The commit is part of the bulk load; attribute it as one more op.
+	uint64_t start = BenchNowNs();
+	rc = Exec(ctx.db, "COMMIT");
+	lat.Add(BenchNowNs() - start);
+	return rc;
+}
+
+static int PointLookup(BenchContext &ctx, BenchLatency &lat)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_prepare_v2(ctx.db, "SELECT b, c FROM t1 WHERE a = ?1", -1, &stmt, nullptr);
+	int rc = SQLITE_OK;
+	for (int i = 0; i < ctx.ops && rc == SQLITE_OK; i++)
+	{
+		sqlite3_bind_int(stmt, 1, 1 + (int)ctx.rng.Below(ctx.rows));
+		rc = StepTimed(stmt, lat);
+	}
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+static int RangeScan(BenchContext &ctx, BenchLatency &lat)
+{
+	sqlite3_stmt *stmt;
+	sqlite3_prepare_v2(ctx.db, "SELECT count(*), sum(length(c)) FROM t1 WHERE a BETWEEN ?1 AND ?1 + 99", -1, &stmt, nullptr);
+	int rc = SQLITE_OK;
+	int scans = ctx.ops / 10;
+	for (int i = 0; i < scans && rc == SQLITE_OK; i++)
+	{
+		sqlite3_bind_int(stmt, 1, 1 + (int)ctx.rng.Below(ctx.rows));
+		rc = StepTimed(stmt, lat);
+	}
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+/*
+** 80% updates, 20% lookups, committed every 100 operations.
+*/
+static int UpdateHeavy(BenchContext &ctx, BenchLatency &lat)
+{
+	sqlite3_stmt *update, *select;
+	sqlite3_prepare_v2(ctx.db, "UPDATE t1 SET b = ?2, c = ?3 WHERE a = ?1", -1, &update, nullptr);
+	sqlite3_prepare_v2(ctx.db, "SELECT b, c FROM t1 WHERE a = ?1", -1, &select, nullptr);
+	int rc = SQLITE_OK;
+	char zText[101];
+	for (int i = 0; i < ctx.ops && rc == SQLITE_OK; i++)
+	{
+		if (i % 100 == 0)
+			rc = Exec(ctx.db, i == 0 ? "BEGIN" : "COMMIT; BEGIN");
+		int key = 1 + (int)ctx.rng.Below(ctx.rows);
+		if (ctx.rng.Below(5) == 0)
+		{
+			sqlite3_bind_int(select, 1, key);
+			rc = StepTimed(select, lat);
+		}
+		else
+		{
+			RandomText(ctx.rng, zText, 20 + (int)ctx.rng.Below(80));
+			sqlite3_bind_int(update, 1, key);
+			sqlite3_bind_int64(update, 2, (sqlite3_int64)ctx.rng.Below(1000000000));
+			sqlite3_bind_text(update, 3, zText, -1, SQLITE_STATIC);
+			rc = StepTimed(update, lat);
+		}
+	}
+	sqlite3_finalize(update);
+	sqlite3_finalize(select);
+	if (rc != SQLITE_OK) return rc;
+	return Exec(ctx.db, "COMMIT");
+}
+
+/*
+** Build (and drop) an index on the unsorted column three times.
+*/
+static int IndexBuild(BenchContext &ctx, BenchLatency &lat)
+{
+	int rc = SQLITE_OK;
+	for (int i = 0; i < 3 && rc == SQLITE_OK; i++)
+	{
+		uint64_t start = BenchNowNs();
+		rc = Exec(ctx.db, "CREATE INDEX t1b ON t1(b)");
+		lat.Add(BenchNowNs() - start);
+		if (rc == SQLITE_OK && i < 2)
+			rc = Exec(ctx.db, "DROP INDEX t1b");
+	}
+	return rc;
+}
+
+/*
+** Delete a third of the rows, then VACUUM three times.
+*/
+static int Vacuum(BenchContext &ctx, BenchLatency &lat)
+{
+	int rc = Exec(ctx.db, "DELETE FROM t1 WHERE a % 3 = 0");
+	for (int i = 0; i < 3 && rc == SQLITE_OK; i++)
+	{
+		uint64_t start = BenchNowNs();
+		rc = Exec(ctx.db, "VACUUM");
+		lat.Add(BenchNowNs() - start);
+	}
+	return rc;
+}
+
+/*
+** Many autocommit transactions of a single insert each; dominated by the
+** journal create/sync/delete cycle.
+*/
+static int SmallTransactions(BenchContext &ctx, BenchLatency &lat)
+{
+	int rc = Exec(ctx.db, "CREATE TABLE t2(a INTEGER PRIMARY KEY, b TEXT)");
+	sqlite3_stmt *stmt;
+	sqlite3_prepare_v2(ctx.db, "INSERT INTO t2(b) VALUES(?1)", -1, &stmt, nullptr);
+	char zText[101];
+	for (int i = 0; i < ctx.txns && rc == SQLITE_OK; i++)
+	{
+		RandomText(ctx.rng, zText, 50);
+		sqlite3_bind_text(stmt, 1, zText, -1, SQLITE_STATIC);
+		rc = StepTimed(stmt, lat);
+	}
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+static const BenchWorkload workloads[] =
+{
+	{ "bulk_insert", BulkInsert },
+	{ "point_lookup", PointLookup },
+	{ "range_scan", RangeScan },
+	{ "update_heavy", UpdateHeavy },
+	{ "index_build", IndexBuild },
+	{ "vacuum", Vacuum },
+	{ "small_transactions", SmallTransactions },
+};
+
+
+int main(int argc, char **argv)
+{
+	const char *zDb = BenchArg(argc, argv, "db", "workloadbench.db");
+	const char *zVfs = BenchArg(argc, argv, "vfs", "WinRTVFS");
+	const char *zOut = BenchArg(argc, argv, "out", nullptr);
+	const char *zTrace = BenchArg(argc, argv, "trace", nullptr);
+
+	BenchContext ctx = { nullptr, 0, 0, 0, BenchRandom(1) };
+	ctx.rows = atoi(BenchArg(argc, argv, "rows", "100000"));
+	ctx.ops = atoi(BenchArg(argc, argv, "ops", "20000"));
+	ctx.txns = atoi(BenchArg(argc, argv, "txns", "500"));
+
+	WinRTBackend *pBackend = BenchBackend(argc, argv);
+	if (pBackend == nullptr || ::WinRTVFSRegister("WinRTVFS", pBackend, 0) != SQLITE_OK)
+	{
+		fprintf(stderr, "could not register WinRTVFS\n");
+		return 1;
+	}
+
+	int deadlineMs = atoi(BenchArg(argc, argv, "deadline-ms", "0"));
+	if (deadlineMs > 0)
+	{
+		WinRTIoPolicy policy;
+		::WinRTIoPolicyDefault(&policy);
+		policy.readMicro = policy.writeMicro = policy.syncMicro = deadlineMs * 1000;
+		::WinRTVFSSetIoPolicy("WinRTVFS", &policy);
+	}
+
+	if (zTrace != nullptr && ::WinRTIoTraceStart(atoi(BenchArg(argc, argv, "trace-events", "200000"))) != SQLITE_OK)
+	{
+		fprintf(stderr, "cannot allocate the trace\n");
+		return 1;
+	}
+
+	// Through the backend, so that layers over it drop their sidecars too,
+	// along with the hot-block list, so that every run starts cold.
+	pBackend->Delete(zDb, 0);
+	for (const char *zSuffix : { "-journal", "-wal", "-hot" })
+		pBackend->Delete((std::string(zDb) + zSuffix).c_str(), 0);
+
+	int rc = sqlite3_open_v2(zDb, &ctx.db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, zVfs);
+	if (rc != SQLITE_OK)
+	{
+		fprintf(stderr, "open %s: %s\n", zDb, sqlite3_errstr(rc));
+		return 1;
+	}
+	Exec(ctx.db, "PRAGMA temp_store=MEMORY");
+
+	FILE *out = zOut ? fopen(zOut, "w") : stdout;
+	if (out == nullptr)
+	{
+		fprintf(stderr, "cannot write %s\n", zOut);
+		return 1;
+	}
+
+	BenchJson json(out);
+	json.BeginObject();
+	json.Field("benchmark", "workload");
+	json.Field("backend", BenchArg(argc, argv, "backend", "posix"));
+	json.Field("vfs", zVfs);
+	json.Field("sqlite", sqlite3_libversion());
+	json.Field("rows", ctx.rows);
+	json.BeginArray("workloads");
+
+	int failed = 0;
+	for (const BenchWorkload &w : workloads)
+	{
+		BenchLatency lat;
+		uint64_t start = BenchNowNs();
+		{
+			WinRTIoTagScope tag(w.name);
+			rc = w.run(ctx, lat);
+		}
+		double seconds = (BenchNowNs() - start) / 1e9;
+
+		json.BeginObject();
+		json.Field("name", w.name);
+		json.Field("status", rc == SQLITE_OK ? "ok" : sqlite3_errstr(rc));
+		json.Field("ops", (uint64_t)lat.Count());
+		json.Field("seconds", seconds);
+		json.Field("ops_per_sec", seconds > 0 ? lat.Count() / seconds : 0.0);
+		json.Latencies("latency_us", lat);
+		json.EndObject();
+
+		if (rc != SQLITE_OK)
+		{
+			failed = 1;
+			break;
+		}
+	}
+
+	json.EndArray();
+	if (strcmp(BenchArg(argc, argv, "backend", "posix"), "sim") == 0)
+	{
+		WinRTSimStats device;
+		::WinRTSimStatus(pBackend, &device);
+		json.BeginObject("device");
+		json.Field("name", BenchArg(argc, argv, "device", "sdcard"));
+		json.Field("busy_ms", device.busyMicro / 1000.0);
+		json.Field("queued_ms", device.waitMicro / 1000.0);
+		json.Field("reads", (uint64_t)device.reads);
+		json.Field("writes", (uint64_t)device.writes);
+		json.Field("syncs", (uint64_t)device.syncs);
+		json.Field("bytes_read", (uint64_t)device.bytesRead);
+		json.Field("bytes_written", (uint64_t)device.bytesWritten);
+		json.Field("stalls", (uint64_t)device.stalls);
+		json.Field("sync_failures", (uint64_t)device.syncFailures);
+		json.Field("abandoned", (uint64_t)device.abandoned);
+		json.EndObject();
+	}
+	WinRTIoDeadlineStats deadlines;
+	::WinRTIoDeadlineStatus(&deadlines);
+	json.BeginObject("deadlines");
+	json.Field("deadline_ms", deadlineMs);
+	json.Field("timeouts", (uint64_t)deadlines.timeouts);
+	json.Field("sync_retries", (uint64_t)deadlines.retries);
+	json.Field("retry_wait_ms", deadlines.retryMicro / 1000.0);
+	json.Field("sync_failures", (uint64_t)deadlines.exhausted);
+	json.EndObject();
+	json.EndObject();
+	json.Finish();
+
+	sqlite3_close(ctx.db);
+	if (out != stdout)
+		fclose(out);
+
+	if (zTrace != nullptr)
+	{
+		std::string trace;
+		::WinRTIoTraceJson(&trace);
+		FILE *f = fopen(zTrace, "w");
+		if (f == nullptr || fwrite(trace.data(), 1, trace.size(), f) != trace.size())
+		{
+			fprintf(stderr, "cannot write %s\n", zTrace);
+			failed = 1;
+		}
+		if (f != nullptr)
+			fclose(f);
+	}
+	return failed;
+}
@@ -1,34 +1,554 @@
 #include "pch.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <Windows.h>
+
 #include "WinRTVFS.h"
+#include "WinRTBlockCache.h"
+#include "WinRTMemoryBudget.h"
+#include "WinRTPageCache.h"
+#include "WinRTAllocator.h"
+#include "WinRTReservation.h"
+#include "WinRTIoLog.h"
+#include "WinRTDeadline.h"
+
+// SQLite and the VFS work in UTF-8.
+static std::string WinRTToUtf8(Platform::String^ s)
+{
+	if (s == nullptr)
+		return std::string();
+	int n = ::WideCharToMultiByte(CP_UTF8, 0, s->Data(), -1, nullptr, 0, nullptr, nullptr);
+	std::string z(n, '\0');
+	::WideCharToMultiByte(CP_UTF8, 0, s->Data(), -1, &z[0], n, nullptr, nullptr);
+	return z;
+}
+
+static Platform::String^ WinRTFromUtf8(const char *z)
+{
+	int n = ::MultiByteToWideChar(CP_UTF8, 0, z, -1, nullptr, 0);
+	if (n <= 1)
+		return L"";
+	std::wstring s(n, L'\0');
+	::MultiByteToWideChar(CP_UTF8, 0, z, -1, &s[0], n);
+	return ref new Platform::String(s.c_str());
+}
 
 namespace SQLiteWinRTExtensions
 {
+	/// <summary>Optional storage features layered over the VFS.</summary>
+	[Platform::Metadata::Flags]
+	public enum class WinRTVFSFeatures : unsigned int
+	{
+		None = 0,
+		/// <summary>LZ-compress main database pages; the database is stored with a "-lzmap" sidecar.</summary>
+		CompressPages = 0x1,
+		/// <summary>Keep a CRC-32C of every main database page in a "-crc" sidecar and verify it on each read.</summary>
+		PageChecksums = 0x2,
+		/// <summary>Encrypt every file with XTS-AES under the key given to Initialize; there is no migration of existing plain files.</summary>
+		EncryptPages = 0x4,
+		/// <summary>Replace SQLite's per-connection page caches with one that all connections share, within a single memory budget, and that keeps table scans from evicting pages in repeated use.</summary>
+		SharedPageCache = 0x8,
+		/// <summary>Serve SQLite's memory from size-classed, per-thread free lists instead of the system heap. SQLite's own memory statistics are turned off.</summary>
+		ThreadCachingAllocator = 0x10,
+	};
+
+	/// <summary>Memory to reserve at Initialize, in one contiguous block, for SQLite's page buffers and for each connection's lookaside (small, short-lived allocations).</summary>
+	public ref class WinRTVFSMemoryConfig sealed
+	{
+	public:
+		WinRTVFSMemoryConfig()
+		{
+			PageSize = 4096;
+			PageCount = 0;
+			LookasideSlotSize = 1200;
+			LookasideSlots = 100;
+			Connections = 0;
+			UseLargePages = false;
+		}
+
+		/// <summary>Largest database page size in use.</summary>
+		property int32 PageSize;
+		/// <summary>Page buffers to reserve; pages beyond them come from the heap.</summary>
+		property int32 PageCount;
+		/// <summary>Bytes in each lookaside slot.</summary>
+		property int32 LookasideSlotSize;
+		/// <summary>Lookaside slots per connection.</summary>
+		property int32 LookasideSlots;
+		/// <summary>Connections open at once whose lookaside to reserve; further connections take theirs from the heap.</summary>
+		property int32 Connections;
+		/// <summary>Back the block with large pages where the OS allows it.</summary>
+		property bool UseLargePages;
+	};
+
+	/// <summary>Use of the memory reserved by WinRTVFSMemoryConfig.</summary>
+	public value struct WinRTVFSMemoryStatus
+	{
+		uint64 ReservedBytes;
+		bool LargePages;
+		int32 PageSlots;
+		int32 PagesUsed;
+		int32 PagesHighwater;
+		/// <summary>Pages held outside the reservation, now and at most.</summary>
+		int32 PageOverflow;
+		int32 PageOverflowHighwater;
+		int32 LookasideRegions;
+		int32 LookasideUsed;
+		int32 LookasideHighwater;
+		/// <summary>Connections that opened with every reserved lookaside region taken.</summary>
+		int64 LookasideOverflow;
+	};
+
+	/// <summary>Use of the VFS block cache: database blocks held uncompressed, and evicted blocks held LZ-compressed in a second tier, within one budget.</summary>
+	public value struct WinRTVFSCacheStatus
+	{
+		uint64 BudgetBytes;
+		uint64 Bytes;
+		int64 Blocks;
+		/// <summary>Held by the second tier, its overhead included.</summary>
+		uint64 CompressedBytes;
+		int64 CompressedBlocks;
+		/// <summary>Reads answered from uncompressed blocks.</summary>
+		int64 Hits;
+		/// <summary>Reads answered by decompressing a block.</summary>
+		int64 CompressedHits;
+		/// <summary>Reads left to storage.</summary>
+		int64 Misses;
+	};
+
+	/// <summary>Memory held by the caches and buffers of the VFS, against the budget set by SetMemoryBudget.</summary>
+	public value struct WinRTVFSMemoryUsage
+	{
+		/// <summary>0 until a budget is set.</summary>
+		uint64 BudgetBytes;
+		uint64 SoftLimitBytes;
+		uint64 UsedBytes;
+		uint64 BlockCacheBytes;
+		uint64 PageCacheBytes;
+		uint64 WriteBufferBytes;
+		uint64 HeaderCacheBytes;
+		int64 Trims;
+		/// <summary>Times the soft limit set off background eviction.</summary>
+		int64 BackgroundEvictions;
+		/// <summary>Freed by trims and background eviction together.</summary>
+		uint64 ReleasedBytes;
+	};
+
+	/// <summary>Operations of the VFS timed by the slow-I/O log and the trace.</summary>
+	public enum class WinRTVFSOperation
+	{
+		/// <summary>Resolving the path and opening the file.</summary>
+		Open = WINRT_IO_OPEN,
+		Read = WINRT_IO_READ,
+		/// <summary>A run of adjacent writes sent to storage together.</summary>
+		Write = WINRT_IO_WRITE,
+		Truncate = WINRT_IO_TRUNCATE,
+		/// <summary>Flushing to the device, retries included.</summary>
+		Sync = WINRT_IO_SYNC,
+		/// <summary>Offset holds the SQLite lock level.</summary>
+		Lock = WINRT_IO_LOCK,
+		/// <summary>Offset holds the SQLite lock level; includes sending pending writes.</summary>
+		Unlock = WINRT_IO_UNLOCK,
+		Close = WINRT_IO_CLOSE,
+		/// <summary>A background read into the block cache, by PrewarmAsync or the saved list of hot blocks.</summary>
+		Prefetch = WINRT_IO_PREFETCH,
+	};
+
+	/// <summary>An operation that took at least the threshold set by SetSlowIoThreshold.</summary>
+	public value struct WinRTVFSSlowIo
+	{
+		/// <summary>Position in the log; entries overwritten before they were read leave gaps.</summary>
+		uint64 Sequence;
+		WinRTVFSOperation Operation;
+		/// <summary>The end of the path, if long.</summary>
+		Platform::String^ File;
+		int64 Offset;
+		/// <summary>Bytes; the new size for Truncate.</summary>
+		int64 Length;
+		/// <summary>When it started, from when the VFS was loaded.</summary>
+		Windows::Foundation::TimeSpan Start;
+		Windows::Foundation::TimeSpan Duration;
+		/// <summary>Attempts after the first.</summary>
+		int32 Retries;
+		uint32 ThreadId;
+		/// <summary>The SQLite result code.</summary>
+		int32 Result;
+		/// <summary>The tag of the thread (SetIoTag); empty if none.</summary>
+		Platform::String^ Tag;
+	};
+
+	/// <summary>I/O made under one tag (SetIoTag), since it was first set. Times are totals; reads and writes are counted in bytes asked for.</summary>
+	public value struct WinRTVFSIoStatistics
+	{
+		/// <summary>Empty for operations made with no tag set.</summary>
+		Platform::String^ Tag;
+		int64 Opens;
+		Windows::Foundation::TimeSpan OpenTime;
+		int64 Reads;
+		uint64 ReadBytes;
+		/// <summary>Reads answered from memory, without storage.</summary>
+		int64 CachedReads;
+		Windows::Foundation::TimeSpan ReadTime;
+		/// <summary>Runs of adjacent writes sent to storage.</summary>
+		int64 Writes;
+		uint64 WriteBytes;
+		Windows::Foundation::TimeSpan WriteTime;
+		int64 Truncates;
+		Windows::Foundation::TimeSpan TruncateTime;
+		int64 Syncs;
+		Windows::Foundation::TimeSpan SyncTime;
+		/// <summary>The longest single operation of any kind.</summary>
+		Windows::Foundation::TimeSpan LongestTime;
+	};
+
+	/// <summary>How long VFS operations may wait on storage before they fail with an I/O error, and how a failed sync is retried. Zero means no deadline. A database opened as a URI can override it with read_timeout_ms, write_timeout_ms, sync_timeout_ms, open_timeout_ms and sync_attempts parameters.</summary>
+	public ref class WinRTVFSIoPolicy sealed
+	{
+	public:
+		WinRTVFSIoPolicy()
+		{
+			WinRTIoPolicy policy;
+			::WinRTIoPolicyDefault(&policy);
+			OpenTimeout.Duration = policy.openMicro * 10LL;
+			ReadTimeout.Duration = policy.readMicro * 10LL;
+			WriteTimeout.Duration = policy.writeMicro * 10LL;
+			SyncTimeout.Duration = policy.syncMicro * 10LL;
+			SyncAttempts = policy.maxAttempts;
+			RetryDelay.Duration = policy.backoffMicro * 10LL;
+			MaxRetryDelay.Duration = policy.backoffMaxMicro * 10LL;
+			JitterPercent = policy.jitterPercent;
+		}
+
+		property Windows::Foundation::TimeSpan OpenTimeout;
+		property Windows::Foundation::TimeSpan ReadTimeout;
+		/// <summary>For writes sent to storage and for truncation.</summary>
+		property Windows::Foundation::TimeSpan WriteTimeout;
+		/// <summary>For a sync, its retries and the waits between them included.</summary>
+		property Windows::Foundation::TimeSpan SyncTimeout;
+		/// <summary>Tries of a sync before it fails, the first included.</summary>
+		property int32 SyncAttempts;
+		/// <summary>Wait before the first retry; it doubles for each retry after, up to MaxRetryDelay.</summary>
+		property Windows::Foundation::TimeSpan RetryDelay;
+		property Windows::Foundation::TimeSpan MaxRetryDelay;
+		/// <summary>Each wait is shortened by a random share of up to this percent.</summary>
+		property int32 JitterPercent;
+	};
+
+	/// <summary>Operations cut short by the deadlines of WinRTVFSIoPolicy or by CancelPendingIo, and the retries of failed syncs, since the VFS was loaded.</summary>
+	public value struct WinRTVFSIoDeadlineStatus
+	{
+		int64 TimedOut;
+		int64 Cancelled;
+		int64 SyncRetries;
+		Windows::Foundation::TimeSpan RetryWaitTime;
+		/// <summary>Syncs that failed every attempt.</summary>
+		int64 SyncFailures;
+	};
+
+	/// <summary>Tags the I/O of the calling thread until disposed, then restores the tag it had. The tag stays with the thread, so do not await inside its scope.</summary>
+	public ref class WinRTVFSIoTagScope sealed
+	{
+	public:
+		WinRTVFSIoTagScope(Platform::String^ tag)
+		{
+			previous = ::WinRTIoTag();
+			::WinRTIoSetTag(WinRTToUtf8(tag).c_str());
+		}
+
+		virtual ~WinRTVFSIoTagScope()
+		{
+			::WinRTIoSetTag(::WinRTIoTagName(previous));
+		}
+
+	private:
+		int previous;
+	};
+
 	public ref class WinRTVFS sealed
 	{
 	public:
 		static bool Initialize(bool makeDefaultVFS)
 		{
-			sqlite3_vfs* pVFS = new sqlite3_vfs
+			return Initialize(makeDefaultVFS, WinRTVFSFeatures::None);
+		}
+
+		static bool Initialize(bool makeDefaultVFS, WinRTVFSFeatures features)
+		{
+			return Initialize(makeDefaultVFS, features, nullptr);
+		}
+
+		/// <param name="key">32 bytes (XTS-AES-128) or 64 bytes (XTS-AES-256), required with EncryptPages.</param>
+		static bool Initialize(bool makeDefaultVFS, WinRTVFSFeatures features, const Platform::Array<uint8>^ key)
+		{
+			return Initialize(makeDefaultVFS, features, key, nullptr);
+		}
+
+		/// <param name="memory">Memory to reserve for page buffers and lookaside; null for none.</param>
+		static bool Initialize(bool makeDefaultVFS, WinRTVFSFeatures features, const Platform::Array<uint8>^ key, WinRTVFSMemoryConfig^ memory)
+		{
+			// The allocator and page cache must be in place before SQLite
+			// initializes, which registering the VFS does.
+			if ((features & WinRTVFSFeatures::ThreadCachingAllocator) == WinRTVFSFeatures::ThreadCachingAllocator)
+			{
+				if (::WinRTAllocatorInstall() != SQLITE_OK)
+					return false;
+			}
+			if ((features & WinRTVFSFeatures::SharedPageCache) == WinRTVFSFeatures::SharedPageCache)
+			{
+				if (::WinRTPageCacheInstall(WINRT_PCACHE_BYTES) != SQLITE_OK)
+					return false;
+			}
+			// Last, since it wraps the allocator and serves the page cache.
+			if (memory != nullptr)
+			{
+				WinRTReservationConfig config;
+				config.pageSize = memory->PageSize;
+				config.pageCount = memory->PageCount;
+				config.lookasideSize = memory->LookasideSlotSize;
+				config.lookasideCount = memory->LookasideSlots;
+				config.connections = memory->Connections;
+				config.largePages = memory->UseLargePages ? 1 : 0;
+				if (::WinRTReserveMemory(&config) != SQLITE_OK)
+					return false;
+			}
+
+			WinRTBackend *backend = ::WinRTStreamBackend();
+			// Encryption sits at the bottom so sidecars and journals are covered too.
+			if ((features & WinRTVFSFeatures::EncryptPages) == WinRTVFSFeatures::EncryptPages)
+			{
+				if (key == nullptr)
+					return false;
+				backend = ::WinRTCipherBackend(backend, key->Data, (int)key->Length);
+				if (backend == nullptr)
+					return false;
+			}
+			if ((features & WinRTVFSFeatures::CompressPages) == WinRTVFSFeatures::CompressPages)
+				backend = ::WinRTCodecBackend(backend);
+			// Checksums cover pages as SQLite sees them, above the codec.
+			if ((features & WinRTVFSFeatures::PageChecksums) == WinRTVFSFeatures::PageChecksums)
+				backend = ::WinRTChecksumBackend(backend);
+			return (::WinRTVFSRegister("WinRTVFS", backend, makeDefaultVFS) == SQLITE_OK);
+		}
+
+		/// <summary>Sets one memory budget for every cache and buffer of the VFS, across all open databases. Caches are sized to fit it and trimmed at once if over; past the soft limit, a background thread evicts from them until use is back under.</summary>
+		/// <param name="softLimitBytes">0 for no background eviction.</param>
+		/// <param name="budgetBytes">At least WINRT_MEMORY_MIN_BYTES (4 MB).</param>
+		/// <returns>False if the budget is under the minimum or the soft limit is above it.</returns>
+		static bool SetMemoryBudget(uint64 budgetBytes, uint64 softLimitBytes)
+		{
+			if (budgetBytes < WINRT_MEMORY_MIN_BYTES || softLimitBytes > budgetBytes || budgetBytes > (uint64)INT64_MAX)
+				return false;
+			return ::WinRTMemorySetBudget((sqlite_int64)budgetBytes, (sqlite_int64)softLimitBytes) == SQLITE_OK;
+		}
+
+		/// <summary>Releases memory held by the caches when the app is told memory is short, e.g. on AppMemoryUsageIncreased or when suspending.</summary>
+		/// <param name="level">Percent of what the caches hold to release: 100 empties them.</param>
+		static void TrimMemory(int32 level)
+		{
+			::WinRTMemoryTrim(level);
+		}
+
+		static WinRTVFSMemoryUsage GetMemoryUsage()
+		{
+			WinRTMemoryStats stats;
+			::WinRTMemoryStatus(&stats);
+			WinRTVFSMemoryUsage usage;
+			usage.BudgetBytes = (uint64)stats.budget;
+			usage.SoftLimitBytes = (uint64)stats.softLimit;
+			usage.UsedBytes = (uint64)stats.used;
+			usage.BlockCacheBytes = (uint64)stats.blockCache;
+			usage.PageCacheBytes = (uint64)stats.pageCache;
+			usage.WriteBufferBytes = (uint64)stats.writeBuffers;
+			usage.HeaderCacheBytes = (uint64)stats.headerCaches;
+			usage.Trims = stats.trims;
+			usage.BackgroundEvictions = stats.evictions;
+			usage.ReleasedBytes = (uint64)stats.released;
+			return usage;
+		}
+
+		static WinRTVFSMemoryStatus GetMemoryStatus()
+		{
+			WinRTReservationStats stats;
+			::WinRTReservationStatus(&stats);
+			WinRTVFSMemoryStatus status;
+			status.ReservedBytes = (uint64)stats.bytes;
+			status.LargePages = stats.largePages != WINRT_RESERVE_SMALL_PAGES;
+			status.PageSlots = stats.pageSlots;
+			status.PagesUsed = stats.pagesUsed;
+			status.PagesHighwater = stats.pagesHighwater;
+			status.PageOverflow = stats.pageOverflow;
+			status.PageOverflowHighwater = stats.pageOverflowHighwater;
+			status.LookasideRegions = stats.lookasideRegions;
+			status.LookasideUsed = stats.lookasideUsed;
+			status.LookasideHighwater = stats.lookasideHighwater;
+			status.LookasideOverflow = stats.lookasideOverflow;
+			return status;
+		}
+
+		static WinRTVFSCacheStatus GetCacheStatus()
+		{
+			WinRTBlockCacheStats stats;
+			WinRTBlockCache::Status(&stats);
+			WinRTVFSCacheStatus status;
+			status.BudgetBytes = (uint64)stats.budget;
+			status.Bytes = (uint64)stats.bytes;
+			status.Blocks = stats.blocks;
+			status.CompressedBytes = (uint64)stats.packedBytes;
+			status.CompressedBlocks = stats.packedBlocks;
+			status.Hits = stats.hits;
+			status.CompressedHits = stats.packedHits;
+			status.Misses = stats.misses;
+			return status;
+		}
+
+		/// <summary>Logs every VFS operation that takes threshold or longer, to a ring of the last entries read with GetSlowIo. Zero, the default, turns the log off.</summary>
+		static void SetSlowIoThreshold(Windows::Foundation::TimeSpan threshold)
+		{
+			::WinRTIoLogSetThreshold(threshold.Duration / 10);
+		}
+
+		/// <summary>Entries of the slow-I/O log from fromSequence on, oldest first; pass one more than the last Sequence seen to read only new ones.</summary>
+		static Platform::Array<WinRTVFSSlowIo>^ GetSlowIo(uint64 fromSequence)
+		{
+			std::vector<WinRTIoLogEntry> entries(WINRT_IO_LOG_ENTRIES);
+			sqlite_uint64 next = fromSequence;
+			int n = ::WinRTIoLogRead(&next, &entries[0], (int)entries.size());
+			Platform::Array<WinRTVFSSlowIo>^ log = ref new Platform::Array<WinRTVFSSlowIo>((unsigned)n);
+			for (int i = 0; i < n; i++)
+			{
+				const WinRTIoLogEntry &entry = entries[i];
+				WinRTVFSSlowIo io;
+				io.Sequence = entry.sequence;
+				io.Operation = (WinRTVFSOperation)entry.op;
+				io.File = WinRTFromUtf8(entry.zFile);
+				io.Tag = WinRTFromUtf8(::WinRTIoTagName(entry.tag));
+				io.Offset = entry.offset;
+				io.Length = entry.amount;
+				io.Start.Duration = entry.start * 10;
+				io.Duration.Duration = entry.duration * 10;
+				io.Retries = entry.retries;
+				io.ThreadId = (uint32)entry.thread;
+				io.Result = entry.result;
+				log[i] = io;
+			}
+			return log;
+		}
+
+		/// <summary>Attributes the VFS operations of the calling thread to tag, e.g. the query or request it serves, until another is set; an empty tag clears it. From the first tag on, every operation is timed and counted per tag.</summary>
+		/// <returns>False, leaving the thread untagged, if 64 tags are already in use.</returns>
+		static bool SetIoTag(Platform::String^ tag)
+		{
+			return ::WinRTIoSetTag(WinRTToUtf8(tag).c_str()) == SQLITE_OK;
+		}
+
+		/// <summary>I/O statistics per tag, in the order the tags were first set; the first is for untagged operations.</summary>
+		static Platform::Array<WinRTVFSIoStatistics>^ GetIoStatistics()
+		{
+			std::vector<WinRTIoTagStats> tags(WINRT_IO_TAGS);
+			int n = ::WinRTIoTagStatus(&tags[0], (int)tags.size());
+			Platform::Array<WinRTVFSIoStatistics>^ stats = ref new Platform::Array<WinRTVFSIoStatistics>((unsigned)n);
+			for (int i = 0; i < n; i++)
+			{
+				const WinRTIoTagStats &tag = tags[i];
+				WinRTVFSIoStatistics io;
+				io.Tag = WinRTFromUtf8(tag.zTag);
+				io.Opens = tag.op[WINRT_IO_OPEN].count;
+				io.OpenTime.Duration = tag.op[WINRT_IO_OPEN].micro * 10;
+				io.Reads = tag.op[WINRT_IO_READ].count;
+				io.ReadBytes = (uint64)tag.op[WINRT_IO_READ].bytes;
+				io.CachedReads = tag.cachedReads;
+				io.ReadTime.Duration = tag.op[WINRT_IO_READ].micro * 10;
+				io.Writes = tag.op[WINRT_IO_WRITE].count;
+				io.WriteBytes = (uint64)tag.op[WINRT_IO_WRITE].bytes;
+				io.WriteTime.Duration = tag.op[WINRT_IO_WRITE].micro * 10;
+				io.Truncates = tag.op[WINRT_IO_TRUNCATE].count;
+				io.TruncateTime.Duration = tag.op[WINRT_IO_TRUNCATE].micro * 10;
+				io.Syncs = tag.op[WINRT_IO_SYNC].count;
+				io.SyncTime.Duration = tag.op[WINRT_IO_SYNC].micro * 10;
+				sqlite_int64 longest = 0;
+				for (int op = 0; op < WINRT_IO_OPS; op++)
+					longest = std::max(longest, tag.op[op].maxMicro);
+				io.LongestTime.Duration = longest * 10;
+				stats[i] = io;
+			}
+			return stats;
+		}
+
+		/// <summary>Records every VFS operation, up to maxEvents of them, for GetIoTrace; later ones are dropped. Discards an earlier trace. Each event takes about 200 bytes.</summary>
+		/// <returns>False if the events could not be allocated.</returns>
+		static bool StartIoTrace(int32 maxEvents)
+		{
+			return ::WinRTIoTraceStart(maxEvents) == SQLITE_OK;
+		}
+
+		static void StopIoTrace()
+		{
+			::WinRTIoTraceStop();
+		}
+
+		/// <summary>The operations recorded since StartIoTrace, as Chrome trace-event JSON to save and open in chrome://tracing or Perfetto: a lane per thread, each operation a bar with its file, offset, bytes, tag and result. Gaps in a lane are time spent outside the VFS.</summary>
+		static Platform::String^ GetIoTrace()
+		{
+			std::string json;
+			::WinRTIoTraceJson(&json);
+			return WinRTFromUtf8(json.c_str());
+		}
+
+		/// <summary>Sets the deadlines and retries of databases and journals opened from now on; those already open keep theirs. Backends that cannot interrupt a call, such as pread, finish it, but a sync still stops retrying at its deadline.</summary>
+		/// <returns>False if a value is negative, larger than about 35 minutes, or SyncAttempts is below 1.</returns>
+		static bool SetIoPolicy(WinRTVFSIoPolicy^ policy)
+		{
+			const int64 limit = 0x7FFFFFFFLL * 10;
+			if (policy->OpenTimeout.Duration > limit || policy->ReadTimeout.Duration > limit || policy->WriteTimeout.Duration > limit
+				|| policy->SyncTimeout.Duration > limit || policy->RetryDelay.Duration > limit || policy->MaxRetryDelay.Duration > limit)
+				return false;
+			WinRTIoPolicy p;
+			p.openMicro = (int)(policy->OpenTimeout.Duration / 10);
+			p.readMicro = (int)(policy->ReadTimeout.Duration / 10);
+			p.writeMicro = (int)(policy->WriteTimeout.Duration / 10);
+			p.syncMicro = (int)(policy->SyncTimeout.Duration / 10);
+			p.maxAttempts = policy->SyncAttempts;
+			p.backoffMicro = (int)(policy->RetryDelay.Duration / 10);
+			p.backoffMaxMicro = (int)(policy->MaxRetryDelay.Duration / 10);
+			p.jitterPercent = policy->JitterPercent;
+			return ::WinRTVFSSetIoPolicy("WinRTVFS", &p) == SQLITE_OK;
+		}
+
+		/// <summary>Fails every VFS operation now waiting on storage, on any thread, with an I/O error, e.g. when a removable drive is pulled or the app is suspending. Operations started afterwards run as usual.</summary>
+		static void CancelPendingIo()
+		{
+			::WinRTIoCancelAll();
+		}
+
+		static WinRTVFSIoDeadlineStatus GetIoDeadlineStatus()
+		{
+			WinRTIoDeadlineStats stats;
+			::WinRTIoDeadlineStatus(&stats);
+			WinRTVFSIoDeadlineStatus status;
+			status.TimedOut = stats.timeouts;
+			status.Cancelled = stats.cancels;
+			status.SyncRetries = stats.retries;
+			status.RetryWaitTime.Duration = stats.retryMicro * 10;
+			status.SyncFailures = stats.exhausted;
+			return status;
+		}
+
+		/// <summary>Reads the start of a database into the VFS block cache in the background, with large sequential reads, so that the first queries after launch run from memory.</summary>
+		/// <param name="path">The path the database will be opened with.</param>
+		/// <param name="maxBytes">How much of the file to read; the whole file if smaller. Capped at the size of the cache.</param>
+		/// <returns>False if the file could not be read.</returns>
+		static Windows::Foundation::IAsyncOperation<bool>^ PrewarmAsync(Platform::String^ path, uint64 maxBytes)
+		{
+			// SQLite hands the VFS UTF-8 paths; the cache is keyed by what it will see.
+			std::string zPath = WinRTToUtf8(path);
+			sqlite_int64 nMax = maxBytes > (uint64)INT64_MAX ? INT64_MAX : (sqlite_int64)maxBytes;
+
+			return concurrency::create_async([zPath, nMax]()
 			{
-				1,                            /* iVersion */
-				sizeof(WinRTFile),             /* szOsFile */
-				MAXPATHNAME,                  /* mxPathname */
-				0,                            /* pNext */
-				"WinRTVFS",                   /* zName */
-				(void*)0,					  /* pAppData */
-				WinRTOpen,                     /* xOpen */
-				WinRTDelete,                   /* xDelete */
-				WinRTAccess,                   /* xAccess */
-				WinRTFullPathname,             /* xFullPathname */
-				WinRTDlOpen,                   /* xDlOpen */
-				WinRTDlError,                  /* xDlError */
-				WinRTDlSym,                    /* xDlSym */
-				WinRTDlClose,                  /* xDlClose */
-				WinRTRandomness,               /* xRandomness */
-				WinRTSleep,                    /* xSleep */
-				WinRTCurrentTime              /* xCurrentTime */
-			};
-			return (::sqlite3_vfs_register(pVFS, makeDefaultVFS) == SQLITE_OK);
+				return ::WinRTVFSPrewarm("WinRTVFS", zPath.c_str(), nMax) == SQLITE_OK;
+			});
 		}
 	};
 }
\ No newline at end of file
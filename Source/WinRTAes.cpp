@@ -0,0 +1,610 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		AES and XTS-AES. XTS works on up to eight blocks at a time: their
+*		tweaks are computed first, then all eight go through the cipher
+*		together, which keeps the pipelined AES instructions busy (one round
+*		has a latency of several cycles but a throughput of one per cycle).
+*		Within a 4 KB page that already gives full throughput, so pages are
+*		not additionally spread over threads.
+*/
+
+#include "pch.h"
+
+#include <string.h>
+#include <mutex>
+
+#include "WinRTAes.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define WINRT_AES_X86 1
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define WINRT_AES_TARGET
+#else
+#include <cpuid.h>
+#define WINRT_AES_TARGET __attribute__((target("aes,sse2")))
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define WINRT_AES_ARM 1
+#if defined(_MSC_VER)
+#include <arm64_neon.h>
+#define WINRT_AES_TARGET
+#else
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#define WINRT_AES_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
+#define AES_BATCH       8		// blocks per pass through the cipher
+
+
+static unsigned char sbox[256], invSbox[256];
+static uint32_t te[4][256], td[4][256];
+static int aesHardware, aesHardwarePresent;
+static std::once_flag aesOnce;
+
+
+static inline uint32_t Rotr8(uint32_t x) { return (x >> 8) | (x << 24); }
+
+static inline uint8_t Mul(uint8_t a, uint8_t b)
+{
+	uint8_t p = 0;
+	while (b)
+	{
+		if (b & 1) p ^= a;
+		a = (uint8_t)((a << 1) ^ ((a & 0x80) ? 0x1b : 0));
+		b >>= 1;
+	}
+	return p;
+}
+
+static inline uint32_t GetU32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void PutU32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8); p[3] = (unsigned char)v;
+}
+
+static int AesDetect()
+{
+#if WINRT_AES_X86
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] >> 25) & 1;
+#else
+	unsigned a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return 0;
+	return (c & bit_AES) != 0;
+#endif
+#elif WINRT_AES_ARM
+#if defined(_MSC_VER) || defined(__ARM_FEATURE_CRYPTO)
+	return 1;
+#elif defined(__linux__)
+	return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+	return 0;
+#endif
+#else
+	return 0;
+#endif
+}
+
+/*
+** Build the S-boxes and T-tables from the field arithmetic, and detect the
+** AES instructions.
+*/
+static void AesInit()
+{
+	// S-box: multiplicative inverse followed by the affine transform
+	uint8_t p = 1, q = 1;
+	do
+	{
+		p = (uint8_t)(p ^ (p << 1) ^ ((p & 0x80) ? 0x1b : 0));		// p *= 3
+		q ^= q << 1; q ^= q << 2; q ^= q << 4;						// q /= 3
+		if (q & 0x80) q ^= 0x09;
+		uint8_t x = (uint8_t)(q ^ (q << 1 | q >> 7) ^ (q << 2 | q >> 6) ^ (q << 3 | q >> 5) ^ (q << 4 | q >> 4));
+		sbox[p] = (uint8_t)(x ^ 0x63);
+	} while (p != 1);
+	sbox[0] = 0x63;
+	for (int i = 0; i < 256; i++)
+		invSbox[sbox[i]] = (unsigned char)i;
+
+	for (int i = 0; i < 256; i++)
+	{
+		uint8_t s = sbox[i], si = invSbox[i];
+		te[0][i] = ((uint32_t)Mul(s, 2) << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | Mul(s, 3);
+		td[0][i] = ((uint32_t)Mul(si, 14) << 24) | ((uint32_t)Mul(si, 9) << 16) |
+			((uint32_t)Mul(si, 13) << 8) | Mul(si, 11);
+		for (int k = 1; k < 4; k++)
+		{
+			te[k][i] = Rotr8(te[k - 1][i]);
+			td[k][i] = Rotr8(td[k - 1][i]);
+		}
+	}
+
+	aesHardwarePresent = AesDetect();
+	aesHardware = aesHardwarePresent;
+}
+
+static int AesSetKey(WinRTAesKey *k, const unsigned char *key, int nKey)
+{
+	static const uint32_t rcon[] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+	int nk = nKey / 4;
+	k->nRounds = nk + 6;
+	int nWords = 4 * (k->nRounds + 1);
+
+	for (int i = 0; i < nk; i++)
+		k->ek[i] = GetU32(key + 4 * i);
+	for (int i = nk; i < nWords; i++)
+	{
+		uint32_t t = k->ek[i - 1];
+		if (i % nk == 0)
+			t = (((uint32_t)sbox[(t >> 16) & 0xff] << 24) | ((uint32_t)sbox[(t >> 8) & 0xff] << 16) |
+				((uint32_t)sbox[t & 0xff] << 8) | sbox[t >> 24]) ^ (rcon[i / nk - 1] << 24);
+		else if (nk > 6 && i % nk == 4)
+			t = ((uint32_t)sbox[t >> 24] << 24) | ((uint32_t)sbox[(t >> 16) & 0xff] << 16) |
+				((uint32_t)sbox[(t >> 8) & 0xff] << 8) | sbox[t & 0xff];
+		k->ek[i] = k->ek[i - nk] ^ t;
+	}
+
+	// Decryption keys: reverse round order, InvMixColumns on the inner rounds.
+	for (int r = 0; r <= k->nRounds; r++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			uint32_t w = k->ek[4 * (k->nRounds - r) + c];
+			if (r > 0 && r < k->nRounds)
+				w = td[0][sbox[w >> 24]] ^ td[1][sbox[(w >> 16) & 0xff]] ^
+					td[2][sbox[(w >> 8) & 0xff]] ^ td[3][sbox[w & 0xff]];
+			k->dk[4 * r + c] = w;
+		}
+	}
+	for (int i = 0; i < nWords; i++)
+	{
+		PutU32(k->ekBytes + 4 * i, k->ek[i]);
+		PutU32(k->dkBytes + 4 * i, k->dk[i]);
+	}
+	return 0;
+}
+
+
+/*
+** Table-driven cipher on nBlocks consecutive 16-byte blocks, in place.
+*/
+static void SoftEncrypt(const WinRTAesKey *k, unsigned char *buf, int nBlocks)
+{
+	for (int b = 0; b < nBlocks; b++, buf += 16)
+	{
+		const uint32_t *rk = k->ek;
+		uint32_t s0 = GetU32(buf) ^ rk[0], s1 = GetU32(buf + 4) ^ rk[1];
+		uint32_t s2 = GetU32(buf + 8) ^ rk[2], s3 = GetU32(buf + 12) ^ rk[3];
+		for (int r = 1; r < k->nRounds; r++)
+		{
+			rk += 4;
+			uint32_t t0 = te[0][s0 >> 24] ^ te[1][(s1 >> 16) & 0xff] ^ te[2][(s2 >> 8) & 0xff] ^ te[3][s3 & 0xff] ^ rk[0];
+			uint32_t t1 = te[0][s1 >> 24] ^ te[1][(s2 >> 16) & 0xff] ^ te[2][(s3 >> 8) & 0xff] ^ te[3][s0 & 0xff] ^ rk[1];
+			uint32_t t2 = te[0][s2 >> 24] ^ te[1][(s3 >> 16) & 0xff] ^ te[2][(s0 >> 8) & 0xff] ^ te[3][s1 & 0xff] ^ rk[2];
+			uint32_t t3 = te[0][s3 >> 24] ^ te[1][(s0 >> 16) & 0xff] ^ te[2][(s1 >> 8) & 0xff] ^ te[3][s2 & 0xff] ^ rk[3];
+			s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+		}
+		rk += 4;
+		PutU32(buf, (((uint32_t)sbox[s0 >> 24] << 24) | ((uint32_t)sbox[(s1 >> 16) & 0xff] << 16) |
+			((uint32_t)sbox[(s2 >> 8) & 0xff] << 8) | sbox[s3 & 0xff]) ^ rk[0]);
+		PutU32(buf + 4, (((uint32_t)sbox[s1 >> 24] << 24) | ((uint32_t)sbox[(s2 >> 16) & 0xff] << 16) |
+			((uint32_t)sbox[(s3 >> 8) & 0xff] << 8) | sbox[s0 & 0xff]) ^ rk[1]);
+		PutU32(buf + 8, (((uint32_t)sbox[s2 >> 24] << 24) | ((uint32_t)sbox[(s3 >> 16) & 0xff] << 16) |
+			((uint32_t)sbox[(s0 >> 8) & 0xff] << 8) | sbox[s1 & 0xff]) ^ rk[2]);
+		PutU32(buf + 12, (((uint32_t)sbox[s3 >> 24] << 24) | ((uint32_t)sbox[(s0 >> 16) & 0xff] << 16) |
+			((uint32_t)sbox[(s1 >> 8) & 0xff] << 8) | sbox[s2 & 0xff]) ^ rk[3]);
+	}
+}
+
+static void SoftDecrypt(const WinRTAesKey *k, unsigned char *buf, int nBlocks)
+{
+	for (int b = 0; b < nBlocks; b++, buf += 16)
+	{
+		const uint32_t *rk = k->dk;
+		uint32_t s0 = GetU32(buf) ^ rk[0], s1 = GetU32(buf + 4) ^ rk[1];
+		uint32_t s2 = GetU32(buf + 8) ^ rk[2], s3 = GetU32(buf + 12) ^ rk[3];
+		for (int r = 1; r < k->nRounds; r++)
+		{
+			rk += 4;
+			uint32_t t0 = td[0][s0 >> 24] ^ td[1][(s3 >> 16) & 0xff] ^ td[2][(s2 >> 8) & 0xff] ^ td[3][s1 & 0xff] ^ rk[0];
+			uint32_t t1 = td[0][s1 >> 24] ^ td[1][(s0 >> 16) & 0xff] ^ td[2][(s3 >> 8) & 0xff] ^ td[3][s2 & 0xff] ^ rk[1];
+			uint32_t t2 = td[0][s2 >> 24] ^ td[1][(s1 >> 16) & 0xff] ^ td[2][(s0 >> 8) & 0xff] ^ td[3][s3 & 0xff] ^ rk[2];
+			uint32_t t3 = td[0][s3 >> 24] ^ td[1][(s2 >> 16) & 0xff] ^ td[2][(s1 >> 8) & 0xff] ^ td[3][s0 & 0xff] ^ rk[3];
+			s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+		}
+		rk += 4;
+		PutU32(buf, (((uint32_t)invSbox[s0 >> 24] << 24) | ((uint32_t)invSbox[(s3 >> 16) & 0xff] << 16) |
+			((uint32_t)invSbox[(s2 >> 8) & 0xff] << 8) | invSbox[s1 & 0xff]) ^ rk[0]);
+		PutU32(buf + 4, (((uint32_t)invSbox[s1 >> 24] << 24) | ((uint32_t)invSbox[(s0 >> 16) & 0xff] << 16) |
+			((uint32_t)invSbox[(s3 >> 8) & 0xff] << 8) | invSbox[s2 & 0xff]) ^ rk[1]);
+		PutU32(buf + 8, (((uint32_t)invSbox[s2 >> 24] << 24) | ((uint32_t)invSbox[(s1 >> 16) & 0xff] << 16) |
+			((uint32_t)invSbox[(s0 >> 8) & 0xff] << 8) | invSbox[s3 & 0xff]) ^ rk[2]);
+		PutU32(buf + 12, (((uint32_t)invSbox[s3 >> 24] << 24) | ((uint32_t)invSbox[(s2 >> 16) & 0xff] << 16) |
+			((uint32_t)invSbox[(s1 >> 8) & 0xff] << 8) | invSbox[s0 & 0xff]) ^ rk[3]);
+	}
+}
+
+
+#if WINRT_AES_X86
+
+WINRT_AES_TARGET
+static void HardEncrypt(const WinRTAesKey *k, unsigned char *buf, int nBlocks)
+{
+	__m128i rk[15];
+	for (int r = 0; r <= k->nRounds; r++)
+		rk[r] = _mm_loadu_si128((const __m128i*)(k->ekBytes + 16 * r));
+
+	__m128i x[AES_BATCH];
+	for (int i = 0; i < nBlocks; i++)
+		x[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + 16 * i)), rk[0]);
+	for (int r = 1; r < k->nRounds; r++)
+		for (int i = 0; i < nBlocks; i++)
+			x[i] = _mm_aesenc_si128(x[i], rk[r]);
+	for (int i = 0; i < nBlocks; i++)
+		_mm_storeu_si128((__m128i*)(buf + 16 * i), _mm_aesenclast_si128(x[i], rk[k->nRounds]));
+}
+
+WINRT_AES_TARGET
+static void HardDecrypt(const WinRTAesKey *k, unsigned char *buf, int nBlocks)
+{
+	__m128i rk[15];
+	for (int r = 0; r <= k->nRounds; r++)
+		rk[r] = _mm_loadu_si128((const __m128i*)(k->dkBytes + 16 * r));
+
+	__m128i x[AES_BATCH];
+	for (int i = 0; i < nBlocks; i++)
+		x[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(buf + 16 * i)), rk[0]);
+	for (int r = 1; r < k->nRounds; r++)
+		for (int i = 0; i < nBlocks; i++)
+			x[i] = _mm_aesdec_si128(x[i], rk[r]);
+	for (int i = 0; i < nBlocks; i++)
+		_mm_storeu_si128((__m128i*)(buf + 16 * i), _mm_aesdeclast_si128(x[i], rk[k->nRounds]));
+}
+
+/*
+** Multiply a tweak by x in GF(2^128): each dword shifts left by one and
+** takes the top bit of the dword below it, the top bit of the whole
+** value folding back into the low byte as 0x87.
+*/
+WINRT_AES_TARGET
+static inline __m128i HardNextTweak(__m128i t)
+{
+	__m128i carry = _mm_shuffle_epi32(_mm_srai_epi32(t, 31), 0x93);
+	carry = _mm_and_si128(carry, _mm_set_epi32(1, 1, 1, 0x87));
+	return _mm_xor_si128(_mm_add_epi32(t, t), carry);
+}
+
+/*
+** XTS over whole blocks with the tweaks kept in registers, eight blocks
+** at a time. t is advanced past the blocks.
+*/
+WINRT_AES_TARGET
+static void HardXtsBlocks(const WinRTAesKey *k, bool encrypt, uint64_t t[2],
+	const unsigned char *in, unsigned char *out, size_t nBlocks)
+{
+	const unsigned char *keys = encrypt ? k->ekBytes : k->dkBytes;
+	__m128i rk[15];
+	for (int r = 0; r <= k->nRounds; r++)
+		rk[r] = _mm_loadu_si128((const __m128i*)(keys + 16 * r));
+	__m128i tweak = _mm_loadu_si128((const __m128i*)t);
+
+	for (; nBlocks >= AES_BATCH; nBlocks -= AES_BATCH, in += 16 * AES_BATCH, out += 16 * AES_BATCH)
+	{
+		// Spelled out so the eight blocks stay in registers and interleave.
+		__m128i tw[AES_BATCH];
+		for (int i = 0; i < AES_BATCH; i++)
+		{
+			tw[i] = tweak;
+			tweak = HardNextTweak(tweak);
+		}
+#define XTS_IN(i) _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 16 * i)), tw[i]), rk[0])
+		__m128i x0 = XTS_IN(0), x1 = XTS_IN(1), x2 = XTS_IN(2), x3 = XTS_IN(3);
+		__m128i x4 = XTS_IN(4), x5 = XTS_IN(5), x6 = XTS_IN(6), x7 = XTS_IN(7);
+#undef XTS_IN
+#define XTS_ROUND(op, key) \
+		x0 = op(x0, key); x1 = op(x1, key); x2 = op(x2, key); x3 = op(x3, key); \
+		x4 = op(x4, key); x5 = op(x5, key); x6 = op(x6, key); x7 = op(x7, key)
+		if (encrypt)
+		{
+			for (int r = 1; r < k->nRounds; r++)
+			{
+				XTS_ROUND(_mm_aesenc_si128, rk[r]);
+			}
+			XTS_ROUND(_mm_aesenclast_si128, rk[k->nRounds]);
+		}
+		else
+		{
+			for (int r = 1; r < k->nRounds; r++)
+			{
+				XTS_ROUND(_mm_aesdec_si128, rk[r]);
+			}
+			XTS_ROUND(_mm_aesdeclast_si128, rk[k->nRounds]);
+		}
+#undef XTS_ROUND
+#define XTS_OUT(i, x) _mm_storeu_si128((__m128i*)(out + 16 * i), _mm_xor_si128(x, tw[i]))
+		XTS_OUT(0, x0); XTS_OUT(1, x1); XTS_OUT(2, x2); XTS_OUT(3, x3);
+		XTS_OUT(4, x4); XTS_OUT(5, x5); XTS_OUT(6, x6); XTS_OUT(7, x7);
+#undef XTS_OUT
+	}
+
+	for (; nBlocks > 0; nBlocks--, in += 16, out += 16)
+	{
+		__m128i x = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128((const __m128i*)in), tweak), rk[0]);
+		for (int r = 1; r < k->nRounds; r++)
+			x = encrypt ? _mm_aesenc_si128(x, rk[r]) : _mm_aesdec_si128(x, rk[r]);
+		x = encrypt ? _mm_aesenclast_si128(x, rk[k->nRounds]) : _mm_aesdeclast_si128(x, rk[k->nRounds]);
+		_mm_storeu_si128((__m128i*)out, _mm_xor_si128(x, tweak));
+		tweak = HardNextTweak(tweak);
+	}
+	_mm_storeu_si128((__m128i*)t, tweak);
+}
+
+#elif WINRT_AES_ARM
+
+WINRT_AES_TARGET
+static void HardEncrypt(const WinRTAesKey *k, unsigned char *buf, int nBlocks)
+{
+	uint8x16_t rk[15];
+	for (int r = 0; r <= k->nRounds; r++)
+		rk[r] = vld1q_u8(k->ekBytes + 16 * r);
+
+	uint8x16_t x[AES_BATCH];
+	for (int i = 0; i < nBlocks; i++)
+		x[i] = vld1q_u8(buf + 16 * i);
+	for (int r = 0; r < k->nRounds - 1; r++)
+		for (int i = 0; i < nBlocks; i++)
+			x[i] = vaesmcq_u8(vaeseq_u8(x[i], rk[r]));
+	for (int i = 0; i < nBlocks; i++)
+		vst1q_u8(buf + 16 * i, veorq_u8(vaeseq_u8(x[i], rk[k->nRounds - 1]), rk[k->nRounds]));
+}
+
+WINRT_AES_TARGET
+static void HardDecrypt(const WinRTAesKey *k, unsigned char *buf, int nBlocks)
+{
+	uint8x16_t rk[15];
+	for (int r = 0; r <= k->nRounds; r++)
+		rk[r] = vld1q_u8(k->dkBytes + 16 * r);
+
+	uint8x16_t x[AES_BATCH];
+	for (int i = 0; i < nBlocks; i++)
+		x[i] = vld1q_u8(buf + 16 * i);
+	for (int r = 0; r < k->nRounds - 1; r++)
+		for (int i = 0; i < nBlocks; i++)
+			x[i] = vaesimcq_u8(vaesdq_u8(x[i], rk[r]));
+	for (int i = 0; i < nBlocks; i++)
+		vst1q_u8(buf + 16 * i, veorq_u8(vaesdq_u8(x[i], rk[k->nRounds - 1]), rk[k->nRounds]));
+}
+
+#endif
+
+static void Encrypt(const WinRTAesKey *k, unsigned char *buf, int nBlocks)
+{
+#if WINRT_AES_X86 || WINRT_AES_ARM
+	if (aesHardware)
+	{
+		HardEncrypt(k, buf, nBlocks);
+		return;
+	}
+#endif
+	SoftEncrypt(k, buf, nBlocks);
+}
+
+static void Decrypt(const WinRTAesKey *k, unsigned char *buf, int nBlocks)
+{
+#if WINRT_AES_X86 || WINRT_AES_ARM
+	if (aesHardware)
+	{
+		HardDecrypt(k, buf, nBlocks);
+		return;
+	}
+#endif
+	SoftDecrypt(k, buf, nBlocks);
+}
+
+
+/*
+** Multiply a tweak by x in GF(2^128), little-endian as XTS defines it.
+*/
+static inline void NextTweak(uint64_t t[2])
+{
+	uint64_t carry = t[1] >> 63;
+	t[1] = (t[1] << 1) | (t[0] >> 63);
+	t[0] = (t[0] << 1) ^ (carry * 0x87);
+}
+
+static inline void Xor16(unsigned char *dst, const unsigned char *a, const uint64_t t[2])
+{
+	uint64_t v[2];
+	::memcpy(v, a, 16);
+	v[0] ^= t[0];
+	v[1] ^= t[1];
+	::memcpy(dst, v, 16);
+}
+
+/*
+** XTS over nBlocks whole blocks starting with tweak t, which is advanced
+** past them.
+*/
+static void XtsBlocks(const WinRTAesKey *k, bool encrypt, uint64_t t[2],
+	const unsigned char *in, unsigned char *out, size_t nBlocks)
+{
+#if WINRT_AES_X86
+	if (aesHardware)
+	{
+		HardXtsBlocks(k, encrypt, t, in, out, nBlocks);
+		return;
+	}
+#endif
+	unsigned char buf[16 * AES_BATCH];
+	uint64_t tweaks[AES_BATCH][2];
+	while (nBlocks > 0)
+	{
+		int n = nBlocks < AES_BATCH ? (int)nBlocks : AES_BATCH;
+		for (int i = 0; i < n; i++)
+		{
+			tweaks[i][0] = t[0];
+			tweaks[i][1] = t[1];
+			Xor16(buf + 16 * i, in + 16 * i, t);
+			NextTweak(t);
+		}
+		if (encrypt)
+			Encrypt(k, buf, n);
+		else
+			Decrypt(k, buf, n);
+		for (int i = 0; i < n; i++)
+			Xor16(out + 16 * i, buf + 16 * i, tweaks[i]);
+		in += 16 * n;
+		out += 16 * n;
+		nBlocks -= n;
+	}
+}
+
+/*
+** One data unit of n bytes, given its encrypted tweak t0.
+*/
+static void XtsUnit(const WinRTXtsKey *pKey, bool encrypt, const unsigned char *t0,
+	const unsigned char *in, unsigned char *out, size_t n)
+{
+	uint64_t t[2];
+	::memcpy(t, t0, 16);
+
+	if (n < 16)
+	{
+		// A file tail shorter than a block: XOR with E(K1, T).
+		unsigned char pad[16];
+		::memcpy(pad, t0, 16);
+		Encrypt(&pKey->data, pad, 1);
+		for (size_t i = 0; i < n; i++)
+			out[i] = in[i] ^ pad[i];
+		return;
+	}
+
+	size_t tail = n % 16;
+	size_t nBlocks = n / 16 - (tail ? 1 : 0);
+	XtsBlocks(&pKey->data, encrypt, t, in, out, nBlocks);
+	if (tail == 0)
+		return;
+
+	// Ciphertext stealing for the last full block and the partial one.
+	in += 16 * nBlocks;
+	out += 16 * nBlocks;
+	unsigned char last[16], stolen[16];
+	uint64_t tNext[2] = { t[0], t[1] };
+	NextTweak(tNext);
+	if (encrypt)
+	{
+		XtsBlocks(&pKey->data, true, t, in, last, 1);
+		::memcpy(stolen, in + 16, tail);
+		::memcpy(stolen + tail, last + tail, 16 - tail);
+		::memcpy(out + 16, last, tail);
+		XtsBlocks(&pKey->data, true, tNext, stolen, out, 1);
+	}
+	else
+	{
+		XtsBlocks(&pKey->data, false, tNext, in, last, 1);
+		::memcpy(stolen, in + 16, tail);
+		::memcpy(stolen + tail, last + tail, 16 - tail);
+		::memcpy(out + 16, last, tail);
+		XtsBlocks(&pKey->data, false, t, stolen, out, 1);
+	}
+}
+
+/*
+** Consecutive data units of unitSize bytes from unit number first; the
+** last may be shorter. The tweaks of up to eight units are encrypted in
+** one pass so their latency overlaps.
+*/
+static void Xts(const WinRTXtsKey *pKey, bool encrypt, uint64_t first, size_t unitSize,
+	const void *pIn, void *pOut, size_t n)
+{
+	const unsigned char *in = (const unsigned char*)pIn;
+	unsigned char *out = (unsigned char*)pOut;
+
+	unsigned char tweaks[16 * AES_BATCH];
+	while (n > 0)
+	{
+		size_t nUnits = (n + unitSize - 1) / unitSize;
+		int batch = nUnits < AES_BATCH ? (int)nUnits : AES_BATCH;
+		::memset(tweaks, 0, sizeof(tweaks));
+		for (int i = 0; i < batch; i++)
+			for (int b = 0; b < 8; b++)
+				tweaks[16 * i + b] = (unsigned char)((first + i) >> (8 * b));
+		Encrypt(&pKey->tweak, tweaks, batch);
+
+		for (int i = 0; i < batch; i++)
+		{
+			size_t len = n < unitSize ? n : unitSize;
+			XtsUnit(pKey, encrypt, tweaks + 16 * i, in, out, len);
+			in += len;
+			out += len;
+			n -= len;
+		}
+		first += batch;
+	}
+}
+
+int WinRTXtsSetKey(WinRTXtsKey *pKey, const void *pRaw, int nRaw)
+{
+	std::call_once(aesOnce, AesInit);
+	const unsigned char *raw = (const unsigned char*)pRaw;
+	if ((nRaw != 32 && nRaw != 64) || ::memcmp(raw, raw + nRaw / 2, nRaw / 2) == 0)
+		return -1;
+	AesSetKey(&pKey->data, raw, nRaw / 2);
+	AesSetKey(&pKey->tweak, raw + nRaw / 2, nRaw / 2);
+	return 0;
+}
+
+void WinRTXtsEncrypt(const WinRTXtsKey *pKey, uint64_t unit, const void *in, void *out, size_t n)
+{
+	Xts(pKey, true, unit, n ? n : 1, in, out, n);
+}
+
+void WinRTXtsDecrypt(const WinRTXtsKey *pKey, uint64_t unit, const void *in, void *out, size_t n)
+{
+	Xts(pKey, false, unit, n ? n : 1, in, out, n);
+}
+
+void WinRTXtsEncryptUnits(const WinRTXtsKey *pKey, uint64_t first, size_t unitSize, const void *in, void *out, size_t n)
+{
+	Xts(pKey, true, first, unitSize, in, out, n);
+}
+
+void WinRTXtsDecryptUnits(const WinRTXtsKey *pKey, uint64_t first, size_t unitSize, const void *in, void *out, size_t n)
+{
+	Xts(pKey, false, first, unitSize, in, out, n);
+}
+
+int WinRTAesHardware()
+{
+	std::call_once(aesOnce, AesInit);
+	return aesHardware;
+}
+
+int WinRTAesSetHardware(int enable)
+{
+	std::call_once(aesOnce, AesInit);
+	int previous = aesHardware;
+	aesHardware = enable && aesHardwarePresent;
+	return previous;
+}
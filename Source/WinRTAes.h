@@ -0,0 +1,70 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** Expanded AES-128 or AES-256 key: encryption round keys and the
+** "equivalent inverse cipher" decryption round keys, as words for the
+** table-driven code and as bytes for the AES instructions.
+*/
+typedef struct WinRTAesKey
+{
+	int nRounds;
+	uint32_t ek[60];
+	uint32_t dk[60];
+	unsigned char ekBytes[240];
+	unsigned char dkBytes[240];
+} WinRTAesKey;
+
+/*
+** XTS-AES (IEEE 1619) key: the data key and the tweak key.
+*/
+typedef struct WinRTXtsKey
+{
+	WinRTAesKey data;
+	WinRTAesKey tweak;
+} WinRTXtsKey;
+
+/*
+** Expand a 32-byte (XTS-AES-128) or 64-byte (XTS-AES-256) key. Returns 0,
+** or -1 for any other length or two equal halves.
+*/
+int WinRTXtsSetKey(WinRTXtsKey *pKey, const void *pRaw, int nRaw);
+
+/*
+** Encrypt or decrypt one data unit of n bytes in place or from in to out.
+** unit is the data unit number the tweak is derived from. Units of 16 bytes
+** or more use ciphertext stealing for a partial last block; shorter units
+** (only ever the tail of a file) are XORed with the encrypted tweak.
+**
+** The AES-NI or ARMv8 Crypto Extension instructions are used when the CPU
+** has them, with eight blocks in flight; otherwise T-tables.
+*/
+void WinRTXtsEncrypt(const WinRTXtsKey *pKey, uint64_t unit, const void *in, void *out, size_t n);
+void WinRTXtsDecrypt(const WinRTXtsKey *pKey, uint64_t unit, const void *in, void *out, size_t n);
+
+/*
+** Encrypt or decrypt n bytes made of consecutive data units of unitSize
+** bytes, numbered from first; the last unit may be shorter. Same result
+** as one call per unit, but the tweaks are computed eight at a time.
+*/
+void WinRTXtsEncryptUnits(const WinRTXtsKey *pKey, uint64_t first, size_t unitSize, const void *in, void *out, size_t n);
+void WinRTXtsDecryptUnits(const WinRTXtsKey *pKey, uint64_t first, size_t unitSize, const void *in, void *out, size_t n);
+
+/*
+** Whether the AES instructions are in use. WinRTAesSetHardware turns them
+** off (0) or back on (1, only if present), for benchmarking, and returns
+** the previous setting.
+*/
+int WinRTAesHardware();
+int WinRTAesSetHardware(int enable);
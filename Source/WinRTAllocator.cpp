@@ -0,0 +1,502 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Thread-caching allocator for SQLite (sqlite3_mem_methods).
+*
+*		Small requests are rounded up to one of 40 size classes: multiples of
+*		16 bytes to 128, then four classes per power of two to
+*		WINRT_ALLOC_MAX_SMALL. Every block starts with an 8-byte header giving
+*		its class and the size asked for, so xFree and xSize need no lookup.
+*
+*		Each thread has a free list per class in thread-local storage, used
+*		with no locks or atomics. A thread whose list runs dry takes a batch
+*		from the class's shared list, under that class's mutex, and the shared
+*		list is topped up by carving a new span from the system heap. A block
+*		is freed onto the list of the thread freeing it; once that list holds
+*		more than WINRT_ALLOC_THREAD_BYTES, half of it goes back to the shared
+*		list, so memory freed by one thread is reused by others. A thread's
+*		lists are handed back when it exits.
+*
+*		Larger requests go to the system heap with the same header.
+*/
+
+#include "pch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if SQLITE_OS_WINRT
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "WinRTAllocator.h"
+
+#if defined(_MSC_VER)
+#define WINRT_THREAD __declspec(thread)
+#else
+#define WINRT_THREAD __thread
+#endif
+
+#define WINRT_ALLOC_CLASSES     40
+#define WINRT_ALLOC_LARGE       0xFFFFFFFFu
+#define WINRT_ALLOC_ROUND8(n)   (((n) + 7) & ~7)
+
+struct WinRTBlockHeader
+{
+	unsigned cls;               // size class, or WINRT_ALLOC_LARGE
+	unsigned requested;         // bytes asked for
+};
+
+struct WinRTFreeBlock
+{
+	WinRTFreeBlock *next;
+};
+
+struct WinRTThreadCache
+{
+	WinRTFreeBlock *free[WINRT_ALLOC_CLASSES];
+	int count[WINRT_ALLOC_CLASSES];
+
+	// Changes not yet folded into the totals
+	sqlite_int64 requested;
+	sqlite_int64 allocated;
+	sqlite_int64 mallocs;
+	sqlite_int64 frees;
+};
+
+struct WinRTSharedList
+{
+	std::mutex mutex;
+	WinRTFreeBlock *free;
+	int count;
+};
+
+static unsigned classBytes[WINRT_ALLOC_CLASSES];
+static int classLimit[WINRT_ALLOC_CLASSES];     // free blocks a thread keeps
+static WinRTSharedList shared[WINRT_ALLOC_CLASSES];
+
+static std::atomic<sqlite_int64> totalRequested;
+static std::atomic<sqlite_int64> totalAllocated;
+static std::atomic<sqlite_int64> highwater;
+static std::atomic<sqlite_int64> footprint;
+static std::atomic<sqlite_int64> footprintHighwater;
+static std::atomic<sqlite_int64> totalMallocs;
+static std::atomic<sqlite_int64> totalFrees;
+static std::atomic<sqlite_int64> totalSpans;
+
+static WINRT_THREAD WinRTThreadCache *threadCache;
+#if SQLITE_OS_WINRT
+static DWORD exitIndex = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t exitKey;
+#endif
+
+static unsigned HighBit(unsigned x)
+{
+#if defined(_MSC_VER)
+	unsigned long i;
+	_BitScanReverse(&i, x);
+	return (unsigned)i;
+#else
+	return 31 - (unsigned)__builtin_clz(x);
+#endif
+}
+
+static int ClassOf(int n)
+{
+	if (n <= 128)
+		return n <= 16 ? 0 : (n - 1) >> 4;
+	unsigned p = HighBit((unsigned)n - 1);
+	return 8 + (int)(p - 7) * 4 + (int)((((unsigned)n - 1) - (1u << p)) >> (p - 2));
+}
+
+static void Raise(std::atomic<sqlite_int64> *pMax, sqlite_int64 value)
+{
+	sqlite_int64 seen = pMax->load(std::memory_order_relaxed);
+	while (value > seen && !pMax->compare_exchange_weak(seen, value, std::memory_order_relaxed))
+		;
+}
+
+static void Fold(WinRTThreadCache *tc)
+{
+	totalRequested.fetch_add(tc->requested, std::memory_order_relaxed);
+	Raise(&highwater, totalAllocated.fetch_add(tc->allocated, std::memory_order_relaxed) + tc->allocated);
+	totalMallocs.fetch_add(tc->mallocs, std::memory_order_relaxed);
+	totalFrees.fetch_add(tc->frees, std::memory_order_relaxed);
+	tc->requested = tc->allocated = tc->mallocs = tc->frees = 0;
+}
+
+static void Account(WinRTThreadCache *tc, sqlite_int64 requested, sqlite_int64 allocated)
+{
+	tc->requested += requested;
+	tc->allocated += allocated;
+	if (allocated > 0)
+		tc->mallocs++;
+	else
+		tc->frees++;
+	if (tc->allocated >= WINRT_ALLOC_STATS_SLACK || tc->allocated <= -WINRT_ALLOC_STATS_SLACK)
+		Fold(tc);
+}
+
+static void GrowFootprint(sqlite_int64 bytes)
+{
+	Raise(&footprintHighwater, footprint.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+/*
+** Thread caches
+*/
+
+static void ReleaseThreadCache(void *pCache)
+{
+	WinRTThreadCache *tc = (WinRTThreadCache*)pCache;
+	for (int c = 0; c < WINRT_ALLOC_CLASSES; c++)
+	{
+		while (tc->free[c] != nullptr)
+		{
+			WinRTFreeBlock *block = tc->free[c];
+			tc->free[c] = block->next;
+			std::lock_guard<std::mutex> lock(shared[c].mutex);
+			block->next = shared[c].free;
+			shared[c].free = block;
+			shared[c].count++;
+		}
+	}
+	Fold(tc);
+	if (threadCache == tc)
+		threadCache = nullptr;
+	::free(tc);
+}
+
+#if SQLITE_OS_WINRT
+static void WINAPI ThreadExit(void *pCache)
+{
+	if (pCache != nullptr)
+		ReleaseThreadCache(pCache);
+}
+#endif
+
+static WinRTThreadCache *ThreadCache()
+{
+	WinRTThreadCache *tc = threadCache;
+	if (tc != nullptr)
+		return tc;
+	tc = (WinRTThreadCache*)::calloc(1, sizeof(WinRTThreadCache));
+	if (tc == nullptr)
+		return nullptr;
+#if SQLITE_OS_WINRT
+	::FlsSetValue(exitIndex, tc);
+#else
+	::pthread_setspecific(exitKey, tc);
+#endif
+	threadCache = tc;
+	return tc;
+}
+
+/*
+** Take a batch for tc's list of class c from the shared list, carving a
+** new span if that is empty. Returns false if the heap is exhausted.
+*/
+static bool Refill(WinRTThreadCache *tc, int c)
+{
+	int batch = classLimit[c] / 2;
+	{
+		std::lock_guard<std::mutex> lock(shared[c].mutex);
+		while (shared[c].free != nullptr && tc->count[c] < batch)
+		{
+			WinRTFreeBlock *block = shared[c].free;
+			shared[c].free = block->next;
+			shared[c].count--;
+			block->next = tc->free[c];
+			tc->free[c] = block;
+			tc->count[c]++;
+		}
+	}
+	if (tc->free[c] != nullptr)
+		return true;
+
+	size_t stride = sizeof(WinRTBlockHeader) + classBytes[c];
+	size_t n = WINRT_ALLOC_SPAN_BYTES / stride;
+	if (n < 4)
+		n = 4;
+	char *span = (char*)::malloc(stride * n);
+	if (span == nullptr)
+		return false;
+	GrowFootprint((sqlite_int64)(stride * n));
+	totalSpans.fetch_add(1, std::memory_order_relaxed);
+
+	// Keep a batch and share the rest.
+	WinRTFreeBlock *rest = nullptr;
+	int nRest = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		WinRTBlockHeader *header = (WinRTBlockHeader*)(span + stride * i);
+		header->cls = (unsigned)c;
+		header->requested = 0;
+		WinRTFreeBlock *block = (WinRTFreeBlock*)(header + 1);
+		if (tc->count[c] < batch || tc->count[c] == 0)
+		{
+			block->next = tc->free[c];
+			tc->free[c] = block;
+			tc->count[c]++;
+		}
+		else
+		{
+			block->next = rest;
+			rest = block;
+			nRest++;
+		}
+	}
+	if (rest != nullptr)
+	{
+		WinRTFreeBlock *last = rest;
+		while (last->next != nullptr)
+			last = last->next;
+		std::lock_guard<std::mutex> lock(shared[c].mutex);
+		last->next = shared[c].free;
+		shared[c].free = rest;
+		shared[c].count += nRest;
+	}
+	return true;
+}
+
+/*
+** Give half of tc's list of class c back to the shared list.
+*/
+static void Spill(WinRTThreadCache *tc, int c)
+{
+	int keep = classLimit[c] / 2;
+	WinRTFreeBlock *first = tc->free[c];
+	WinRTFreeBlock *last = first;
+	for (int i = 1; i < tc->count[c] - keep; i++)
+		last = last->next;
+	tc->free[c] = last->next;
+	int n = tc->count[c] - keep;
+	tc->count[c] = keep;
+
+	std::lock_guard<std::mutex> lock(shared[c].mutex);
+	last->next = shared[c].free;
+	shared[c].free = first;
+	shared[c].count += n;
+}
+
+/*
+** sqlite3_mem_methods
+*/
+
+static void *LargeMalloc(int n)
+{
+	WinRTBlockHeader *header = (WinRTBlockHeader*)::malloc(sizeof(WinRTBlockHeader) + n);
+	if (header == nullptr)
+		return nullptr;
+	header->cls = WINRT_ALLOC_LARGE;
+	header->requested = (unsigned)n;
+	GrowFootprint(sizeof(WinRTBlockHeader) + n);
+	totalRequested.fetch_add(n, std::memory_order_relaxed);
+	Raise(&highwater, totalAllocated.fetch_add(n, std::memory_order_relaxed) + n);
+	totalMallocs.fetch_add(1, std::memory_order_relaxed);
+	return header + 1;
+}
+
+static void LargeFree(WinRTBlockHeader *header)
+{
+	sqlite_int64 n = header->requested;
+	footprint.fetch_sub(sizeof(WinRTBlockHeader) + n, std::memory_order_relaxed);
+	totalRequested.fetch_sub(n, std::memory_order_relaxed);
+	totalAllocated.fetch_sub(n, std::memory_order_relaxed);
+	totalFrees.fetch_add(1, std::memory_order_relaxed);
+	::free(header);
+}
+
+static void *WinRTMemMalloc(int n)
+{
+	if (n > WINRT_ALLOC_MAX_SMALL)
+		return LargeMalloc(n);
+	if (n < 0)
+		return nullptr;
+
+	int c = ClassOf(n);
+	WinRTThreadCache *tc = ThreadCache();
+	if (tc == nullptr || (tc->free[c] == nullptr && !Refill(tc, c)))
+		return nullptr;
+	WinRTFreeBlock *block = tc->free[c];
+	tc->free[c] = block->next;
+	tc->count[c]--;
+	((WinRTBlockHeader*)block - 1)->requested = (unsigned)n;
+	Account(tc, n, classBytes[c]);
+	return block;
+}
+
+static void WinRTMemFree(void *p)
+{
+	if (p == nullptr)
+		return;
+	WinRTBlockHeader *header = (WinRTBlockHeader*)p - 1;
+	if (header->cls == WINRT_ALLOC_LARGE)
+	{
+		LargeFree(header);
+		return;
+	}
+
+	int c = (int)header->cls;
+	WinRTThreadCache *tc = ThreadCache();
+	if (tc == nullptr)
+	{
+		// No cache to put it on: share it directly.
+		totalRequested.fetch_sub(header->requested, std::memory_order_relaxed);
+		totalAllocated.fetch_sub(classBytes[c], std::memory_order_relaxed);
+		totalFrees.fetch_add(1, std::memory_order_relaxed);
+		std::lock_guard<std::mutex> lock(shared[c].mutex);
+		((WinRTFreeBlock*)p)->next = shared[c].free;
+		shared[c].free = (WinRTFreeBlock*)p;
+		shared[c].count++;
+		return;
+	}
+	Account(tc, -(sqlite_int64)header->requested, -(sqlite_int64)classBytes[c]);
+	WinRTFreeBlock *block = (WinRTFreeBlock*)p;
+	block->next = tc->free[c];
+	tc->free[c] = block;
+	if (++tc->count[c] > classLimit[c])
+		Spill(tc, c);
+}
+
+static int WinRTMemSize(void *p)
+{
+	if (p == nullptr)
+		return 0;
+	WinRTBlockHeader *header = (WinRTBlockHeader*)p - 1;
+	return header->cls == WINRT_ALLOC_LARGE ? (int)header->requested : (int)classBytes[header->cls];
+}
+
+static void *WinRTMemRealloc(void *p, int n)
+{
+	if (p == nullptr)
+		return WinRTMemMalloc(n);
+	WinRTBlockHeader *header = (WinRTBlockHeader*)p - 1;
+	if (header->cls != WINRT_ALLOC_LARGE && n <= (int)classBytes[header->cls] && n > (int)classBytes[header->cls] / 2)
+	{
+		WinRTThreadCache *tc = ThreadCache();
+		if (tc != nullptr)
+		{
+			tc->requested += n - (sqlite_int64)header->requested;
+			header->requested = (unsigned)n;
+			return p;
+		}
+	}
+	if (header->cls == WINRT_ALLOC_LARGE && n > WINRT_ALLOC_MAX_SMALL)
+	{
+		sqlite_int64 old = header->requested;
+		WinRTBlockHeader *moved = (WinRTBlockHeader*)::realloc(header, sizeof(WinRTBlockHeader) + n);
+		if (moved == nullptr)
+			return nullptr;
+		moved->requested = (unsigned)n;
+		GrowFootprint(n - old);
+		totalRequested.fetch_add(n - old, std::memory_order_relaxed);
+		Raise(&highwater, totalAllocated.fetch_add(n - old, std::memory_order_relaxed) + (n - old));
+		return moved + 1;
+	}
+
+	void *q = WinRTMemMalloc(n);
+	if (q == nullptr)
+		return nullptr;
+	int nOld = WinRTMemSize(p);
+	::memcpy(q, p, nOld < n ? nOld : n);
+	WinRTMemFree(p);
+	return q;
+}
+
+static int WinRTMemRoundup(int n)
+{
+	if (n > WINRT_ALLOC_MAX_SMALL)
+		return WINRT_ALLOC_ROUND8(n);
+	return (int)classBytes[ClassOf(n < 1 ? 1 : n)];
+}
+
+static int WinRTMemInit(void *pAppData)
+{
+	return SQLITE_OK;
+}
+
+static void WinRTMemShutdown(void *pAppData)
+{
+}
+
+int WinRTAllocatorInstall()
+{
+	static const sqlite3_mem_methods methods =
+	{
+		WinRTMemMalloc,         /* xMalloc */
+		WinRTMemFree,           /* xFree */
+		WinRTMemRealloc,        /* xRealloc */
+		WinRTMemSize,           /* xSize */
+		WinRTMemRoundup,        /* xRoundup */
+		WinRTMemInit,           /* xInit */
+		WinRTMemShutdown,       /* xShutdown */
+		nullptr                 /* pAppData */
+	};
+	static std::once_flag once;
+	static bool installed = false;
+	std::call_once(once, []()
+	{
+		for (int c = 0; c < WINRT_ALLOC_CLASSES; c++)
+		{
+			if (c < 8)
+			{
+				classBytes[c] = 16 * (c + 1);
+			}
+			else
+			{
+				unsigned p = 7 + (c - 8) / 4;
+				classBytes[c] = (1u << p) + ((c - 8) % 4 + 1) * (1u << (p - 2));
+			}
+			classLimit[c] = (int)(WINRT_ALLOC_THREAD_BYTES / classBytes[c]);
+			if (classLimit[c] < 4)
+				classLimit[c] = 4;
+		}
+#if SQLITE_OS_WINRT
+		exitIndex = ::FlsAlloc(ThreadExit);
+#else
+		::pthread_key_create(&exitKey, ReleaseThreadCache);
+#endif
+	});
+#if SQLITE_OS_WINRT
+	if (exitIndex == FLS_OUT_OF_INDEXES)
+		return SQLITE_NOMEM;
+#endif
+
+	if (installed)
+		return SQLITE_OK;
+	int rc = ::sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+	if (rc == SQLITE_OK)
+		rc = ::sqlite3_config(SQLITE_CONFIG_MEMSTATUS, 0);
+	installed = rc == SQLITE_OK;
+	return rc;
+}
+
+void WinRTAllocatorStatus(WinRTAllocatorStats *pStats)
+{
+	::memset(pStats, 0, sizeof(*pStats));
+	pStats->requested = totalRequested.load(std::memory_order_relaxed);
+	pStats->allocated = totalAllocated.load(std::memory_order_relaxed);
+	pStats->highwater = highwater.load(std::memory_order_relaxed);
+	pStats->footprint = footprint.load(std::memory_order_relaxed);
+	pStats->footprintHighwater = footprintHighwater.load(std::memory_order_relaxed);
+	pStats->mallocs = totalMallocs.load(std::memory_order_relaxed);
+	pStats->frees = totalFrees.load(std::memory_order_relaxed);
+	pStats->spans = totalSpans.load(std::memory_order_relaxed);
+	if (pStats->allocated > 0)
+		pStats->internalFragmentation = (double)(pStats->allocated - pStats->requested) / pStats->allocated;
+	if (pStats->footprint > 0)
+		pStats->externalFragmentation = (double)(pStats->footprint - pStats->allocated) / pStats->footprint;
+}
@@ -0,0 +1,65 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include "sqlite3.h"
+
+/*
+** Allocations up to WINRT_ALLOC_MAX_SMALL bytes are rounded up to one of
+** the size classes and served from per-thread free lists; larger ones go
+** to the system heap.
+*/
+#define WINRT_ALLOC_MAX_SMALL       32768
+
+/*
+** Free bytes a thread may keep per size class before returning half of
+** them to the shared lists, and size of the spans new blocks are carved
+** from.
+*/
+#define WINRT_ALLOC_THREAD_BYTES    (64 * 1024)
+#define WINRT_ALLOC_SPAN_BYTES      (64 * 1024)
+
+/*
+** Each thread folds its counters into the totals after this many bytes of
+** change, so the totals below may lag by that much per thread.
+*/
+#define WINRT_ALLOC_STATS_SLACK     (64 * 1024)
+
+typedef struct
+{
+	sqlite_int64 requested;     /* Bytes asked for and not yet freed */
+	sqlite_int64 allocated;     /* The same allocations rounded up to their size class */
+	sqlite_int64 highwater;     /* Most bytes allocated at once */
+	sqlite_int64 footprint;     /* Bytes taken from the system heap */
+	sqlite_int64 footprintHighwater;
+	sqlite_int64 mallocs;       /* Calls to xMalloc and xRealloc that allocated */
+	sqlite_int64 frees;
+	sqlite_int64 spans;         /* Spans carved into small blocks */
+	double internalFragmentation;  /* Share of allocated lost to rounding up */
+	double externalFragmentation;  /* Share of footprint that is free */
+} WinRTAllocatorStats;
+
+/*
+** Make this allocator SQLite's (SQLITE_CONFIG_MALLOC). Small blocks come
+** from free lists of the calling thread with no locking; a thread that
+** frees more than it allocates hands blocks back to shared per-class
+** lists in batches. SQLite's own memory statistics are turned off
+** (SQLITE_CONFIG_MEMSTATUS), since they serialize every allocation behind
+** one mutex; WinRTAllocatorStatus reports usage instead.
+**
+** Must be called before sqlite3_initialize. Memory in small blocks is kept
+** for reuse rather than returned to the system.
+*/
+int WinRTAllocatorInstall();
+
+/*
+** Usage of the installed allocator.
+*/
+void WinRTAllocatorStatus(WinRTAllocatorStats *pStats);
@@ -0,0 +1,745 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+/*
+*		Eviction is ARC (adaptive replacement cache), over the blocks of all
+*		files together. Blocks read once sit on the recency list T1 and
+*		blocks read again move to the frequency list T2; when a block is
+*		evicted its key is kept, without its data, on ghost list B1 or B2.
+*		A miss that finds its key on B1 shows T1 was too short and grows
+*		the target size of T1; one found on B2 shrinks it. Eviction takes
+*		from T1 while it is over target and from T2 otherwise. A scan fills
+*		T1 and B1 only, so blocks in repeated use stay on T2 through it,
+*		while a working set that moves is let in as fast as its blocks
+*		prove themselves.
+*
+*		Blocks evicted from T1 and T2 drop to a second tier, LZ-compressed,
+*		if they compress well. The tier is an LRU list of its own, those
+*		from T1 entering it at the cold end. As it fills, T1 and T2 give
+*		it up to WINRT_BLOCK_PACKED_PERCENT of the budget, so that with
+*		pages compressing 3:1 the same memory holds about twice as many
+*		blocks, while data that does not compress keeps the whole
+*		budget uncompressed. A read that finds a block there decompresses
+*		it back into the first tier, which costs a few microseconds
+*		against a storage read's tens or hundreds.
+*/
+
+#include "pch.h"
+
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "WinRTBlockCache.h"
+#include "WinRTLz.h"
+#include "WinRTMemoryBudget.h"
+
+/*
+** An evicted block is kept compressed only if it shrinks to this.
+*/
+#define WINRT_BLOCK_PACKED_MAX      (WINRT_BLOCK_BYTES * 3 / 4)
+
+/*
+** A block, or with data null the key of an evicted one (a ghost). Both are
+** found through the owner's blocks map.
+*/
+struct WinRTCachedBlock
+{
+	WinRTBlockCache *owner;
+	sqlite_int64 index;					// offset / WINRT_BLOCK_BYTES
+	int n;								// valid bytes; short only at end of file
+	WinRTCachedBlock *newer;			// list the block is on
+	WinRTCachedBlock *older;
+	struct WinRTBlockList *list;
+	unsigned char *data;				// null for a ghost
+};
+
+struct WinRTBlockList
+{
+	WinRTCachedBlock *newest;
+	WinRTCachedBlock *oldest;
+	sqlite_int64 count;
+};
+
+/*
+** A block in the second tier; always a whole one.
+*/
+struct WinRTPackedBlock
+{
+	WinRTBlockCache *owner;
+	sqlite_int64 index;
+	int nPacked;
+	WinRTPackedBlock *newer;			// second tier LRU list
+	WinRTPackedBlock *older;
+	unsigned char *data;
+};
+
+/*
+** One lock covers the registry, the ARC lists and every cache; a hit is a
+** hash lookup and a memcpy, so it is held only briefly.
+*/
+static std::mutex cacheMutex;
+static std::map<std::pair<const void*, std::string>, WinRTBlockCache*> caches;
+static WinRTBlockList t1, t2;			// cached: seen once, seen again
+static WinRTBlockList b1, b2;			// ghosts evicted from t1, t2
+static sqlite_int64 target = 0;			// blocks t1 should hold
+static sqlite_int64 cachedBytes = 0;
+static sqlite_int64 budget = WINRT_BLOCK_CACHE_BYTES;	// both tiers; see SetBudget
+static WinRTPackedBlock *packedNewest = nullptr;
+static WinRTPackedBlock *packedOldest = nullptr;
+static WinRTBlockCacheStats counters;	// hits, misses and second tier counts
+
+/*
+** Blocks T1 and T2 may hold: the budget less what the second tier holds,
+** up to its share. Data that does not compress leaves the whole budget to
+** uncompressed blocks.
+*/
+static sqlite_int64 Capacity()
+{
+	sqlite_int64 packedShare = budget / 100 * WINRT_BLOCK_PACKED_PERCENT;
+	return (budget - std::min(counters.packedBytes, packedShare)) / WINRT_BLOCK_BYTES;
+}
+
+/*
+** Change the bytes held by one tier, and tell the memory budget.
+*/
+static void Account(sqlite_int64 *pBytes, sqlite_int64 delta)
+{
+	*pBytes += delta;
+	::WinRTMemoryCharge(WINRT_MEMORY_BLOCK_CACHE, delta);
+}
+
+static void Unlink(WinRTCachedBlock *block)
+{
+	WinRTBlockList *list = block->list;
+	(block->newer ? block->newer->older : list->newest) = block->older;
+	(block->older ? block->older->newer : list->oldest) = block->newer;
+	list->count--;
+	block->list = nullptr;
+}
+
+static void LinkNewest(WinRTBlockList *list, WinRTCachedBlock *block)
+{
+	block->newer = nullptr;
+	block->older = list->newest;
+	(list->newest ? list->newest->newer : list->oldest) = block;
+	list->newest = block;
+	list->count++;
+	block->list = list;
+}
+
+/*
+** A cached block was read again.
+*/
+static void Touch(WinRTCachedBlock *block)
+{
+	if (block != t2.newest)
+	{
+		Unlink(block);
+		LinkNewest(&t2, block);
+	}
+}
+
+WinRTBlockCache *WinRTBlockCache::Acquire(const void *pBackend, const char *zName)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	WinRTBlockCache *&cache = caches[std::make_pair(pBackend, std::string(zName))];
+	if (cache == nullptr)
+	{
+		cache = new WinRTBlockCache();
+		cache->backend = pBackend;
+		cache->name = zName;
+	}
+	cache->nRef++;
+	return cache;
+}
+
+void WinRTBlockCache::Release(WinRTBlockCache *cache, std::vector<sqlite_int64> *pHot)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	if (--cache->nRef > 0)
+		return;
+
+	if (pHot != nullptr && !cache->reads.empty())
+	{
+		std::vector<std::pair<unsigned, sqlite_int64>> counts;
+		counts.reserve(cache->reads.size());
+		for (auto &entry : cache->reads)
+			counts.push_back(std::make_pair(entry.second, entry.first));
+		size_t n = std::min<size_t>(counts.size(), WINRT_HOT_BLOCKS);
+		std::partial_sort(counts.begin(), counts.begin() + n, counts.end(),
+			[](const std::pair<unsigned, sqlite_int64> &a, const std::pair<unsigned, sqlite_int64> &b)
+		{
+			return a.first > b.first;
+		});
+		pHot->clear();
+		for (size_t i = 0; i < n; i++)
+			pHot->push_back(counts[i].second);
+		std::sort(pHot->begin(), pHot->end());
+		cache->reads.clear();
+	}
+
+	// The blocks stay for the next open; the cache goes once they, and the
+	// ghosts of blocks already evicted, are gone.
+	cache->Reap();
+}
+
+void WinRTBlockCache::Forget(const void *pBackend, const char *zName)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto it = caches.find(std::make_pair(pBackend, std::string(zName)));
+	if (it == caches.end())
+		return;
+	WinRTBlockCache *cache = it->second;
+	cache->Clear();
+	while (!cache->blocks.empty())
+		cache->Drop(cache->blocks.begin()->second);	// ghosts
+	cache->Reap();
+}
+
+void WinRTBlockCache::SetBudget(sqlite_int64 bytes)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	budget = bytes;
+	while (t1.count + t2.count > Capacity())
+		ReplaceOne(false, true);
+	TrimPacked();
+}
+
+void WinRTBlockCache::Shrink(sqlite_int64 bytes)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	// Coldest first: the second tier, then the first without packing.
+	while (cachedBytes + counters.packedBytes > bytes)
+	{
+		if (packedOldest != nullptr)
+		{
+			WinRTBlockCache *owner = packedOldest->owner;
+			owner->Discard(packedOldest);
+			owner->Reap();
+			counters.packedEvictions++;
+		}
+		else if (t1.count + t2.count > 0)
+		{
+			ReplaceOne(false, false);
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+void WinRTBlockCache::Status(WinRTBlockCacheStats *pStats)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	*pStats = counters;
+	pStats->budget = budget;
+	pStats->bytes = cachedBytes;
+	pStats->blocks = t1.count + t2.count;
+}
+
+bool WinRTBlockCache::Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	if (iOfst < 0)
+		return false;
+
+	sqlite_int64 first = iOfst / WINRT_BLOCK_BYTES;
+	sqlite_int64 last = (iOfst + iAmt - 1) / WINRT_BLOCK_BYTES;
+	if (reads.size() >= WINRT_HOT_TRACKED)
+	{
+		// Age the counts, which also forgets blocks read only once.
+		for (auto it = reads.begin(); it != reads.end();)
+		{
+			it->second /= 2;
+			it = it->second == 0 ? reads.erase(it) : std::next(it);
+		}
+	}
+	for (sqlite_int64 i = first; i <= last; i++)
+		reads[i]++;
+
+	// Check every block first so that a miss leaves the lists alone. 0 if
+	// one is missing, 2 if one is only in the second tier.
+	auto present = [&]()
+	{
+		int found = 1;
+		for (sqlite_int64 i = first; i <= last; i++)
+		{
+			auto it = blocks.find(i);
+			if (it != blocks.end() && it->second->data != nullptr)
+			{
+				if (it->second->n < WINRT_BLOCK_BYTES)
+					break;	// end of file
+			}
+			else if (packed.count(i) != 0)
+			{
+				found = 2;
+			}
+			else
+			{
+				return 0;
+			}
+		}
+		return found;
+	};
+	int found = present();
+	if (found == 2)
+	{
+		for (sqlite_int64 i = first; i <= last; i++)
+		{
+			auto it = packed.find(i);
+			if (it != packed.end() && !Unpack(it->second))
+				found = 0;
+		}
+		// Making room for one may have evicted another.
+		if (found != 0 && present() != 1)
+			found = 0;
+	}
+	if (found == 0)
+	{
+		counters.misses++;
+		return false;
+	}
+	(found == 2 ? counters.packedHits : counters.hits)++;
+
+	int done = 0;
+	for (sqlite_int64 i = first; done < iAmt; i++)
+	{
+		WinRTCachedBlock *block = blocks[i];
+		int offset = (int)(iOfst + done - i * WINRT_BLOCK_BYTES);
+		int n = std::max(0, std::min(iAmt - done, block->n - offset));
+		::memcpy((char*)zBuf + done, block->data + offset, n);
+		done += n;
+		Touch(block);
+		if (block->n < WINRT_BLOCK_BYTES)
+			break;
+	}
+	*pnRead = done;
+	return true;
+}
+
+void WinRTBlockCache::Missing(std::vector<sqlite_int64> *aIndex)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	aIndex->erase(
+		std::remove_if(aIndex->begin(), aIndex->end(), [this](sqlite_int64 i)
+	{
+		auto it = blocks.find(i);
+		return (it != blocks.end() && it->second->data != nullptr) || packed.count(i) != 0;
+	}),
+		aIndex->end()
+		);
+}
+
+unsigned WinRTBlockCache::Generation()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	return generation;
+}
+
+void WinRTBlockCache::Fill(unsigned readGeneration, const void *zBuf, int iAmt, int nRead, sqlite_int64 iOfst)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	if (readGeneration != generation || sending > 0 || iOfst < 0)
+		return;
+
+	sqlite_int64 end = iOfst + nRead;
+	for (sqlite_int64 i = (iOfst + WINRT_BLOCK_BYTES - 1) / WINRT_BLOCK_BYTES; i * WINRT_BLOCK_BYTES < end; i++)
+	{
+		sqlite_int64 start = i * WINRT_BLOCK_BYTES;
+		int n = (int)std::min<sqlite_int64>(WINRT_BLOCK_BYTES, end - start);
+		if (n < WINRT_BLOCK_BYTES && nRead == iAmt)
+			break;	// the block runs on past the read, not past end of file
+		Insert(i, (const char*)zBuf + (start - iOfst), n);
+	}
+}
+
+void WinRTBlockCache::Update(const WinRTIoVec *aVec, int nVec)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	generation++;
+	sending++;
+	for (int v = 0; v < nVec; v++)
+	{
+		sqlite_int64 start = aVec[v].iOfst;
+		sqlite_int64 end = start + aVec[v].iAmt;
+
+		// A write into or past the short last block moves end of file.
+		if (partial >= 0 && end > partial * WINRT_BLOCK_BYTES)
+			Drop(blocks[partial]);
+
+		for (sqlite_int64 i = start / WINRT_BLOCK_BYTES; i * WINRT_BLOCK_BYTES < end; i++)
+		{
+			auto p = packed.find(i);
+			if (p != packed.end())
+				Discard(p->second);
+			auto it = blocks.find(i);
+			if (it == blocks.end() || it->second->data == nullptr)
+				continue;
+			sqlite_int64 from = std::max(start, i * WINRT_BLOCK_BYTES);
+			sqlite_int64 to = std::min(end, (i + 1) * WINRT_BLOCK_BYTES);
+			::memcpy(
+				it->second->data + (from - i * WINRT_BLOCK_BYTES),
+				(const char*)aVec[v].zBuf + (from - start),
+				(size_t)(to - from)
+				);
+		}
+	}
+}
+
+void WinRTBlockCache::Sent()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	generation++;
+	sending--;
+}
+
+void WinRTBlockCache::Truncate(sqlite_int64 size)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	generation++;
+	if (partial >= 0 && size > partial * WINRT_BLOCK_BYTES + blocks[partial]->n)
+		Drop(blocks[partial]);
+
+	std::vector<WinRTCachedBlock*> gone;
+	for (auto &entry : blocks)
+	{
+		WinRTCachedBlock *block = entry.second;
+		if (block->data == nullptr)
+			continue;
+		sqlite_int64 start = block->index * WINRT_BLOCK_BYTES;
+		if (start >= size)
+		{
+			gone.push_back(block);
+		}
+		else if (start + block->n > size)
+		{
+			block->n = (int)(size - start);
+			partial = block->index;
+		}
+	}
+	for (WinRTCachedBlock *block : gone)
+		Drop(block);
+
+	std::vector<WinRTPackedBlock*> gonePacked;
+	for (auto &entry : packed)
+	{
+		if ((entry.first + 1) * WINRT_BLOCK_BYTES > size)
+			gonePacked.push_back(entry.second);
+	}
+	for (WinRTPackedBlock *p : gonePacked)
+		Discard(p);
+}
+
+bool WinRTBlockCache::Validate(const sqlite_uint64 *pToken)
+{
+	if (pToken == nullptr)
+		return false;
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	bool changed = haveToken && *pToken != token && tokenGeneration == generation;
+	if (changed)
+		Clear();	// changed by someone else
+	token = *pToken;
+	tokenGeneration = generation;
+	haveToken = true;
+	return changed;
+}
+
+bool WinRTBlockCache::TokenBehind()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	return haveToken && tokenGeneration != generation;
+}
+
+void WinRTBlockCache::Rebase(const sqlite_uint64 *pToken)
+{
+	if (pToken == nullptr)
+		return;
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	token = *pToken;
+	tokenGeneration = generation;
+	haveToken = true;
+}
+
+void WinRTBlockCache::Invalidate()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	Clear();
+}
+
+void WinRTBlockCache::Insert(sqlite_int64 index, const void *zBuf, int n)
+{
+	auto p = packed.find(index);
+	if (p != packed.end())
+		Discard(p->second);
+
+	WinRTCachedBlock *&block = blocks[index];
+	if (block != nullptr && block->data != nullptr)
+	{
+		Touch(block);
+	}
+	else if (block != nullptr)
+	{
+		// A ghost: the list it was evicted from was too short.
+		WinRTBlockList *list = block->list;
+		if (list == &b1)
+			target = std::min<sqlite_int64>(Capacity(), target + std::max<sqlite_int64>(b2.count / b1.count, 1));
+		else
+			target = std::max<sqlite_int64>(0, target - std::max<sqlite_int64>(b1.count / b2.count, 1));
+		Unlink(block);
+		Replace(list == &b2);
+		block->data = new unsigned char[WINRT_BLOCK_BYTES];
+		LinkNewest(&t2, block);
+		Account(&cachedBytes, WINRT_BLOCK_BYTES);
+		TrimPacked();
+	}
+	else
+	{
+		// A new key. Keep the ghost lists to the size of the cache.
+		sqlite_int64 capacity = Capacity();
+		if (t1.count + b1.count >= capacity)
+		{
+			if (t1.count < capacity)
+			{
+				DropAny(b1.oldest);
+				Replace(false);
+			}
+			else
+			{
+				// T1 holds everything: evict from it, and keep no ghost.
+				// With a budget under one block there is nothing to evict,
+				// and the block is not kept.
+				WinRTCachedBlock *victim = t1.oldest;
+				if (victim == nullptr)
+				{
+					blocks.erase(index);
+					return;
+				}
+				if (victim->owner->partial != victim->index)
+					Pack(victim, false);
+				DropAny(victim);
+				Replace(false);	// in case the second tier took the space
+			}
+		}
+		else if (t1.count + t2.count + b1.count + b2.count >= capacity)
+		{
+			if (t1.count + t2.count + b1.count + b2.count >= 2 * capacity && b2.count > 0)
+				DropAny(b2.oldest);
+			Replace(false);
+		}
+
+		block = new WinRTCachedBlock;
+		block->owner = this;
+		block->index = index;
+		block->data = new unsigned char[WINRT_BLOCK_BYTES];
+		LinkNewest(&t1, block);
+		Account(&cachedBytes, WINRT_BLOCK_BYTES);
+		TrimPacked();
+	}
+	::memcpy(block->data, zBuf, n);
+	block->n = n;
+	if (n < WINRT_BLOCK_BYTES)
+		partial = index;
+}
+
+/*
+** Remove a block or ghost entirely.
+*/
+void WinRTBlockCache::Drop(WinRTCachedBlock *block)
+{
+	Unlink(block);
+	if (block->data != nullptr)
+	{
+		Account(&cachedBytes, -WINRT_BLOCK_BYTES);
+		if (partial == block->index)
+			partial = -1;
+		delete[] block->data;
+	}
+	blocks.erase(block->index);
+	delete block;
+}
+
+/*
+** Drop a block or ghost of any cache, and the cache if that left it unused.
+** Not for blocks of this one, which is in use.
+*/
+void WinRTBlockCache::DropAny(WinRTCachedBlock *block)
+{
+	WinRTBlockCache *owner = block->owner;
+	owner->Drop(block);
+	owner->Reap();
+}
+
+/*
+** Delete the cache if nothing holds it and it holds nothing.
+*/
+void WinRTBlockCache::Reap()
+{
+	if (nRef == 0 && blocks.empty() && packed.empty())
+	{
+		caches.erase(std::make_pair(backend, name));
+		delete this;
+	}
+}
+
+void WinRTBlockCache::Clear()
+{
+	generation++;
+	std::vector<WinRTCachedBlock*> cached;
+	for (auto &entry : blocks)
+	{
+		if (entry.second->data != nullptr)
+			cached.push_back(entry.second);
+	}
+	// Ghosts stay: what was hot before a change is likely hot after it.
+	for (WinRTCachedBlock *block : cached)
+	{
+		Unlink(block);
+		Account(&cachedBytes, -WINRT_BLOCK_BYTES);
+		delete[] block->data;
+		blocks.erase(block->index);
+		delete block;
+	}
+	while (!packed.empty())
+		Discard(packed.begin()->second);
+	partial = -1;
+}
+
+/*
+** Make room for one block when the cache is full: evict the oldest block
+** of T1 if T1 is over its target (or at it, for a block coming back from
+** B2), else the oldest of T2, keeping its key as a ghost. More than one
+** goes when the second tier has grown into the space.
+*/
+void WinRTBlockCache::Replace(bool fromB2)
+{
+	while (t1.count + t2.count > 0 && t1.count + t2.count >= Capacity())
+		ReplaceOne(fromB2, true);
+}
+
+void WinRTBlockCache::ReplaceOne(bool fromB2, bool pack)
+{
+	WinRTCachedBlock *victim;
+	WinRTBlockList *ghosts;
+	if (t1.count > 0 && (t1.count > target || (fromB2 && t1.count == target) || t2.count == 0))
+	{
+		victim = t1.oldest;
+		ghosts = &b1;
+	}
+	else
+	{
+		victim = t2.oldest;
+		ghosts = &b2;
+	}
+	if (victim == nullptr)
+		return;	// nothing cached
+
+	if (victim->owner->partial == victim->index)
+	{
+		// The short last block is not worth remembering.
+		DropAny(victim);
+		return;
+	}
+	Unlink(victim);
+	if (pack)
+		Pack(victim, ghosts == &b2);
+	Account(&cachedBytes, -WINRT_BLOCK_BYTES);
+	delete[] victim->data;
+	victim->data = nullptr;
+	LinkNewest(ghosts, victim);
+	TrimPacked();
+}
+
+/*
+** Keep a block being evicted in the second tier, if it compresses well.
+** A block read only once goes in at the cold end, so that a scan passing
+** through does not push out blocks in repeated use.
+*/
+void WinRTBlockCache::Pack(WinRTCachedBlock *block, bool reused)
+{
+#if WINRT_BLOCK_PACKED_PERCENT > 0
+	static unsigned char buffer[WINRT_BLOCK_PACKED_MAX];
+	int nPacked = ::WinRTLzCompress(block->data, WINRT_BLOCK_BYTES, buffer, sizeof(buffer));
+	if (nPacked == 0)
+	{
+		counters.incompressible++;
+		return;
+	}
+
+	WinRTPackedBlock *p = new WinRTPackedBlock;
+	p->owner = block->owner;
+	p->index = block->index;
+	p->nPacked = nPacked;
+	p->data = new unsigned char[nPacked];
+	::memcpy(p->data, buffer, nPacked);
+	if (reused)
+	{
+		p->newer = nullptr;
+		p->older = packedNewest;
+		(packedNewest ? packedNewest->newer : packedOldest) = p;
+		packedNewest = p;
+	}
+	else
+	{
+		p->older = nullptr;
+		p->newer = packedOldest;
+		(packedOldest ? packedOldest->older : packedNewest) = p;
+		packedOldest = p;
+	}
+	block->owner->packed[p->index] = p;
+	counters.packed++;
+	counters.packedBlocks++;
+	Account(&counters.packedBytes, sizeof(WinRTPackedBlock) + nPacked);
+#endif
+}
+
+/*
+** Decompress a block back into the first tier. False if it was corrupt.
+*/
+bool WinRTBlockCache::Unpack(WinRTPackedBlock *p)
+{
+	static unsigned char buffer[WINRT_BLOCK_BYTES];
+	int n = ::WinRTLzDecompress(p->data, p->nPacked, buffer, sizeof(buffer));
+	sqlite_int64 index = p->index;
+	Discard(p);
+	if (n != WINRT_BLOCK_BYTES)
+		return false;
+	Insert(index, buffer, n);
+	return true;
+}
+
+void WinRTBlockCache::Discard(WinRTPackedBlock *p)
+{
+	(p->newer ? p->newer->older : packedNewest) = p->older;
+	(p->older ? p->older->newer : packedOldest) = p->newer;
+	counters.packedBlocks--;
+	Account(&counters.packedBytes, -(sqlite_int64)(sizeof(WinRTPackedBlock) + p->nPacked));
+	packed.erase(p->index);
+	delete[] p->data;
+	delete p;
+}
+
+/*
+** Keep both tiers together within the budget.
+*/
+void WinRTBlockCache::TrimPacked()
+{
+	while (packedOldest != nullptr && cachedBytes + counters.packedBytes > budget)
+	{
+		WinRTBlockCache *owner = packedOldest->owner;
+		owner->Discard(packedOldest);
+		owner->Reap();
+		counters.packedEvictions++;
+	}
+}
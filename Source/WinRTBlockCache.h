@@ -0,0 +1,183 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "WinRTStorage.h"
+
+/*
+** Cache granularity, and the most memory all block caches together may hold.
+*/
+#define WINRT_BLOCK_BYTES           4096
+#define WINRT_BLOCK_CACHE_BYTES     (32 * 1024 * 1024)
+
+/*
+** Share of the budget that evicted blocks, held LZ-compressed, may take
+** from uncompressed ones (0 for none). WINRT_BLOCK_PRIMARY_BYTES is what
+** that leaves of the default budget.
+*/
+#define WINRT_BLOCK_PACKED_PERCENT  50
+#define WINRT_BLOCK_PRIMARY_BYTES   (WINRT_BLOCK_CACHE_BYTES / 100 * (100 - WINRT_BLOCK_PACKED_PERCENT))
+
+/*
+** Most blocks whose reads are counted at once, and most blocks in the hot
+** list handed out by Release.
+*/
+#define WINRT_HOT_TRACKED           65536
+#define WINRT_HOT_BLOCKS            2048
+
+struct WinRTCachedBlock;
+struct WinRTPackedBlock;
+
+typedef struct
+{
+	sqlite_int64 budget;            /* WINRT_BLOCK_CACHE_BYTES, or as set by SetBudget */
+	sqlite_int64 bytes;             /* Held by uncompressed blocks */
+	sqlite_int64 blocks;
+	sqlite_int64 packedBytes;       /* Held by compressed blocks, overhead included */
+	sqlite_int64 packedBlocks;
+	sqlite_int64 hits;              /* Reads answered from uncompressed blocks */
+	sqlite_int64 packedHits;        /* Reads that decompressed a block to be answered */
+	sqlite_int64 misses;            /* Reads left to storage */
+	sqlite_int64 packed;            /* Evicted blocks compressed into the second tier */
+	sqlite_int64 incompressible;    /* Evicted blocks that did not compress enough to keep */
+	sqlite_int64 packedEvictions;   /* Compressed blocks dropped to stay in budget */
+} WinRTBlockCacheStats;
+
+/*
+** Blocks of a main database file kept in memory, shared by every connection
+** to the file in this process and by WinRTVFSPrewarm. Reads that miss SQLite's
+** own page cache are answered from here when every block they cover is
+** present; aligned reads from storage fill it. All files share one budget
+** (WINRT_BLOCK_CACHE_BYTES unless set) and one scan-resistant eviction policy
+** (ARC; see WinRTBlockCache.cpp), and evicted blocks are kept compressed
+** in a second tier within the same budget.
+**
+** Unlike the header cache, the blocks of a file outlive its last handle, so
+** that a database warmed before it is opened, or closed and reopened, starts
+** with them. Coherence works as in WinRTHeaderCache: local writes patch the
+** blocks they touch and bump a generation, reads that raced a write are not
+** kept, and Validate drops everything when the storage's change token moved
+** for another reason. Storage with no change token is assumed to be changed
+** only through this process.
+*/
+class WinRTBlockCache
+{
+public:
+	/*
+	** The cache for zName opened through pBackend, created on first use.
+	** Every Acquire is matched by a Release. zName is a canonical path
+	** (WinRTCanonicalPath).
+	**
+	** The cache counts how often each block is read. When the last holder
+	** releases it with pHot, *pHot receives the most read blocks, in file
+	** order, and the counts start again.
+	*/
+	static WinRTBlockCache *Acquire(const void *pBackend, const char *zName);
+	static void Release(WinRTBlockCache *cache, std::vector<sqlite_int64> *pHot = nullptr);
+
+	/*
+	** Drop the blocks of a file that is being deleted.
+	*/
+	static void Forget(const void *pBackend, const char *zName);
+
+	/*
+	** Memory budget of all caches together, both tiers, in place of
+	** WINRT_BLOCK_CACHE_BYTES; blocks over it are evicted at once. Shrink
+	** evicts, coldest first, until the caches hold no more than bytes, but
+	** leaves the budget as it was.
+	*/
+	static void SetBudget(sqlite_int64 bytes);
+	static void Shrink(sqlite_int64 bytes);
+
+	/*
+	** Counters of all caches together.
+	*/
+	static void Status(WinRTBlockCacheStats *pStats);
+
+	/*
+	** Answer a read from the cache. Returns false if any block in the range
+	** is missing; otherwise *pnRead is set as storage would set it.
+	*/
+	bool Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead);
+
+	/*
+	** Remove from aIndex the blocks already cached.
+	*/
+	void Missing(std::vector<sqlite_int64> *aIndex);
+
+	/*
+	** Offer the result of a storage read of iAmt bytes at iOfst that
+	** returned nRead, started when the generation was generation. Only whole
+	** blocks are kept, and the block holding end of file.
+	*/
+	unsigned Generation();
+	void Fill(unsigned generation, const void *zBuf, int iAmt, int nRead, sqlite_int64 iOfst);
+
+	/*
+	** Writes being sent to storage, and truncation. Every Update is
+	** followed by Sent once storage has returned; reads are made without
+	** waiting for writes, so one offered in between, or started before
+	** Sent, may hold either data and is not kept.
+	*/
+	void Update(const WinRTIoVec *aVec, int nVec);
+	void Sent();
+	void Truncate(sqlite_int64 size);
+
+	/*
+	** Start of a read transaction, given the storage's change token (null if
+	** it has none): drop every block if the file changed other than through
+	** this process. Returns true if it did.
+	*/
+	bool Validate(const sqlite_uint64 *pToken);
+
+	/*
+	** True if a local write was made since the change token was taken.
+	** Once the writes are in storage the token is taken again and given to
+	** Rebase, so that Validate can see the next change by another process.
+	*/
+	bool TokenBehind();
+	void Rebase(const sqlite_uint64 *pToken);
+
+	/*
+	** Forget every block, e.g. after a write that failed part way.
+	*/
+	void Invalidate();
+
+private:
+	WinRTBlockCache() {}
+	void Insert(sqlite_int64 index, const void *zBuf, int n);
+	void Drop(WinRTCachedBlock *block);
+	void Reap();
+	void Clear();
+	static void DropAny(WinRTCachedBlock *block);
+	static void Replace(bool fromB2);
+	static void ReplaceOne(bool fromB2, bool pack);
+	static void Pack(WinRTCachedBlock *block, bool reused);
+	bool Unpack(WinRTPackedBlock *p);
+	void Discard(WinRTPackedBlock *p);
+	static void TrimPacked();
+
+	std::unordered_map<sqlite_int64, WinRTCachedBlock*> blocks;	// and ghosts
+	std::unordered_map<sqlite_int64, WinRTPackedBlock*> packed;	// second tier
+	std::unordered_map<sqlite_int64, unsigned> reads;	// reads of each block
+	sqlite_int64 partial = -1;			// index of a block shorter than WINRT_BLOCK_BYTES
+	unsigned generation = 0;			// bumped by every local write
+	int sending = 0;					// Updates not yet Sent
+	unsigned tokenGeneration = 0;		// generation when token was taken
+	sqlite_uint64 token = 0;
+	bool haveToken = false;
+	int nRef = 0;
+	const void *backend = nullptr;
+	std::string name;
+};
@@ -0,0 +1,520 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Page checksum stage. Wraps another backend and keeps a CRC-32C of every
+*		page of a main database file, so a page damaged by the storage is
+*		reported as SQLITE_CORRUPT when it is read instead of going unnoticed.
+*		Journals and WAL files are left alone; SQLite checksums those itself.
+*
+*		Checksums are stored out of band in a sidecar "<name>-crc": a header
+*		followed by one 4-byte CRC per page. The checksum unit is the database
+*		page size, taken from the database header or from the first write to a
+*		new database. All checksums are held in memory (1 MB per GB of 4 KB
+*		pages); changed ones are written when the database is synced, after
+*		the data.
+*
+*		Data written since the last sync may reach storage before or without
+*		its checksums, and SQLite reads page 1 of a database with a hot
+*		journal before rolling the journal back. So before the first write of
+*		a session the sidecar header is marked as being written and synced,
+*		and the mark is cleared when the file is closed with everything
+*		synced. A sidecar found marked at open (a crash, or a process killed
+*		with the file open) cannot be trusted for any page, and the database
+*		is checksummed in full again, as is an existing database without a
+*		sidecar. Damage done to the data during the crash goes undetected.
+*/
+
+#include "pch.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "WinRTStorage.h"
+#include "WinRTCrc32c.h"
+
+#define WINRT_CRC_SUFFIX        "-crc"
+#define WINRT_CRC_HEADER        512			// sidecar: header, then entries
+#define WINRT_CRC_PAGE          4096		// entries are written per page
+#define WINRT_CRC_DEFAULT_BLOCK 4096
+#define WINRT_CRC_WRITING       1			// header flag: written since the last clean close
+
+static const char crcMagic[16] = "WinRTVFS crc32c";
+
+
+static inline void Put32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24);
+}
+
+static inline uint32_t Get32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool ValidBlockSize(sqlite_int64 n)
+{
+	return n >= 512 && n <= 65536 && (n & (n - 1)) == 0;
+}
+
+
+class WinRTChecksumStorage : public WinRTStorage
+{
+public:
+	WinRTChecksumStorage(WinRTStorage *data, WinRTStorage *sums, bool readOnly)
+		: data(data), sums(sums), readOnly(readOnly), blockSize(0), dataSize(0), zeroCrc(0), headerDirty(false),
+		writing(false) {}
+
+	virtual ~WinRTChecksumStorage()
+	{
+		// The mark stays if anything failed to reach storage.
+		if (Sync(SQLITE_SYNC_NORMAL) == SQLITE_OK && writing)
+		{
+			unsigned char header[64];
+			FillHeader(header, 0);
+			if (sums->Write(header, sizeof(header), 0) == SQLITE_OK)
+				sums->Sync(SQLITE_SYNC_NORMAL);
+		}
+		delete data;
+		delete sums;
+	}
+
+	/*
+	** Read the sidecar, or checksum the whole database if there is no usable
+	** one or it was left marked as being written. A count that disagrees
+	** with the file size is trimmed or extended from the data.
+	*/
+	int Load()
+	{
+		int rc = data->FileSize(&dataSize);
+		if (rc != SQLITE_OK) return rc;
+
+		unsigned char header[64];
+		int nRead = 0;
+		rc = sums->Read(header, sizeof(header), 0, &nRead);
+		if (rc != SQLITE_OK) return rc;
+
+		size_t nBlocks = 0;
+		if (nRead == (int)sizeof(header) && ::memcmp(header, crcMagic, sizeof(crcMagic)) == 0 &&
+			ValidBlockSize(Get32(header + 16)))
+		{
+			blockSize = Get32(header + 16);
+			nBlocks = Get32(header + 20);
+			if (Get32(header + 24) & WINRT_CRC_WRITING)
+			{
+				// Still marked on storage, so no new mark is needed.
+				nBlocks = 0;
+				headerDirty = true;
+				writing = !readOnly;
+			}
+			std::vector<unsigned char> raw(nBlocks * 4);
+			if (nBlocks > 0)
+			{
+				rc = sums->Read(&raw[0], (int)raw.size(), WINRT_CRC_HEADER, &nRead);
+				if (rc != SQLITE_OK) return rc;
+				nBlocks = nRead / 4;
+			}
+			crcs.resize(nBlocks);
+			for (size_t i = 0; i < nBlocks; i++)
+				crcs[i] = Get32(&raw[i * 4]);
+		}
+		else if (dataSize > 0)
+		{
+			blockSize = DatabasePageSize();
+			headerDirty = true;
+		}
+
+		if (blockSize == 0)
+			return SQLITE_OK;	// new database; the first write picks the size
+
+		size_t want = BlockCount(dataSize);
+		if (crcs.size() > want)
+			crcs.resize(want);
+		for (size_t b = crcs.size() > 0 ? crcs.size() - 1 : 0; b < want; b++)
+		{
+			rc = Recompute(b);
+			if (rc != SQLITE_OK) return rc;
+		}
+		return SQLITE_OK;
+	}
+
+	virtual int Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead)
+	{
+		if (blockSize == 0)
+			return data->Read(zBuf, iAmt, iOfst, pnRead);
+
+		// Whole pages are verified in place; anything else reads the pages
+		// around it.
+		if (iOfst % blockSize == 0 && iAmt % blockSize == 0)
+		{
+			int rc = data->Read(zBuf, iAmt, iOfst, pnRead);
+			if (rc != SQLITE_OK) return rc;
+			return Verify((unsigned char*)zBuf, iOfst, *pnRead);
+		}
+
+		sqlite_int64 start = iOfst - iOfst % blockSize;
+		sqlite_int64 end = iOfst + iAmt;
+		end += (blockSize - end % blockSize) % blockSize;
+		scratch.resize((size_t)(end - start));
+
+		int nRead = 0;
+		int rc = data->Read(&scratch[0], (int)(end - start), start, &nRead);
+		if (rc != SQLITE_OK) return rc;
+		rc = Verify(&scratch[0], start, nRead);
+		if (rc != SQLITE_OK) return rc;
+
+		int skip = (int)(iOfst - start);
+		int n = nRead > skip ? std::min(nRead - skip, iAmt) : 0;
+		::memcpy(zBuf, &scratch[skip], n);
+		*pnRead = n;
+		return SQLITE_OK;
+	}
+
+	virtual int Write(const void *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		WinRTIoVec vec = { (void*)zBuf, iAmt, iOfst, 0 };
+		return WriteBatch(&vec, 1);
+	}
+
+	virtual int WriteBatch(WinRTIoVec *aVec, int nVec)
+	{
+		if (blockSize == 0 && nVec > 0)
+		{
+			// Page 1 of a new database is written at offset 0 with the page size.
+			blockSize = (aVec[0].iOfst == 0 && ValidBlockSize(aVec[0].iAmt)) ? aVec[0].iAmt : WINRT_CRC_DEFAULT_BLOCK;
+			headerDirty = true;
+		}
+
+		int rc = MarkWriting();
+		if (rc == SQLITE_OK)
+			rc = data->WriteBatch(aVec, nVec);
+		if (rc != SQLITE_OK) return rc;
+
+		sqlite_int64 newSize = dataSize;
+		for (int i = 0; i < nVec; i++)
+			newSize = std::max(newSize, aVec[i].iOfst + aVec[i].iAmt);
+		Extend(newSize);
+
+		for (int i = 0; i < nVec; i++)
+		{
+			const WinRTIoVec &v = aVec[i];
+			const unsigned char *p = (const unsigned char*)v.zBuf;
+			sqlite_int64 pos = v.iOfst;
+			sqlite_int64 end = v.iOfst + v.iAmt;
+			while (pos < end)
+			{
+				size_t b = (size_t)(pos / blockSize);
+				sqlite_int64 blockStart = (sqlite_int64)b * blockSize;
+				sqlite_int64 blockEnd = std::min(blockStart + blockSize, dataSize);
+				if (pos == blockStart && end >= blockEnd)
+					SetCrc(b, WinRTCrc32c(0, p + (pos - v.iOfst), (size_t)(blockEnd - blockStart)));
+				else
+					partial.push_back(b);
+				pos = blockStart + blockSize;
+			}
+		}
+
+		return RecomputePartial();
+	}
+
+	virtual int Truncate(sqlite_int64 size)
+	{
+		int rc = blockSize != 0 ? MarkWriting() : SQLITE_OK;
+		if (rc == SQLITE_OK)
+			rc = data->Truncate(size);
+		if (rc != SQLITE_OK || blockSize == 0)
+			return rc;
+		headerDirty = true;
+		if (size > dataSize)
+		{
+			Extend(size);
+			return RecomputePartial();
+		}
+		dataSize = size;
+		crcs.resize(BlockCount(size));
+		if (size % blockSize != 0)
+			rc = Recompute(crcs.size() - 1);
+		return rc;
+	}
+
+	virtual int Sync(int flags)
+	{
+		int rc = data->Sync(flags);
+		if (rc != SQLITE_OK || readOnly || (!headerDirty && dirtyPages.empty()))
+			return rc;
+		rc = SaveSums();
+		if (rc == SQLITE_OK)
+			rc = sums->Sync(flags);
+		return rc;
+	}
+
+	virtual int FileSize(sqlite_int64 *pSize)
+	{
+		return data->FileSize(pSize);
+	}
+
+	virtual int ChangeToken(sqlite_uint64 *pToken)
+	{
+		return data->ChangeToken(pToken);
+	}
+
+private:
+	size_t BlockCount(sqlite_int64 size)
+	{
+		return (size_t)((size + blockSize - 1) / blockSize);
+	}
+
+	/*
+	** The page size recorded in the database header, or the default if the
+	** file does not start with one.
+	*/
+	int DatabasePageSize()
+	{
+		unsigned char header[100];
+		int nRead = 0;
+		if (data->Read(header, sizeof(header), 0, &nRead) != SQLITE_OK || nRead < (int)sizeof(header) ||
+			::memcmp(header, "SQLite format 3", 16) != 0)
+			return WINRT_CRC_DEFAULT_BLOCK;
+		int n = (header[16] << 8) | header[17];
+		if (n == 1)
+			n = 65536;
+		return ValidBlockSize(n) ? n : WINRT_CRC_DEFAULT_BLOCK;
+	}
+
+	/*
+	** Grow the file to newSize. Pages past the old end read back as zeros;
+	** a page that ended early is queued in partial to be checksummed again.
+	*/
+	void Extend(sqlite_int64 newSize)
+	{
+		if (newSize <= dataSize)
+			return;
+		if (dataSize % blockSize != 0)
+			partial.push_back((size_t)(dataSize / blockSize));
+		size_t oldCount = crcs.size();
+		dataSize = newSize;
+		crcs.resize(BlockCount(newSize));
+		if (crcs.size() > oldCount)
+		{
+			if (zeroCrc == 0)
+			{
+				std::vector<unsigned char> zeros(blockSize);
+				zeroCrc = WinRTCrc32c(0, &zeros[0], blockSize);
+			}
+			for (size_t b = oldCount; b < crcs.size(); b++)
+				SetCrc(b, zeroCrc);
+			if (newSize % blockSize != 0)
+				partial.push_back(crcs.size() - 1);
+		}
+	}
+
+	/*
+	** Check every page of p (nRead bytes read at iOfst) that has a checksum.
+	*/
+	int Verify(const unsigned char *p, sqlite_int64 iOfst, int nRead)
+	{
+		size_t b = (size_t)(iOfst / blockSize);
+		for (int at = 0; at < nRead; at += blockSize, b++)
+		{
+			if (b >= crcs.size())
+				break;
+			int n = (int)std::min((sqlite_int64)blockSize, dataSize - (iOfst + at));
+			if (n > nRead - at)
+				break;	// short read; SQLite zero-fills and handles it
+			if (WinRTCrc32c(0, p + at, n) != crcs[b])
+				return SQLITE_CORRUPT;
+		}
+		return SQLITE_OK;
+	}
+
+	int Recompute(size_t b)
+	{
+		sqlite_int64 start = (sqlite_int64)b * blockSize;
+		int n = (int)std::min((sqlite_int64)blockSize, dataSize - start);
+		if (n <= 0)
+			return SQLITE_OK;
+		scratch.resize(blockSize);
+		int nRead = 0;
+		int rc = data->Read(&scratch[0], n, start, &nRead);
+		if (rc != SQLITE_OK) return rc;
+		if (crcs.size() <= b)
+			crcs.resize(b + 1);
+		SetCrc(b, WinRTCrc32c(0, &scratch[0], nRead));
+		return SQLITE_OK;
+	}
+
+	/*
+	** Pages written only in part are checksummed from storage.
+	*/
+	int RecomputePartial()
+	{
+		int rc = SQLITE_OK;
+		for (size_t b : partial)
+		{
+			rc = Recompute(b);
+			if (rc != SQLITE_OK) break;
+		}
+		partial.clear();
+		return rc;
+	}
+
+	void SetCrc(size_t b, uint32_t crc)
+	{
+		crcs[b] = crc;
+		size_t page = b * 4 / WINRT_CRC_PAGE;
+		if (dirtyPages.empty() || dirtyPages.back() != page)
+			dirtyPages.push_back(page);
+	}
+
+	/*
+	** The 64-byte sidecar header: magic, page size, page count and flags.
+	*/
+	void FillHeader(unsigned char *header, uint32_t flags)
+	{
+		::memset(header, 0, 64);
+		::memcpy(header, crcMagic, sizeof(crcMagic));
+		Put32(header + 16, blockSize);
+		Put32(header + 20, (uint32_t)crcs.size());
+		Put32(header + 24, flags);
+	}
+
+	/*
+	** Mark the sidecar as being written, durably, before the data first
+	** changes: one write and sync per session.
+	*/
+	int MarkWriting()
+	{
+		if (writing || readOnly)
+			return SQLITE_OK;
+		unsigned char header[64];
+		FillHeader(header, WINRT_CRC_WRITING);
+		int rc = sums->Write(header, sizeof(header), 0);
+		if (rc == SQLITE_OK)
+			rc = sums->Sync(SQLITE_SYNC_NORMAL);
+		if (rc == SQLITE_OK)
+			writing = true;
+		return rc;
+	}
+
+	int SaveSums()
+	{
+		std::sort(dirtyPages.begin(), dirtyPages.end());
+		dirtyPages.erase(std::unique(dirtyPages.begin(), dirtyPages.end()), dirtyPages.end());
+
+		std::vector<unsigned char> buf(64 + dirtyPages.size() * WINRT_CRC_PAGE);
+		std::vector<WinRTIoVec> vecs;
+
+		unsigned char *header = &buf[0];
+		FillHeader(header, writing ? WINRT_CRC_WRITING : 0);
+		WinRTIoVec hv = { header, 64, 0, 0 };
+		vecs.push_back(hv);
+
+		const size_t perPage = WINRT_CRC_PAGE / 4;
+		unsigned char *out = header + 64;
+		for (size_t page : dirtyPages)
+		{
+			size_t first = page * perPage;
+			if (first >= crcs.size())
+				continue;
+			size_t last = std::min(first + perPage, crcs.size());
+			for (size_t i = first; i < last; i++)
+				Put32(out + (i - first) * 4, crcs[i]);
+			WinRTIoVec v = { out, (int)((last - first) * 4), (sqlite_int64)(WINRT_CRC_HEADER + first * 4), 0 };
+			vecs.push_back(v);
+			out += WINRT_CRC_PAGE;
+		}
+
+		int rc = sums->WriteBatch(&vecs[0], (int)vecs.size());
+		if (rc == SQLITE_OK)
+		{
+			dirtyPages.clear();
+			headerDirty = false;
+		}
+		return rc;
+	}
+
+	WinRTStorage *data;
+	WinRTStorage *sums;
+	bool readOnly;
+
+	int blockSize;						// checksum unit; 0 until known
+	sqlite_int64 dataSize;
+	uint32_t zeroCrc;					// CRC of a page of zeros
+	std::vector<uint32_t> crcs;
+	std::vector<size_t> dirtyPages;		// sidecar pages changed since the last sync
+	std::vector<size_t> partial;		// pages to checksum from storage
+	std::vector<unsigned char> scratch;
+	bool headerDirty;
+	bool writing;						// the sidecar on storage is marked WINRT_CRC_WRITING
+};
+
+
+class WinRTChecksumBackendImpl : public WinRTBackend
+{
+public:
+	WinRTChecksumBackendImpl(WinRTBackend *inner) : inner(inner) {}
+
+	virtual int Open(const char *zName, int flags, WinRTStorage **ppStorage)
+	{
+		if (!(flags & SQLITE_OPEN_MAIN_DB))
+			return inner->Open(zName, flags, ppStorage);
+
+		// Checksums live in memory, so connections share one table.
+		return share.Open(zName, ppStorage, [&](WinRTStorage **ppOpened) {
+			return OpenChecked(zName, flags, ppOpened);
+		});
+	}
+
+	virtual int Delete(const char *zName, int dirSync)
+	{
+		int rc = inner->Delete(zName, dirSync);
+		std::string sumsName = std::string(zName) + WINRT_CRC_SUFFIX;
+		inner->Delete(sumsName.c_str(), dirSync);
+		return rc;
+	}
+
+private:
+	int OpenChecked(const char *zName, int flags, WinRTStorage **ppStorage)
+	{
+		WinRTStorage *data = nullptr;
+		int rc = inner->Open(zName, flags, &data);
+		if (rc != SQLITE_OK)
+			return rc;
+
+		// The sidecar is not a database page file for the layers below.
+		std::string sumsName = std::string(zName) + WINRT_CRC_SUFFIX;
+		WinRTStorage *sums = nullptr;
+		if (inner->Open(sumsName.c_str(), flags & ~SQLITE_OPEN_MAIN_DB, &sums) != SQLITE_OK)
+		{
+			// A read-only database without checksums is read unchecked.
+			*ppStorage = data;
+			return SQLITE_OK;
+		}
+
+		WinRTChecksumStorage *storage = new WinRTChecksumStorage(data, sums, (flags & SQLITE_OPEN_READONLY) != 0);
+		rc = storage->Load();
+		if (rc != SQLITE_OK)
+		{
+			delete storage;
+			return rc;
+		}
+		*ppStorage = storage;
+		return SQLITE_OK;
+	}
+
+	WinRTBackend *inner;
+	WinRTStorageShare share;
+};
+
+WinRTBackend *WinRTChecksumBackend(WinRTBackend *inner)
+{
+	return new WinRTChecksumBackendImpl(inner);
+}
@@ -0,0 +1,342 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Encryption stage. Wraps another backend and encrypts every file it
+*		opens (databases, journals, WAL) with XTS-AES, the length-preserving
+*		mode made for disk sectors: each 512-byte sector is one data unit and
+*		its tweak is the sector number, so a page is sealed by its position
+*		and can be read or rewritten without touching its neighbours.
+*		512 bytes is SQLite's smallest page size, so page writes never need a
+*		read-modify-write; journal records, which are not sector aligned, do
+*		at the edges of each run of writes.
+*
+*		A sector at the end of a file that is only partly filled is a shorter
+*		data unit; when the file grows it is read back and sealed again as a
+*		full one. Gaps skipped by a write are filled with encrypted zeros so
+*		they still read back as zeros.
+*
+*		There is no migration: a database must be created with encryption on.
+*/
+
+#include "pch.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "WinRTStorage.h"
+#include "WinRTAes.h"
+
+#define WINRT_CIPHER_SECTOR     512
+#define WINRT_CIPHER_PARALLEL   (256 * 1024)	// batch size worth more threads
+#define WINRT_CIPHER_THREADS    4
+
+static inline sqlite_int64 SectorFloor(sqlite_int64 x) { return x & ~(sqlite_int64)(WINRT_CIPHER_SECTOR - 1); }
+static inline sqlite_int64 SectorCeil(sqlite_int64 x) { return SectorFloor(x + WINRT_CIPHER_SECTOR - 1); }
+
+
+/*
+** Encrypt or decrypt n bytes at iOfst in place. A large batch is split over
+** a few threads; each sector is independent.
+*/
+static void CryptRange(const WinRTXtsKey *key, bool encrypt, unsigned char *p, sqlite_int64 iOfst, size_t n)
+{
+	auto run = [=](size_t from, size_t to) {
+		uint64_t first = (uint64_t)(iOfst + from) / WINRT_CIPHER_SECTOR;
+		if (encrypt)
+			WinRTXtsEncryptUnits(key, first, WINRT_CIPHER_SECTOR, p + from, p + from, to - from);
+		else
+			WinRTXtsDecryptUnits(key, first, WINRT_CIPHER_SECTOR, p + from, p + from, to - from);
+	};
+
+	static const unsigned nThreads = std::min((unsigned)WINRT_CIPHER_THREADS, std::thread::hardware_concurrency());
+	if (n < WINRT_CIPHER_PARALLEL || nThreads < 2)
+	{
+		run(0, n);
+		return;
+	}
+
+	size_t slice = (size_t)SectorCeil((sqlite_int64)(n / nThreads));
+	std::vector<std::thread> workers;
+	for (size_t at = slice; at < n; at += slice)
+		workers.emplace_back(run, at, std::min(at + slice, n));
+	run(0, slice);
+	for (auto &t : workers)
+		t.join();
+}
+
+
+class WinRTCipherStorage : public WinRTStorage
+{
+public:
+	WinRTCipherStorage(WinRTStorage *inner, const WinRTXtsKey *key, sqlite_int64 size)
+		: inner(inner), key(key), size(size) {}
+
+	virtual ~WinRTCipherStorage()
+	{
+		delete inner;
+	}
+
+	/*
+	** Whole sectors are read and decrypted in the caller's buffer; anything
+	** else goes through a scratch buffer.
+	*/
+	virtual int Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead)
+	{
+		sqlite_int64 start = SectorFloor(iOfst);
+		sqlite_int64 end = SectorCeil(iOfst + iAmt);
+		if (start == iOfst && end == iOfst + iAmt)
+		{
+			int rc = inner->Read(zBuf, iAmt, iOfst, pnRead);
+			if (rc == SQLITE_OK)
+				CryptRange(key, false, (unsigned char*)zBuf, iOfst, *pnRead);
+			return rc;
+		}
+
+		scratch.resize((size_t)(end - start));
+		int nRead = 0;
+		int rc = inner->Read(&scratch[0], (int)(end - start), start, &nRead);
+		if (rc != SQLITE_OK) return rc;
+		CryptRange(key, false, &scratch[0], start, nRead);
+
+		int skip = (int)(iOfst - start);
+		int n = nRead > skip ? std::min(nRead - skip, iAmt) : 0;
+		::memcpy(zBuf, &scratch[skip], n);
+		*pnRead = n;
+		return SQLITE_OK;
+	}
+
+	virtual int Write(const void *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		WinRTIoVec vec = { (void*)zBuf, iAmt, iOfst, 0 };
+		return WriteBatch(&vec, 1);
+	}
+
+	/*
+	** Each run of adjacent requests is copied into whole sectors, completed
+	** from storage at its edges, encrypted and handed on as one batch.
+	*/
+	virtual int WriteBatch(WinRTIoVec *aVec, int nVec)
+	{
+		int i = 0;
+		while (i < nVec)
+		{
+			int j = i + 1;
+			while (j < nVec && aVec[j].iOfst == aVec[j - 1].iOfst + aVec[j - 1].iAmt)
+				j++;
+
+			sqlite_int64 runStart = aVec[i].iOfst;
+			sqlite_int64 runEnd = aVec[j - 1].iOfst + aVec[j - 1].iAmt;
+			int rc = SQLITE_OK;
+			if (runStart > size)
+				rc = Stage(nullptr, 0, size, runStart);
+			if (rc == SQLITE_OK)
+				rc = Stage(aVec + i, j - i, runStart, runEnd);
+			if (rc != SQLITE_OK)
+				return rc;
+			for (; i < j; i++)
+				aVec[i].nDone = aVec[i].iAmt;
+		}
+		return Flush();
+	}
+
+	virtual int Truncate(sqlite_int64 newSize)
+	{
+		int rc = SQLITE_OK;
+		if (newSize > size)
+		{
+			rc = Stage(nullptr, 0, size, newSize);
+			return rc == SQLITE_OK ? Flush() : rc;
+		}
+
+		// The new last sector becomes a shorter data unit.
+		if (newSize % WINRT_CIPHER_SECTOR != 0 && newSize < size)
+		{
+			sqlite_int64 sector = SectorFloor(newSize);
+			unsigned char buf[WINRT_CIPHER_SECTOR];
+			int nRead = 0;
+			rc = inner->Read(buf, WINRT_CIPHER_SECTOR, sector, &nRead);
+			if (rc != SQLITE_OK) return rc;
+			CryptRange(key, false, buf, sector, nRead);
+			CryptRange(key, true, buf, sector, (size_t)(newSize - sector));
+			rc = inner->Write(buf, (int)(newSize - sector), sector);
+			if (rc != SQLITE_OK) return rc;
+		}
+		rc = inner->Truncate(newSize);
+		if (rc == SQLITE_OK)
+			size = newSize;
+		return rc;
+	}
+
+	virtual int Sync(int flags)
+	{
+		return inner->Sync(flags);
+	}
+
+	virtual int FileSize(sqlite_int64 *pSize)
+	{
+		*pSize = size;
+		return SQLITE_OK;
+	}
+
+	virtual int ChangeToken(sqlite_uint64 *pToken)
+	{
+		return inner->ChangeToken(pToken);
+	}
+
+private:
+	/*
+	** Queue encrypted sectors covering [from, to). The plaintext comes from
+	** the nVec adjacent requests in aVec, or is zeros if aVec is null. Bytes
+	** of the edge sectors outside the range are read back from storage.
+	*/
+	int Stage(const WinRTIoVec *aVec, int nVec, sqlite_int64 from, sqlite_int64 to)
+	{
+		if (to <= from)
+			return SQLITE_OK;
+		sqlite_int64 start = SectorFloor(from);
+		sqlite_int64 end = SectorCeil(to);
+		sqlite_int64 last = end - WINRT_CIPHER_SECTOR;
+		sqlite_int64 newSize = std::max(size, to);
+		sqlite_int64 stored = std::min(end, newSize);	// bytes this run leaves on disk
+
+		// Edge sectors that hold data outside the run are completed first,
+		// after any earlier run still waiting on them has been written.
+		bool readHead = from > start && start < size;
+		bool readTail = to < end && to < size && (last > start || !readHead);
+		if ((readHead && IsStaged(start)) || (readTail && IsStaged(last)))
+		{
+			int rc = Flush();
+			if (rc != SQLITE_OK) return rc;
+		}
+
+		size_t at = plain.size();
+		plain.resize(at + (size_t)(end - start));
+		unsigned char *p = &plain[at];
+		::memset(p, 0, (size_t)(end - start));
+		if (readHead)
+		{
+			int rc = ReadBack(p, start);
+			if (rc != SQLITE_OK) return rc;
+		}
+		if (readTail)
+		{
+			int rc = ReadBack(p + (last - start), last);
+			if (rc != SQLITE_OK) return rc;
+		}
+
+		for (int i = 0; i < nVec; i++)
+			::memcpy(p + (aVec[i].iOfst - start), aVec[i].zBuf, aVec[i].iAmt);
+
+		CryptRange(key, true, p, start, (size_t)(stored - start));
+		StagedWrite s = { at, (int)(stored - start), start };
+		staged.push_back(s);
+		plain.resize(at + (size_t)(stored - start));
+		size = newSize;
+		return SQLITE_OK;
+	}
+
+	bool IsStaged(sqlite_int64 iOfst) const
+	{
+		for (const StagedWrite &s : staged)
+			if (iOfst >= s.iOfst && iOfst < s.iOfst + s.iAmt)
+				return true;
+		return false;
+	}
+
+	/*
+	** Decrypted contents of the sector at iOfst, written into p.
+	*/
+	int ReadBack(unsigned char *p, sqlite_int64 iOfst)
+	{
+		int nRead = 0;
+		int rc = inner->Read(p, WINRT_CIPHER_SECTOR, iOfst, &nRead);
+		if (rc == SQLITE_OK)
+			CryptRange(key, false, p, iOfst, nRead);
+		return rc;
+	}
+
+	int Flush()
+	{
+		if (staged.empty())
+			return SQLITE_OK;
+		vecs.resize(staged.size());
+		for (size_t i = 0; i < staged.size(); i++)
+		{
+			WinRTIoVec v = { &plain[staged[i].at], staged[i].iAmt, staged[i].iOfst, 0 };
+			vecs[i] = v;
+		}
+		int rc = inner->WriteBatch(&vecs[0], (int)vecs.size());
+		staged.clear();
+		plain.clear();
+		return rc;
+	}
+
+	struct StagedWrite
+	{
+		size_t at;				// position in plain (encrypted by then)
+		int iAmt;
+		sqlite_int64 iOfst;
+	};
+
+	WinRTStorage *inner;
+	const WinRTXtsKey *key;
+	sqlite_int64 size;					// file size including staged writes
+
+	std::vector<unsigned char> plain;	// sectors being prepared for a batch
+	std::vector<StagedWrite> staged;
+	std::vector<WinRTIoVec> vecs;
+	std::vector<unsigned char> scratch;
+};
+
+
+class WinRTCipherBackendImpl : public WinRTBackend
+{
+public:
+	WinRTCipherBackendImpl(WinRTBackend *inner, const WinRTXtsKey &key) : inner(inner), key(key) {}
+
+	virtual int Open(const char *zName, int flags, WinRTStorage **ppStorage)
+	{
+		// The file size is cached, so connections share one storage per file.
+		return share.Open(zName, ppStorage, [&](WinRTStorage **ppOpened) {
+			WinRTStorage *storage = nullptr;
+			int rc = inner->Open(zName, flags, &storage);
+			if (rc != SQLITE_OK)
+				return rc;
+			sqlite_int64 size = 0;
+			rc = storage->FileSize(&size);
+			if (rc != SQLITE_OK)
+			{
+				delete storage;
+				return rc;
+			}
+			*ppOpened = new WinRTCipherStorage(storage, &key, size);
+			return SQLITE_OK;
+		});
+	}
+
+	virtual int Delete(const char *zName, int dirSync)
+	{
+		return inner->Delete(zName, dirSync);
+	}
+
+private:
+	WinRTBackend *inner;
+	WinRTXtsKey key;
+	WinRTStorageShare share;
+};
+
+WinRTBackend *WinRTCipherBackend(WinRTBackend *inner, const void *pKey, int nKey)
+{
+	WinRTXtsKey key;
+	if (::WinRTXtsSetKey(&key, pKey, nKey) != 0)
+		return nullptr;
+	return new WinRTCipherBackendImpl(inner, key);
+}
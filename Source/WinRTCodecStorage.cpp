@@ -0,0 +1,636 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Page codec stage. Wraps another backend and stores main database files
+*		as LZ-compressed fixed-size blocks, so fewer bytes cross slow storage.
+*
+*		The database file becomes a container of compressed extents, and a
+*		sidecar "<name>-lzmap" holds the offset map: a header page followed by
+*		one 8-byte entry per logical block (extent offset, stored length, kind).
+*		Finding a block is an array lookup, so random page access stays O(1).
+*
+*		Extents are copy-on-write: a rewritten block always goes to space the
+*		last saved map does not reference, and replaced extents only become
+*		reusable after the next map has been synced. After a crash the map
+*		therefore always points at intact data.
+*
+*		Connections to the same database share one in-memory map.
+*
+*		Journals and other files pass through unchanged, as do existing
+*		databases that were created without the codec.
+*/
+
+#include "pch.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "WinRTStorage.h"
+#include "WinRTLz.h"
+
+#define WINRT_CODEC_BLOCK       4096		// logical block size
+#define WINRT_CODEC_ALIGN       16			// granularity of extents
+#define WINRT_CODEC_MAP_HEADER  4096		// map file: header, then entries
+#define WINRT_CODEC_MAP_PAGE    4096		// map entries are written per page
+#define WINRT_CODEC_ENTRY       8
+#define WINRT_CODEC_SUFFIX      "-lzmap"
+
+static const char codecMagic[16] = "WinRTVFS lzmap";
+
+// Block kinds recorded in the map
+#define CODEC_ZERO      0		// never written or all zeros; no extent
+#define CODEC_LZ        1
+#define CODEC_RAW       2		// did not compress
+
+
+static inline void Put32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24);
+}
+
+static inline uint32_t Get32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+class WinRTCodecStorage : public WinRTStorage
+{
+public:
+	WinRTCodecStorage(WinRTStorage *data, WinRTStorage *map)
+		: data(data), map(map), cur(-1), curDirty(false), logicalSize(0),
+		physEnd(0), headerDirty(true)
+	{
+		block.resize(WINRT_CODEC_BLOCK);
+		packed.resize(WINRT_LZ_BOUND(WINRT_CODEC_BLOCK));
+	}
+
+	virtual ~WinRTCodecStorage()
+	{
+		Sync(SQLITE_SYNC_NORMAL);	// never leave the saved map behind the data
+		delete data;
+		delete map;
+	}
+
+	/*
+	** Read the map of an existing container. A map file without a valid
+	** header is treated as a new, empty container.
+	*/
+	int Load()
+	{
+		unsigned char header[64];
+		int nRead = 0;
+		int rc = map->Read(header, sizeof(header), 0, &nRead);
+		if (rc != SQLITE_OK) return rc;
+		if (nRead < (int)sizeof(header) || ::memcmp(header, codecMagic, sizeof(codecMagic)) != 0)
+			return SQLITE_OK;
+		if (Get32(header + 16) != WINRT_CODEC_BLOCK)
+			return SQLITE_NOTADB;
+
+		logicalSize = Get32(header + 24) | ((sqlite_int64)Get32(header + 28) << 32);
+		uint32_t nEntries = Get32(header + 32);
+
+		std::vector<unsigned char> raw((size_t)nEntries * WINRT_CODEC_ENTRY);
+		if (nEntries > 0)
+		{
+			rc = map->Read(&raw[0], (int)raw.size(), WINRT_CODEC_MAP_HEADER, &nRead);
+			if (rc != SQLITE_OK) return rc;
+			if (nRead != (int)raw.size()) return SQLITE_CORRUPT;
+		}
+
+		entries.resize(nEntries);
+		std::map<uint64_t, uint32_t> usedExtents;
+		for (uint32_t i = 0; i < nEntries; i++)
+		{
+			Entry &e = entries[i];
+			const unsigned char *p = &raw[(size_t)i * WINRT_CODEC_ENTRY];
+			e.offset = Get32(p);
+			e.length = (uint16_t)(p[4] | (p[5] << 8));
+			e.kind = (uint16_t)(p[6] | (p[7] << 8));
+			if (e.kind != CODEC_ZERO)
+				usedExtents[ExtentOffset(e)] = ExtentLength(e);
+		}
+
+		// Everything between referenced extents is free.
+		for (auto &x : usedExtents)
+		{
+			if (x.first > physEnd)
+				Release(physEnd, (uint32_t)(x.first - physEnd));
+			physEnd = x.first + x.second;
+		}
+		headerDirty = false;
+		return SQLITE_OK;
+	}
+
+	virtual int Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead)
+	{
+		*pnRead = 0;
+		if (iOfst >= logicalSize)
+			return SQLITE_OK;
+		int n = (int)(iOfst + iAmt > logicalSize ? logicalSize - iOfst : iAmt);
+
+		int done = 0;
+		while (done < n)
+		{
+			sqlite_int64 pos = iOfst + done;
+			int64_t b = pos / WINRT_CODEC_BLOCK;
+			int within = (int)(pos % WINRT_CODEC_BLOCK);
+			int piece = WINRT_CODEC_BLOCK - within;
+			if (piece > n - done) piece = n - done;
+
+			int rc = Acquire(b);
+			if (rc != SQLITE_OK) return rc;
+			::memcpy((char*)zBuf + done, &block[within], piece);
+			done += piece;
+		}
+		*pnRead = n;
+		return SQLITE_OK;
+	}
+
+	virtual int Write(const void *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		WinRTIoVec vec = { (void*)zBuf, iAmt, iOfst, 0 };
+		return WriteBatch(&vec, 1);
+	}
+
+	/*
+	** Every block touched by the batch is compressed once, and the new
+	** extents go to storage as one WriteBatch of their own.
+	*/
+	virtual int WriteBatch(WinRTIoVec *aVec, int nVec)
+	{
+		for (int i = 0; i < nVec; i++)
+		{
+			const WinRTIoVec &v = aVec[i];
+			int done = 0;
+			while (done < v.iAmt)
+			{
+				sqlite_int64 pos = v.iOfst + done;
+				int64_t b = pos / WINRT_CODEC_BLOCK;
+				int within = (int)(pos % WINRT_CODEC_BLOCK);
+				int piece = WINRT_CODEC_BLOCK - within;
+				if (piece > v.iAmt - done) piece = v.iAmt - done;
+
+				int rc = (within == 0 && piece == WINRT_CODEC_BLOCK) ? Replace(b) : Acquire(b);
+				if (rc != SQLITE_OK) return rc;
+				::memcpy(&block[within], (const char*)v.zBuf + done, piece);
+				curDirty = true;
+				done += piece;
+			}
+			if (v.iOfst + v.iAmt > logicalSize)
+			{
+				logicalSize = v.iOfst + v.iAmt;
+				headerDirty = true;
+			}
+			aVec[i].nDone = v.iAmt;
+		}
+
+		int rc = Stage();
+		if (rc != SQLITE_OK) return rc;
+		return FlushStaged();
+	}
+
+	virtual int Truncate(sqlite_int64 size)
+	{
+		int64_t nBlocks = (size + WINRT_CODEC_BLOCK - 1) / WINRT_CODEC_BLOCK;
+		if (cur >= nBlocks)
+			cur = -1;
+		for (int64_t b = nBlocks; b < (int64_t)entries.size(); b++)
+			Drop(entries[(size_t)b]);
+		if ((int64_t)entries.size() > nBlocks)
+			entries.resize((size_t)nBlocks);
+
+		// Zero the tail of a partial last block so growing the file again
+		// reads zeros, as it would from a real truncate.
+		int within = (int)(size % WINRT_CODEC_BLOCK);
+		if (within != 0 && nBlocks > 0 && nBlocks <= (int64_t)entries.size()
+			&& entries[(size_t)(nBlocks - 1)].kind != CODEC_ZERO)
+		{
+			int rc = Acquire(nBlocks - 1);
+			if (rc != SQLITE_OK) return rc;
+			::memset(&block[within], 0, WINRT_CODEC_BLOCK - within);
+			curDirty = true;
+			rc = Stage();
+			if (rc == SQLITE_OK) rc = FlushStaged();
+			if (rc != SQLITE_OK) return rc;
+		}
+
+		logicalSize = size;
+		headerDirty = true;
+		return SQLITE_OK;
+	}
+
+	/*
+	** Data first, then the map, so a synced map never references data that
+	** is not on the device.
+	*/
+	virtual int Sync(int flags)
+	{
+		int rc = data->Sync(flags);
+		if (rc != SQLITE_OK) return rc;
+		if (!headerDirty && dirtyPages.empty())
+			return SQLITE_OK;
+
+		rc = SaveMap();
+		if (rc == SQLITE_OK) rc = map->Sync(flags);
+		if (rc != SQLITE_OK) return rc;
+
+		for (auto &x : pendingFree)
+			Release(x.first, x.second);
+		pendingFree.clear();
+		return SQLITE_OK;
+	}
+
+	virtual int FileSize(sqlite_int64 *pSize)
+	{
+		*pSize = logicalSize;
+		return SQLITE_OK;
+	}
+
+	virtual int ChangeToken(sqlite_uint64 *pToken)
+	{
+		return data->ChangeToken(pToken);
+	}
+
+private:
+	struct Entry
+	{
+		uint32_t offset;	// extent offset / WINRT_CODEC_ALIGN
+		uint16_t length;	// stored bytes
+		uint16_t kind;
+	};
+
+	static uint64_t ExtentOffset(const Entry &e) { return (uint64_t)e.offset * WINRT_CODEC_ALIGN; }
+	static uint32_t ExtentLength(const Entry &e) { return (e.length + WINRT_CODEC_ALIGN - 1) & ~(WINRT_CODEC_ALIGN - 1); }
+
+	/*
+	** Make block b the current block, decompressed into block[].
+	*/
+	int Acquire(int64_t b)
+	{
+		if (b == cur)
+			return SQLITE_OK;
+		int rc = Stage();
+		if (rc != SQLITE_OK) return rc;
+		// The block may live in an extent that is still only staged.
+		rc = FlushStaged();
+		if (rc != SQLITE_OK) return rc;
+
+		cur = -1;
+		if (b >= (int64_t)entries.size() || entries[(size_t)b].kind == CODEC_ZERO)
+			::memset(&block[0], 0, WINRT_CODEC_BLOCK);
+		else
+		{
+			const Entry &e = entries[(size_t)b];
+			int nRead = 0;
+			rc = data->Read(&packed[0], e.length, ExtentOffset(e), &nRead);
+			if (rc != SQLITE_OK) return rc;
+			if (nRead != e.length) return SQLITE_CORRUPT;
+
+			if (e.kind == CODEC_RAW)
+				::memcpy(&block[0], &packed[0], WINRT_CODEC_BLOCK);
+			else if (WinRTLzDecompress(&packed[0], e.length, &block[0], WINRT_CODEC_BLOCK) != WINRT_CODEC_BLOCK)
+				return SQLITE_CORRUPT;
+		}
+		cur = b;
+		return SQLITE_OK;
+	}
+
+	/*
+	** Make block b current without reading it; the caller overwrites all of it.
+	*/
+	int Replace(int64_t b)
+	{
+		if (b == cur)
+			return SQLITE_OK;
+		int rc = Stage();
+		if (rc != SQLITE_OK) return rc;
+		cur = b;
+		return SQLITE_OK;
+	}
+
+	/*
+	** Compress the current block if it was modified and queue its new extent.
+	*/
+	int Stage()
+	{
+		if (cur < 0 || !curDirty)
+			return SQLITE_OK;
+		curDirty = false;
+
+		if ((int64_t)entries.size() <= cur)
+		{
+			entries.resize((size_t)cur + 1, Entry());
+			headerDirty = true;
+		}
+		Entry &e = entries[(size_t)cur];
+		Drop(e);
+		MarkDirty(cur);
+
+		bool zero = true;
+		for (int i = 0; i < WINRT_CODEC_BLOCK && zero; i += 8)
+		{
+			uint64_t w;
+			::memcpy(&w, &block[i], 8);
+			zero = (w == 0);
+		}
+		if (zero)
+			return SQLITE_OK;
+
+		size_t at = staging.size();
+		staging.resize(at + WINRT_LZ_BOUND(WINRT_CODEC_BLOCK));
+		int n = WinRTLzCompress(&block[0], WINRT_CODEC_BLOCK, &staging[at], WINRT_CODEC_BLOCK - WINRT_CODEC_ALIGN);
+		if (n > 0)
+			e.kind = CODEC_LZ;
+		else
+		{
+			::memcpy(&staging[at], &block[0], WINRT_CODEC_BLOCK);
+			n = WINRT_CODEC_BLOCK;
+			e.kind = CODEC_RAW;
+		}
+		e.length = (uint16_t)n;
+		staging.resize(at + n);
+
+		uint64_t ofst = Allocate(ExtentLength(e));
+		e.offset = (uint32_t)(ofst / WINRT_CODEC_ALIGN);
+
+		StagedWrite s = { at, n, (sqlite_int64)ofst };
+		staged.push_back(s);
+		return SQLITE_OK;
+	}
+
+	int FlushStaged()
+	{
+		if (staged.empty())
+			return SQLITE_OK;
+
+		std::vector<WinRTIoVec> vecs(staged.size());
+		for (size_t i = 0; i < staged.size(); i++)
+		{
+			WinRTIoVec v = { &staging[staged[i].at], staged[i].iAmt, staged[i].iOfst, 0 };
+			vecs[i] = v;
+		}
+		int rc = data->WriteBatch(&vecs[0], (int)vecs.size());
+		staged.clear();
+		staging.clear();
+		return rc;
+	}
+
+	/*
+	** Forget the extent behind e. Its space is reusable after the next sync.
+	*/
+	void Drop(Entry &e)
+	{
+		if (e.kind != CODEC_ZERO)
+			pendingFree.push_back(std::make_pair(ExtentOffset(e), ExtentLength(e)));
+		e.kind = CODEC_ZERO;
+		e.length = 0;
+		e.offset = 0;
+	}
+
+	void MarkDirty(int64_t b)
+	{
+		int64_t page = b * WINRT_CODEC_ENTRY / WINRT_CODEC_MAP_PAGE;
+		if (dirtyPages.empty() || dirtyPages.back() != page)
+			dirtyPages.push_back(page);
+	}
+
+	/*
+	** Best fit from the free extents, else grow the container.
+	*/
+	uint64_t Allocate(uint32_t len)
+	{
+		auto it = freeBySize.lower_bound(len);
+		if (it == freeBySize.end())
+		{
+			uint64_t ofst = physEnd;
+			physEnd += len;
+			return ofst;
+		}
+		uint32_t size = it->first;
+		uint64_t ofst = it->second;
+		freeBySize.erase(it);
+		freeByOffset.erase(ofst);
+		if (size > len)
+			Insert(ofst + len, size - len);
+		return ofst;
+	}
+
+	/*
+	** Return an extent to the free lists, merging it with its neighbours.
+	*/
+	void Release(uint64_t ofst, uint32_t len)
+	{
+		auto next = freeByOffset.lower_bound(ofst);
+		if (next != freeByOffset.end() && next->first == ofst + len)
+		{
+			len += next->second;
+			Remove(next->first, next->second);
+		}
+		auto prev = freeByOffset.lower_bound(ofst);
+		if (prev != freeByOffset.begin())
+		{
+			--prev;
+			if (prev->first + prev->second == ofst)
+			{
+				ofst = prev->first;
+				len += prev->second;
+				Remove(prev->first, prev->second);
+			}
+		}
+		if (ofst + len == physEnd)
+			physEnd = ofst;
+		else
+			Insert(ofst, len);
+	}
+
+	void Insert(uint64_t ofst, uint32_t len)
+	{
+		freeByOffset[ofst] = len;
+		freeBySize.insert(std::make_pair(len, ofst));
+	}
+
+	void Remove(uint64_t ofst, uint32_t len)
+	{
+		freeByOffset.erase(ofst);
+		auto range = freeBySize.equal_range(len);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (it->second == ofst)
+			{
+				freeBySize.erase(it);
+				break;
+			}
+		}
+	}
+
+	/*
+	** Write the header and every map page with a changed entry.
+	*/
+	int SaveMap()
+	{
+		std::sort(dirtyPages.begin(), dirtyPages.end());
+		dirtyPages.erase(std::unique(dirtyPages.begin(), dirtyPages.end()), dirtyPages.end());
+
+		std::vector<WinRTIoVec> vecs;
+		std::vector<unsigned char> buf(WINRT_CODEC_MAP_HEADER + dirtyPages.size() * WINRT_CODEC_MAP_PAGE);
+
+		unsigned char *header = &buf[0];
+		::memcpy(header, codecMagic, sizeof(codecMagic));
+		Put32(header + 16, WINRT_CODEC_BLOCK);
+		Put32(header + 24, (uint32_t)logicalSize);
+		Put32(header + 28, (uint32_t)(logicalSize >> 32));
+		Put32(header + 32, (uint32_t)entries.size());
+		WinRTIoVec hv = { header, 64, 0, 0 };
+		vecs.push_back(hv);
+
+		const int perPage = WINRT_CODEC_MAP_PAGE / WINRT_CODEC_ENTRY;
+		unsigned char *out = header + WINRT_CODEC_MAP_HEADER;
+		for (int64_t page : dirtyPages)
+		{
+			size_t first = (size_t)(page * perPage);
+			if (first >= entries.size())
+				continue;
+			size_t last = first + perPage < entries.size() ? first + perPage : entries.size();
+			unsigned char *p = out;
+			for (size_t i = first; i < last; i++, p += WINRT_CODEC_ENTRY)
+			{
+				const Entry &e = entries[i];
+				Put32(p, e.offset);
+				p[4] = (unsigned char)e.length; p[5] = (unsigned char)(e.length >> 8);
+				p[6] = (unsigned char)e.kind; p[7] = (unsigned char)(e.kind >> 8);
+			}
+			WinRTIoVec v = { out, (int)(p - out), WINRT_CODEC_MAP_HEADER + page * WINRT_CODEC_MAP_PAGE, 0 };
+			vecs.push_back(v);
+			out += WINRT_CODEC_MAP_PAGE;
+		}
+
+		int rc = map->WriteBatch(&vecs[0], (int)vecs.size());
+		if (rc == SQLITE_OK)
+		{
+			dirtyPages.clear();
+			headerDirty = false;
+		}
+		return rc;
+	}
+
+	struct StagedWrite
+	{
+		size_t at;			// position in staging
+		int iAmt;
+		sqlite_int64 iOfst;	// extent offset in the container
+	};
+
+	WinRTStorage *data;
+	WinRTStorage *map;
+
+	std::vector<Entry> entries;
+	std::vector<int64_t> dirtyPages;	// map pages changed since the last sync
+	std::vector<unsigned char> block;	// current block, decompressed
+	std::vector<unsigned char> packed;	// compressed extent being read
+	int64_t cur;
+	bool curDirty;
+	sqlite_int64 logicalSize;
+
+	std::vector<unsigned char> staging;	// compressed extents not yet written
+	std::vector<StagedWrite> staged;
+
+	uint64_t physEnd;					// end of the last allocated extent
+	std::map<uint64_t, uint32_t> freeByOffset;
+	std::multimap<uint32_t, uint64_t> freeBySize;
+	std::vector<std::pair<uint64_t, uint32_t> > pendingFree;
+	bool headerDirty;
+};
+
+
+class WinRTCodecBackendImpl : public WinRTBackend
+{
+public:
+	WinRTCodecBackendImpl(WinRTBackend *inner) : inner(inner) {}
+
+	virtual int Open(const char *zName, int flags, WinRTStorage **ppStorage)
+	{
+		if (!(flags & SQLITE_OPEN_MAIN_DB))
+			return inner->Open(zName, flags, ppStorage);
+
+		// The map lives in memory, so connections share one container.
+		return share.Open(zName, ppStorage, [&](WinRTStorage **ppOpened) {
+			return OpenContainer(zName, flags, ppOpened);
+		});
+	}
+
+	virtual int Delete(const char *zName, int dirSync)
+	{
+		int rc = inner->Delete(zName, dirSync);
+		std::string mapName = std::string(zName) + WINRT_CODEC_SUFFIX;
+		inner->Delete(mapName.c_str(), dirSync);
+		return rc;
+	}
+
+private:
+	int OpenContainer(const char *zName, int flags, WinRTStorage **ppStorage)
+	{
+		WinRTStorage *data = nullptr;
+		int rc = inner->Open(zName, flags, &data);
+		if (rc != SQLITE_OK)
+			return rc;
+
+		std::string mapName = std::string(zName) + WINRT_CODEC_SUFFIX;
+		WinRTStorage *map = nullptr;
+		sqlite_int64 mapSize = 0, dataSize = 0;
+		if (inner->Open(mapName.c_str(), flags, &map) == SQLITE_OK)
+			map->FileSize(&mapSize);
+		data->FileSize(&dataSize);
+
+		if (mapSize == 0 && dataSize > 0)
+		{
+			// A database created without the codec: leave it as it is.
+			if (map)
+			{
+				delete map;
+				if (!(flags & SQLITE_OPEN_READONLY))
+					inner->Delete(mapName.c_str(), 0);
+			}
+			*ppStorage = data;
+			return SQLITE_OK;
+		}
+		if (map == nullptr)
+		{
+			delete data;
+			return SQLITE_CANTOPEN;
+		}
+		if (dataSize == 0 && mapSize > 0 && !(flags & SQLITE_OPEN_READONLY))
+		{
+			// The database was deleted behind our back; the map is stale.
+			map->Truncate(0);
+		}
+
+		WinRTCodecStorage *storage = new WinRTCodecStorage(data, map);
+		rc = storage->Load();
+		if (rc != SQLITE_OK)
+		{
+			delete storage;
+			return rc;
+		}
+		*ppStorage = storage;
+		return SQLITE_OK;
+	}
+
+	WinRTBackend *inner;
+	WinRTStorageShare share;
+};
+
+WinRTBackend *WinRTCodecBackend(WinRTBackend *inner)
+{
+	return new WinRTCodecBackendImpl(inner);
+}
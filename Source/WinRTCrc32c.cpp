@@ -0,0 +1,244 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		The hardware path splits long input into three stripes, runs one CRC
+*		instruction chain per stripe, and merges the results by "shifting" the
+*		first two stripe CRCs over the bytes that follow them. A shift over a
+*		fixed number of zero bytes is linear in the CRC, so it is a lookup in
+*		four 256-entry tables built once per stripe length.
+*/
+
+#include "pch.h"
+
+#include <string.h>
+#include <mutex>
+
+#include "WinRTCrc32c.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define WINRT_CRC_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define WINRT_CRC_TARGET
+#else
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define WINRT_CRC_TARGET __attribute__((target("sse4.2")))
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define WINRT_CRC_ARM 1
+#if defined(_MSC_VER)
+#include <arm64intr.h>
+#define WINRT_CRC_TARGET
+#else
+#include <arm_acle.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#define WINRT_CRC_TARGET __attribute__((target("+crc")))
+#endif
+#endif
+
+#define CRC_POLY        0x82F63B78u		// reflected Castagnoli polynomial
+#define CRC_LONG        1360			// stripe lengths for the hardware path:
+#define CRC_SHORT       336				// 3 * 1360 + 16 = 4096, 3 * 336 + 16 = 1024
+
+
+static uint32_t crcTable[8][256];		// slicing-by-8
+static uint32_t crcLong[4][256];		// shift by CRC_LONG zero bytes
+static uint32_t crcShort[4][256];		// shift by CRC_SHORT zero bytes
+static int crcHardware;
+static std::once_flag crcOnce;
+
+
+/*
+** Advance a raw CRC register over n zero bytes, one byte at a time.
+*/
+static uint32_t CrcZeros(uint32_t crc, size_t n)
+{
+	while (n--)
+		crc = crcTable[0][crc & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static void CrcShiftTable(uint32_t table[4][256], size_t n)
+{
+	for (int k = 0; k < 4; k++)
+		for (uint32_t v = 0; v < 256; v++)
+			table[k][v] = CrcZeros(v << (8 * k), n);
+}
+
+static inline uint32_t CrcShift(const uint32_t table[4][256], uint32_t crc)
+{
+	return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+		table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+static int CrcDetect()
+{
+#if WINRT_CRC_X86
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] >> 20) & 1;
+#else
+	unsigned a, b, c, d;
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return 0;
+	return (c & bit_SSE4_2) != 0;
+#endif
+#elif WINRT_CRC_ARM
+#if defined(_MSC_VER) || defined(__ARM_FEATURE_CRC32)
+	return 1;		// every Windows on ARM64 device has the CRC extension
+#elif defined(__linux__)
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+	return 0;
+#endif
+#else
+	return 0;
+#endif
+}
+
+/*
+** Build the tables and pick an implementation; runs once.
+*/
+static void CrcInit()
+{
+	for (uint32_t v = 0; v < 256; v++)
+	{
+		uint32_t crc = v;
+		for (int k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (CRC_POLY & (0u - (crc & 1)));
+		crcTable[0][v] = crc;
+	}
+	for (uint32_t v = 0; v < 256; v++)
+		for (int k = 1; k < 8; k++)
+			crcTable[k][v] = crcTable[0][crcTable[k - 1][v] & 0xff] ^ (crcTable[k - 1][v] >> 8);
+
+	CrcShiftTable(crcLong, CRC_LONG);
+	CrcShiftTable(crcShort, CRC_SHORT);
+	crcHardware = CrcDetect();
+}
+
+
+uint32_t WinRTCrc32cSoftware(uint32_t crc, const void *pBuf, size_t n)
+{
+	std::call_once(crcOnce, CrcInit);
+
+	const unsigned char *p = (const unsigned char*)pBuf;
+	crc = ~crc;
+	while (n >= 8)
+	{
+		uint32_t lo, hi;
+		::memcpy(&lo, p, 4);
+		::memcpy(&hi, p + 4, 4);
+		lo ^= crc;		// little-endian byte order assumed, as on every target
+		crc = crcTable[7][lo & 0xff] ^ crcTable[6][(lo >> 8) & 0xff] ^
+			crcTable[5][(lo >> 16) & 0xff] ^ crcTable[4][lo >> 24] ^
+			crcTable[3][hi & 0xff] ^ crcTable[2][(hi >> 8) & 0xff] ^
+			crcTable[1][(hi >> 16) & 0xff] ^ crcTable[0][hi >> 24];
+		p += 8;
+		n -= 8;
+	}
+	while (n--)
+		crc = crcTable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+
+#if WINRT_CRC_X86 || WINRT_CRC_ARM
+
+#if WINRT_CRC_X86
+#if defined(_M_X64) || defined(__x86_64__)
+#define CRC_WORD(c, p)      ((uint32_t)_mm_crc32_u64((c), Load64(p)))
+#else
+#define CRC_WORD(c, p)      _mm_crc32_u32(_mm_crc32_u32((c), Load32(p)), Load32((p) + 4))
+#endif
+#define CRC_BYTE(c, b)      _mm_crc32_u8((c), (b))
+#else
+#define CRC_WORD(c, p)      __crc32cd((c), Load64(p))
+#define CRC_BYTE(c, b)      __crc32cb((c), (b))
+#endif
+
+static inline uint64_t Load64(const unsigned char *p)
+{
+	uint64_t v;
+	::memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint32_t Load32(const unsigned char *p)
+{
+	uint32_t v;
+	::memcpy(&v, p, 4);
+	return v;
+}
+
+/*
+** Three stripes of len bytes each, then merge. len is a multiple of 8.
+*/
+#define CRC_STRIPES(len, table)                                             \
+	while (n >= 3 * (len))                                                  \
+	{                                                                       \
+		uint32_t c1 = 0, c2 = 0;                                            \
+		const unsigned char *end = p + (len);                               \
+		do                                                                  \
+		{                                                                   \
+			crc = CRC_WORD(crc, p);                                         \
+			c1 = CRC_WORD(c1, p + (len));                                   \
+			c2 = CRC_WORD(c2, p + 2 * (len));                               \
+			p += 8;                                                         \
+		} while (p < end);                                                  \
+		crc = CrcShift(table, crc) ^ c1;                                    \
+		crc = CrcShift(table, crc) ^ c2;                                    \
+		p += 2 * (len);                                                     \
+		n -= 3 * (len);                                                     \
+	}
+
+WINRT_CRC_TARGET
+static uint32_t CrcHardware(uint32_t crc, const unsigned char *p, size_t n)
+{
+	crc = ~crc;
+	while (n > 0 && ((uintptr_t)p & 7) != 0)
+	{
+		crc = CRC_BYTE(crc, *p++);
+		n--;
+	}
+	CRC_STRIPES(CRC_LONG, crcLong)
+	CRC_STRIPES(CRC_SHORT, crcShort)
+	while (n >= 8)
+	{
+		crc = CRC_WORD(crc, p);
+		p += 8;
+		n -= 8;
+	}
+	while (n--)
+		crc = CRC_BYTE(crc, *p++);
+	return ~crc;
+}
+
+#endif
+
+uint32_t WinRTCrc32c(uint32_t crc, const void *pBuf, size_t n)
+{
+	std::call_once(crcOnce, CrcInit);
+#if WINRT_CRC_X86 || WINRT_CRC_ARM
+	if (crcHardware)
+		return CrcHardware(crc, (const unsigned char*)pBuf, n);
+#endif
+	return WinRTCrc32cSoftware(crc, pBuf, n);
+}
+
+int WinRTCrc32cHardware()
+{
+	std::call_once(crcOnce, CrcInit);
+	return crcHardware;
+}
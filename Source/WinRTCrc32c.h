@@ -0,0 +1,26 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+** CRC-32C (Castagnoli), as used by iSCSI and ext4. Pass 0 to start and the
+** previous result to continue over more data.
+**
+** WinRTCrc32c uses the SSE4.2 or ARMv8 CRC32C instructions when the CPU has
+** them, with three interleaved streams to hide the instruction latency, and
+** falls back to WinRTCrc32cSoftware (slicing-by-8 tables) otherwise.
+** WinRTCrc32cHardware reports which one is in use.
+*/
+uint32_t WinRTCrc32c(uint32_t crc, const void *pBuf, size_t n);
+uint32_t WinRTCrc32cSoftware(uint32_t crc, const void *pBuf, size_t n);
+int WinRTCrc32cHardware();
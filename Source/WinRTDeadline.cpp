@@ -0,0 +1,202 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+/*
+*		A deadline is kept in thread-local storage, where the backend a
+*		storage call reaches can find it without it being passed down
+*		through the layers in between. Cancellation is a process-wide
+*		generation: WinRTIoCancelAll moves it on, and an operation whose
+*		deadline took an older one is cancelled. Checking either costs a
+*		clock read and one relaxed load, made once per wait slice.
+*/
+
+#include "pch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include "WinRTDeadline.h"
+#include "WinRTTimer.h"
+
+#if defined(_MSC_VER)
+#define WINRT_THREAD __declspec(thread)
+#else
+#define WINRT_THREAD __thread
+#endif
+
+static std::atomic<unsigned> generation(0);
+static std::atomic<sqlite_uint64> jitterState(0);
+
+static std::atomic<long long> timeouts(0);
+static std::atomic<long long> cancels(0);
+static std::atomic<long long> retries(0);
+static std::atomic<long long> retryMicro(0);
+static std::atomic<long long> exhausted(0);
+
+static WINRT_THREAD sqlite_int64 threadDeadline = 0;    // clock microseconds; 0 for none
+static WINRT_THREAD unsigned threadGeneration = 0;
+static WINRT_THREAD int threadBounded = 0;              // inside a WinRTIoDeadline
+static WINRT_THREAD int threadCounted = 0;              // its operation counted as given up
+
+static sqlite_int64 ClockMicro()
+{
+	return (sqlite_int64)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+void WinRTIoPolicyDefault(WinRTIoPolicy *pPolicy)
+{
+	pPolicy->openMicro = 0;
+	pPolicy->readMicro = 0;
+	pPolicy->writeMicro = 0;
+	pPolicy->syncMicro = 0;
+	pPolicy->maxAttempts = 10;
+	pPolicy->backoffMicro = 10000;
+	pPolicy->backoffMaxMicro = 1000000;
+	pPolicy->jitterPercent = 25;
+}
+
+int WinRTIoPolicyCheck(const WinRTIoPolicy *pPolicy)
+{
+	if (pPolicy->openMicro < 0 || pPolicy->readMicro < 0 || pPolicy->writeMicro < 0 || pPolicy->syncMicro < 0
+		|| pPolicy->maxAttempts < 1 || pPolicy->backoffMicro < 0 || pPolicy->backoffMaxMicro < pPolicy->backoffMicro
+		|| pPolicy->jitterPercent < 0 || pPolicy->jitterPercent > 100)
+		return SQLITE_MISUSE;
+	return SQLITE_OK;
+}
+
+WinRTIoDeadline::WinRTIoDeadline(int micro)
+	: previousDeadline(threadDeadline), previousGeneration(threadGeneration),
+	previousBounded(threadBounded), previousCounted(threadCounted)
+{
+	if (!threadBounded)
+	{
+		threadDeadline = 0;
+		threadGeneration = generation.load(std::memory_order_relaxed);
+		threadCounted = 0;
+	}
+	if (micro > 0)
+	{
+		sqlite_int64 deadline = ClockMicro() + micro;
+		if (threadDeadline == 0 || deadline < threadDeadline)
+			threadDeadline = deadline;
+	}
+	threadBounded = 1;
+}
+
+WinRTIoDeadline::~WinRTIoDeadline()
+{
+	// An operation given up inside is not counted again by the one around it.
+	threadCounted = previousBounded ? (threadCounted | previousCounted) : 0;
+	threadDeadline = previousDeadline;
+	threadGeneration = previousGeneration;
+	threadBounded = previousBounded;
+}
+
+/*
+** Count the calling thread's operation as given up, once.
+*/
+static int WinRTIoGiveUp(bool cancelled)
+{
+	if (!threadCounted)
+	{
+		threadCounted = 1;
+		(cancelled ? cancels : timeouts)++;
+	}
+	return SQLITE_INTERRUPT;
+}
+
+int WinRTIoExpired()
+{
+	if (!threadBounded)
+		return SQLITE_OK;
+	if (generation.load(std::memory_order_relaxed) != threadGeneration)
+		return WinRTIoGiveUp(true);
+	if (threadDeadline != 0 && ClockMicro() >= threadDeadline)
+		return WinRTIoGiveUp(false);
+	return SQLITE_OK;
+}
+
+int WinRTIoWaitMicro()
+{
+	if (threadDeadline == 0)
+		return WINRT_IO_CANCEL_MICRO;
+	sqlite_int64 remaining = threadDeadline - ClockMicro();
+	return (int)std::max<sqlite_int64>(0, std::min<sqlite_int64>(remaining, WINRT_IO_CANCEL_MICRO));
+}
+
+int WinRTIoSleep(sqlite_int64 nMicro)
+{
+	if (!threadBounded)
+	{
+		::WinRTTimerSleep((int)std::min<sqlite_int64>(nMicro, 0x7FFFFFFF));
+		return SQLITE_OK;
+	}
+	sqlite_int64 end = ClockMicro() + nMicro;
+	for (;;)
+	{
+		int rc = WinRTIoExpired();
+		if (rc != SQLITE_OK)
+			return rc;
+		sqlite_int64 remaining = end - ClockMicro();
+		if (remaining <= 0)
+			return SQLITE_OK;
+		// A deadline already past is caught at the top.
+		::WinRTTimerSleep((int)std::max<sqlite_int64>(1, std::min<sqlite_int64>(remaining, WinRTIoWaitMicro())));
+	}
+}
+
+int WinRTIoRetry(const WinRTIoPolicy *pPolicy, int attempt)
+{
+	if (attempt >= pPolicy->maxAttempts)
+	{
+		exhausted++;
+		return SQLITE_IOERR;
+	}
+	int rc = WinRTIoExpired();
+	if (rc != SQLITE_OK)
+		return rc;
+
+	sqlite_int64 wait = pPolicy->backoffMicro;
+	for (int i = 1; i < attempt && wait < pPolicy->backoffMaxMicro; i++)
+		wait *= 2;
+	wait = std::min<sqlite_int64>(wait, pPolicy->backoffMaxMicro);
+	if (pPolicy->jitterPercent > 0)
+	{
+		// splitmix64 of a shared counter: cheap, and distinct across threads.
+		sqlite_uint64 z = (jitterState += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		z ^= z >> 31;
+		wait -= wait * pPolicy->jitterPercent * (sqlite_int64)(z % 1000) / 100000;
+	}
+
+	// Fail now rather than sleep past the deadline.
+	if (threadDeadline != 0 && ClockMicro() + wait >= threadDeadline)
+		return WinRTIoGiveUp(false);
+	retries++;
+	retryMicro += wait;
+	return WinRTIoSleep(wait);
+}
+
+void WinRTIoCancelAll()
+{
+	generation++;
+}
+
+void WinRTIoDeadlineStatus(WinRTIoDeadlineStats *pStats)
+{
+	pStats->timeouts = timeouts;
+	pStats->cancels = cancels;
+	pStats->retries = retries;
+	pStats->retryMicro = retryMicro;
+	pStats->exhausted = exhausted;
+}
@@ -0,0 +1,115 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include "sqlite3.h"
+
+/*
+** How long the VFS lets storage take over an operation, and how it retries
+** a sync that fails. Times are in microseconds; a deadline of 0 is none.
+** Retries wait backoffMicro, doubling each time up to backoffMaxMicro, each
+** wait shortened by a random share of up to jitterPercent so that files
+** failing together do not retry together.
+*/
+typedef struct
+{
+	int openMicro;
+	int readMicro;
+	int writeMicro;             /* A write run sent to storage, or a truncate */
+	int syncMicro;              /* A sync with its retries and the waits between them */
+	int maxAttempts;            /* Tries of a sync, the first included */
+	int backoffMicro;
+	int backoffMaxMicro;
+	int jitterPercent;
+} WinRTIoPolicy;
+
+typedef struct
+{
+	sqlite_int64 timeouts;      /* Operations given up at their deadline */
+	sqlite_int64 cancels;       /* Operations given up by WinRTIoCancelAll */
+	sqlite_int64 retries;       /* Syncs tried again */
+	sqlite_int64 retryMicro;    /* Time spent waiting to retry */
+	sqlite_int64 exhausted;     /* Syncs that failed every attempt */
+} WinRTIoDeadlineStats;
+
+/*
+** The policy a VFS starts with: no deadlines, and up to 10 attempts of a
+** sync, 10 ms apart doubling to 1 s, with 25% jitter.
+*/
+void WinRTIoPolicyDefault(WinRTIoPolicy *pPolicy);
+
+/*
+** SQLITE_MISUSE if a time or maxAttempts is out of range, else SQLITE_OK.
+*/
+int WinRTIoPolicyCheck(const WinRTIoPolicy *pPolicy);
+
+/*
+** Bounds the storage calls the calling thread makes during its lifetime by
+** a deadline micro microseconds away, 0 for none, and by WinRTIoCancelAll.
+** Inside another, the nearer deadline applies.
+**
+** Backends that wait on a device (WinRTStreamStorage.cpp, the simulator)
+** stop waiting, cancel what they can, and fail the call once it expires.
+** A pread or pwrite cannot be interrupted, so the POSIX backends finish the
+** call and only a sync's retries are cut short.
+*/
+class WinRTIoDeadline
+{
+public:
+	explicit WinRTIoDeadline(int micro);
+	~WinRTIoDeadline();
+
+private:
+	sqlite_int64 previousDeadline;
+	unsigned previousGeneration;
+	int previousBounded;
+	int previousCounted;
+};
+
+/*
+** SQLITE_INTERRUPT once the calling thread's deadline has passed or its
+** operation has been cancelled, else SQLITE_OK. The first time it returns
+** SQLITE_INTERRUPT for an operation, the operation is counted as given up.
+*/
+int WinRTIoExpired();
+
+/*
+** Microseconds a backend may block before it calls WinRTIoExpired again:
+** until the deadline, and no more than WINRT_IO_CANCEL_MICRO.
+*/
+int WinRTIoWaitMicro();
+
+/*
+** Longest a backend blocks between checks for cancellation.
+*/
+#define WINRT_IO_CANCEL_MICRO   10000
+
+/*
+** Sleep for nMicro microseconds, or until WinRTIoExpired. Returns its
+** result.
+*/
+int WinRTIoSleep(sqlite_int64 nMicro);
+
+/*
+** Called after the attempt-th attempt of a sync has failed: waits for the
+** next retry and returns SQLITE_OK, or returns at once with SQLITE_IOERR if
+** that was the last attempt and with SQLITE_INTERRUPT if the deadline would
+** pass before the retry.
+*/
+int WinRTIoRetry(const WinRTIoPolicy *pPolicy, int attempt);
+
+/*
+** Give up every bounded operation in progress, on any thread, e.g. when the
+** app is suspended or a removable drive goes away. Operations that start
+** afterwards are unaffected.
+*/
+void WinRTIoCancelAll();
+
+void WinRTIoDeadlineStatus(WinRTIoDeadlineStats *pStats);
@@ -0,0 +1,135 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#include "pch.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "WinRTHeaderCache.h"
+#include "WinRTMemoryBudget.h"
+
+WinRTHeaderCache::~WinRTHeaderCache()
+{
+	::WinRTMemoryCharge(WINRT_MEMORY_HEADER_CACHES, -(sqlite_int64)bytes.capacity());
+}
+
+bool WinRTHeaderCache::Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (iOfst < 0 || iOfst + iAmt > nCached)
+		return false;
+	int n = iOfst < nFile ? std::min(iAmt, nFile - (int)iOfst) : 0;
+	::memcpy(zBuf, &bytes[(size_t)iOfst], n);
+	*pnRead = n;
+	return true;
+}
+
+unsigned WinRTHeaderCache::Generation()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return generation;
+}
+
+void WinRTHeaderCache::Fill(unsigned readGeneration, const void *zBuf, int iAmt, int nRead)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	int n = std::min(iAmt, WINRT_HEADER_CACHE_BYTES);
+	if (readGeneration != generation || sending > 0 || n <= nCached)
+		return;
+	size_t capacity = bytes.capacity();
+	bytes.assign(n, 0);
+	::WinRTMemoryCharge(WINRT_MEMORY_HEADER_CACHES, (sqlite_int64)(bytes.capacity() - capacity));
+	nCached = n;
+	nFile = std::min(nRead, n);
+	::memcpy(&bytes[0], zBuf, nFile);
+}
+
+void WinRTHeaderCache::Update(const WinRTIoVec *aVec, int nVec)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	generation++;
+	sending++;
+	for (int i = 0; i < nVec; i++)
+	{
+		sqlite_int64 start = aVec[i].iOfst;
+		sqlite_int64 end = start + aVec[i].iAmt;
+		if (end > nFile)
+			nFile = (int)std::min<sqlite_int64>(end, nCached);
+		if (start >= nCached)
+			continue;
+		int n = (int)(std::min<sqlite_int64>(end, nCached) - start);
+		::memcpy(&bytes[(size_t)start], aVec[i].zBuf, n);
+	}
+}
+
+void WinRTHeaderCache::Sent()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	generation++;
+	sending--;
+}
+
+void WinRTHeaderCache::Truncate(sqlite_int64 size)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	generation++;
+	if (size < nFile)
+	{
+		::memset(&bytes[(size_t)size], 0, nFile - (size_t)size);
+		nFile = (int)size;
+	}
+	else if (size > nFile)
+	{
+		nFile = (int)std::min<sqlite_int64>(size, nCached);
+	}
+}
+
+void WinRTHeaderCache::Invalidate()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Clear();
+}
+
+void WinRTHeaderCache::Clear()
+{
+	generation++;
+	nCached = nFile = 0;
+	bytes.clear();
+}
+
+bool WinRTHeaderCache::Validate(const sqlite_uint64 *pToken)
+{
+	if (pToken == nullptr)
+		return false;
+	std::lock_guard<std::mutex> lock(mutex);
+	bool changed = haveToken && *pToken != token && tokenGeneration == generation;
+	if (changed)
+		Clear();	// changed by someone else
+	token = *pToken;
+	tokenGeneration = generation;
+	haveToken = true;
+	return changed;
+}
+
+bool WinRTHeaderCache::TokenBehind()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return haveToken && tokenGeneration != generation;
+}
+
+void WinRTHeaderCache::Rebase(const sqlite_uint64 *pToken)
+{
+	if (pToken == nullptr)
+		return;
+	std::lock_guard<std::mutex> lock(mutex);
+	token = *pToken;
+	tokenGeneration = generation;
+	haveToken = true;
+}
@@ -0,0 +1,94 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include "WinRTStorage.h"
+
+/*
+** Largest prefix of a database kept, enough for page 1 at the maximum page
+** size.
+*/
+#define WINRT_HEADER_CACHE_BYTES    65536
+
+/*
+** Copy of the start of a main database file (the 100-byte header and the
+** rest of page 1), held by its WinRTSharedFile for every connection to the
+** file in this process. SQLite reads the change counter at the start of each
+** read transaction and page 1 whenever its own cache was reset; both are
+** answered from here instead of storage.
+**
+** The copy is filled by the first read at offset 0 and kept current by
+** Update as writes from any connection are sent to storage. Each local write
+** bumps a generation, which lets a read that raced a write be discarded and
+** lets Validate tell the file's own changes from those of another process.
+*/
+class WinRTHeaderCache
+{
+public:
+	~WinRTHeaderCache();
+
+	/*
+	** Answer a read from the cache. Returns false if the range is not
+	** cached; otherwise *pnRead is set as storage would set it.
+	*/
+	bool Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead);
+
+	/*
+	** Offer the result of a storage read at offset 0, started when the
+	** generation was generation.
+	*/
+	unsigned Generation();
+	void Fill(unsigned generation, const void *zBuf, int iAmt, int nRead);
+
+	/*
+	** Writes being sent to storage, and truncation. Every Update is
+	** followed by Sent once storage has returned; no read offered in
+	** between, or started before Sent, is kept.
+	*/
+	void Update(const WinRTIoVec *aVec, int nVec);
+	void Sent();
+	void Truncate(sqlite_int64 size);
+
+	/*
+	** Start of a read transaction, given the storage's change token (null if
+	** it has none): drop the copy if the token moved for any reason other
+	** than a local write. Returns true if it did.
+	*/
+	bool Validate(const sqlite_uint64 *pToken);
+
+	/*
+	** True if a local write was made since the change token was taken.
+	** Once the writes are in storage the token is taken again and given to
+	** Rebase, so that Validate can see the next change by another process.
+	*/
+	bool TokenBehind();
+	void Rebase(const sqlite_uint64 *pToken);
+
+	/*
+	** Forget the copy, e.g. after a write that failed part way.
+	*/
+	void Invalidate();
+
+private:
+	void Clear();
+
+	std::mutex mutex;
+	std::vector<unsigned char> bytes;	// nCached bytes, zero past nFile
+	int nCached = 0;
+	int nFile = 0;						// bytes of the prefix present in the file
+	unsigned generation = 0;			// bumped by every local write
+	int sending = 0;					// Updates not yet Sent
+	unsigned tokenGeneration = 0;		// generation when token was taken
+	sqlite_uint64 token = 0;
+	bool haveToken = false;
+};
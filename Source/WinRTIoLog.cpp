@@ -0,0 +1,448 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+/*
+*		The log is a ring of slots, each guarded by a sequence word in the
+*		manner of a seqlock. A writer takes the next sequence with one
+*		fetch_add, marks its slot odd while it copies the entry in and even
+*		once done; readers copy an entry out and keep it only if the word
+*		was the same, and even, before and after. Nothing waits on anything:
+*		a writer that finds its slot still held by the writer one lap ahead
+*		of it drops its entry, and a reader stops at an entry not yet
+*		written and picks it up on its next call.
+*
+*		The entry is copied through atomic words rather than memcpy, so that
+*		a torn read is detected rather than undefined.
+*
+*		Tags are interned into a fixed table that only grows, so that a
+*		thread's tag is a small index kept in thread-local storage and the
+*		counters are plain arrays of atomics. Setting a tag already in the
+*		table takes no lock.
+*
+*		The trace is an array that writers take slots of with a fetch_add.
+*		To free or read it, WinRTIoTraceStart and WinRTIoTraceJson clear the
+*		trace bit and wait for writers inside it to leave; a writer marks
+*		itself inside before it tests the bit, so none is missed.
+*/
+
+#include "pch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#if SQLITE_OS_WINRT
+#include <Windows.h>
+#endif
+
+#include "WinRTIoLog.h"
+
+#if defined(_MSC_VER)
+#define WINRT_THREAD __declspec(thread)
+#else
+#define WINRT_THREAD __thread
+#endif
+
+#define WINRT_IO_LOG_WORDS ((sizeof(WinRTIoLogEntry) + 7) / 8)
+
+/*
+** What spans are timed for (modes).
+*/
+#define WINRT_IO_MODE_LOG       0x1
+#define WINRT_IO_MODE_TAGS      0x2
+#define WINRT_IO_MODE_TRACE     0x4
+
+struct WinRTIoLogSlot
+{
+	std::atomic<sqlite_uint64> state;           // 2 * (sequence + 1) once written, odd while being written
+	std::atomic<sqlite_uint64> words[WINRT_IO_LOG_WORDS];
+};
+
+static WinRTIoLogSlot ring[WINRT_IO_LOG_ENTRIES];
+static std::atomic<sqlite_uint64> next(0);      // sequence of the next entry
+static std::atomic<long long> threshold(0);
+static std::atomic<long long> dropped(0);
+static std::atomic<unsigned> modes(0);
+
+struct WinRTIoCounters
+{
+	std::atomic<long long> count;
+	std::atomic<long long> bytes;
+	std::atomic<long long> micro;
+	std::atomic<long long> maxMicro;
+};
+
+static char tagNames[WINRT_IO_TAGS][WINRT_IO_TAG_NAME];     // [0] is "", for untagged
+static std::atomic<int> tagCount(1);            // names below it are set and never change
+static std::mutex tagMutex;                     // held to add a tag
+static WINRT_THREAD int threadTag = 0;
+static WinRTIoCounters counters[WINRT_IO_TAGS][WINRT_IO_OPS];
+static std::atomic<long long> cachedReads[WINRT_IO_TAGS];
+
+static WinRTIoLogEntry *traceEvents = nullptr;
+static int traceCapacity = 0;
+static std::atomic<int> traceCount(0);
+static std::atomic<long long> traceDropped(0);
+static std::atomic<int> traceWriters(0);        // spans inside Record
+static std::mutex traceMutex;                   // held to start, stop or read the trace
+
+static const char *const opNames[WINRT_IO_OPS] =
+{
+	"open", "read", "write", "truncate", "sync", "lock", "unlock", "close", "prefetch"
+};
+
+static long long ClockMicro()
+{
+	return (long long)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+static const long long clockStart = ClockMicro();
+
+static sqlite_uint64 ThreadId()
+{
+#if SQLITE_OS_WINRT
+	return ::GetCurrentThreadId();
+#else
+	static std::atomic<sqlite_uint64> lastId(0);
+	static WINRT_THREAD sqlite_uint64 id = 0;
+	if (id == 0)
+		id = ++lastId;
+	return id;
+#endif
+}
+
+static void Append(WinRTIoLogEntry *pEntry)
+{
+	sqlite_uint64 sequence = next++;
+	WinRTIoLogSlot &slot = ring[sequence % WINRT_IO_LOG_ENTRIES];
+	sqlite_uint64 state = slot.state.load(std::memory_order_acquire);
+	if ((state & 1) != 0 || state > 2 * sequence || !slot.state.compare_exchange_strong(state, 2 * sequence + 1))
+	{
+		dropped++;
+		return;
+	}
+
+	pEntry->sequence = sequence;
+	sqlite_uint64 words[WINRT_IO_LOG_WORDS] = { 0 };
+	::memcpy(words, pEntry, sizeof(WinRTIoLogEntry));
+	for (size_t i = 0; i < WINRT_IO_LOG_WORDS; i++)
+		slot.words[i].store(words[i], std::memory_order_relaxed);
+	slot.state.store(2 * sequence + 2, std::memory_order_release);
+}
+
+static void Count(int tag, int op, sqlite_int64 bytes, sqlite_int64 duration, bool cached)
+{
+	WinRTIoCounters &c = counters[tag][op];
+	c.count++;
+	c.bytes += bytes;
+	c.micro += duration;
+	long long longest = c.maxMicro.load(std::memory_order_relaxed);
+	while (duration > longest && !c.maxMicro.compare_exchange_weak(longest, duration))
+		;
+	if (cached)
+		cachedReads[tag]++;
+}
+
+static void Record(const WinRTIoLogEntry *pEntry)
+{
+	traceWriters++;
+	if ((modes & WINRT_IO_MODE_TRACE) != 0)
+	{
+		int i = traceCount.load(std::memory_order_relaxed) < traceCapacity ? traceCount++ : traceCapacity;
+		if (i < traceCapacity)
+			traceEvents[i] = *pEntry;
+		else
+			traceDropped++;
+	}
+	traceWriters--;
+}
+
+/*
+** Stop recording and wait for spans still copying an event in. Called with
+** traceMutex held.
+*/
+static void Quiesce()
+{
+	modes &= ~WINRT_IO_MODE_TRACE;
+	while (traceWriters != 0)
+		std::this_thread::yield();
+}
+
+void WinRTIoLogSetThreshold(sqlite_int64 thresholdMicro)
+{
+	threshold = std::max<sqlite_int64>(thresholdMicro, 0);
+	if (thresholdMicro > 0)
+		modes |= WINRT_IO_MODE_LOG;
+	else
+		modes &= ~WINRT_IO_MODE_LOG;
+}
+
+int WinRTIoLogRead(sqlite_uint64 *pNext, WinRTIoLogEntry *aEntry, int nEntry)
+{
+	sqlite_uint64 head = next.load(std::memory_order_acquire);
+	if (head - std::min(*pNext, head) > WINRT_IO_LOG_ENTRIES)
+		*pNext = head - WINRT_IO_LOG_ENTRIES;
+
+	int n = 0;
+	for (; *pNext < head && n < nEntry; ++*pNext)
+	{
+		WinRTIoLogSlot &slot = ring[*pNext % WINRT_IO_LOG_ENTRIES];
+		sqlite_uint64 expect = 2 * *pNext + 2;
+		sqlite_uint64 state = slot.state.load(std::memory_order_acquire);
+		if (state < expect)
+			break;                  // not written yet
+		if (state != expect)
+			continue;               // overwritten
+
+		sqlite_uint64 words[WINRT_IO_LOG_WORDS];
+		for (size_t i = 0; i < WINRT_IO_LOG_WORDS; i++)
+			words[i] = slot.words[i].load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.state.load(std::memory_order_relaxed) != expect)
+			continue;               // overwritten while copying
+		::memcpy(&aEntry[n++], words, sizeof(WinRTIoLogEntry));
+	}
+	return n;
+}
+
+void WinRTIoLogStatus(WinRTIoLogStats *pStats)
+{
+	pStats->threshold = threshold;
+	pStats->logged = (sqlite_int64)next.load() - dropped;
+	pStats->dropped = dropped;
+}
+
+int WinRTIoSetTag(const char *zTag)
+{
+	if (zTag == nullptr || zTag[0] == '\0')
+	{
+		threadTag = 0;
+		return SQLITE_OK;
+	}
+	char zName[WINRT_IO_TAG_NAME];
+	::sqlite3_snprintf(WINRT_IO_TAG_NAME, zName, "%s", zTag);
+	modes |= WINRT_IO_MODE_TAGS;
+
+	int n = tagCount.load(std::memory_order_acquire);
+	for (int i = 1; i < n; i++)
+	{
+		if (::strcmp(tagNames[i], zName) == 0)
+		{
+			threadTag = i;
+			return SQLITE_OK;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(tagMutex);
+	int i = n;
+	n = tagCount.load(std::memory_order_relaxed);
+	for (; i < n; i++)
+	{
+		if (::strcmp(tagNames[i], zName) == 0)
+		{
+			threadTag = i;
+			return SQLITE_OK;
+		}
+	}
+	if (n == WINRT_IO_TAGS)
+	{
+		threadTag = 0;
+		return SQLITE_FULL;
+	}
+	::memcpy(tagNames[n], zName, ::strlen(zName) + 1);
+	tagCount.store(n + 1, std::memory_order_release);
+	threadTag = n;
+	return SQLITE_OK;
+}
+
+int WinRTIoTag()
+{
+	return threadTag;
+}
+
+const char *WinRTIoTagName(int tag)
+{
+	return tag > 0 && tag < tagCount.load(std::memory_order_acquire) ? tagNames[tag] : "";
+}
+
+WinRTIoTagScope::WinRTIoTagScope(const char *zTag)
+	: previous(threadTag)
+{
+	::WinRTIoSetTag(zTag);
+}
+
+WinRTIoTagScope::~WinRTIoTagScope()
+{
+	threadTag = previous;
+}
+
+int WinRTIoTagStatus(WinRTIoTagStats *aStats, int nStats)
+{
+	int n = std::min(tagCount.load(std::memory_order_acquire), nStats);
+	for (int tag = 0; tag < n; tag++)
+	{
+		WinRTIoTagStats *pStats = &aStats[tag];
+		::memcpy(pStats->zTag, tagNames[tag], ::strlen(tagNames[tag]) + 1);
+		for (int op = 0; op < WINRT_IO_OPS; op++)
+		{
+			const WinRTIoCounters &c = counters[tag][op];
+			pStats->op[op].count = c.count;
+			pStats->op[op].bytes = c.bytes;
+			pStats->op[op].micro = c.micro;
+			pStats->op[op].maxMicro = c.maxMicro;
+		}
+		pStats->cachedReads = cachedReads[tag];
+	}
+	return n;
+}
+
+int WinRTIoTraceStart(int maxEvents)
+{
+	std::lock_guard<std::mutex> lock(traceMutex);
+	Quiesce();
+	delete[] traceEvents;
+	traceCapacity = 0;
+	traceEvents = new (std::nothrow) WinRTIoLogEntry[std::max(maxEvents, 1)];
+	if (traceEvents == nullptr)
+		return SQLITE_NOMEM;
+	traceCapacity = std::max(maxEvents, 1);
+	traceCount = 0;
+	traceDropped = 0;
+	modes |= WINRT_IO_MODE_TRACE;
+	return SQLITE_OK;
+}
+
+void WinRTIoTraceStop()
+{
+	std::lock_guard<std::mutex> lock(traceMutex);
+	Quiesce();
+}
+
+void WinRTIoTraceStatus(WinRTIoTraceStats *pStats)
+{
+	pStats->recording = (modes & WINRT_IO_MODE_TRACE) != 0;
+	pStats->events = std::min(traceCount.load(), traceCapacity);
+	pStats->dropped = traceDropped;
+}
+
+static void AppendJsonString(std::string *pJson, const char *z)
+{
+	pJson->push_back('"');
+	for (; *z != '\0'; z++)
+	{
+		unsigned char c = (unsigned char)*z;
+		if (c == '"' || c == '\\')
+		{
+			pJson->push_back('\\');
+			pJson->push_back((char)c);
+		}
+		else if (c < 0x20)
+		{
+			char zEscape[8];
+			::sqlite3_snprintf(sizeof(zEscape), zEscape, "\\u%04x", c);
+			pJson->append(zEscape);
+		}
+		else
+		{
+			pJson->push_back((char)c);
+		}
+	}
+	pJson->push_back('"');
+}
+
+void WinRTIoTraceJson(std::string *pJson)
+{
+	std::lock_guard<std::mutex> lock(traceMutex);
+	bool recording = (modes & WINRT_IO_MODE_TRACE) != 0;
+	Quiesce();
+
+	int n = std::min(traceCount.load(), traceCapacity);
+	pJson->clear();
+	pJson->reserve((size_t)n * 200 + 256);
+	pJson->append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	pJson->append("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"SQLiteRT VFS\"}}");
+	char zLine[256];
+	for (int i = 0; i < n; i++)
+	{
+		const WinRTIoLogEntry &e = traceEvents[i];
+		::sqlite3_snprintf(sizeof(zLine), zLine, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%llu,\"ts\":%lld,\"dur\":%lld,\"args\":{\"file\":",
+			opNames[e.op], e.cached ? "cache" : "storage", (unsigned long long)e.thread, (long long)e.start, (long long)e.duration);
+		pJson->append(zLine);
+		AppendJsonString(pJson, e.zFile);
+		::sqlite3_snprintf(sizeof(zLine), zLine, ",\"offset\":%lld,\"bytes\":%lld,\"result\":%d", (long long)e.offset, (long long)e.amount, e.result);
+		pJson->append(zLine);
+		if (e.retries > 0)
+		{
+			::sqlite3_snprintf(sizeof(zLine), zLine, ",\"retries\":%d", e.retries);
+			pJson->append(zLine);
+		}
+		if (e.tag > 0)
+		{
+			pJson->append(",\"tag\":");
+			AppendJsonString(pJson, ::WinRTIoTagName(e.tag));
+		}
+		pJson->append("}}");
+	}
+	::sqlite3_snprintf(sizeof(zLine), zLine, "\n],\"otherData\":{\"dropped\":%lld}}\n", (long long)traceDropped.load());
+	pJson->append(zLine);
+
+	if (recording)
+		modes |= WINRT_IO_MODE_TRACE;
+}
+
+WinRTIoSpan::WinRTIoSpan(int op, const char *zFile, sqlite_int64 offset, sqlite_int64 amount)
+	: op(op), tag(threadTag), cached(false), zFile(zFile), offset(offset), amount(amount), start(-1)
+{
+	if (modes.load(std::memory_order_relaxed) != 0)
+		start = ClockMicro();
+}
+
+int WinRTIoSpan::End(int result, int retries)
+{
+	if (start < 0)
+		return result;
+	sqlite_int64 duration = ClockMicro() - start;
+	unsigned mode = modes.load(std::memory_order_relaxed);
+	if ((mode & WINRT_IO_MODE_TAGS) != 0)
+		Count(tag, op, op == WINRT_IO_READ || op == WINRT_IO_WRITE ? amount : 0, duration, cached);
+	sqlite_int64 limit = threshold.load(std::memory_order_relaxed);
+	bool slow = (mode & WINRT_IO_MODE_LOG) != 0 && limit > 0 && duration >= limit;
+	if (!slow && (mode & WINRT_IO_MODE_TRACE) == 0)
+		return result;
+
+	WinRTIoLogEntry entry;
+	::memset(&entry, 0, sizeof(entry));
+	entry.start = start - clockStart;
+	entry.duration = duration;
+	entry.offset = offset;
+	entry.amount = amount;
+	entry.thread = ThreadId();
+	entry.op = op;
+	entry.retries = retries;
+	entry.result = result;
+	entry.tag = tag;
+	entry.cached = cached;
+	if (zFile != nullptr)
+	{
+		size_t nFile = ::strlen(zFile);
+		size_t nKeep = std::min(nFile, (size_t)WINRT_IO_LOG_NAME - 1);
+		::memcpy(entry.zFile, zFile + nFile - nKeep, nKeep);
+	}
+	if (slow)
+		Append(&entry);
+	if ((mode & WINRT_IO_MODE_TRACE) != 0)
+		Record(&entry);
+	return result;
+}
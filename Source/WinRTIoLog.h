@@ -0,0 +1,205 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include <string>
+
+#include "sqlite3.h"
+
+/*
+** Operations of the VFS that are timed (WinRTIoSpan).
+*/
+#define WINRT_IO_OPEN       0   /* WinRTOpen: resolving the path and opening storage */
+#define WINRT_IO_READ       1   /* WinRTRead, whether or not a cache answered it */
+#define WINRT_IO_WRITE      2   /* A write run sent to storage (WinRTFlushRun) */
+#define WINRT_IO_TRUNCATE   3
+#define WINRT_IO_SYNC       4   /* WinRTFlush, its retries included */
+#define WINRT_IO_LOCK       5   /* offset is the lock level */
+#define WINRT_IO_UNLOCK     6   /* the same; includes sending the write run */
+#define WINRT_IO_CLOSE      7
+#define WINRT_IO_PREFETCH   8   /* A read into the block cache by prewarm or the hot list */
+#define WINRT_IO_OPS        9
+
+/*
+** Entries the slow-I/O log holds; older ones are overwritten.
+*/
+#define WINRT_IO_LOG_ENTRIES    256
+
+/*
+** Bytes of the file name kept in an entry, with its terminator. The end of
+** a longer name is kept, since that is the part that tells files apart.
+*/
+#define WINRT_IO_LOG_NAME       96
+
+/*
+** Distinct tags (WinRTIoSetTag) the statistics keep apart, the empty tag of
+** untagged operations included, and bytes of a tag kept with its terminator.
+*/
+#define WINRT_IO_TAGS           64
+#define WINRT_IO_TAG_NAME       32
+
+typedef struct
+{
+	sqlite_uint64 sequence;     /* Position in the log, from 0 */
+	sqlite_int64 start;         /* Microseconds since the log's clock started */
+	sqlite_int64 duration;      /* Microseconds */
+	sqlite_int64 offset;        /* 0 for open and sync */
+	sqlite_int64 amount;        /* Bytes; the new size for truncate */
+	sqlite_uint64 thread;       /* OS thread id on Windows, else a number per thread */
+	int op;                     /* WINRT_IO_xxx */
+	int retries;                /* Attempts after the first */
+	int result;                 /* SQLite result code */
+	int tag;                    /* Tag of the thread (WinRTIoTagName) */
+	int cached;                 /* A read answered without storage */
+	char zFile[WINRT_IO_LOG_NAME];
+} WinRTIoLogEntry;
+
+typedef struct
+{
+	sqlite_int64 threshold;     /* Microseconds; 0 when the log is off */
+	sqlite_int64 logged;        /* Entries ever written */
+	sqlite_int64 dropped;       /* Entries lost to a writer still in their slot */
+} WinRTIoLogStats;
+
+/*
+** Log every operation that takes thresholdMicro microseconds or more; 0
+** turns the log off, which is the default. Operations are not timed at all
+** while it is off.
+*/
+void WinRTIoLogSetThreshold(sqlite_int64 thresholdMicro);
+
+/*
+** Copy up to nEntry entries, oldest first, starting at sequence *pNext, and
+** set *pNext to the sequence to ask for next time. Entries overwritten
+** since are skipped; compare sequences to see how many. Returns the number
+** copied. Never blocks the operations writing the log.
+*/
+int WinRTIoLogRead(sqlite_uint64 *pNext, WinRTIoLogEntry *aEntry, int nEntry);
+
+void WinRTIoLogStatus(WinRTIoLogStats *pStats);
+
+typedef struct
+{
+	sqlite_int64 count;
+	sqlite_int64 bytes;         /* Asked for; the new size is not counted for truncate */
+	sqlite_int64 micro;         /* Total time */
+	sqlite_int64 maxMicro;      /* Longest */
+} WinRTIoOpStats;
+
+typedef struct
+{
+	char zTag[WINRT_IO_TAG_NAME];
+	WinRTIoOpStats op[WINRT_IO_OPS];
+	sqlite_int64 cachedReads;   /* Reads the header or block cache answered */
+} WinRTIoTagStats;
+
+/*
+** Attribute the operations this thread makes from now on to zTag, e.g. the
+** query or request it is serving, until it sets another; 0 or "" clears
+** it. Tags longer than WINRT_IO_TAG_NAME - 1 bytes are cut short.
+**
+** Once any thread has set a tag, every operation is timed and counted under
+** the tag of its thread, untagged ones under "". A write run counts under
+** the thread that sends it to storage, which is the one that ends the
+** transaction unless the run filled up or was read back first.
+**
+** Returns SQLITE_FULL, leaving the thread untagged, if WINRT_IO_TAGS tags
+** are already in use; they are never forgotten.
+*/
+int WinRTIoSetTag(const char *zTag);
+
+/*
+** The calling thread's tag, and the name of a tag.
+*/
+int WinRTIoTag();
+const char *WinRTIoTagName(int tag);
+
+/*
+** Tags the calling thread for its lifetime, and restores the tag it had.
+*/
+class WinRTIoTagScope
+{
+public:
+	explicit WinRTIoTagScope(const char *zTag);
+	~WinRTIoTagScope();
+
+private:
+	int previous;
+};
+
+/*
+** Copy the statistics of up to nStats tags, in the order they were first
+** set. Returns the number copied.
+*/
+int WinRTIoTagStatus(WinRTIoTagStats *aStats, int nStats);
+
+/*
+** Record every operation from now on, up to maxEvents of them, for
+** WinRTIoTraceJson; those past it are counted and dropped. Discards what an
+** earlier trace recorded. Each event takes sizeof(WinRTIoLogEntry) bytes.
+** Returns SQLITE_NOMEM if they cannot be allocated.
+*/
+int WinRTIoTraceStart(int maxEvents);
+
+/*
+** Stop recording, keeping what was recorded.
+*/
+void WinRTIoTraceStop();
+
+typedef struct
+{
+	int recording;              /* Between WinRTIoTraceStart and WinRTIoTraceStop */
+	sqlite_int64 events;        /* Recorded */
+	sqlite_int64 dropped;       /* Past maxEvents */
+} WinRTIoTraceStats;
+
+void WinRTIoTraceStatus(WinRTIoTraceStats *pStats);
+
+/*
+** Set *pJson to the recorded operations as Chrome trace-event JSON, for
+** chrome://tracing or Perfetto: one complete event per operation, in a lane
+** per thread, with file, offset, bytes, tag and result as arguments. An
+** operation inside another, such as the write run sent by an unlock, nests
+** under it; the gaps between a thread's operations are time it spent
+** outside the VFS. Operations that end while the JSON is written are not
+** recorded.
+*/
+void WinRTIoTraceJson(std::string *pJson);
+
+/*
+** Times one operation of the VFS from its construction to End. Costs one
+** relaxed load while the log, tags and trace are all unused.
+*/
+class WinRTIoSpan
+{
+public:
+	WinRTIoSpan(int op, const char *zFile, sqlite_int64 offset, sqlite_int64 amount);
+
+	/*
+	** A read answered from a cache, without storage.
+	*/
+	void Cached() { cached = true; }
+
+	/*
+	** Count the operation under its tag, and log it if it took the
+	** threshold or longer. Returns result, so that it can wrap a return
+	** value.
+	*/
+	int End(int result, int retries = 0);
+
+private:
+	int op;
+	int tag;
+	bool cached;
+	const char *zFile;
+	sqlite_int64 offset;
+	sqlite_int64 amount;
+	sqlite_int64 start;         /* -1 when not timed */
+};
@@ -0,0 +1,225 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Block format: a sequence of
+*
+*			token            high nibble = literal length, low nibble = match
+*			                 length - 4; 15 means "more length bytes follow"
+*			[length bytes]   255 255 ... n, added to the literal length
+*			literals
+*			offset           2 bytes little endian, back from the match start
+*			[length bytes]   added to the match length
+*
+*		The last sequence has literals only and no offset.
+*/
+
+#include "pch.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "WinRTLz.h"
+
+#define LZ_MIN_MATCH    4
+#define LZ_HASH_BITS    12
+#define LZ_MAX_OFFSET   65535
+#define LZ_LAST_LITERALS 5		// the final bytes are always literals
+#define LZ_MF_LIMIT     12		// no match may start this close to the end
+
+
+static inline uint32_t Read32(const uint8_t *p)
+{
+	uint32_t v;
+	::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t Hash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+** Append a length continuation (the part of a length at or above 15).
+*/
+static inline uint8_t *PutLength(uint8_t *op, int n)
+{
+	while (n >= 255)
+	{
+		*op++ = 255;
+		n -= 255;
+	}
+	*op++ = (uint8_t)n;
+	return op;
+}
+
+/*
+** Emit one sequence. Returns the new output pointer, or nullptr if it would
+** not fit before oend. A match length of 0 means literals only.
+*/
+static uint8_t *PutSequence(uint8_t *op, uint8_t *oend,
+	const uint8_t *lit, int nLit, int offset, int nMatch)
+{
+	if ((oend - op) < 1 + nLit + nLit / 255 + 1 + 2 + nMatch / 255 + 1)
+		return nullptr;
+
+	uint8_t *token = op++;
+	int litCode = nLit < 15 ? nLit : 15;
+	if (nLit >= 15)
+		op = PutLength(op, nLit - 15);
+	::memcpy(op, lit, nLit);
+	op += nLit;
+
+	int matchCode = 0;
+	if (nMatch > 0)
+	{
+		*op++ = (uint8_t)(offset & 0xff);
+		*op++ = (uint8_t)(offset >> 8);
+		int m = nMatch - LZ_MIN_MATCH;
+		matchCode = m < 15 ? m : 15;
+		if (m >= 15)
+			op = PutLength(op, m - 15);
+	}
+	*token = (uint8_t)((litCode << 4) | matchCode);
+	return op;
+}
+
+int WinRTLzCompress(const void *pSrc, int nSrc, void *pDst, int nDst)
+{
+	const uint8_t *src = (const uint8_t*)pSrc;
+	const uint8_t *ip = src;
+	const uint8_t *anchor = src;
+	const uint8_t *iend = src + nSrc;
+	uint8_t *op = (uint8_t*)pDst;
+	uint8_t *oend = op + nDst;
+
+	if (nSrc > LZ_MF_LIMIT)
+	{
+		const uint8_t *mflimit = iend - LZ_MF_LIMIT;
+		const uint8_t *matchlimit = iend - LZ_LAST_LITERALS;
+		uint32_t table[1 << LZ_HASH_BITS];
+		::memset(table, 0, sizeof(table));
+
+		ip++;
+		int misses = 0;
+		while (ip < mflimit)
+		{
+			uint32_t seq = Read32(ip);
+			uint32_t h = Hash(seq);
+			const uint8_t *ref = src + table[h];
+			table[h] = (uint32_t)(ip - src);
+
+			if (ref >= ip || ip - ref > LZ_MAX_OFFSET || Read32(ref) != seq)
+			{
+				// Skip faster through data that does not compress.
+				ip += 1 + (misses++ >> 5);
+				continue;
+			}
+			misses = 0;
+
+			// Extend backwards over literals, then forwards.
+			while (ip > anchor && ref > src && ip[-1] == ref[-1])
+			{
+				ip--;
+				ref--;
+			}
+			const uint8_t *matchStart = ip;
+			int offset = (int)(ip - ref);
+			ip += LZ_MIN_MATCH;
+			ref += LZ_MIN_MATCH;
+			while (ip < matchlimit && *ip == *ref)
+			{
+				ip++;
+				ref++;
+			}
+
+			op = PutSequence(op, oend, anchor, (int)(matchStart - anchor), offset, (int)(ip - matchStart));
+			if (op == nullptr)
+				return 0;
+			anchor = ip;
+
+			// Index the position just before the next search start.
+			if (ip - 2 > src)
+				table[Hash(Read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+		}
+	}
+
+	op = PutSequence(op, oend, anchor, (int)(iend - anchor), 0, 0);
+	if (op == nullptr)
+		return 0;
+	return (int)(op - (uint8_t*)pDst);
+}
+
+int WinRTLzDecompress(const void *pSrc, int nSrc, void *pDst, int nDst)
+{
+	const uint8_t *ip = (const uint8_t*)pSrc;
+	const uint8_t *iend = ip + nSrc;
+	uint8_t *dst = (uint8_t*)pDst;
+	uint8_t *op = dst;
+	uint8_t *oend = dst + nDst;
+
+	while (ip < iend)
+	{
+		int token = *ip++;
+
+		size_t nLit = token >> 4;
+		if (nLit == 15)
+		{
+			int b;
+			do
+			{
+				if (ip >= iend) return -1;
+				b = *ip++;
+				nLit += b;
+			} while (b == 255);
+		}
+		if (nLit > (size_t)(iend - ip) || nLit > (size_t)(oend - op))
+			return -1;
+		::memcpy(op, ip, nLit);
+		ip += nLit;
+		op += nLit;
+
+		if (ip == iend)
+			break;	// final literal-only sequence
+
+		if (iend - ip < 2) return -1;
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - dst))
+			return -1;
+
+		size_t nMatch = token & 15;
+		if (nMatch == 15)
+		{
+			int b;
+			do
+			{
+				if (ip >= iend) return -1;
+				b = *ip++;
+				nMatch += b;
+			} while (b == 255);
+		}
+		nMatch += LZ_MIN_MATCH;
+		if (nMatch > (size_t)(oend - op))
+			return -1;
+
+		const uint8_t *ref = op - offset;
+		if (offset >= nMatch)
+		{
+			::memcpy(op, ref, nMatch);
+			op += nMatch;
+		}
+		else
+		{
+			// Overlapping copy repeats the last offset bytes.
+			while (nMatch--)
+				*op++ = *ref++;
+		}
+	}
+	return (int)(op - dst);
+}
@@ -0,0 +1,28 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+/*
+** Worst-case compressed size of n input bytes.
+*/
+#define WINRT_LZ_BOUND(n)       ((n) + (n) / 255 + 16)
+
+/*
+** Fast LZ77 block codec in the style of LZ4: a greedy single-probe match
+** finder and a byte-aligned token format, tuned for page-sized blocks
+** (offsets are limited to 64 KB).
+**
+** WinRTLzCompress returns the compressed size, or 0 if the output would not
+** fit in nDst bytes. WinRTLzDecompress returns the number of bytes produced,
+** or -1 if the input is malformed or would overrun pDst; it never reads or
+** writes out of bounds.
+*/
+int WinRTLzCompress(const void *pSrc, int nSrc, void *pDst, int nDst);
+int WinRTLzDecompress(const void *pSrc, int nSrc, void *pDst, int nDst);
@@ -0,0 +1,169 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+/*
+*		The caches and buffers report every change in their size here, as
+*		they make it, into atomic counters, so that the total is known
+*		without taking any of their locks. Shrinking goes the other way,
+*		through each cache's own lock, so it is never done by a thread that
+*		is charging: the evictor runs on a thread of its own, woken by the
+*		charge that crossed the soft limit, and nothing here holds a lock
+*		while it calls into a cache.
+*/
+
+#include "pch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "WinRTMemoryBudget.h"
+#include "WinRTBlockCache.h"
+#include "WinRTPageCache.h"
+
+static std::atomic<long long> usage[WINRT_MEMORY_KINDS];
+static std::atomic<long long> used(0);
+static std::atomic<long long> budget(0);
+static std::atomic<long long> softLimit(0);
+static std::atomic<long long> trims(0);
+static std::atomic<long long> evictions(0);
+static std::atomic<long long> released(0);
+static std::atomic<unsigned> trimGeneration(0);
+
+// Never destroyed: the evictor may still wait on them at exit.
+static std::mutex &evictorMutex = *new std::mutex;	// held only to wait and to wake
+static std::condition_variable &evictorWake = *new std::condition_variable;
+static std::atomic<bool> evictWanted(false);
+static bool evictorStarted = false;
+
+static void WakeIfOver()
+{
+	sqlite_int64 soft = softLimit;
+	if (soft > 0 && used > soft && !evictWanted.exchange(true))
+	{
+		std::lock_guard<std::mutex> lock(evictorMutex);
+		evictorWake.notify_one();
+	}
+}
+
+/*
+** Free about bytes from the caches, each giving up its share of them.
+** Returns what was freed.
+*/
+static sqlite_int64 Release(sqlite_int64 bytes)
+{
+	sqlite_int64 block = usage[WINRT_MEMORY_BLOCK_CACHE];
+	sqlite_int64 page = usage[WINRT_MEMORY_PAGE_CACHE];
+	sqlite_int64 total = block + page;
+	if (total <= 0 || bytes <= 0)
+		return 0;
+	bytes = std::min(bytes, total);
+
+	WinRTBlockCache::Shrink(block - (sqlite_int64)((double)bytes * block / total));
+	if (page > 0)
+		::WinRTPageCacheShrink(page - (sqlite_int64)((double)bytes * page / total));
+
+	sqlite_int64 freed = total - (usage[WINRT_MEMORY_BLOCK_CACHE] + usage[WINRT_MEMORY_PAGE_CACHE]);
+	if (freed > 0)
+		released += freed;
+	return freed;
+}
+
+static void Evictor()
+{
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(evictorMutex);
+			evictorWake.wait(lock, []() { return evictWanted.load(); });
+		}
+		sqlite_int64 soft = softLimit;
+		sqlite_int64 target = soft - budget / 100 * WINRT_MEMORY_HYSTERESIS_PERCENT;
+		if (soft > 0 && used > target)
+		{
+			Release(used - target);
+			evictions++;
+		}
+		// Charges from here on may wake it again.
+		evictWanted = false;
+	}
+}
+
+int WinRTMemorySetBudget(sqlite_int64 budgetBytes, sqlite_int64 softBytes)
+{
+	if (budgetBytes < WINRT_MEMORY_MIN_BYTES || softBytes < 0 || softBytes > budgetBytes)
+		return SQLITE_MISUSE;
+
+	// The caches' caps, in proportion to their default sizes.
+	sqlite_int64 caches = budgetBytes - budgetBytes / 100 * WINRT_MEMORY_BUFFER_PERCENT;
+	if (::WinRTPageCacheInstalled())
+	{
+		sqlite_int64 block = (sqlite_int64)((double)caches * WINRT_BLOCK_CACHE_BYTES / (WINRT_BLOCK_CACHE_BYTES + WINRT_PCACHE_BYTES));
+		WinRTBlockCache::SetBudget(block);
+		int rc = ::WinRTPageCacheInstall(caches - block);
+		if (rc != SQLITE_OK)
+			return rc;
+	}
+	else
+	{
+		WinRTBlockCache::SetBudget(caches);
+	}
+
+	budget = budgetBytes;
+	softLimit = softBytes;
+	if (softBytes > 0)
+	{
+		std::lock_guard<std::mutex> lock(evictorMutex);
+		if (!evictorStarted)
+		{
+			std::thread(Evictor).detach();
+			evictorStarted = true;
+		}
+	}
+	WakeIfOver();
+	return SQLITE_OK;
+}
+
+void WinRTMemoryTrim(int level)
+{
+	level = std::max(0, std::min(level, 100));
+	trims++;
+	trimGeneration++;
+	sqlite_int64 caches = usage[WINRT_MEMORY_BLOCK_CACHE] + usage[WINRT_MEMORY_PAGE_CACHE];
+	Release((sqlite_int64)((double)caches * level / 100));
+}
+
+void WinRTMemoryStatus(WinRTMemoryStats *pStats)
+{
+	pStats->budget = budget;
+	pStats->softLimit = softLimit;
+	pStats->used = used;
+	pStats->blockCache = usage[WINRT_MEMORY_BLOCK_CACHE];
+	pStats->pageCache = usage[WINRT_MEMORY_PAGE_CACHE];
+	pStats->writeBuffers = usage[WINRT_MEMORY_WRITE_BUFFERS];
+	pStats->headerCaches = usage[WINRT_MEMORY_HEADER_CACHES];
+	pStats->trims = trims;
+	pStats->evictions = evictions;
+	pStats->released = released;
+}
+
+void WinRTMemoryCharge(int kind, sqlite_int64 delta)
+{
+	usage[kind] += delta;
+	used += delta;
+	if (delta > 0)
+		WakeIfOver();
+}
+
+unsigned WinRTMemoryTrimGeneration()
+{
+	return trimGeneration;
+}
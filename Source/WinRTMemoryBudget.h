@@ -0,0 +1,92 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include "sqlite3.h"
+
+/*
+** What the VFS holds memory for (WinRTMemoryCharge).
+*/
+#define WINRT_MEMORY_BLOCK_CACHE        0   /* Both tiers of WinRTBlockCache */
+#define WINRT_MEMORY_PAGE_CACHE         1   /* The shared page cache, if installed */
+#define WINRT_MEMORY_WRITE_BUFFERS      2   /* Write runs' buffers, pending and pooled */
+#define WINRT_MEMORY_HEADER_CACHES      3   /* Each open database's WinRTHeaderCache */
+#define WINRT_MEMORY_KINDS              4
+
+/*
+** Share of a budget kept for buffers; the caches are sized to the rest.
+*/
+#define WINRT_MEMORY_BUFFER_PERCENT     10
+
+/*
+** Smallest budget accepted. Split as the defaults are, it leaves the block
+** cache room for a couple of hundred blocks with its second tier full, and
+** the page cache several slabs.
+*/
+#define WINRT_MEMORY_MIN_BYTES          (4 * 1024 * 1024)
+
+/*
+** Once over the soft limit, the background evictor brings use down to
+** this much below it, so that it does not run again at the next block.
+*/
+#define WINRT_MEMORY_HYSTERESIS_PERCENT 5
+
+typedef struct
+{
+	sqlite_int64 budget;        /* Hard limit; 0 until one is set */
+	sqlite_int64 softLimit;     /* 0 for none */
+	sqlite_int64 used;          /* All of the below together */
+	sqlite_int64 blockCache;
+	sqlite_int64 pageCache;
+	sqlite_int64 writeBuffers;
+	sqlite_int64 headerCaches;
+	sqlite_int64 trims;         /* Calls to WinRTMemoryTrim */
+	sqlite_int64 evictions;     /* Passes of the background evictor */
+	sqlite_int64 released;      /* Bytes the two have freed */
+} WinRTMemoryStats;
+
+/*
+** Set one budget for the memory of every cache and buffer of the VFS, in
+** all files together. The block cache and, if installed, the shared page
+** cache are capped so that with WINRT_MEMORY_BUFFER_PERCENT kept for
+** buffers they fit in budgetBytes, and are trimmed at once if they hold
+** more. Once the total goes over softBytes (0 for no soft limit), a
+** background thread evicts from the caches, in proportion to what each
+** holds, until it is back under.
+**
+** Call after the page cache is installed. Returns SQLITE_MISUSE if the
+** budget is under WINRT_MEMORY_MIN_BYTES or the soft limit is above it.
+*/
+int WinRTMemorySetBudget(sqlite_int64 budgetBytes, sqlite_int64 softBytes);
+
+/*
+** Release level percent (0 to 100) of what the caches hold, each giving up
+** the same share, as the host asks when memory is short; and have every
+** write run free its pooled buffers at its next flush. The caches fill
+** again as they are used.
+*/
+void WinRTMemoryTrim(int level);
+
+/*
+** Use of memory by the VFS.
+*/
+void WinRTMemoryStatus(WinRTMemoryStats *pStats);
+
+/*
+** For the caches and buffers: record that memory of kind grew or shrank by
+** delta bytes. Takes none of the caches' locks, so may be called under
+** them; may wake the background evictor.
+*/
+void WinRTMemoryCharge(int kind, sqlite_int64 delta);
+
+/*
+** Moved by every trim; write runs free their pooled buffers when it has.
+*/
+unsigned WinRTMemoryTrimGeneration();
@@ -0,0 +1,639 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Page cache (sqlite3_pcache_methods2) shared by every connection.
+*
+*		Each pager gets a WinRTPageCache whose pages are found through an
+*		open-addressing table: an array of page pointers probed linearly from
+*		a multiplicative hash of the page number, kept at most half full and
+*		compacted by backward shift on removal, so a lookup touches one or two
+*		adjacent slots and there are no tombstones.
+*
+*		A page is one allocation holding the WinRTPage header, the page image
+*		and SQLite's extra bytes. They are carved from slabs, one list of slabs
+*		per allocation size; a slab is freed once all its pages are, keeping
+*		one spare per size so a cache that churns does not thrash the heap.
+*		When memory was reserved for pages (WinRTReserveMemory), pages come
+*		from there first.
+*
+*		Unpinned pages of purgeable caches sit on one of two global lists, a
+*		segmented LRU: a page goes on probation when first unpinned, and on the
+*		protected list if it was fetched again while cached. Protected pages
+*		beyond WINRT_PCACHE_PROTECTED_PERCENT of the budget are demoted to
+*		probation, and eviction takes the oldest probation page first, so a
+*		scan only ever displaces other pages read once. Pages of
+*		non-purgeable caches (in-memory databases) are never evicted and do
+*		not count against the budget.
+*/
+
+#include "pch.h"
+
+#include <string.h>
+#include <mutex>
+#include <vector>
+
+#include "WinRTPageCache.h"
+#include "WinRTMemoryBudget.h"
+#include "WinRTReservation.h"
+
+#define WINRT_PCACHE_ROUND(n)   (((n) + 15) & ~(size_t)15)
+#define WINRT_PCACHE_MIN_SLOTS  64
+
+enum WinRTPageSegment
+{
+	WINRT_PAGE_PINNED,
+	WINRT_PAGE_PROBATION,
+	WINRT_PAGE_PROTECTED,
+	WINRT_PAGE_KEPT,            // unpinned, but its cache is not purgeable
+};
+
+struct WinRTPageCache;
+struct WinRTSlab;
+struct WinRTSlabClass;
+
+struct WinRTPage
+{
+	sqlite3_pcache_page base;   // must be first
+	WinRTPageCache *cache;
+	WinRTSlab *slab;            // null for a reserved page
+	unsigned key;
+	unsigned char segment;      // WinRTPageSegment
+	bool reused;                // fetched again while cached
+	WinRTPage *newer;           // segment list; newer is also the slab free list
+	WinRTPage *older;
+};
+
+struct WinRTSlab
+{
+	WinRTSlabClass *cls;
+	WinRTSlab *next;            // slabs of the class with free pages
+	WinRTSlab *prev;
+	WinRTPage *free;
+	int nUsed;
+	int nItem;
+};
+
+struct WinRTSlabClass
+{
+	size_t itemBytes;
+	int nItem;                  // pages per slab
+	WinRTSlab *partial;         // slabs with at least one free page
+	int nSpare;                 // slabs with none in use
+};
+
+struct WinRTPageCache
+{
+	int szPage;
+	int szExtra;
+	bool purgeable;
+	WinRTSlabClass *cls;
+	WinRTPage **table;
+	unsigned nSlot;             // power of two
+	unsigned shift;             // 32 - log2(nSlot)
+	unsigned nPage;
+};
+
+struct WinRTPageList
+{
+	WinRTPage *newest;
+	WinRTPage *oldest;
+	sqlite_int64 bytes;
+};
+
+/*
+** One lock covers the lists, the slabs and every cache's table, since
+** eviction takes pages from any cache.
+*/
+static std::mutex pcacheMutex;
+static std::vector<WinRTSlabClass*> classes;
+static WinRTPageList probation;
+static WinRTPageList protectedList;
+static WinRTPageCacheStats stats = { WINRT_PCACHE_BYTES };
+static bool installed = false;
+
+/*
+** Change the bytes held by purgeable pages, and tell the memory budget.
+*/
+static void Account(sqlite_int64 delta)
+{
+	stats.used += delta;
+	::WinRTMemoryCharge(WINRT_MEMORY_PAGE_CACHE, delta);
+}
+
+static void Unlink(WinRTPageList *list, WinRTPage *page)
+{
+	(page->newer ? page->newer->older : list->newest) = page->older;
+	(page->older ? page->older->newer : list->oldest) = page->newer;
+	list->bytes -= page->cache->cls->itemBytes;
+}
+
+static void LinkNewest(WinRTPageList *list, WinRTPage *page)
+{
+	page->newer = nullptr;
+	page->older = list->newest;
+	(list->newest ? list->newest->newer : list->oldest) = page;
+	list->newest = page;
+	list->bytes += page->cache->cls->itemBytes;
+}
+
+static WinRTPageList *ListOf(WinRTPage *page)
+{
+	switch (page->segment)
+	{
+	case WINRT_PAGE_PROBATION: return &probation;
+	case WINRT_PAGE_PROTECTED: return &protectedList;
+	default: return nullptr;
+	}
+}
+
+/*
+** Slabs
+*/
+
+static WinRTSlabClass *ClassFor(int szPage, int szExtra)
+{
+	size_t itemBytes = WINRT_PCACHE_ROUND(sizeof(WinRTPage)) + WINRT_PCACHE_ROUND(szPage) + WINRT_PCACHE_ROUND(szExtra);
+	for (WinRTSlabClass *cls : classes)
+	{
+		if (cls->itemBytes == itemBytes)
+			return cls;
+	}
+	WinRTSlabClass *cls = new WinRTSlabClass();
+	cls->itemBytes = itemBytes;
+	cls->nItem = (int)((WINRT_PCACHE_SLAB_BYTES - WINRT_PCACHE_ROUND(sizeof(WinRTSlab))) / itemBytes);
+	if (cls->nItem < 1)
+		cls->nItem = 1;
+	classes.push_back(cls);
+	return cls;
+}
+
+static void UnlinkSlab(WinRTSlab *slab)
+{
+	(slab->prev ? slab->prev->next : slab->cls->partial) = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+
+static void LinkSlab(WinRTSlab *slab)
+{
+	slab->prev = nullptr;
+	slab->next = slab->cls->partial;
+	if (slab->next)
+		slab->next->prev = slab;
+	slab->cls->partial = slab;
+}
+
+static WinRTPage *SlabAlloc(WinRTPageCache *cache)
+{
+	WinRTSlabClass *cls = cache->cls;
+	WinRTSlab *slab = cls->partial;
+	if (slab == nullptr)
+	{
+		size_t header = WINRT_PCACHE_ROUND(sizeof(WinRTSlab));
+		size_t bytes = header + cls->itemBytes * cls->nItem;
+		slab = (WinRTSlab*)::sqlite3_malloc((int)bytes);
+		if (slab == nullptr)
+			return nullptr;
+		slab->cls = cls;
+		slab->free = nullptr;
+		slab->nUsed = 0;
+		slab->nItem = cls->nItem;
+		for (int i = cls->nItem - 1; i >= 0; i--)
+		{
+			WinRTPage *page = (WinRTPage*)((char*)slab + header + cls->itemBytes * i);
+			page->slab = slab;
+			page->newer = slab->free;
+			slab->free = page;
+		}
+		LinkSlab(slab);
+		cls->nSpare++;
+		stats.slabBytes += bytes;
+	}
+
+	WinRTPage *page = slab->free;
+	slab->free = page->newer;
+	if (slab->nUsed++ == 0)
+		cls->nSpare--;
+	if (slab->free == nullptr)
+		UnlinkSlab(slab);
+	return page;
+}
+
+static void SlabFree(WinRTPage *page)
+{
+	WinRTSlab *slab = page->slab;
+	WinRTSlabClass *cls = slab->cls;
+	if (slab->free == nullptr)
+		LinkSlab(slab);
+	page->newer = slab->free;
+	slab->free = page;
+	if (--slab->nUsed > 0)
+		return;
+
+	if (cls->nSpare++ == 0)
+		return;	// keep one empty slab
+	UnlinkSlab(slab);
+	cls->nSpare--;
+	stats.slabBytes -= WINRT_PCACHE_ROUND(sizeof(WinRTSlab)) + cls->itemBytes * cls->nItem;
+	::sqlite3_free(slab);
+}
+
+static WinRTPage *PageAlloc(WinRTPageCache *cache)
+{
+	WinRTPage *page = (WinRTPage*)::WinRTReservedPage((int)cache->cls->itemBytes);
+	if (page != nullptr)
+	{
+		page->slab = nullptr;
+		stats.reservedPages++;
+	}
+	else
+	{
+		page = SlabAlloc(cache);
+		if (page == nullptr)
+			return nullptr;
+		if (++stats.heapPages > stats.heapPagesHighwater)
+			stats.heapPagesHighwater = stats.heapPages;
+	}
+
+	char *p = (char*)page + WINRT_PCACHE_ROUND(sizeof(WinRTPage));
+	page->base.pBuf = p;
+	page->base.pExtra = p + WINRT_PCACHE_ROUND(cache->szPage);
+	return page;
+}
+
+static void PageFree(WinRTPage *page)
+{
+	if (page->slab == nullptr)
+	{
+		::WinRTReleaseReservedPage(page);
+		stats.reservedPages--;
+	}
+	else
+	{
+		SlabFree(page);
+		stats.heapPages--;
+	}
+}
+
+/*
+** Page tables
+*/
+
+static unsigned Home(WinRTPageCache *cache, unsigned key)
+{
+	return (key * 0x9E3779B1u) >> cache->shift;
+}
+
+static WinRTPage *Find(WinRTPageCache *cache, unsigned key)
+{
+	unsigned mask = cache->nSlot - 1;
+	for (unsigned i = Home(cache, key);; i = (i + 1) & mask)
+	{
+		WinRTPage *page = cache->table[i];
+		if (page == nullptr || page->key == key)
+			return page;
+	}
+}
+
+static void Place(WinRTPageCache *cache, WinRTPage *page)
+{
+	unsigned mask = cache->nSlot - 1;
+	unsigned i = Home(cache, page->key);
+	while (cache->table[i] != nullptr)
+		i = (i + 1) & mask;
+	cache->table[i] = page;
+}
+
+static bool Resize(WinRTPageCache *cache, unsigned nSlot)
+{
+	WinRTPage **table = (WinRTPage**)::sqlite3_malloc((int)(nSlot * sizeof(WinRTPage*)));
+	if (table == nullptr)
+		return false;
+	::memset(table, 0, nSlot * sizeof(WinRTPage*));
+
+	WinRTPage **old = cache->table;
+	unsigned nOld = cache->nSlot;
+	cache->table = table;
+	cache->nSlot = nSlot;
+	cache->shift = 32;
+	for (unsigned n = nSlot; n > 1; n >>= 1)
+		cache->shift--;
+	for (unsigned i = 0; i < nOld; i++)
+	{
+		if (old[i] != nullptr)
+			Place(cache, old[i]);
+	}
+	::sqlite3_free(old);
+	return true;
+}
+
+static bool Insert(WinRTPageCache *cache, WinRTPage *page)
+{
+	if ((cache->nPage + 1) * 2 > cache->nSlot && !Resize(cache, cache->nSlot * 2))
+		return false;
+	Place(cache, page);
+	cache->nPage++;
+	return true;
+}
+
+static void Remove(WinRTPageCache *cache, WinRTPage *page)
+{
+	unsigned mask = cache->nSlot - 1;
+	unsigned i = Home(cache, page->key);
+	while (cache->table[i] != page)
+		i = (i + 1) & mask;
+
+	// Pull back later entries of the run that would no longer be reached.
+	for (unsigned j = (i + 1) & mask; cache->table[j] != nullptr; j = (j + 1) & mask)
+	{
+		unsigned home = Home(cache, cache->table[j]->key);
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			cache->table[i] = cache->table[j];
+			i = j;
+		}
+	}
+	cache->table[i] = nullptr;
+	cache->nPage--;
+}
+
+/*
+** Pages
+*/
+
+static void Discard(WinRTPage *page)
+{
+	WinRTPageCache *cache = page->cache;
+	WinRTPageList *list = ListOf(page);
+	if (list != nullptr)
+		Unlink(list, page);
+	Remove(cache, page);
+	if (cache->purgeable)
+		Account(-(sqlite_int64)cache->cls->itemBytes);
+	stats.pages--;
+	PageFree(page);
+}
+
+/*
+** Drop the oldest unpinned page, from probation if it has any.
+*/
+static bool EvictOne()
+{
+	WinRTPage *victim = probation.oldest ? probation.oldest : protectedList.oldest;
+	if (victim == nullptr)
+		return false;
+	Discard(victim);
+	stats.evictions++;
+	return true;
+}
+
+static void Enforce(sqlite_int64 bytes)
+{
+	while (stats.used > bytes && EvictOne())
+		;
+}
+
+/*
+** sqlite3_pcache_methods2
+*/
+
+static int WinRTPcacheInit(void *pArg)
+{
+	return SQLITE_OK;
+}
+
+static void WinRTPcacheShutdown(void *pArg)
+{
+}
+
+static sqlite3_pcache *WinRTPcacheCreate(int szPage, int szExtra, int bPurgeable)
+{
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+	WinRTPageCache *cache = new WinRTPageCache();
+	cache->szPage = szPage;
+	cache->szExtra = szExtra;
+	cache->purgeable = bPurgeable != 0;
+	cache->cls = ClassFor(szPage, szExtra);
+	if (!Resize(cache, WINRT_PCACHE_MIN_SLOTS))
+	{
+		delete cache;
+		return nullptr;
+	}
+	stats.caches++;
+	return (sqlite3_pcache*)cache;
+}
+
+static void WinRTPcacheCachesize(sqlite3_pcache *pCache, int nCachesize)
+{
+	// The shared budget stands in for each connection's cache_size.
+}
+
+static int WinRTPcachePagecount(sqlite3_pcache *pCache)
+{
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+	return (int)((WinRTPageCache*)pCache)->nPage;
+}
+
+static sqlite3_pcache_page *WinRTPcacheFetch(sqlite3_pcache *pCache, unsigned key, int createFlag)
+{
+	WinRTPageCache *cache = (WinRTPageCache*)pCache;
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+
+	WinRTPage *page = Find(cache, key);
+	if (page != nullptr)
+	{
+		WinRTPageList *list = ListOf(page);
+		if (list != nullptr)
+			Unlink(list, page);
+		page->segment = WINRT_PAGE_PINNED;
+		page->reused = true;
+		stats.hits++;
+		return &page->base;
+	}
+	if (createFlag == 0)
+		return nullptr;
+
+	if (cache->purgeable)
+	{
+		size_t itemBytes = cache->cls->itemBytes;
+		while (stats.used + (sqlite_int64)itemBytes > stats.budget && EvictOne())
+			;
+		// Over budget with every page pinned: let SQLite spill dirty pages
+		// first, and only then (createFlag 2) go over.
+		if (createFlag == 1 && stats.used + (sqlite_int64)itemBytes > stats.budget)
+			return nullptr;
+	}
+
+	page = PageAlloc(cache);
+	if (page == nullptr)
+		return nullptr;
+	page->cache = cache;
+	page->key = key;
+	page->segment = WINRT_PAGE_PINNED;
+	page->reused = false;
+	if (!Insert(cache, page))
+	{
+		PageFree(page);
+		return nullptr;
+	}
+	::memset(page->base.pExtra, 0, cache->szExtra);
+	if (cache->purgeable)
+		Account(cache->cls->itemBytes);
+	stats.pages++;
+	stats.misses++;
+	return &page->base;
+}
+
+static void WinRTPcacheUnpin(sqlite3_pcache *pCache, sqlite3_pcache_page *pPg, int discard)
+{
+	WinRTPageCache *cache = (WinRTPageCache*)pCache;
+	WinRTPage *page = (WinRTPage*)pPg;
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+	if (discard)
+	{
+		Discard(page);
+		return;
+	}
+	if (!cache->purgeable)
+	{
+		page->segment = WINRT_PAGE_KEPT;
+		return;
+	}
+
+	if (page->reused)
+	{
+		page->segment = WINRT_PAGE_PROTECTED;
+		LinkNewest(&protectedList, page);
+		sqlite_int64 limit = stats.budget / 100 * WINRT_PCACHE_PROTECTED_PERCENT;
+		while (protectedList.bytes > limit && protectedList.oldest != nullptr)
+		{
+			WinRTPage *demoted = protectedList.oldest;
+			Unlink(&protectedList, demoted);
+			demoted->segment = WINRT_PAGE_PROBATION;
+			demoted->reused = false;
+			LinkNewest(&probation, demoted);
+		}
+	}
+	else
+	{
+		page->segment = WINRT_PAGE_PROBATION;
+		LinkNewest(&probation, page);
+	}
+	Enforce(stats.budget);
+}
+
+static void WinRTPcacheRekey(sqlite3_pcache *pCache, sqlite3_pcache_page *pPg, unsigned oldKey, unsigned newKey)
+{
+	WinRTPageCache *cache = (WinRTPageCache*)pCache;
+	WinRTPage *page = (WinRTPage*)pPg;
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+
+	// Any page already at newKey is unpinned and goes.
+	WinRTPage *existing = Find(cache, newKey);
+	if (existing != nullptr && existing != page)
+		Discard(existing);
+	Remove(cache, page);
+	page->key = newKey;
+	Place(cache, page);
+	cache->nPage++;
+}
+
+static void WinRTPcacheTruncate(sqlite3_pcache *pCache, unsigned iLimit)
+{
+	WinRTPageCache *cache = (WinRTPageCache*)pCache;
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+	std::vector<WinRTPage*> gone;
+	for (unsigned i = 0; i < cache->nSlot; i++)
+	{
+		WinRTPage *page = cache->table[i];
+		if (page != nullptr && page->key >= iLimit)
+			gone.push_back(page);
+	}
+	for (WinRTPage *page : gone)
+		Discard(page);
+}
+
+static void WinRTPcacheDestroy(sqlite3_pcache *pCache)
+{
+	WinRTPageCache *cache = (WinRTPageCache*)pCache;
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+	for (unsigned i = 0; i < cache->nSlot; i++)
+	{
+		// Removal shifts later pages back into slot i.
+		while (cache->table[i] != nullptr)
+			Discard(cache->table[i]);
+	}
+	::sqlite3_free(cache->table);
+	stats.caches--;
+	delete cache;
+}
+
+static void WinRTPcacheShrink(sqlite3_pcache *pCache)
+{
+	WinRTPageCache *cache = (WinRTPageCache*)pCache;
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+	std::vector<WinRTPage*> gone;
+	for (unsigned i = 0; i < cache->nSlot; i++)
+	{
+		WinRTPage *page = cache->table[i];
+		if (page != nullptr && ListOf(page) != nullptr)
+			gone.push_back(page);
+	}
+	for (WinRTPage *page : gone)
+		Discard(page);
+}
+
+int WinRTPageCacheInstall(sqlite_int64 budgetBytes)
+{
+	static const sqlite3_pcache_methods2 methods =
+	{
+		1,                          /* iVersion */
+		nullptr,                    /* pArg */
+		WinRTPcacheInit,            /* xInit */
+		WinRTPcacheShutdown,        /* xShutdown */
+		WinRTPcacheCreate,          /* xCreate */
+		WinRTPcacheCachesize,       /* xCachesize */
+		WinRTPcachePagecount,       /* xPagecount */
+		WinRTPcacheFetch,           /* xFetch */
+		WinRTPcacheUnpin,           /* xUnpin */
+		WinRTPcacheRekey,           /* xRekey */
+		WinRTPcacheTruncate,        /* xTruncate */
+		WinRTPcacheDestroy,         /* xDestroy */
+		WinRTPcacheShrink           /* xShrink */
+	};
+
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+	if (!installed)
+	{
+		int rc = ::sqlite3_config(SQLITE_CONFIG_PCACHE2, &methods);
+		if (rc != SQLITE_OK)
+			return rc;
+		installed = true;
+	}
+	stats.budget = budgetBytes;
+	Enforce(stats.budget);
+	return SQLITE_OK;
+}
+
+void WinRTPageCacheShrink(sqlite_int64 bytes)
+{
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+	Enforce(bytes);
+}
+
+bool WinRTPageCacheInstalled()
+{
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+	return installed;
+}
+
+void WinRTPageCacheStatus(WinRTPageCacheStats *pStats)
+{
+	std::lock_guard<std::mutex> lock(pcacheMutex);
+	*pStats = stats;
+}
@@ -0,0 +1,72 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include "sqlite3.h"
+
+/*
+** Default memory budget of the page cache, shared by every connection.
+*/
+#define WINRT_PCACHE_BYTES              (32 * 1024 * 1024)
+
+/*
+** Share of the budget that pages read more than once may hold; the rest is
+** left to pages read once, such as those of a table scan.
+*/
+#define WINRT_PCACHE_PROTECTED_PERCENT  75
+
+/*
+** Page buffers are carved from slabs of about this size.
+*/
+#define WINRT_PCACHE_SLAB_BYTES         (256 * 1024)
+
+typedef struct
+{
+	sqlite_int64 budget;        /* Bytes the purgeable pages may use */
+	sqlite_int64 used;          /* Bytes they use now */
+	sqlite_int64 slabBytes;     /* Bytes held in slabs, including free buffers */
+	sqlite_int64 hits;          /* Fetches of a page already cached */
+	sqlite_int64 misses;        /* Pages created */
+	sqlite_int64 evictions;     /* Unpinned pages dropped to stay in budget */
+	int pages;                  /* Pages cached, pinned or not */
+	int reservedPages;          /* Pages in memory from WinRTReserveMemory */
+	int heapPages;              /* Pages in slabs from the heap, now and at most */
+	int heapPagesHighwater;
+	int caches;                 /* Open caches, one per pager */
+} WinRTPageCacheStats;
+
+/*
+** Replace SQLite's page cache (SQLITE_CONFIG_PCACHE2) with one shared by all
+** connections: each connection's pages are found through an open-addressing
+** table, their buffers come from slabs, and all purgeable pages share one
+** budget of budgetBytes instead of each connection's cache_size. Eviction is
+** a segmented LRU, so pages read once wait on probation and a large scan
+** does not push out pages in repeated use.
+**
+** Must be called before sqlite3_initialize (and so before the VFS is
+** registered); calling it again once installed only changes the budget.
+*/
+int WinRTPageCacheInstall(sqlite_int64 budgetBytes);
+
+/*
+** Evict unpinned pages, oldest first, until the purgeable pages take no
+** more than bytes; the budget stays as it was.
+*/
+void WinRTPageCacheShrink(sqlite_int64 bytes);
+
+/*
+** Whether WinRTPageCacheInstall has installed the cache.
+*/
+bool WinRTPageCacheInstalled();
+
+/*
+** Counters of the installed page cache.
+*/
+void WinRTPageCacheStatus(WinRTPageCacheStats *pStats);
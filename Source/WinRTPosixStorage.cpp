@@ -0,0 +1,237 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Storage backend built on pread/pwrite/fdatasync/ftruncate, so the VFS
+*		can be exercised and benchmarked outside of a Windows Store app.
+*/
+
+#include "pch.h"
+
+#if !SQLITE_OS_WINRT
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "WinRTStorage.h"
+
+/*
+** Most iovecs handed to one pwritev; a longer run takes several calls.
+*/
+#define WINRT_POSIX_IOV         256
+
+/*
+** Nanoseconds of a file's modification and change times: st_mtim and st_ctim
+** on Linux, st_mtimespec and st_ctimespec on Apple platforms. Elsewhere the
+** change token makes do with the whole seconds in st_mtime and st_ctime.
+*/
+#if defined(__APPLE__)
+#define WINRT_MTIME_NSEC(st)    ((st).st_mtimespec.tv_nsec)
+#define WINRT_CTIME_NSEC(st)    ((st).st_ctimespec.tv_nsec)
+#elif defined(__linux__)
+#define WINRT_MTIME_NSEC(st)    ((st).st_mtim.tv_nsec)
+#define WINRT_CTIME_NSEC(st)    ((st).st_ctim.tv_nsec)
+#else
+#define WINRT_MTIME_NSEC(st)    0
+#define WINRT_CTIME_NSEC(st)    0
+#endif
+
+
+class WinRTPosixStorage : public WinRTStorage
+{
+public:
+	WinRTPosixStorage(int fd) : fd(fd) {}
+
+	virtual ~WinRTPosixStorage()
+	{
+		::close(fd);
+	}
+
+	virtual int Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead)
+	{
+		int nRead = 0;
+		while (nRead < iAmt)
+		{
+			ssize_t got = ::pread(fd, (char*)zBuf + nRead, iAmt - nRead, iOfst + nRead);
+			if (got < 0)
+			{
+				if (errno == EINTR) continue;
+				return SQLITE_IOERR_READ;
+			}
+			if (got == 0)
+				break;	// end of file
+			nRead += (int)got;
+		}
+		*pnRead = nRead;
+		return SQLITE_OK;
+	}
+
+	virtual int Write(const void *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		int nWritten = 0;
+		while (nWritten < iAmt)
+		{
+			ssize_t put = ::pwrite(fd, (const char*)zBuf + nWritten, iAmt - nWritten, iOfst + nWritten);
+			if (put < 0)
+			{
+				if (errno == EINTR) continue;
+				return errno == ENOSPC ? SQLITE_FULL : SQLITE_IOERR_WRITE;
+			}
+			nWritten += (int)put;
+		}
+		return SQLITE_OK;
+	}
+
+	/*
+	** Each run of adjacent requests is written with pwritev, straight from
+	** the callers' buffers.
+	*/
+	virtual int WriteBatch(WinRTIoVec *aVec, int nVec)
+	{
+		struct iovec iov[WINRT_POSIX_IOV];
+		int i = 0;
+		while (i < nVec)
+		{
+			sqlite_int64 iOfst = aVec[i].iOfst;
+			sqlite_int64 iEnd = iOfst;
+			int nIov = 0;
+			int j = i;
+			while (j < nVec && aVec[j].iOfst == iEnd && nIov < WINRT_POSIX_IOV)
+			{
+				iov[nIov].iov_base = aVec[j].zBuf;
+				iov[nIov].iov_len = (size_t)aVec[j].iAmt;
+				nIov++;
+				iEnd += aVec[j].iAmt;
+				j++;
+			}
+
+			int rc = WriteV(iov, nIov, iOfst);
+			if (rc != SQLITE_OK)
+				return rc;
+			for (; i < j; i++)
+				aVec[i].nDone = aVec[i].iAmt;
+		}
+		return SQLITE_OK;
+	}
+
+	virtual int Truncate(sqlite_int64 size)
+	{
+		if (::ftruncate(fd, (off_t)size) != 0)
+			return SQLITE_IOERR_TRUNCATE;
+		return SQLITE_OK;
+	}
+
+	virtual int Sync(int flags)
+	{
+		if (::fdatasync(fd) != 0)
+			return SQLITE_IOERR_FSYNC;
+		return SQLITE_OK;
+	}
+
+	virtual int FileSize(sqlite_int64 *pSize)
+	{
+		struct stat st;
+		if (::fstat(fd, &st) != 0)
+			return SQLITE_IOERR_FSTAT;
+		*pSize = st.st_size;
+		return SQLITE_OK;
+	}
+
+	/*
+	** Modification time, change time, size and inode, folded together.
+	** Timestamps have the kernel's clock-tick granularity (whole seconds
+	** where WINRT_MTIME_NSEC is unknown), so two writes by another process
+	** within one tick that leave the size alone look alike.
+	*/
+	virtual int ChangeToken(sqlite_uint64 *pToken)
+	{
+		struct stat st;
+		if (::fstat(fd, &st) != 0)
+			return SQLITE_IOERR_FSTAT;
+		sqlite_uint64 h = 14695981039346656037ULL;
+		sqlite_uint64 parts[] = { (sqlite_uint64)st.st_mtime, (sqlite_uint64)WINRT_MTIME_NSEC(st),
+			(sqlite_uint64)st.st_ctime, (sqlite_uint64)WINRT_CTIME_NSEC(st),
+			(sqlite_uint64)st.st_size, (sqlite_uint64)st.st_ino };
+		for (sqlite_uint64 part : parts)
+			h = (h ^ part) * 1099511628211ULL;
+		*pToken = h;
+		return SQLITE_OK;
+	}
+
+private:
+	/*
+	** pwritev until every iovec is written, advancing past partial writes.
+	*/
+	int WriteV(struct iovec *iov, int nIov, sqlite_int64 iOfst)
+	{
+		while (nIov > 0)
+		{
+			ssize_t put = ::pwritev(fd, iov, nIov, (off_t)iOfst);
+			if (put < 0)
+			{
+				if (errno == EINTR) continue;
+				return errno == ENOSPC ? SQLITE_FULL : SQLITE_IOERR_WRITE;
+			}
+			iOfst += put;
+			while (nIov > 0 && (size_t)put >= iov->iov_len)
+			{
+				put -= iov->iov_len;
+				iov++;
+				nIov--;
+			}
+			if (nIov > 0)
+			{
+				iov->iov_base = (char*)iov->iov_base + put;
+				iov->iov_len -= put;
+			}
+		}
+		return SQLITE_OK;
+	}
+
+	int fd;
+};
+
+
+class WinRTPosixBackendImpl : public WinRTBackend
+{
+public:
+	virtual int Open(const char *zName, int flags, WinRTStorage **ppStorage)
+	{
+		// Like GetStorageFileFromPath, files are always created if missing.
+		int oflags = (flags & SQLITE_OPEN_READONLY) ? O_RDONLY : (O_RDWR | O_CREAT);
+		int fd;
+		do
+		{
+			fd = ::open(zName, oflags | O_CLOEXEC, 0644);
+		} while (fd < 0 && errno == EINTR);
+
+		if (fd < 0)
+			return errno == EACCES ? SQLITE_IOERR_ACCESS : SQLITE_CANTOPEN;
+
+		*ppStorage = new WinRTPosixStorage(fd);
+		return SQLITE_OK;
+	}
+
+	virtual int Delete(const char *zName, int dirSync)
+	{
+		if (::unlink(zName) != 0 && errno != ENOENT)
+			return errno == EACCES ? SQLITE_IOERR_ACCESS : SQLITE_IOERR_DELETE;
+		return SQLITE_OK;
+	}
+};
+
+WinRTBackend *WinRTPosixBackend()
+{
+	static WinRTPosixBackendImpl backend;
+	return &backend;
+}
+
+#endif /* !SQLITE_OS_WINRT */
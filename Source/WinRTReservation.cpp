@@ -0,0 +1,356 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Memory reserved up front for page buffers and lookaside.
+*
+*		The reservation is one block: the page buffers, then one lookaside
+*		region per connection. It is aligned to WINRT_RESERVE_ALIGN so that,
+*		where the OS backs it with 2 MB pages, the TLB covers it in a handful
+*		of entries, and it is touched once when reserved so that no page
+*		faults are taken later on the paths that use it.
+*
+*		SQLite allocates each connection's lookaside with one malloc of
+*		exactly lookasideSize * lookasideCount bytes when the connection
+*		opens, and frees it last when the connection closes, so the
+*		reservation wraps SQLite's allocator and answers mallocs of that size
+*		with a free region. Anything else, and connections opened when every
+*		region is taken, go to the allocator that was installed before.
+*
+*		On WinRT, where apps cannot map huge pages, the block comes from the
+*		heap, aligned.
+*/
+
+#include "pch.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#if SQLITE_OS_WINRT
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "WinRTReservation.h"
+#include "WinRTPageCache.h"
+
+#define WINRT_RESERVE_ALIGN     (2 * 1024 * 1024)
+
+/*
+** Bytes SQLite keeps with each page beyond the page itself; newer SQLite
+** reports it (SQLITE_CONFIG_PCACHE_HDRSZ), older is assumed to need no more
+** than WINRT_RESERVE_PAGE_HEADER. WINRT_RESERVE_PAGE_OWN covers the shared
+** page cache's own header.
+*/
+#ifndef SQLITE_CONFIG_PCACHE_HDRSZ
+#define SQLITE_CONFIG_PCACHE_HDRSZ  24
+#endif
+#define WINRT_RESERVE_PAGE_HEADER   448
+#define WINRT_RESERVE_PAGE_OWN      64
+
+#define WINRT_RESERVE_ROUND(n, m)   (((n) + (m) - 1) / (m) * (m))
+
+struct WinRTFreeRegion
+{
+	WinRTFreeRegion *next;
+};
+
+static std::mutex reserveMutex;
+static bool reserved = false;
+static char *block = nullptr;
+static sqlite_int64 blockBytes = 0;
+static int largePages = WINRT_RESERVE_SMALL_PAGES;
+static sqlite3_mem_methods underlying;
+
+// Page buffers
+static char *pageStart = nullptr;
+static char *pageEnd = nullptr;
+static int slotBytes = 0;
+static int nSlot = 0;
+static bool sharedPageCache = false;
+static WinRTFreeRegion *freeSlots = nullptr;
+static int slotsUsed = 0;
+static int slotsHighwater = 0;
+
+// Lookaside
+static char *lookasideStart = nullptr;
+static char *lookasideEnd = nullptr;
+static int regionBytes = 0;
+static int nRegion = 0;
+static WinRTFreeRegion *freeRegions = nullptr;
+static int regionsUsed = 0;
+static int regionsHighwater = 0;
+static sqlite_int64 regionOverflow = 0;
+
+static char *MapBlock(size_t bytes, bool wantLarge, int *pLarge)
+{
+	*pLarge = WINRT_RESERVE_SMALL_PAGES;
+#if SQLITE_OS_WINRT
+	return (char*)::_aligned_malloc(bytes, WINRT_RESERVE_ALIGN);
+#else
+#if defined(MAP_HUGETLB)
+	if (wantLarge)
+	{
+		void *p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			*pLarge = WINRT_RESERVE_HUGE_PAGES;
+			return (char*)p;
+		}
+	}
+#endif
+	// Map with room to align, and give back the ends.
+	size_t mapped = bytes + WINRT_RESERVE_ALIGN;
+	char *p = (char*)::mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == (char*)MAP_FAILED)
+		return nullptr;
+	char *aligned = (char*)WINRT_RESERVE_ROUND((uintptr_t)p, WINRT_RESERVE_ALIGN);
+	if (aligned > p)
+		::munmap(p, aligned - p);
+	if (aligned + bytes < p + mapped)
+		::munmap(aligned + bytes, p + mapped - (aligned + bytes));
+#if defined(MADV_HUGEPAGE)
+	if (wantLarge && ::madvise(aligned, bytes, MADV_HUGEPAGE) == 0)
+		*pLarge = WINRT_RESERVE_TRANSPARENT_HUGE;
+#endif
+	return aligned;
+#endif
+}
+
+static void Push(WinRTFreeRegion **pList, char *p)
+{
+	WinRTFreeRegion *region = (WinRTFreeRegion*)p;
+	region->next = *pList;
+	*pList = region;
+}
+
+static char *Pop(WinRTFreeRegion **pList)
+{
+	WinRTFreeRegion *region = *pList;
+	if (region != nullptr)
+		*pList = region->next;
+	return (char*)region;
+}
+
+static bool IsLookaside(void *p)
+{
+	return (char*)p >= lookasideStart && (char*)p < lookasideEnd;
+}
+
+/*
+** sqlite3_mem_methods wrapped around the allocator installed before
+*/
+
+static void *WinRTReserveMalloc(int n)
+{
+	if (n == regionBytes)
+	{
+		std::unique_lock<std::mutex> lock(reserveMutex);
+		char *p = Pop(&freeRegions);
+		if (p != nullptr)
+		{
+			if (++regionsUsed > regionsHighwater)
+				regionsHighwater = regionsUsed;
+			return p;
+		}
+		regionOverflow++;
+	}
+	return underlying.xMalloc(n);
+}
+
+static void WinRTReserveFree(void *p)
+{
+	if (IsLookaside(p))
+	{
+		std::lock_guard<std::mutex> lock(reserveMutex);
+		Push(&freeRegions, (char*)p);
+		regionsUsed--;
+		return;
+	}
+	underlying.xFree(p);
+}
+
+static int WinRTReserveSize(void *p)
+{
+	return IsLookaside(p) ? regionBytes : underlying.xSize(p);
+}
+
+static void *WinRTReserveRealloc(void *p, int n)
+{
+	if (!IsLookaside(p))
+		return underlying.xRealloc(p, n);
+	void *q = underlying.xMalloc(n);
+	if (q != nullptr)
+	{
+		::memcpy(q, p, n < regionBytes ? n : regionBytes);
+		WinRTReserveFree(p);
+	}
+	return q;
+}
+
+static int WinRTReserveRoundup(int n)
+{
+	return underlying.xRoundup(n);
+}
+
+static int WinRTReserveInit(void *pAppData)
+{
+	return underlying.xInit(underlying.pAppData);
+}
+
+static void WinRTReserveShutdown(void *pAppData)
+{
+	underlying.xShutdown(underlying.pAppData);
+}
+
+int WinRTReserveMemory(const WinRTReservationConfig *pConfig)
+{
+	static const sqlite3_mem_methods methods =
+	{
+		WinRTReserveMalloc,     /* xMalloc */
+		WinRTReserveFree,       /* xFree */
+		WinRTReserveRealloc,    /* xRealloc */
+		WinRTReserveSize,       /* xSize */
+		WinRTReserveRoundup,    /* xRoundup */
+		WinRTReserveInit,       /* xInit */
+		WinRTReserveShutdown,   /* xShutdown */
+		nullptr                 /* pAppData */
+	};
+
+	std::lock_guard<std::mutex> lock(reserveMutex);
+	if (reserved)
+		return SQLITE_MISUSE;
+	if (pConfig->pageCount < 0 || pConfig->connections < 0 || pConfig->lookasideCount < 0 || pConfig->lookasideSize < 0)
+		return SQLITE_MISUSE;
+
+	int header = 0;
+	if (::sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header) != SQLITE_OK)
+		header = WINRT_RESERVE_PAGE_HEADER;
+	int slot = WINRT_RESERVE_ROUND(pConfig->pageSize + header + WINRT_RESERVE_PAGE_OWN, 64);
+	int nPage = pConfig->pageSize > 0 ? pConfig->pageCount : 0;
+
+	// As SQLite rounds it.
+	int lookasideSize = pConfig->lookasideSize & ~7;
+	int region = lookasideSize * pConfig->lookasideCount;
+	int nConn = region > 0 ? pConfig->connections : 0;
+
+	size_t pageBytes = WINRT_RESERVE_ROUND((size_t)slot * nPage, 4096);
+	size_t lookasideBytes = WINRT_RESERVE_ROUND((size_t)region * nConn, 4096);
+	size_t bytes = WINRT_RESERVE_ROUND(pageBytes + lookasideBytes, WINRT_RESERVE_ALIGN);
+	if (bytes == 0)
+		return SQLITE_OK;
+
+	int large = WINRT_RESERVE_SMALL_PAGES;
+	char *p = MapBlock(bytes, pConfig->largePages != 0, &large);
+	if (p == nullptr)
+		return SQLITE_NOMEM;
+	::memset(p, 0, bytes);	// fault every page in now
+
+	int rc = SQLITE_OK;
+	if (nPage > 0)
+	{
+		if (::WinRTPageCacheInstalled())
+		{
+			// The shared page cache takes its pages through WinRTReservedPage.
+			sharedPageCache = true;
+			for (int i = nPage - 1; i >= 0; i--)
+				Push(&freeSlots, p + (size_t)slot * i);
+		}
+		else
+		{
+			rc = ::sqlite3_config(SQLITE_CONFIG_PAGECACHE, p, slot, nPage);
+		}
+	}
+	if (rc == SQLITE_OK && nConn > 0)
+	{
+		rc = ::sqlite3_config(SQLITE_CONFIG_GETMALLOC, &underlying);
+		if (rc == SQLITE_OK)
+			rc = ::sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+		if (rc == SQLITE_OK)
+			rc = ::sqlite3_config(SQLITE_CONFIG_LOOKASIDE, lookasideSize, pConfig->lookasideCount);
+		for (int i = nConn - 1; i >= 0; i--)
+			Push(&freeRegions, p + pageBytes + (size_t)region * i);
+	}
+	if (rc != SQLITE_OK)
+	{
+		// SQLite is already initialized; the block stays, unused.
+		freeSlots = nullptr;
+		freeRegions = nullptr;
+		return rc;
+	}
+
+	reserved = true;
+	block = p;
+	blockBytes = (sqlite_int64)bytes;
+	largePages = large;
+	pageStart = p;
+	pageEnd = p + (size_t)slot * nPage;
+	slotBytes = slot;
+	nSlot = nPage;
+	lookasideStart = p + pageBytes;
+	lookasideEnd = lookasideStart + (size_t)region * nConn;
+	regionBytes = nConn > 0 ? region : -1;
+	nRegion = nConn;
+	return SQLITE_OK;
+}
+
+void *WinRTReservedPage(int nByte)
+{
+	std::lock_guard<std::mutex> lock(reserveMutex);
+	if (nByte > slotBytes)
+		return nullptr;
+	char *p = Pop(&freeSlots);
+	if (p != nullptr && ++slotsUsed > slotsHighwater)
+		slotsHighwater = slotsUsed;
+	return p;
+}
+
+bool WinRTReleaseReservedPage(void *p)
+{
+	if ((char*)p < pageStart || (char*)p >= pageEnd)
+		return false;
+	std::lock_guard<std::mutex> lock(reserveMutex);
+	Push(&freeSlots, (char*)p);
+	slotsUsed--;
+	return true;
+}
+
+void WinRTReservationStatus(WinRTReservationStats *pStats)
+{
+	::memset(pStats, 0, sizeof(*pStats));
+	std::lock_guard<std::mutex> lock(reserveMutex);
+	pStats->bytes = blockBytes;
+	pStats->largePages = largePages;
+	pStats->pageSlots = nSlot;
+	pStats->pageSlotBytes = slotBytes;
+	if (sharedPageCache)
+	{
+		WinRTPageCacheStats cache;
+		::WinRTPageCacheStatus(&cache);
+		pStats->pagesUsed = slotsUsed;
+		pStats->pagesHighwater = slotsHighwater;
+		pStats->pageOverflow = cache.heapPages;
+		pStats->pageOverflowHighwater = cache.heapPagesHighwater;
+	}
+	else if (nSlot > 0)
+	{
+		// SQLite's page cache counts slots, and overflow in bytes.
+		int current = 0, highwater = 0;
+		::sqlite3_status(SQLITE_STATUS_PAGECACHE_USED, &current, &highwater, 0);
+		pStats->pagesUsed = current;
+		pStats->pagesHighwater = highwater;
+		::sqlite3_status(SQLITE_STATUS_PAGECACHE_OVERFLOW, &current, &highwater, 0);
+		pStats->pageOverflow = (current + slotBytes - 1) / slotBytes;
+		pStats->pageOverflowHighwater = (highwater + slotBytes - 1) / slotBytes;
+	}
+	pStats->lookasideRegions = nRegion;
+	pStats->lookasideUsed = regionsUsed;
+	pStats->lookasideHighwater = regionsHighwater;
+	pStats->lookasideOverflow = regionOverflow;
+}
@@ -0,0 +1,77 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include "sqlite3.h"
+
+/*
+** What backs the reservation (WinRTReservationStats.largePages).
+*/
+#define WINRT_RESERVE_SMALL_PAGES       0
+#define WINRT_RESERVE_TRANSPARENT_HUGE  1   /* the OS was asked to use huge pages */
+#define WINRT_RESERVE_HUGE_PAGES        2   /* mapped from huge pages */
+
+typedef struct
+{
+	int pageSize;               /* Largest database page size in use */
+	int pageCount;              /* Page buffers to reserve; 0 for none */
+	int lookasideSize;          /* Bytes per lookaside slot */
+	int lookasideCount;         /* Lookaside slots per connection */
+	int connections;            /* Connections whose lookaside to reserve; 0 for none */
+	int largePages;             /* Ask for huge pages where the OS allows */
+} WinRTReservationConfig;
+
+typedef struct
+{
+	sqlite_int64 bytes;         /* Size of the reservation */
+	int largePages;             /* WINRT_RESERVE_* */
+	int pageSlots;              /* Page buffers reserved */
+	int pageSlotBytes;          /* Size of each, page header included */
+	int pagesUsed;              /* Buffers in use, now and at most */
+	int pagesHighwater;
+	int pageOverflow;           /* Pages held outside the reservation, now and at most */
+	int pageOverflowHighwater;
+	int lookasideRegions;       /* Connections' lookaside regions reserved */
+	int lookasideUsed;          /* Regions in use, now and at most */
+	int lookasideHighwater;
+	sqlite_int64 lookasideOverflow;    /* Connections opened when none was free */
+} WinRTReservationStats;
+
+/*
+** Reserve one contiguous block of memory, huge-page backed if asked and
+** possible, for the page cache and for connections' lookaside:
+**
+**   - pageCount buffers for database pages of up to pageSize, handed to
+**     SQLite's page cache as SQLITE_CONFIG_PAGECACHE, or, when the shared
+**     page cache (WinRTPageCacheInstall) is installed, taken by it;
+**   - connections regions of lookasideCount slots of lookasideSize bytes.
+**     SQLITE_CONFIG_LOOKASIDE is set to that size, and SQLite's allocator
+**     is wrapped so that each connection's lookaside comes from a free
+**     region.
+**
+** Pages or connections beyond what was reserved fall back to the heap and
+** are counted as overflow. Must be called before sqlite3_initialize, after
+** any other allocator or page cache is installed, and only once; the
+** memory is never released.
+*/
+int WinRTReserveMemory(const WinRTReservationConfig *pConfig);
+
+/*
+** Usage of the reservation.
+*/
+void WinRTReservationStatus(WinRTReservationStats *pStats);
+
+/*
+** For the shared page cache: a reserved page buffer of at least nByte
+** bytes, or null if there is none; and its release. WinRTReleaseReservedPage
+** returns false for memory that was not reserved.
+*/
+void *WinRTReservedPage(int nByte);
+bool WinRTReleaseReservedPage(void *p);
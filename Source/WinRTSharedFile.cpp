@@ -0,0 +1,169 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#include "pch.h"
+
+#include <stdlib.h>
+#include <map>
+#include <utility>
+#if !SQLITE_OS_WINRT
+#include <limits.h>
+#endif
+
+#include "WinRTSharedFile.h"
+
+#if SQLITE_OS_WINRT
+#define WINRT_PATH_SEPARATOR '\\'
+#else
+#define WINRT_PATH_SEPARATOR '/'
+#endif
+
+static std::mutex filesMutex;
+static std::map<std::pair<const void*, std::string>, WinRTSharedFile*> files;
+
+int WinRTSharedFile::Open(WinRTBackend *pBackend, const char *zName, int flags, WinRTSharedFile **ppFile, bool *pFirst)
+{
+	*pFirst = false;
+	if (!(flags & SQLITE_OPEN_MAIN_DB))
+	{
+		WinRTStorage *storage = nullptr;
+		int rc = pBackend->Open(zName, flags, &storage);
+		if (rc != SQLITE_OK)
+			return rc;
+		WinRTSharedFile *file = new WinRTSharedFile();
+		file->storage = storage;
+		file->reader = storage;
+		file->nRef = 1;
+		*ppFile = file;
+		return SQLITE_OK;
+	}
+
+	std::string path = ::WinRTCanonicalPath(zName);
+	bool readOnly = (flags & SQLITE_OPEN_READONLY) != 0;
+
+	std::lock_guard<std::mutex> lock(filesMutex);
+	auto it = files.find(std::make_pair((const void*)pBackend, path));
+	WinRTSharedFile *file = it != files.end() ? it->second : nullptr;
+	if (file == nullptr || (file->readOnly && !readOnly))
+	{
+		WinRTStorage *storage = nullptr;
+		int rc = pBackend->Open(zName, flags, &storage);
+		if (rc != SQLITE_OK)
+			return rc;
+
+		if (file == nullptr)
+		{
+			file = new WinRTSharedFile();
+			file->backend = pBackend;
+			file->path = path;
+			file->readOnly = readOnly;
+			file->storage = storage;
+			file->reader = storage;
+			file->header = new WinRTHeaderCache();
+			file->blocks = WinRTBlockCache::Acquire(pBackend, path.c_str());
+			files[std::make_pair((const void*)pBackend, path)] = file;
+			*pFirst = true;
+		}
+		else
+		{
+			// Connections already open carry on with the writable storage.
+			std::lock_guard<std::mutex> fileLock(file->mutex);
+			file->retired.push_back(file->storage);
+			file->storage = storage;
+			file->reader = storage;
+			file->readOnly = false;
+		}
+	}
+	file->nRef++;
+	*ppFile = file;
+	return SQLITE_OK;
+}
+
+void WinRTSharedFile::Retain(WinRTSharedFile *file)
+{
+	std::lock_guard<std::mutex> lock(filesMutex);
+	file->nRef++;
+}
+
+void WinRTSharedFile::Release(WinRTSharedFile *file, std::vector<sqlite_int64> *pHot)
+{
+	{
+		std::lock_guard<std::mutex> lock(filesMutex);
+		if (--file->nRef > 0)
+			return;
+		if (file->header != nullptr)
+			files.erase(std::make_pair(file->backend, file->path));
+	}
+	if (file->blocks != nullptr)
+		WinRTBlockCache::Release(file->blocks, pHot);
+	delete file->header;
+	delete file->storage;
+	for (WinRTStorage *storage : file->retired)
+		delete storage;
+	delete file;
+}
+
+std::string WinRTCanonicalPath(const char *zPath)
+{
+	std::string in(zPath);
+	for (char &c : in)
+	{
+		if (c == '/' || c == '\\')
+			c = WINRT_PATH_SEPARATOR;
+#if SQLITE_OS_WINRT
+		else if (c >= 'A' && c <= 'Z')
+			c = c - 'A' + 'a';
+#endif
+	}
+
+	// Keep the leading separators ("/", or "\\" of a UNC path), then rebuild
+	// the rest segment by segment.
+	size_t i = in.find_first_not_of(WINRT_PATH_SEPARATOR);
+	if (i == std::string::npos)
+		return in;
+	std::string prefix = in.substr(0, i);
+	std::vector<std::string> segments;
+	while (i < in.size())
+	{
+		size_t j = in.find(WINRT_PATH_SEPARATOR, i);
+		if (j == std::string::npos)
+			j = in.size();
+		std::string segment = in.substr(i, j - i);
+		if (segment == ".." && !segments.empty() && segments.back() != "..")
+			segments.pop_back();
+		else if (!segment.empty() && segment != ".")
+			segments.push_back(segment);
+		i = j + 1;
+	}
+
+	std::string dir = prefix;
+	for (size_t k = 0; k + 1 < segments.size(); k++)
+	{
+		if (k > 0)
+			dir += WINRT_PATH_SEPARATOR;
+		dir += segments[k];
+	}
+	std::string base = segments.empty() ? std::string() : segments.back();
+
+#if !SQLITE_OS_WINRT
+	// The directory, unlike the file, exists before the first open, so it
+	// resolves the same way every time.
+	char zReal[PATH_MAX];
+	if (::realpath(dir.empty() ? "." : dir.c_str(), zReal) != nullptr)
+	{
+		dir = zReal;
+		if (dir.size() > 1)
+			dir += WINRT_PATH_SEPARATOR;
+		return dir + base;
+	}
+#endif
+	if (!dir.empty() && dir != prefix)
+		dir += WINRT_PATH_SEPARATOR;
+	return dir + base;
+}
@@ -0,0 +1,85 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "WinRTStorage.h"
+#include "WinRTHeaderCache.h"
+#include "WinRTBlockCache.h"
+
+/*
+** An open file as the connections using it share it. Every connection to a
+** main database in this process gets the same WinRTSharedFile, found by
+** canonical path, so there is one storage handle, one header cache, one
+** block cache and one cached size per file however many connections are
+** open. Each connection's WinRTFile only adds its own pending writes.
+**
+** Other files (journals) belong to one connection and get a WinRTSharedFile
+** of their own, with no caches.
+**
+** Storage calls and size are guarded by mutex, except reads of a main
+** database, which go through Reader() without it so that connections read
+** in parallel; the caches have locks of their own and are used without it.
+*/
+class WinRTSharedFile
+{
+public:
+	/*
+	** The shared file for zName, opening storage through pBackend if it is
+	** not open yet. Storage open read-only is reopened if flags ask for
+	** writing. *pFirst is set for the first connection to the file.
+	*/
+	static int Open(WinRTBackend *pBackend, const char *zName, int flags, WinRTSharedFile **ppFile, bool *pFirst);
+
+	/*
+	** Add a holder that is not a connection, matched by a Release.
+	*/
+	static void Retain(WinRTSharedFile *file);
+
+	/*
+	** Drop a connection or holder. When the last one goes, *pHot receives the blocks
+	** to remember for the next open (see WinRTBlockCache::Release).
+	*/
+	static void Release(WinRTSharedFile *file, std::vector<sqlite_int64> *pHot);
+
+	/*
+	** The storage, for a read made without mutex. Storage that Open replaces
+	** is kept until the file is released, for reads still using it.
+	*/
+	WinRTStorage *Reader() { return reader; }
+
+	std::mutex mutex;
+	WinRTStorage *storage = nullptr;
+	WinRTHeaderCache *header = nullptr;	// main databases only
+	WinRTBlockCache *blocks = nullptr;	// main databases only
+	sqlite_int64 size = 0;				// size of the file in storage, if sizeKnown
+	bool sizeKnown = false;
+
+private:
+	WinRTSharedFile() : reader(nullptr) {}
+
+	std::atomic<WinRTStorage*> reader;
+	std::vector<WinRTStorage*> retired;	// replaced by Open
+	const void *backend = nullptr;
+	std::string path;
+	bool readOnly = false;
+	int nRef = 0;
+};
+
+/*
+** Key under which state about the file zPath is shared: separators made
+** uniform and "." and ".." segments resolved; on Windows the case is folded,
+** and elsewhere the directory's symbolic links are resolved when it exists.
+*/
+std::string WinRTCanonicalPath(const char *zPath);
@@ -0,0 +1,340 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Storage backend that keeps files in memory and makes every operation
+*		take as long as it would on a modelled device, so that caching,
+*		prefetch and write coalescing can be evaluated against slow storage
+*		on any machine.
+*/
+
+/*
+*		The device serves one operation at a time. Each operation books the
+*		device from the later of now and the end of the last booking, for
+*		its cost, and then sleeps until the booking ends; the lock is held
+*		only to book. A run of adjacent requests in a batch is one
+*		operation, as a vectored write is on a real device.
+*
+*		Data is copied once the wait is over, under the file's own lock, so
+*		a read never sees a write that has not finished on the device. An
+*		operation given up at its deadline (WinRTDeadline.h) stops waiting
+*		and copies nothing, but keeps its booking, as a real device goes on
+*		with a request the caller has stopped waiting for.
+*/
+
+#include "pch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <vector>
+
+#include "WinRTSimStorage.h"
+#include "WinRTDeadline.h"
+
+struct WinRTSimFile
+{
+	WinRTSimFile() : dirty(0), version(0) {}
+
+	std::mutex mutex;
+	std::vector<char> data;
+	sqlite_int64 dirty;             // bytes written since the last sync
+	sqlite_uint64 version;          // the change token
+};
+
+class WinRTSimBackendImpl : public WinRTBackend
+{
+public:
+	WinRTSimBackendImpl(const WinRTSimModel &model)
+		: model(model), random(model.seed != 0 ? model.seed : 1), freeAt(0)
+	{
+		::memset(&stats, 0, sizeof(stats));
+	}
+
+	virtual int Open(const char *zName, int flags, WinRTStorage **ppStorage);
+	virtual int Delete(const char *zName, int dirSync);
+
+	/*
+	** Book the device for an operation of latency plus bytes at rate, and
+	** wait until it is done. Returns SQLITE_IOERR if the operation is to
+	** fail, drawn at failPerMillion, and SQLITE_INTERRUPT if it was given
+	** up before it was done.
+	*/
+	int Serve(int latency, sqlite_int64 bytes, sqlite_int64 rate, int failPerMillion = 0)
+	{
+		sqlite_int64 cost = latency + (rate > 0 ? bytes * 1000000 / rate : 0);
+		sqlite_int64 wait;
+		bool fail;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (Chance(model.stallPerMillion))
+			{
+				cost += model.stallMicro;
+				stats.stalls++;
+			}
+			fail = Chance(failPerMillion);
+			sqlite_int64 now = ClockMicro();
+			sqlite_int64 start = std::max(now, freeAt);
+			freeAt = start + cost;
+			wait = freeAt - now;
+			stats.busyMicro += cost;
+			stats.waitMicro += start - now;
+		}
+		if (wait > 0 && ::WinRTIoSleep(wait) != SQLITE_OK)
+		{
+			Count(&WinRTSimStats::abandoned, 1);
+			return SQLITE_INTERRUPT;
+		}
+		return fail ? SQLITE_IOERR : SQLITE_OK;
+	}
+
+	void Count(sqlite_int64 WinRTSimStats::*counter, sqlite_int64 n)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.*counter += n;
+	}
+
+	void Status(WinRTSimStats *pStats)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		*pStats = stats;
+	}
+
+	const WinRTSimModel model;
+
+private:
+	static sqlite_int64 ClockMicro()
+	{
+		return (sqlite_int64)std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+			).count();
+	}
+
+	// xorshift64*, called with mutex held.
+	bool Chance(int perMillion)
+	{
+		if (perMillion <= 0)
+			return false;
+		random ^= random >> 12;
+		random ^= random << 25;
+		random ^= random >> 27;
+		return (random * 2685821657736338717ULL) % 1000000 < (sqlite_uint64)perMillion;
+	}
+
+	std::mutex mutex;               // held to book the device and count
+	sqlite_uint64 random;
+	sqlite_int64 freeAt;            // when the device finishes what is booked
+	WinRTSimStats stats;
+	std::map<std::string, std::shared_ptr<WinRTSimFile>> files;
+	std::mutex filesMutex;
+};
+
+
+class WinRTSimStorage : public WinRTStorage
+{
+public:
+	WinRTSimStorage(WinRTSimBackendImpl *backend, std::shared_ptr<WinRTSimFile> file)
+		: backend(backend), file(file) {}
+
+	virtual int Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead)
+	{
+		WinRTIoVec vec = { zBuf, iAmt, iOfst, 0 };
+		int rc = ReadBatch(&vec, 1);
+		*pnRead = vec.nDone;
+		return rc;
+	}
+
+	virtual int Write(const void *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		WinRTIoVec vec = { (void*)zBuf, iAmt, iOfst, 0 };
+		return WriteBatch(&vec, 1);
+	}
+
+	virtual int ReadBatch(WinRTIoVec *aVec, int nVec)
+	{
+		for (int i = 0; i < nVec;)
+		{
+			int j = Run(aVec, nVec, i);
+			sqlite_int64 bytes = aVec[j - 1].iOfst + aVec[j - 1].iAmt - aVec[i].iOfst;
+			int rc = backend->Serve(backend->model.readMicro, bytes, backend->model.readBytesPerSec);
+			backend->Count(&WinRTSimStats::reads, 1);
+			backend->Count(&WinRTSimStats::bytesRead, bytes);
+			if (rc != SQLITE_OK)
+				return SQLITE_IOERR_READ;
+
+			std::lock_guard<std::mutex> lock(file->mutex);
+			sqlite_int64 size = (sqlite_int64)file->data.size();
+			for (; i < j; i++)
+			{
+				WinRTIoVec &vec = aVec[i];
+				int n = (int)std::max<sqlite_int64>(0, std::min<sqlite_int64>(vec.iAmt, size - vec.iOfst));
+				if (n > 0)
+					::memcpy(vec.zBuf, &file->data[(size_t)vec.iOfst], n);
+				vec.nDone = n;
+			}
+		}
+		return SQLITE_OK;
+	}
+
+	virtual int WriteBatch(WinRTIoVec *aVec, int nVec)
+	{
+		for (int i = 0; i < nVec;)
+		{
+			int j = Run(aVec, nVec, i);
+			sqlite_int64 bytes = aVec[j - 1].iOfst + aVec[j - 1].iAmt - aVec[i].iOfst;
+			int rc = backend->Serve(backend->model.writeMicro, bytes, backend->model.writeBytesPerSec);
+			backend->Count(&WinRTSimStats::writes, 1);
+			backend->Count(&WinRTSimStats::bytesWritten, bytes);
+			if (rc != SQLITE_OK)
+				return SQLITE_IOERR_WRITE;
+
+			std::lock_guard<std::mutex> lock(file->mutex);
+			for (; i < j; i++)
+			{
+				WinRTIoVec &vec = aVec[i];
+				size_t end = (size_t)(vec.iOfst + vec.iAmt);
+				if (file->data.size() < end)
+					file->data.resize(end);
+				::memcpy(&file->data[(size_t)vec.iOfst], vec.zBuf, vec.iAmt);
+				vec.nDone = vec.iAmt;
+			}
+			file->dirty += bytes;
+			file->version++;
+		}
+		return SQLITE_OK;
+	}
+
+	virtual int Truncate(sqlite_int64 size)
+	{
+		if (backend->Serve(backend->model.writeMicro, 0, 0) != SQLITE_OK)
+			return SQLITE_IOERR_TRUNCATE;
+		std::lock_guard<std::mutex> lock(file->mutex);
+		file->data.resize((size_t)size);
+		file->version++;
+		return SQLITE_OK;
+	}
+
+	virtual int Sync(int flags)
+	{
+		sqlite_int64 dirty;
+		{
+			std::lock_guard<std::mutex> lock(file->mutex);
+			dirty = file->dirty;
+		}
+		backend->Count(&WinRTSimStats::syncs, 1);
+		int rc = backend->Serve(backend->model.syncMicro, dirty, backend->model.syncBytesPerSec, backend->model.syncFailPerMillion);
+		if (rc != SQLITE_OK)
+		{
+			if (rc == SQLITE_IOERR)
+				backend->Count(&WinRTSimStats::syncFailures, 1);
+			return SQLITE_IOERR_FSYNC;
+		}
+		std::lock_guard<std::mutex> lock(file->mutex);
+		file->dirty -= std::min(dirty, file->dirty);
+		return SQLITE_OK;
+	}
+
+	virtual int FileSize(sqlite_int64 *pSize)
+	{
+		std::lock_guard<std::mutex> lock(file->mutex);
+		*pSize = (sqlite_int64)file->data.size();
+		return SQLITE_OK;
+	}
+
+	virtual int ChangeToken(sqlite_uint64 *pToken)
+	{
+		std::lock_guard<std::mutex> lock(file->mutex);
+		*pToken = file->version;
+		return SQLITE_OK;
+	}
+
+private:
+	/*
+	** End of the run of adjacent requests starting at aVec[i].
+	*/
+	static int Run(const WinRTIoVec *aVec, int nVec, int i)
+	{
+		int j = i + 1;
+		while (j < nVec && aVec[j].iOfst == aVec[j - 1].iOfst + aVec[j - 1].iAmt)
+			j++;
+		return j;
+	}
+
+	WinRTSimBackendImpl *backend;
+	std::shared_ptr<WinRTSimFile> file;
+};
+
+
+int WinRTSimBackendImpl::Open(const char *zName, int flags, WinRTStorage **ppStorage)
+{
+	int rc = Serve(model.openMicro, 0, 0);
+	Count(&WinRTSimStats::opens, 1);
+	if (rc != SQLITE_OK)
+		return SQLITE_CANTOPEN;
+
+	std::lock_guard<std::mutex> lock(filesMutex);
+	std::shared_ptr<WinRTSimFile> &file = files[zName];
+	if (file == nullptr)
+	{
+		// Like the other backends, files are created unless opened read-only.
+		if (flags & SQLITE_OPEN_READONLY)
+		{
+			files.erase(zName);
+			return SQLITE_CANTOPEN;
+		}
+		file = std::make_shared<WinRTSimFile>();
+	}
+	*ppStorage = new WinRTSimStorage(this, file);
+	return SQLITE_OK;
+}
+
+int WinRTSimBackendImpl::Delete(const char *zName, int dirSync)
+{
+	if (Serve(model.openMicro, 0, 0) != SQLITE_OK)
+		return SQLITE_IOERR_DELETE;
+	std::lock_guard<std::mutex> lock(filesMutex);
+	files.erase(zName);
+	return SQLITE_OK;
+}
+
+int WinRTSimPreset(const char *zDevice, WinRTSimModel *pModel)
+{
+	// open, read, write, sync (us); read, write, sync rates; stalls per million, stall us; sync failures per million
+	static const struct
+	{
+		const char *zName;
+		WinRTSimModel model;
+	} presets[] =
+	{
+		{ "ssd", { 50, 80, 30, 200, 500000000, 400000000, 400000000, 0, 0, 0, 1 } },
+		{ "sdcard", { 2000, 600, 1500, 10000, 40000000, 10000000, 10000000, 500, 150000, 0, 1 } },
+		{ "usb", { 1000, 300, 800, 5000, 30000000, 20000000, 20000000, 200, 100000, 0, 1 } },
+		{ "network", { 20000, 5000, 8000, 50000, 10000000, 10000000, 10000000, 1000, 500000, 5000, 1 } },
+	};
+	for (const auto &preset : presets)
+	{
+		if (::strcmp(zDevice, preset.zName) == 0)
+		{
+			*pModel = preset.model;
+			return SQLITE_OK;
+		}
+	}
+	return SQLITE_NOTFOUND;
+}
+
+WinRTBackend *WinRTSimBackend(const WinRTSimModel *pModel)
+{
+	return new WinRTSimBackendImpl(*pModel);
+}
+
+void WinRTSimStatus(WinRTBackend *pBackend, WinRTSimStats *pStats)
+{
+	static_cast<WinRTSimBackendImpl*>(pBackend)->Status(pStats);
+}
@@ -0,0 +1,74 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include "WinRTStorage.h"
+
+/*
+** How the simulated device behaves. Times are in microseconds and rates in
+** bytes per second, 0 meaning free. An operation costs its latency plus its
+** bytes at the rate; a sync costs its latency plus the bytes written to the
+** file since its last sync at syncBytesPerSec, as a device with a write
+** cache must then write them out.
+*/
+typedef struct
+{
+	int openMicro;              /* Resolving a path, to open or delete a file */
+	int readMicro;
+	int writeMicro;
+	int syncMicro;
+	sqlite_int64 readBytesPerSec;
+	sqlite_int64 writeBytesPerSec;
+	sqlite_int64 syncBytesPerSec;
+	int stallPerMillion;        /* Operations, in a million, held up by a stall */
+	int stallMicro;             /* How long a stall adds */
+	int syncFailPerMillion;     /* Syncs, in a million, that fail, to be retried */
+	sqlite_uint64 seed;         /* For the choice of stalls and failures */
+} WinRTSimModel;
+
+typedef struct
+{
+	sqlite_int64 opens;
+	sqlite_int64 reads;
+	sqlite_int64 writes;
+	sqlite_int64 syncs;
+	sqlite_int64 bytesRead;
+	sqlite_int64 bytesWritten;
+	sqlite_int64 busyMicro;     /* Time the device spent on operations */
+	sqlite_int64 waitMicro;     /* Time operations queued behind others */
+	sqlite_int64 stalls;
+	sqlite_int64 syncFailures;
+	sqlite_int64 abandoned;     /* Given up at their deadline; the device still did them */
+} WinRTSimStats;
+
+/*
+** Fill *pModel with a rough profile of a kind of device: "ssd", "sdcard",
+** "usb" or "network" (a cloud-synced folder). Returns SQLITE_NOTFOUND for
+** any other name.
+*/
+int WinRTSimPreset(const char *zDevice, WinRTSimModel *pModel);
+
+/*
+** A backend whose files live in memory, on one simulated device: operations
+** from every thread queue for it in turn, and each waits, on the shared
+** timer (WinRTTimer.h), until the model says it would have finished or the
+** caller's deadline (WinRTDeadline.h) passes. Which operations stall or
+** fail is drawn from the model's seed in the order the device serves them,
+** so a single-threaded run repeats exactly.
+**
+** Files last until deleted, for the life of the process; the backend is
+** never freed.
+*/
+WinRTBackend *WinRTSimBackend(const WinRTSimModel *pModel);
+
+/*
+** Counters of a backend made by WinRTSimBackend.
+*/
+void WinRTSimStatus(WinRTBackend *pBackend, WinRTSimStats *pStats);
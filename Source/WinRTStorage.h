@@ -0,0 +1,157 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "sqlite3.h"
+
+/*
+** One element of a batched read or write. nDone receives the number of
+** bytes transferred.
+*/
+typedef struct WinRTIoVec
+{
+	void *zBuf;
+	int iAmt;
+	sqlite_int64 iOfst;
+	int nDone;
+} WinRTIoVec;
+
+/*
+** Storage layer underneath the VFS. The io_methods in WinRTVFS.cpp implement
+** SQLite's semantics (short reads, flush retries, handle lifetime) and leave
+** the actual byte movement to a WinRTStorage obtained from a WinRTBackend.
+**
+** The VFS serializes calls on a storage, except that a main database is
+** read by any number of threads at once, while another call may be running.
+** All methods return SQLite result codes.
+*/
+class WinRTStorage
+{
+public:
+	virtual ~WinRTStorage() {}
+
+	/*
+	** Read up to iAmt bytes at iOfst. *pnRead receives the number of bytes
+	** actually read, which is less than iAmt only at end of file.
+	*/
+	virtual int Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead) = 0;
+	virtual int Write(const void *zBuf, int iAmt, sqlite_int64 iOfst) = 0;
+	virtual int Truncate(sqlite_int64 size) = 0;
+	virtual int Sync(int flags) = 0;
+	virtual int FileSize(sqlite_int64 *pSize) = 0;
+
+	/*
+	** Batched forms of Read and Write. A backend that can submit several
+	** requests at once (io_uring, vectored I/O) overrides these; the default
+	** simply issues the requests one at a time.
+	*/
+	virtual int ReadBatch(WinRTIoVec *aVec, int nVec)
+	{
+		for (int i = 0; i < nVec; i++)
+		{
+			int rc = Read(aVec[i].zBuf, aVec[i].iAmt, aVec[i].iOfst, &aVec[i].nDone);
+			if (rc != SQLITE_OK) return rc;
+		}
+		return SQLITE_OK;
+	}
+
+	virtual int WriteBatch(WinRTIoVec *aVec, int nVec)
+	{
+		for (int i = 0; i < nVec; i++)
+		{
+			int rc = Write(aVec[i].zBuf, aVec[i].iAmt, aVec[i].iOfst);
+			if (rc != SQLITE_OK) return rc;
+			aVec[i].nDone = aVec[i].iAmt;
+		}
+		return SQLITE_OK;
+	}
+
+	/*
+	** A value that changes whenever the file is modified, by this process or
+	** another, for change checks cheaper than reading the file. Storage with
+	** no such query returns SQLITE_NOTFOUND.
+	*/
+	virtual int ChangeToken(sqlite_uint64 *pToken)
+	{
+		return SQLITE_NOTFOUND;
+	}
+};
+
+/*
+** Opens and deletes files for one kind of storage. A backend is stored in
+** the pAppData of the sqlite3_vfs it was registered with.
+*/
+class WinRTBackend
+{
+public:
+	virtual ~WinRTBackend() {}
+
+	virtual int Open(const char *zName, int flags, WinRTStorage **ppStorage) = 0;
+	virtual int Delete(const char *zName, int dirSync) = 0;
+};
+
+/*
+** Registry for layers that keep per-file state in memory, such as an offset
+** map or a checksum table. Every connection to a file must see the same
+** state, so Open creates the storage once per name and hands out handles to
+** it; calls through the handles are serialized and the storage is deleted
+** when the last handle closes. Implemented in WinRTStorageShare.cpp.
+*/
+class WinRTStorageShare
+{
+public:
+	typedef std::function<int(WinRTStorage **ppStorage)> Creator;
+
+	/*
+	** Return a handle to the storage open under zName, calling create to
+	** open it first if there is none.
+	*/
+	int Open(const char *zName, WinRTStorage **ppStorage, const Creator &create);
+
+private:
+	struct Shared;
+	friend class WinRTSharedHandle;
+
+	void Release(Shared *shared);
+
+	std::mutex mutex;
+	std::map<std::string, Shared*> open;
+};
+
+#if SQLITE_OS_WINRT
+// StorageFile/IRandomAccessStream backend (WinRTStreamStorage.cpp)
+WinRTBackend *WinRTStreamBackend();
+#else
+// pread/pwrite backend (WinRTPosixStorage.cpp)
+WinRTBackend *WinRTPosixBackend();
+#if defined(__linux__)
+// io_uring backend (WinRTUringStorage.cpp); falls back to pread/pwrite
+// storage when the kernel does not allow io_uring.
+WinRTBackend *WinRTUringBackend();
+#endif
+#endif
+
+// LZ page compression for main database files (WinRTCodecStorage.cpp),
+// layered over another backend.
+WinRTBackend *WinRTCodecBackend(WinRTBackend *inner);
+
+// CRC-32C page checksums for main database files, verified on every read
+// (WinRTChecksumStorage.cpp), layered over another backend.
+WinRTBackend *WinRTChecksumBackend(WinRTBackend *inner);
+
+// XTS-AES encryption of every file, layered over another backend
+// (WinRTCipherStorage.cpp). nKey is 32 or 64 bytes (AES-128 or AES-256 key
+// pairs); returns null for a bad key.
+WinRTBackend *WinRTCipherBackend(WinRTBackend *inner, const void *pKey, int nKey);
@@ -0,0 +1,119 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#include "pch.h"
+
+#include "WinRTStorage.h"
+
+
+struct WinRTStorageShare::Shared
+{
+	std::string name;
+	WinRTStorage *storage;
+	int nRef;
+	std::mutex mutex;
+};
+
+class WinRTSharedHandle : public WinRTStorage
+{
+public:
+	WinRTSharedHandle(WinRTStorageShare *share, WinRTStorageShare::Shared *shared)
+		: share(share), shared(shared) {}
+
+	virtual ~WinRTSharedHandle()
+	{
+		share->Release(shared);
+	}
+
+	virtual int Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead)
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		return shared->storage->Read(zBuf, iAmt, iOfst, pnRead);
+	}
+
+	virtual int Write(const void *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		return shared->storage->Write(zBuf, iAmt, iOfst);
+	}
+
+	virtual int ReadBatch(WinRTIoVec *aVec, int nVec)
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		return shared->storage->ReadBatch(aVec, nVec);
+	}
+
+	virtual int WriteBatch(WinRTIoVec *aVec, int nVec)
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		return shared->storage->WriteBatch(aVec, nVec);
+	}
+
+	virtual int Truncate(sqlite_int64 size)
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		return shared->storage->Truncate(size);
+	}
+
+	virtual int Sync(int flags)
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		return shared->storage->Sync(flags);
+	}
+
+	virtual int FileSize(sqlite_int64 *pSize)
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		return shared->storage->FileSize(pSize);
+	}
+
+	virtual int ChangeToken(sqlite_uint64 *pToken)
+	{
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		return shared->storage->ChangeToken(pToken);
+	}
+
+private:
+	WinRTStorageShare *share;
+	WinRTStorageShare::Shared *shared;
+};
+
+
+int WinRTStorageShare::Open(const char *zName, WinRTStorage **ppStorage, const Creator &create)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = open.find(zName);
+	if (it == open.end())
+	{
+		WinRTStorage *storage = nullptr;
+		int rc = create(&storage);
+		if (rc != SQLITE_OK)
+			return rc;
+
+		Shared *shared = new Shared;
+		shared->name = zName;
+		shared->storage = storage;
+		shared->nRef = 0;
+		it = open.insert(std::make_pair(shared->name, shared)).first;
+	}
+
+	it->second->nRef++;
+	*ppStorage = new WinRTSharedHandle(this, it->second);
+	return SQLITE_OK;
+}
+
+void WinRTStorageShare::Release(Shared *shared)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (--shared->nRef > 0)
+		return;
+	open.erase(shared->name);
+	delete shared->storage;
+	delete shared;
+}
@@ -0,0 +1,433 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Storage backend that opens files with StorageFile and StorageFolder and
+*		accesses them through IRandomAccessStream.
+*/
+
+/*
+*		Every asynchronous call is waited on through WinRTAwait rather than
+*		get() or wait(), so that the wait can end at the deadline of the
+*		calling operation (WinRTDeadline.h). The call is then cancelled;
+*		the buffers it holds are its own references, and a read copies
+*		nothing out until the call has completed.
+*/
+
+#include "pch.h"
+
+#if SQLITE_OS_WINRT
+
+#include <memory>
+#include <string.h>
+#include <ppltasks.h>
+#include <collection.h>
+#include <Windows.h>
+#include <robuffer.h>
+
+#include "WinRTVFS.h"
+#include "WinRTStorage.h"
+#include "WinRTDeadline.h"
+
+/*
+** Wait for t, the task of info, until it completes or the calling thread's
+** deadline passes, when info is cancelled. Returns SQLITE_OK once it has
+** completed, successfully or not, so that get() returns at once, and
+** SQLITE_INTERRUPT if it was given up.
+*/
+template <typename T>
+static int WinRTAwait(task<T> t, IAsyncInfo^ info)
+{
+	if (t.is_done())
+		return SQLITE_OK;
+	auto done = std::make_shared<concurrency::event>();
+	t.then([done](task<T> completed)
+	{
+		// Observe an exception here too, in case the caller has given up.
+		try
+		{
+			completed.get();
+		}
+		catch (...)
+		{
+		}
+		done->set();
+	});
+	while (done->wait((unsigned int)(::WinRTIoWaitMicro() + 999) / 1000) != 0)
+	{
+		if (::WinRTIoExpired() != SQLITE_OK)
+		{
+			info->Cancel();
+			return SQLITE_INTERRUPT;
+		}
+	}
+	return SQLITE_OK;
+}
+
+
+class WinRTStreamStorage : public WinRTStorage
+{
+public:
+	WinRTStreamStorage(StorageFile^ file, IRandomAccessStream^ stream, bool writable) :
+		file(file), stream(stream), writable(writable), tokenKnown(false), token(0) {}
+
+	virtual ~WinRTStreamStorage()
+	{
+		delete stream;
+		stream = nullptr;
+		file = nullptr;
+	}
+
+	virtual int Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead)
+	{
+		IInputStream^ inputStream = stream->GetInputStreamAt(
+			iOfst
+			);
+		Buffer^ readBuffer = ref new Buffer(iAmt);
+		IBuffer^ finalBuffer = nullptr;
+
+		try
+		{
+			auto readOperation = inputStream->ReadAsync(
+				readBuffer,
+				iAmt,
+				InputStreamOptions::ReadAhead);
+			auto readTask = create_task(readOperation);
+			if (WinRTAwait(readTask, readOperation) != SQLITE_OK)
+			{
+				delete readBuffer;
+				return SQLITE_IOERR_READ;
+			}
+			// always use the returned buffer, not the original buffer!
+			finalBuffer = readTask.get();
+		}
+		catch (AccessDeniedException^ ex)
+		{
+			delete readBuffer;
+			return SQLITE_IOERR_ACCESS;
+		}
+
+		ComPtr<IBufferByteAccess> bufferByteAccess;
+		reinterpret_cast<IInspectable*>(finalBuffer)->QueryInterface(
+			IID_PPV_ARGS(&bufferByteAccess)
+			);
+		BYTE* pData = nullptr;
+		if (FAILED(
+			bufferByteAccess->Buffer(&pData)
+			))
+			return SQLITE_IOERR;
+
+		::memcpy(zBuf, pData, finalBuffer->Length);
+		*pnRead = finalBuffer->Length;
+
+		delete readBuffer;
+		return SQLITE_OK;
+	}
+
+	virtual int Write(const void *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		tokenKnown = false;
+		IOutputStream^ outputStream = stream->GetOutputStreamAt(
+			iOfst
+			);
+		Buffer^ writeBuffer = ref new Buffer(iAmt);
+		ComPtr<IBufferByteAccess> bufferByteAccess;
+		reinterpret_cast<IInspectable*>(writeBuffer)->QueryInterface(
+			IID_PPV_ARGS(&bufferByteAccess)
+			);
+		BYTE* pData = nullptr;
+		if (FAILED(
+			bufferByteAccess->Buffer(&pData)
+			))
+			return SQLITE_IOERR;
+
+		::memcpy(pData, zBuf, iAmt);
+		writeBuffer->Length = iAmt;
+
+		int result = SQLITE_OK;
+		try
+		{
+			auto writeOperation = outputStream->WriteAsync(writeBuffer);
+			auto writeTask = create_task(writeOperation);
+			if (WinRTAwait(writeTask, writeOperation) != SQLITE_OK)
+				result = SQLITE_IOERR_WRITE;
+			else
+				writeTask.wait();
+		}
+		catch (AccessDeniedException^ ex)
+		{
+			result = SQLITE_IOERR_ACCESS;
+		}
+
+		delete outputStream;
+		delete writeBuffer;
+
+		return result;
+	}
+
+	/*
+	** There is no gathered WriteAsync, so each run of adjacent requests is
+	** copied into one Buffer (the same single copy Write makes per request)
+	** and written with one WriteAsync.
+	*/
+	virtual int WriteBatch(WinRTIoVec *aVec, int nVec)
+	{
+		tokenKnown = false;
+		int i = 0;
+		while (i < nVec)
+		{
+			int j = i + 1;
+			int nRun = aVec[i].iAmt;
+			while (j < nVec && aVec[j].iOfst == aVec[j - 1].iOfst + aVec[j - 1].iAmt)
+				nRun += aVec[j++].iAmt;
+
+			if (j == i + 1)
+			{
+				int rc = Write(aVec[i].zBuf, aVec[i].iAmt, aVec[i].iOfst);
+				if (rc != SQLITE_OK) return rc;
+				aVec[i].nDone = aVec[i].iAmt;
+				i = j;
+				continue;
+			}
+
+			IOutputStream^ outputStream = stream->GetOutputStreamAt(
+				aVec[i].iOfst
+				);
+			Buffer^ writeBuffer = ref new Buffer(nRun);
+			ComPtr<IBufferByteAccess> bufferByteAccess;
+			reinterpret_cast<IInspectable*>(writeBuffer)->QueryInterface(
+				IID_PPV_ARGS(&bufferByteAccess)
+				);
+			BYTE* pData = nullptr;
+			if (FAILED(
+				bufferByteAccess->Buffer(&pData)
+				))
+				return SQLITE_IOERR;
+
+			for (int k = i; k < j; k++)
+			{
+				::memcpy(pData, aVec[k].zBuf, aVec[k].iAmt);
+				pData += aVec[k].iAmt;
+			}
+			writeBuffer->Length = nRun;
+
+			int result = SQLITE_OK;
+			try
+			{
+				auto writeOperation = outputStream->WriteAsync(writeBuffer);
+				auto writeTask = create_task(writeOperation);
+				if (WinRTAwait(writeTask, writeOperation) != SQLITE_OK)
+					result = SQLITE_IOERR_WRITE;
+				else
+					writeTask.wait();
+			}
+			catch (AccessDeniedException^ ex)
+			{
+				result = SQLITE_IOERR_ACCESS;
+			}
+
+			delete outputStream;
+			delete writeBuffer;
+			if (result != SQLITE_OK)
+				return result;
+
+			for (; i < j; i++)
+				aVec[i].nDone = aVec[i].iAmt;
+		}
+		return SQLITE_OK;
+	}
+
+	virtual int Truncate(sqlite_int64 size)
+	{
+		tokenKnown = false;
+		stream->Size = size;
+		return SQLITE_OK;
+	}
+
+	virtual int Sync(int flags)
+	{
+		tokenKnown = false;
+		try
+		{
+			auto flushOperation = stream->FlushAsync();
+			auto flushTask = create_task(flushOperation);
+			if (WinRTAwait(flushTask, flushOperation) != SQLITE_OK)
+				return SQLITE_IOERR_FSYNC;
+			flushTask.wait();
+		}
+		catch (Exception^ ex)
+		{
+			return SQLITE_IOERR_FSYNC;
+		}
+		return SQLITE_OK;
+	}
+
+	virtual int FileSize(sqlite_int64 *pSize)
+	{
+		*pSize = stream->Size;
+		return SQLITE_OK;
+	}
+
+	/*
+	** Size and modification time from the file's basic properties, folded
+	** together. The time is kept by the file system, which may only update
+	** it when a writer flushes, so another process's writes are seen once
+	** they are synced, which is when SQLite would look for them anyway.
+	**
+	** Asking for the properties costs about as much as the page read the
+	** token saves, and is done on every read transaction. A stream opened
+	** for writing shares the file with readers only, so no other process
+	** can change it while it is open: the token is kept until this storage
+	** writes, truncates or flushes. A read-only stream asks every time.
+	*/
+	virtual int ChangeToken(sqlite_uint64 *pToken)
+	{
+		if (tokenKnown)
+		{
+			*pToken = token;
+			return SQLITE_OK;
+		}
+		try
+		{
+			auto propertiesOperation = file->GetBasicPropertiesAsync();
+			auto propertiesTask = create_task(propertiesOperation);
+			if (WinRTAwait(propertiesTask, propertiesOperation) != SQLITE_OK)
+				return SQLITE_IOERR_FSTAT;
+			FileProperties::BasicProperties^ properties = propertiesTask.get();
+			sqlite_uint64 h = 14695981039346656037ULL;
+			sqlite_uint64 parts[] = { properties->Size, (sqlite_uint64)properties->DateModified.UniversalTime };
+			for (sqlite_uint64 part : parts)
+				h = (h ^ part) * 1099511628211ULL;
+			*pToken = h;
+			token = h;
+			tokenKnown = writable;
+		}
+		catch (Exception^ ex)
+		{
+			return SQLITE_IOERR_FSTAT;
+		}
+		return SQLITE_OK;
+	}
+
+private:
+	StorageFile^ file;			// for its properties
+	IRandomAccessStream^ stream;
+	bool writable;				// opened ReadWrite, so no other writer
+	bool tokenKnown;			// token is current; see ChangeToken
+	sqlite_uint64 token;
+};
+
+
+class WinRTStreamBackendImpl : public WinRTBackend
+{
+public:
+	virtual int Open(const char *zName, int flags, WinRTStorage **ppStorage)
+	{
+		StorageFile^ file = nullptr;
+		IRandomAccessStream^ stream = nullptr;
+		try
+		{
+			file = ::GetStorageFileFromPath(zName);
+			if (file == nullptr) return SQLITE_IOERR_ACCESS;
+
+			auto openOperation = file->OpenAsync(
+				flags & SQLITE_OPEN_READONLY ? FileAccessMode::Read : FileAccessMode::ReadWrite
+				);
+			auto openTask = create_task(openOperation);
+			if (WinRTAwait(openTask, openOperation) != SQLITE_OK)
+				return SQLITE_CANTOPEN;
+			stream = openTask.get();
+		}
+		catch (AccessDeniedException^ ex)
+		{
+			return SQLITE_IOERR_ACCESS;
+		}
+
+		*ppStorage = new WinRTStreamStorage(file, stream, (flags & SQLITE_OPEN_READONLY) == 0);
+		return SQLITE_OK;
+	}
+
+	virtual int Delete(const char *zName, int dirSync)
+	{
+		try
+		{
+			StorageFile^ file = ::GetStorageFileFromPath(zName);
+			auto deleteOperation = file->DeleteAsync();
+			auto deleteFileTask = create_task(deleteOperation);
+			//if (dirSync)
+			if (WinRTAwait(deleteFileTask, deleteOperation) != SQLITE_OK)	// always wait regardless of dirSync (2015-03-16)
+				return SQLITE_IOERR_DELETE;
+			deleteFileTask.wait();
+			return SQLITE_OK;
+		}
+		catch (AccessDeniedException^ ex)
+		{
+			return SQLITE_IOERR_ACCESS;
+		}
+	}
+};
+
+WinRTBackend *WinRTStreamBackend()
+{
+	static WinRTStreamBackendImpl backend;
+	return &backend;
+}
+
+
+StorageFile^ GetStorageFileFromPath(const char* zPath)
+{
+	int pathLength = ::strlen(zPath);
+	int i;
+
+	for (i = pathLength; i >= 0; i--)
+	{
+		if (zPath[i - 1] == '\\')
+			break;
+	}
+
+	wchar_t* lpwstrPath = new wchar_t[i];
+	int folderPathCount = ::MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, zPath, i, lpwstrPath, i);
+	String^ strFolderPath = ref new String(lpwstrPath, folderPathCount);
+	delete lpwstrPath;
+
+	wchar_t* lpwstrFilename = new wchar_t[pathLength - i];
+	int fileNameCount = ::MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, zPath + i, pathLength - i,
+
+		lpwstrFilename, pathLength - i);
+	String^ strFilePath = ref new String(lpwstrFilename, fileNameCount);
+	delete lpwstrFilename;
+
+	try
+	{
+		auto folderOperation = StorageFolder::GetFolderFromPathAsync(strFolderPath);
+		auto folderTask = create_task(folderOperation);
+		if (WinRTAwait(folderTask, folderOperation) != SQLITE_OK)
+			return nullptr;
+		StorageFolder^ folder = folderTask.get();
+		if (folder == nullptr)
+			return nullptr;
+
+		auto fileOperation = folder->CreateFileAsync(
+			strFilePath,
+			CreationCollisionOption::OpenIfExists
+			);
+		auto fileTask = create_task(fileOperation);
+		if (WinRTAwait(fileTask, fileOperation) != SQLITE_OK)
+			return nullptr;
+		StorageFile^ file = fileTask.get();
+		if (file == nullptr)
+			return nullptr;
+
+		return file;
+	}
+	catch (Platform::AccessDeniedException^)
+	{
+		return nullptr;
+	}
+}
+
+#endif /* SQLITE_OS_WINRT */
@@ -0,0 +1,267 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		Timer wheel. Timers hang off WINRT_TIMER_SLOTS lists, one per tick of
+*		WINRT_TIMER_TICK_US, indexed by due tick modulo the wheel size; a timer
+*		more than one turn away stays in its list until its turn comes round.
+*		The service thread sleeps until the earliest timer in the next slot
+*		that has one, so an idle wheel costs nothing and a long timer costs
+*		one wake-up per turn.
+*
+*		The thread measures how late the OS wakes it and aims that much
+*		early next time. Sleepers ask to be woken WINRT_TIMER_SLACK_US before
+*		their deadline and spin and yield through the rest, which is what
+*		makes sub-millisecond sleeps accurate.
+*/
+
+#include "pch.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define WINRT_CPU_RELAX() _mm_pause()
+#elif defined(_M_ARM) || defined(_M_ARM64)
+#include <intrin.h>
+#define WINRT_CPU_RELAX() __yield()
+#elif defined(__arm__) || defined(__aarch64__)
+#define WINRT_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define WINRT_CPU_RELAX() ((void)0)
+#endif
+
+#include "WinRTTimer.h"
+
+#define WINRT_TIMER_TICK_US     250		// width of a wheel slot
+#define WINRT_TIMER_SLOTS       256		// one turn is 64 ms
+#define WINRT_TIMER_SPIN_US     20		// waits this short only spin
+#define WINRT_TIMER_YIELD_US    200		// waits this short spin, then yield
+#define WINRT_TIMER_SLACK_US    50		// sleepers wake this early and spin the rest
+
+static const uint64_t tickNs = WINRT_TIMER_TICK_US * 1000ull;
+
+static inline uint64_t NowNs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+}
+
+/*
+** A pending timer. Sleepers keep theirs on the stack; scheduled calls
+** allocate one.
+*/
+struct WinRTTimerNode
+{
+	WinRTTimerNode *next;
+	uint64_t due;						// steady clock, ns
+	void(*fire)(void *context);			// called without the wheel lock
+	void *context;
+};
+
+class WinRTTimerWheel
+{
+public:
+	WinRTTimerWheel()
+	{
+		for (int i = 0; i < WINRT_TIMER_SLOTS; i++)
+			slots[i] = nullptr;
+		cursor = NowNs() / tickNs;
+		std::thread(&WinRTTimerWheel::Run, this).detach();
+	}
+
+	void Add(WinRTTimerNode *node)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (count == 0)
+			cursor = NowNs() / tickNs;
+		uint64_t tick = std::max(node->due / tickNs, cursor);
+		WinRTTimerNode *&slot = slots[tick % WINRT_TIMER_SLOTS];
+		node->next = slot;
+		slot = node;
+		count++;
+		if (node->due < waitingFor)
+			wake.notify_one();
+	}
+
+private:
+	void Run()
+	{
+		std::vector<WinRTTimerNode*> due;
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;)
+		{
+			if (count == 0)
+			{
+				waitingFor = UINT64_MAX;
+				wake.wait(lock);
+				continue;
+			}
+
+			uint64_t next = NextDue();
+			waitingFor = next;
+			uint64_t aim = next > lateness ? next - lateness : 0;
+			uint64_t now = NowNs();
+			if (now < aim)
+			{
+				std::cv_status status = wake.wait_for(lock, std::chrono::nanoseconds(aim - now));
+				now = NowNs();
+				if (status == std::cv_status::no_timeout && now < aim)
+					continue;	// an earlier timer was added
+				if (now > aim)
+					lateness = (lateness * 7 + std::min<uint64_t>(now - aim, tickNs)) / 8;
+			}
+
+			uint64_t last = now / tickNs;
+			for (uint64_t t = cursor, n = 0; t <= last && n < WINRT_TIMER_SLOTS; t++, n++)
+			{
+				WinRTTimerNode **pp = &slots[t % WINRT_TIMER_SLOTS];
+				while (*pp != nullptr)
+				{
+					WinRTTimerNode *node = *pp;
+					if (node->due <= now)
+					{
+						*pp = node->next;
+						due.push_back(node);
+						count--;
+					}
+					else
+					{
+						pp = &node->next;
+					}
+				}
+			}
+			cursor = last;
+
+			lock.unlock();
+			for (WinRTTimerNode *node : due)
+				node->fire(node->context);
+			due.clear();
+			lock.lock();
+		}
+	}
+
+	/*
+	** Earliest due time in the first slot, from the cursor on, holding a
+	** timer for this turn of the wheel; or the end of the turn if there is
+	** none.
+	*/
+	uint64_t NextDue()
+	{
+		for (uint64_t t = cursor; t < cursor + WINRT_TIMER_SLOTS; t++)
+		{
+			uint64_t first = UINT64_MAX;
+			for (WinRTTimerNode *node = slots[t % WINRT_TIMER_SLOTS]; node != nullptr; node = node->next)
+			{
+				if (node->due < (t + 1) * tickNs)
+					first = std::min(first, node->due);
+			}
+			if (first != UINT64_MAX)
+				return first;
+		}
+		return (cursor + WINRT_TIMER_SLOTS) * tickNs;
+	}
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	WinRTTimerNode *slots[WINRT_TIMER_SLOTS];
+	uint64_t cursor;					// first tick that may hold due timers
+	uint64_t waitingFor = UINT64_MAX;	// time the thread is sleeping towards
+	uint64_t lateness = 0;				// average OS wake-up delay, ns
+	int count = 0;
+};
+
+/*
+** The wheel and its thread live for the life of the process, like the
+** sqlite3_vfs; stopping a thread during DLL unload is not safe.
+*/
+static WinRTTimerWheel *Wheel()
+{
+	static WinRTTimerWheel *wheel = new WinRTTimerWheel();
+	return wheel;
+}
+
+
+struct WinRTSleeper
+{
+	WinRTTimerNode node;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool fired;
+};
+
+static void WakeSleeper(void *context)
+{
+	WinRTSleeper *sleeper = (WinRTSleeper*)context;
+	// Notify under the lock: the sleeper's stack frame goes away as soon as
+	// it sees fired.
+	std::lock_guard<std::mutex> lock(sleeper->mutex);
+	sleeper->fired = true;
+	sleeper->cv.notify_one();
+}
+
+void WinRTTimerSleep(int nMicro)
+{
+	if (nMicro <= 0)
+		return;
+	uint64_t deadline = NowNs() + nMicro * 1000ull;
+
+	if (nMicro > WINRT_TIMER_YIELD_US)
+	{
+		WinRTSleeper sleeper;
+		sleeper.node.due = deadline - WINRT_TIMER_SLACK_US * 1000ull;
+		sleeper.node.fire = WakeSleeper;
+		sleeper.node.context = &sleeper;
+		sleeper.fired = false;
+		std::unique_lock<std::mutex> lock(sleeper.mutex);
+		Wheel()->Add(&sleeper.node);
+		sleeper.cv.wait(lock, [&] { return sleeper.fired; });
+	}
+
+	// Finish the wait: yield while there is time to spare, then spin.
+	for (;;)
+	{
+		uint64_t now = NowNs();
+		if (now >= deadline)
+			break;
+		if (deadline - now > WINRT_TIMER_SPIN_US * 1000ull)
+			std::this_thread::yield();
+		else
+			WINRT_CPU_RELAX();
+	}
+}
+
+
+struct WinRTScheduled
+{
+	WinRTTimerNode node;
+	std::function<void()> fn;
+};
+
+static void RunScheduled(void *context)
+{
+	WinRTScheduled *scheduled = (WinRTScheduled*)context;
+	scheduled->fn();
+	delete scheduled;
+}
+
+void WinRTTimerSchedule(int nMicro, std::function<void()> fn)
+{
+	WinRTScheduled *scheduled = new WinRTScheduled();
+	scheduled->node.due = NowNs() + (nMicro > 0 ? nMicro : 0) * 1000ull;
+	scheduled->node.fire = RunScheduled;
+	scheduled->node.context = scheduled;
+	scheduled->fn = std::move(fn);
+	Wheel()->Add(&scheduled->node);
+}
@@ -0,0 +1,28 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include <functional>
+
+/*
+** Shared timer service (WinRTTimer.cpp): one thread and a timer wheel serve
+** every sleep and delayed call in the process, without allocating a timer
+** object per wait.
+**
+** WinRTTimerSleep blocks for nMicro microseconds with microsecond accuracy.
+** Very short waits spin, short ones spin and then yield, and longer ones
+** park on the wheel until shortly before the deadline and finish the wait
+** the same way.
+**
+** WinRTTimerSchedule calls fn once on the timer thread, no earlier than
+** nMicro microseconds from now. fn must be quick; it holds up other timers.
+*/
+void WinRTTimerSleep(int nMicro);
+void WinRTTimerSchedule(int nMicro, std::function<void()> fn);
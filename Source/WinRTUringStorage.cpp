@@ -0,0 +1,576 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*
+*		io_uring storage backend for Linux. Talks to the kernel directly through
+*		io_uring_setup/io_uring_enter/io_uring_register, so no liburing is needed.
+*
+*		Writes are copied into one registered buffer arena and queued with
+*		IORING_OP_WRITE_FIXED without waiting. They are submitted together with
+*		the next operation that has to observe them: a Sync (the fsync is queued
+*		behind the writes with IOSQE_IO_DRAIN, so a whole commit is one
+*		io_uring_enter), a Read, FileSize or Truncate, or when the arena or
+*		submission queue fills up. ReadBatch submits every read in one call;
+*		the hot-block prefetch in WinRTVFS.cpp reads its runs that way.
+*		The file descriptor is registered as a fixed file when the kernel
+*		allows it.
+*
+*		A write error is kept until the next Sync, which reports it, whatever
+*		operation reaped it: the VFS has already passed the data to its caches,
+*		and SQLite only learns whether a commit reached the file from the Sync.
+*
+*		One ring serves every thread, so each call holds the storage's mutex;
+*		the VFS reads a main database from several threads at once.
+*
+*		If io_uring_enter fails outright the ring is given up: Drain waits for
+*		what the kernel already took, writes every queued write again with
+*		pwrite (the arena is only reused once they are done) and the file
+*		carries on with pread, pwrite and fdatasync.
+*/
+
+#include "pch.h"
+
+#if !SQLITE_OS_WINRT && defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "WinRTStorage.h"
+
+/*
+** Submission queue depth and size of the registered write arena per file.
+*/
+#define WINRT_URING_ENTRIES     64
+#define WINRT_URING_ARENA       (1024 * 1024)
+
+// user_data tags; the low bits carry the index of the ReadBatch element or
+// queued write the completion belongs to.
+#define WINRT_URING_WRITE       (1ull << 62)
+#define WINRT_URING_READ        (2ull << 62)
+#define WINRT_URING_SYNC        (3ull << 62)
+#define WINRT_URING_TAG_MASK    (3ull << 62)
+
+
+class WinRTUringStorage : public WinRTStorage
+{
+public:
+	WinRTUringStorage(int fd) : fd(fd) {}
+
+	virtual ~WinRTUringStorage()
+	{
+		Drain();
+		if (sqes) ::munmap(sqes, sqesSize);
+		if (cqRing && cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+		if (sqRing) ::munmap(sqRing, sqRingSize);
+		if (ringFd >= 0) ::close(ringFd);
+		free(arena);
+		::close(fd);
+	}
+
+	/*
+	** Create the ring, map it and register the arena and the file. Returns
+	** false if io_uring is unavailable, in which case the object is discarded.
+	*/
+	bool Setup()
+	{
+		struct io_uring_params params;
+		::memset(&params, 0, sizeof(params));
+		ringFd = (int)::syscall(__NR_io_uring_setup, WINRT_URING_ENTRIES, &params);
+		if (ringFd < 0)
+			return false;
+
+		sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMmap)
+			sqRingSize = cqRingSize = sqRingSize > cqRingSize ? sqRingSize : cqRingSize;
+
+		sqRing = (char*)::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+		if (sqRing == MAP_FAILED) { sqRing = nullptr; return false; }
+
+		if (singleMmap)
+			cqRing = sqRing;
+		else
+		{
+			cqRing = (char*)::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+			if (cqRing == MAP_FAILED) { cqRing = nullptr; return false; }
+		}
+
+		sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+		sqes = (struct io_uring_sqe*)::mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) { sqes = nullptr; return false; }
+
+		sqHead = (unsigned*)(sqRing + params.sq_off.head);
+		sqTail = (unsigned*)(sqRing + params.sq_off.tail);
+		sqMask = *(unsigned*)(sqRing + params.sq_off.ring_mask);
+		sqEntries = *(unsigned*)(sqRing + params.sq_off.ring_entries);
+		sqArray = (unsigned*)(sqRing + params.sq_off.array);
+		cqHead = (unsigned*)(cqRing + params.cq_off.head);
+		cqTail = (unsigned*)(cqRing + params.cq_off.tail);
+		cqMask = *(unsigned*)(cqRing + params.cq_off.ring_mask);
+		cqes = (struct io_uring_cqe*)(cqRing + params.cq_off.cqes);
+		localTail = *sqTail;
+
+		if (::posix_memalign(&arena, 4096, WINRT_URING_ARENA) != 0)
+		{
+			arena = nullptr;
+			return false;
+		}
+		struct iovec iov = { arena, WINRT_URING_ARENA };
+		fixedBuffer = ::syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+		fixedFile = ::syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES, &fd, 1) == 0;
+		return true;
+	}
+
+	virtual int Read(void *zBuf, int iAmt, sqlite_int64 iOfst, int *pnRead)
+	{
+		WinRTIoVec vec = { zBuf, iAmt, iOfst, 0 };
+		int rc = ReadBatch(&vec, 1);
+		*pnRead = vec.nDone;
+		return rc;
+	}
+
+	virtual int ReadBatch(WinRTIoVec *aVec, int nVec)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// Reads must observe every queued write.
+		int rc = Drain();
+		if (rc != SQLITE_OK) return rc;
+
+		for (int i = 0; i < nVec; i++)
+			aVec[i].nDone = 0;
+		if (!dead)
+		{
+			readVec = aVec;
+			for (int i = 0; i < nVec; i++)
+			{
+				struct io_uring_sqe *sqe = NextSqe();
+				if (sqe == nullptr)
+				{
+					// More reads than queue slots; complete what is queued first.
+					rc = Drain();
+					if (rc != SQLITE_OK || dead) break;
+					sqe = NextSqe();
+				}
+				Prepare(sqe, IORING_OP_READ, aVec[i].zBuf, aVec[i].iAmt, aVec[i].iOfst);
+				sqe->user_data = WINRT_URING_READ | (uint64_t)i;
+			}
+			if (rc == SQLITE_OK)
+				rc = Drain();
+			readVec = nullptr;
+			if (rc != SQLITE_OK) return rc;
+		}
+
+		// A short read that is not at end of file, and every read once the
+		// ring is dead, is finished synchronously.
+		for (int i = 0; i < nVec; i++)
+		{
+			WinRTIoVec &v = aVec[i];
+			while (v.nDone < v.iAmt)
+			{
+				ssize_t got = ::pread(fd, (char*)v.zBuf + v.nDone, v.iAmt - v.nDone, v.iOfst + v.nDone);
+				if (got < 0 && errno == EINTR) continue;
+				if (got < 0) return SQLITE_IOERR_READ;
+				if (got == 0) break;
+				v.nDone += (int)got;
+			}
+		}
+		return SQLITE_OK;
+	}
+
+	virtual int Write(const void *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		WinRTIoVec vec = { (void*)zBuf, iAmt, iOfst, 0 };
+		return WriteBatch(&vec, 1);
+	}
+
+	virtual int WriteBatch(WinRTIoVec *aVec, int nVec)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int i = 0; i < nVec; i++)
+		{
+			WinRTIoVec &v = aVec[i];
+			bool fits = fixedBuffer && v.iAmt <= WINRT_URING_ARENA;
+			if (fits && !dead && (arenaUsed + v.iAmt > WINRT_URING_ARENA || inFlight + toSubmit >= sqEntries))
+			{
+				int rc = Drain();
+				if (rc != SQLITE_OK) return rc;
+			}
+			if (!fits || dead)
+			{
+				int rc = Drain();
+				if (rc == SQLITE_OK) rc = WriteNow(v.zBuf, v.iAmt, v.iOfst);
+				if (rc != SQLITE_OK) return rc;
+				v.nDone = v.iAmt;
+				continue;
+			}
+
+			char *zDst = (char*)arena + arenaUsed;
+			::memcpy(zDst, v.zBuf, v.iAmt);
+			arenaUsed += (v.iAmt + 511) & ~511;
+
+			struct io_uring_sqe *sqe = NextSqe();
+			Prepare(sqe, IORING_OP_WRITE_FIXED, zDst, v.iAmt, v.iOfst);
+			sqe->buf_index = 0;
+			sqe->user_data = WINRT_URING_WRITE | (uint64_t)queued.size();
+			QueuedWrite q = { zDst, v.iAmt, v.iOfst };
+			queued.push_back(q);
+			v.nDone = v.iAmt;
+		}
+		return SQLITE_OK;
+	}
+
+	virtual int Truncate(sqlite_int64 size)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		int rc = Drain();
+		if (rc != SQLITE_OK) return rc;
+		if (::ftruncate(fd, (off_t)size) != 0)
+			return SQLITE_IOERR_TRUNCATE;
+		return SQLITE_OK;
+	}
+
+	/*
+	** Also reports, once, the first error of a write queued since the last
+	** Sync, even if another operation reaped it.
+	*/
+	virtual int Sync(int flags)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		int rc = SyncQueued();
+		if (rc == SQLITE_OK)
+			rc = writeError;
+		writeError = SQLITE_OK;
+		return rc;
+	}
+
+	virtual int FileSize(sqlite_int64 *pSize)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		int rc = Drain();
+		if (rc != SQLITE_OK) return rc;
+		struct stat st;
+		if (::fstat(fd, &st) != 0)
+			return SQLITE_IOERR_FSTAT;
+		*pSize = st.st_size;
+		return SQLITE_OK;
+	}
+
+	/*
+	** Modification time, change time, size and inode, folded together.
+	** Timestamps have the kernel's clock-tick granularity, so two writes by
+	** another process within one tick that leave the size alone look alike.
+	** Pending writes are completed first so they are part of the value.
+	*/
+	virtual int ChangeToken(sqlite_uint64 *pToken)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		int rc = Drain();
+		if (rc != SQLITE_OK) return rc;
+		struct stat st;
+		if (::fstat(fd, &st) != 0)
+			return SQLITE_IOERR_FSTAT;
+		sqlite_uint64 h = 14695981039346656037ULL;
+		sqlite_uint64 parts[] = { (sqlite_uint64)st.st_mtim.tv_sec, (sqlite_uint64)st.st_mtim.tv_nsec,
+			(sqlite_uint64)st.st_ctim.tv_sec, (sqlite_uint64)st.st_ctim.tv_nsec,
+			(sqlite_uint64)st.st_size, (sqlite_uint64)st.st_ino };
+		for (sqlite_uint64 part : parts)
+			h = (h ^ part) * 1099511628211ULL;
+		*pToken = h;
+		return SQLITE_OK;
+	}
+
+private:
+	int SyncQueued()
+	{
+		int rc;
+		struct io_uring_sqe *sqe = dead ? nullptr : NextSqe();
+		if (sqe == nullptr)
+		{
+			rc = Drain();
+			if (rc != SQLITE_OK) return rc;
+			sqe = dead ? nullptr : NextSqe();
+		}
+		if (sqe != nullptr)
+		{
+			Prepare(sqe, IORING_OP_FSYNC, nullptr, 0, 0);
+			sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+			sqe->flags |= IOSQE_IO_DRAIN;
+			sqe->user_data = WINRT_URING_SYNC;
+			rc = Drain();
+			if (rc != SQLITE_OK || !dead) return rc;
+		}
+
+		// The ring died before the fsync was known to cover every write.
+		while (::fdatasync(fd) != 0)
+		{
+			if (errno != EINTR) return SQLITE_IOERR_FSYNC;
+		}
+		return SQLITE_OK;
+	}
+
+	struct io_uring_sqe *NextSqe()
+	{
+		unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+		if (localTail - head >= sqEntries || inFlight + toSubmit >= sqEntries)
+			return nullptr;
+		unsigned idx = localTail & sqMask;
+		sqArray[idx] = idx;
+		localTail++;
+		toSubmit++;
+		struct io_uring_sqe *sqe = &sqes[idx];
+		::memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+
+	void Prepare(struct io_uring_sqe *sqe, int op, void *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		sqe->opcode = (unsigned char)op;
+		if (fixedFile)
+		{
+			sqe->fd = 0;
+			sqe->flags = IOSQE_FIXED_FILE;
+		}
+		else
+			sqe->fd = fd;
+		sqe->addr = (uint64_t)(uintptr_t)zBuf;
+		sqe->len = (unsigned)iAmt;
+		sqe->off = (uint64_t)iOfst;
+	}
+
+	/*
+	** Submit everything queued and wait until every request has completed.
+	** Returns the first read or sync error seen since the last Drain; write
+	** errors are kept in writeError for Sync.
+	*/
+	int Drain()
+	{
+		while (!dead && (toSubmit > 0 || inFlight > 0))
+		{
+			__atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+			unsigned wait = toSubmit + inFlight;
+			int n = (int)::syscall(__NR_io_uring_enter, ringFd, toSubmit, wait,
+				IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (n < 0)
+			{
+				if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				{
+					Reap();
+					continue;
+				}
+				Abandon();
+				break;
+			}
+			toSubmit -= (unsigned)n;
+			inFlight += (unsigned)n;
+			Reap();
+		}
+		arenaUsed = 0;
+		queued.clear();
+
+		int rc = firstError;
+		firstError = SQLITE_OK;
+		return rc;
+	}
+
+	/*
+	** Stop using the ring after io_uring_enter has failed. Requests the kernel
+	** took still complete into the completion queue; they are waited for by
+	** polling it, since the arena and readVec must outlive them. The queued
+	** writes are then made again with pwrite, in order, because there is no
+	** telling which of them were submitted. Reads still queued are redone by
+	** ReadBatch and a sync still queued by Sync.
+	*/
+	void Abandon()
+	{
+		dead = true;
+		toSubmit = 0;
+		for (;;)
+		{
+			Reap();
+			if (inFlight == 0) break;
+			::usleep(100);
+		}
+		for (size_t i = 0; i < queued.size(); i++)
+		{
+			int rc = WriteNow(queued[i].zSrc, queued[i].iAmt, queued[i].iOfst);
+			if (rc != SQLITE_OK && writeError == SQLITE_OK)
+				writeError = rc;
+		}
+	}
+
+	void Reap()
+	{
+		unsigned head = *cqHead;
+		unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+		while (head != tail)
+		{
+			struct io_uring_cqe *cqe = &cqes[head & cqMask];
+			Complete(cqe->user_data, cqe->res);
+			head++;
+			inFlight--;
+		}
+		__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	void Complete(uint64_t userData, int res)
+	{
+		uint64_t tag = userData & WINRT_URING_TAG_MASK;
+		uint64_t arg = userData & ~WINRT_URING_TAG_MASK;
+		int rc = SQLITE_OK;
+
+		if (tag == WINRT_URING_READ)
+		{
+			if (res < 0)
+				rc = SQLITE_IOERR_READ;
+			else if (readVec)
+				readVec[arg].nDone = res;
+		}
+		else if (tag == WINRT_URING_WRITE)
+		{
+			// A short write is rare enough to finish with pwrite.
+			const QueuedWrite &q = queued[arg];
+			if (res < 0)
+				rc = res == -ENOSPC ? SQLITE_FULL : SQLITE_IOERR_WRITE;
+			else if (res < q.iAmt)
+				rc = WriteNow(q.zSrc + res, q.iAmt - res, q.iOfst + res);
+			if (rc != SQLITE_OK && writeError == SQLITE_OK)
+				writeError = rc;
+			return;
+		}
+		else if (tag == WINRT_URING_SYNC && res < 0)
+			rc = SQLITE_IOERR_FSYNC;
+
+		if (rc != SQLITE_OK && firstError == SQLITE_OK)
+			firstError = rc;
+	}
+
+	int WriteNow(const void *zBuf, int iAmt, sqlite_int64 iOfst)
+	{
+		int nWritten = 0;
+		while (nWritten < iAmt)
+		{
+			ssize_t put = ::pwrite(fd, (const char*)zBuf + nWritten, iAmt - nWritten, iOfst + nWritten);
+			if (put < 0)
+			{
+				if (errno == EINTR) continue;
+				return errno == ENOSPC ? SQLITE_FULL : SQLITE_IOERR_WRITE;
+			}
+			nWritten += (int)put;
+		}
+		return SQLITE_OK;
+	}
+
+	std::mutex mutex;			// held by every call; Read and Write take it in the batch forms
+	int fd;
+	int ringFd = -1;
+	bool fixedFile = false;
+	bool fixedBuffer = false;
+
+	char *sqRing = nullptr;
+	char *cqRing = nullptr;
+	size_t sqRingSize = 0;
+	size_t cqRingSize = 0;
+	struct io_uring_sqe *sqes = nullptr;
+	size_t sqesSize = 0;
+
+	unsigned *sqHead = nullptr;
+	unsigned *sqTail = nullptr;
+	unsigned *sqArray = nullptr;
+	unsigned sqMask = 0;
+	unsigned sqEntries = 0;
+	unsigned *cqHead = nullptr;
+	unsigned *cqTail = nullptr;
+	unsigned cqMask = 0;
+	struct io_uring_cqe *cqes = nullptr;
+
+	unsigned localTail = 0;		// SQ tail not yet published to the kernel
+	unsigned toSubmit = 0;		// SQEs queued but not yet entered
+	unsigned inFlight = 0;		// SQEs entered but not yet reaped
+	int firstError = SQLITE_OK;	// of a read or sync, until Drain returns it
+	int writeError = SQLITE_OK;	// of a queued write, until Sync returns it
+	bool dead = false;			// io_uring_enter failed; pread and pwrite from now on
+
+	struct QueuedWrite
+	{
+		const char *zSrc;	// copy of the data in the arena
+		int iAmt;
+		sqlite_int64 iOfst;
+	};
+
+	void *arena = nullptr;
+	int arenaUsed = 0;
+	std::vector<QueuedWrite> queued;	// writes queued since the last Drain
+	WinRTIoVec *readVec = nullptr;	// target of READ completions during ReadBatch
+};
+
+
+class WinRTUringBackendImpl : public WinRTBackend
+{
+public:
+	virtual int Open(const char *zName, int flags, WinRTStorage **ppStorage)
+	{
+		// Rollback journals live for one transaction, which does not pay for
+		// setting up and registering a ring; only long-lived files use one.
+		if (!available || !(flags & (SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_WAL)))
+			return ::WinRTPosixBackend()->Open(zName, flags, ppStorage);
+
+		int oflags = (flags & SQLITE_OPEN_READONLY) ? O_RDONLY : (O_RDWR | O_CREAT);
+		int fd;
+		do
+		{
+			fd = ::open(zName, oflags | O_CLOEXEC, 0644);
+		} while (fd < 0 && errno == EINTR);
+
+		if (fd < 0)
+			return errno == EACCES ? SQLITE_IOERR_ACCESS : SQLITE_CANTOPEN;
+
+		WinRTUringStorage *storage = new WinRTUringStorage(fd);
+		if (!storage->Setup())
+		{
+			// io_uring is disabled (seccomp, old kernel, container policy);
+			// stop trying and use pread/pwrite from now on.
+			available = false;
+			delete storage;
+			return ::WinRTPosixBackend()->Open(zName, flags, ppStorage);
+		}
+		*ppStorage = storage;
+		return SQLITE_OK;
+	}
+
+	virtual int Delete(const char *zName, int dirSync)
+	{
+		return ::WinRTPosixBackend()->Delete(zName, dirSync);
+	}
+
+private:
+	std::atomic<bool> available { true };	// stored by any thread that opens
+};
+
+WinRTBackend *WinRTUringBackend()
+{
+	static WinRTUringBackendImpl backend;
+	return &backend;
+}
+
+#endif /* !SQLITE_OS_WINRT && __linux__ */
@@ -23,39 +23,398 @@
 *		There is much room for improvement, but this does provide the core functionality
 *		necessary to use SQLite with databases located in places other than the application
 *		folder.
+*
+*		The io_methods below do not touch storage directly; they go through the
+*		WinRTStorage interface in WinRTStorage.h. Initialize() registers the VFS on the
+*		StorageFile backend (WinRTStreamStorage.cpp). On POSIX systems the same VFS can
+*		be registered with WinRTVFSRegister() on the pread/pwrite backend
+*		(WinRTPosixStorage.cpp), e.g. for benchmarking.
 */
 
 #include "pch.h"
 
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 #include <assert.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <Shcore.h>
 #include <time.h>
 #include <errno.h>
 #include <fcntl.h>
+#if SQLITE_OS_WINRT
+#include <Shcore.h>
 #include <ppltasks.h> 
 #include <collection.h>
 #include <Windows.h>
 #include <robuffer.h>
-#include "pch.h"
-
-#include <ppltasks.h>
-#include <agents.h>
-#include <iostream>
-
 #include <Objidl.h>
+#endif
+
 #include "WinRTVFS.h"
+#include "WinRTTimer.h"
+#include "WinRTIoLog.h"
+
+
+
+/*
+** Register a VFS named zName whose files are opened through pBackend.
+** The sqlite3_vfs is never freed; SQLite keeps a pointer to it for the
+** life of the process.
+*/
+int WinRTVFSRegister(const char *zName, WinRTBackend *pBackend, int makeDefault)
+{
+	sqlite3_vfs base =
+	{
+		1,                            /* iVersion */
+		sizeof(WinRTFile),             /* szOsFile */
+		MAXPATHNAME,                  /* mxPathname */
+		0,                            /* pNext */
+		zName,                        /* zName */
+		(void*)pBackend,			  /* pAppData */
+		WinRTOpen,                     /* xOpen */
+		WinRTDelete,                   /* xDelete */
+		WinRTAccess,                   /* xAccess */
+		WinRTFullPathname,             /* xFullPathname */
+		WinRTDlOpen,                   /* xDlOpen */
+		WinRTDlError,                  /* xDlError */
+		WinRTDlSym,                    /* xDlSym */
+		WinRTDlClose,                  /* xDlClose */
+		WinRTRandomness,               /* xRandomness */
+		WinRTSleep,                    /* xSleep */
+		WinRTCurrentTime              /* xCurrentTime */
+	};
+	WinRTVfs *pVFS = new WinRTVfs;
+	pVFS->base = base;
+	::WinRTIoPolicyDefault(&pVFS->policy);
+	return ::sqlite3_vfs_register(&pVFS->base, makeDefault);
+}
+
+/*
+** Guards the policies of the VFSes, which files copy as they open.
+*/
+static std::mutex policyMutex;
+
+int WinRTVFSSetIoPolicy(const char *zVfs, const WinRTIoPolicy *pPolicy)
+{
+	sqlite3_vfs *pVfs = ::sqlite3_vfs_find(zVfs);
+	if (pVfs == nullptr || pVfs->xOpen != WinRTOpen || ::WinRTIoPolicyCheck(pPolicy) != SQLITE_OK)
+		return SQLITE_MISUSE;
+	std::lock_guard<std::mutex> lock(policyMutex);
+	((WinRTVfs*)pVfs)->policy = *pPolicy;
+	return SQLITE_OK;
+}
+
+/*
+** Largest read made to fill the block cache, and the largest gap between hot
+** blocks that is read through rather than split into two reads.
+*/
+#define WINRT_PREWARM_CHUNK_BYTES   (1024 * 1024)
+#define WINRT_HOT_GAP_BYTES         (64 * 1024)
+
+/*
+** Hot-block list kept next to each main database: WINRT_HOT_MAGIC, the block
+** size and the number of blocks, then the block numbers in file order, all
+** 32-bit little-endian.
+*/
+#define WINRT_HOT_SUFFIX            "-hot"
+#define WINRT_HOT_MAGIC             0x48545257	/* "WRTH" */
+
+static void WinRTPut32(unsigned char *z, sqlite_uint64 v)
+{
+	z[0] = (unsigned char)v;
+	z[1] = (unsigned char)(v >> 8);
+	z[2] = (unsigned char)(v >> 16);
+	z[3] = (unsigned char)(v >> 24);
+}
+
+static sqlite_uint64 WinRTGet32(const unsigned char *z)
+{
+	return z[0] | (z[1] << 8) | (z[2] << 16) | ((sqlite_uint64)z[3] << 24);
+}
+
+/*
+** Save the blocks read most in the session that just ended. The list is only
+** a hint, so failures are ignored.
+*/
+static void WinRTSaveHotBlocks(WinRTBackend *pBackend, const char *zName, const std::vector<sqlite_int64> &hot)
+{
+	std::vector<unsigned char> list(12 + 4 * hot.size());
+	WinRTPut32(&list[0], WINRT_HOT_MAGIC);
+	WinRTPut32(&list[4], WINRT_BLOCK_BYTES);
+	WinRTPut32(&list[8], hot.size());
+	for (size_t i = 0; i < hot.size(); i++)
+		WinRTPut32(&list[12 + 4 * i], hot[i]);
+
+	std::string hotName = std::string(zName) + WINRT_HOT_SUFFIX;
+	WinRTStorage *storage = nullptr;
+	if (pBackend->Open(hotName.c_str(), SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, &storage) != SQLITE_OK)
+		return;
+	if (storage->Write(&list[0], (int)list.size(), 0) == SQLITE_OK)
+		storage->Truncate(list.size());
+	delete storage;
+}
+
+/*
+** Check the header and block caches against the storage's change token, and
+** forget the size if another process changed the file.
+*/
+static void WinRTValidateCaches(WinRTSharedFile *file)
+{
+	std::lock_guard<std::mutex> lock(file->mutex);
+	sqlite_uint64 token;
+	const sqlite_uint64 *pToken = file->storage->ChangeToken(&token) == SQLITE_OK ? &token : nullptr;
+	bool changed = file->header->Validate(pToken);
+	if (file->blocks->Validate(pToken) || changed)
+		file->sizeKnown = false;
+}
+
+/*
+** After a transaction that wrote, take the change token of the file as its
+** writes left it, so that the caches can tell the next change made by
+** another process from them; the blocks outlive the file's last handle, so
+** this also covers a change made while the file was closed.
+*/
+static void WinRTRebaseCaches(WinRTSharedFile *file)
+{
+	std::lock_guard<std::mutex> lock(file->mutex);
+	if (!file->header->TokenBehind() && !file->blocks->TokenBehind())
+		return;
+	sqlite_uint64 token;
+	if (file->storage->ChangeToken(&token) != SQLITE_OK)
+		return;
+	file->header->Rebase(&token);
+	file->blocks->Rebase(&token);
+}
+
+/*
+** Read the ranges in aVec, in ascending order, from a main database's shared
+** storage into its block cache with one ReadBatch, placing them in buf (their
+** zBuf is set here). *pEof is set if the file ends inside one of them.
+**
+** Like WinRTRead, it reads without the file's mutex; the block cache keeps
+** nothing read while a connection's writes were being sent.
+*/
+static int WinRTReadIntoCache(
+	const char *zName,
+	WinRTSharedFile *file,
+	std::vector<char> &buf,
+	WinRTIoVec *aVec,
+	int nVec,
+	bool *pEof
+	)
+{
+	size_t nTotal = 0;
+	for (int i = 0; i < nVec; i++)
+		nTotal += aVec[i].iAmt;
+	if (buf.size() < nTotal)
+		buf.resize(nTotal);
+	for (int i = 0, iBuf = 0; i < nVec; iBuf += aVec[i++].iAmt)
+		aVec[i].zBuf = &buf[iBuf];
+
+	WinRTIoSpan span(WINRT_IO_PREFETCH, zName, aVec[0].iOfst, nTotal);
+	unsigned generation = file->blocks->Generation();
+	int rc = span.End(file->Reader()->ReadBatch(aVec, nVec));
+	if (rc != SQLITE_OK)
+		return rc;
+	*pEof = false;
+	for (int i = 0; i < nVec; i++)
+	{
+		file->blocks->Fill(generation, aVec[i].zBuf, aVec[i].iAmt, aVec[i].nDone, aVec[i].iOfst);
+		if (aVec[i].nDone < aVec[i].iAmt)
+			*pEof = true;
+	}
+	return SQLITE_OK;
+}
+
+/*
+** Stream the start of a database into its block cache, for an app to call
+** at launch. The file is opened as a connection would open it (read-write
+** when possible) and shared with the connections that open it meanwhile, so
+** that its reads are ordered with their writes.
+*/
+int WinRTVFSPrewarm(const char *zVfs, const char *zName, sqlite_int64 maxBytes)
+{
+	sqlite3_vfs *pVfs = ::sqlite3_vfs_find(zVfs);
+	if (pVfs == nullptr || pVfs->xOpen != WinRTOpen || zName == nullptr)
+		return SQLITE_MISUSE;
+	WinRTBackend *pBackend = (WinRTBackend*)pVfs->pAppData;
+
+	WinRTSharedFile *file = nullptr;
+	bool first;
+	int rc = WinRTSharedFile::Open(pBackend, zName, SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_READWRITE, &file, &first);
+	if (rc != SQLITE_OK)
+		rc = WinRTSharedFile::Open(pBackend, zName, SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_READONLY, &file, &first);
+	if (rc != SQLITE_OK)
+		return rc;
+	WinRTValidateCaches(file);
+
+	// Whole blocks only, so that a short read marks end of file.
+	sqlite_int64 limit = maxBytes < WINRT_BLOCK_PRIMARY_BYTES ? maxBytes : WINRT_BLOCK_PRIMARY_BYTES;
+	limit = (limit + WINRT_BLOCK_BYTES - 1) / WINRT_BLOCK_BYTES * WINRT_BLOCK_BYTES;
+	std::vector<char> buf;
+	bool eof = false;
+	for (sqlite_int64 iOfst = 0; rc == SQLITE_OK && !eof && iOfst < limit; iOfst += WINRT_PREWARM_CHUNK_BYTES)
+	{
+		int iAmt = (int)(limit - iOfst < WINRT_PREWARM_CHUNK_BYTES ? limit - iOfst : WINRT_PREWARM_CHUNK_BYTES);
+		WinRTIoVec vec = { nullptr, iAmt, iOfst, 0 };
+		rc = WinRTReadIntoCache(zName, file, buf, &vec, 1, &eof);
+	}
+
+	// Connections may have come and gone meanwhile, leaving this the last.
+	std::vector<sqlite_int64> hot;
+	WinRTSharedFile::Release(file, &hot);
+	if (!hot.empty())
+		WinRTSaveHotBlocks(pBackend, zName, hot);
+	return rc;
+}
+
+/*
+** Prefetch the blocks in a database's hot list that are not cached, in file
+** order, reading blocks less than WINRT_HOT_GAP_BYTES apart together. The
+** runs go to storage in batches of up to WINRT_PREWARM_CHUNK_BYTES, so a
+** backend that queues reads (io_uring) has them all in flight at once. Runs
+** on a thread of its own, started by the first open of the file, which
+** hands it a reference to the shared file.
+*/
+static void WinRTLoadHotBlocks(WinRTBackend *pBackend, std::string name, WinRTSharedFile *file)
+{
+	std::string hotName = name + WINRT_HOT_SUFFIX;
+	WinRTStorage *storage = nullptr;
+	std::vector<unsigned char> list(12);
+	int nRead = 0;
+	std::vector<sqlite_int64> hot;
+	if (pBackend->Open(hotName.c_str(), SQLITE_OPEN_READONLY, &storage) == SQLITE_OK
+		&& storage->Read(&list[0], 12, 0, &nRead) == SQLITE_OK && nRead == 12
+		&& WinRTGet32(&list[0]) == WINRT_HOT_MAGIC && WinRTGet32(&list[4]) == WINRT_BLOCK_BYTES
+		&& WinRTGet32(&list[8]) <= WINRT_HOT_BLOCKS)
+	{
+		int n = (int)WinRTGet32(&list[8]);
+		list.resize(4 * n + 1);
+		if (storage->Read(&list[0], 4 * n, 12, &nRead) == SQLITE_OK && nRead == 4 * n)
+		{
+			for (int i = 0; i < n; i++)
+				hot.push_back(WinRTGet32(&list[4 * i]));
+		}
+	}
+	delete storage;
+	file->blocks->Missing(&hot);
+	if (!hot.empty())
+	{
+		std::vector<char> buf;
+		std::vector<WinRTIoVec> batch;
+		int nBatch = 0;
+		int rc = SQLITE_OK;
+		bool eof = false;
+		for (size_t i = 0; i < hot.size() && rc == SQLITE_OK && !eof;)
+		{
+			sqlite_int64 first = hot[i], last = hot[i];
+			for (i++; i < hot.size(); i++)
+			{
+				if ((hot[i] - last - 1) * WINRT_BLOCK_BYTES > WINRT_HOT_GAP_BYTES
+					|| (hot[i] - first + 1) * WINRT_BLOCK_BYTES > WINRT_PREWARM_CHUNK_BYTES)
+					break;
+				last = hot[i];
+			}
+			WinRTIoVec vec = { nullptr, (int)((last - first + 1) * WINRT_BLOCK_BYTES), first * WINRT_BLOCK_BYTES, 0 };
+			if (nBatch + vec.iAmt > WINRT_PREWARM_CHUNK_BYTES)
+			{
+				rc = WinRTReadIntoCache(name.c_str(), file, buf, &batch[0], (int)batch.size(), &eof);
+				batch.clear();
+				nBatch = 0;
+			}
+			batch.push_back(vec);
+			nBatch += vec.iAmt;
+		}
+		if (rc == SQLITE_OK && !eof && !batch.empty())
+			WinRTReadIntoCache(name.c_str(), file, buf, &batch[0], (int)batch.size(), &eof);
+	}
 
+	// The connections may all have closed meanwhile, leaving this the last.
+	hot.clear();
+	WinRTSharedFile::Release(file, &hot);
+	if (!hot.empty())
+		WinRTSaveHotBlocks(pBackend, name.c_str(), hot);
+}
+
+/*
+** Called when an io_method is invoked on a file whose storage has already
+** been released by WinRTClose.
+*/
+static int WinRTFileClosed()
+{
+#if SQLITE_OS_WINRT
+	throw ref new Exception(
+		E_HANDLE,
+		"WinRTVFS Exception: SQLite database file already closed"
+		);
+#else
+	return SQLITE_MISUSE;
+#endif
+}
 
+/*
+** Send the pending write run to storage, passing it to the header and block
+** caches on the way.
+*/
+static int WinRTFlushRun(WinRTFile *p)
+{
+	if (p->writeRun->Empty())
+		return SQLITE_OK;
 
+	// Timed from here, since waiting for the file is part of the stall.
+	WinRTIoSpan span(WINRT_IO_WRITE, p->zName, p->writeRun->Start(), p->writeRun->End() - p->writeRun->Start());
+	WinRTIoDeadline deadline(p->policy.writeMicro);
+	WinRTSharedFile *file = p->file;
+	std::lock_guard<std::mutex> lock(file->mutex);
+	if (file->header != nullptr)
+	{
+		const std::vector<WinRTIoVec> &pending = p->writeRun->Pending();
+		file->header->Update(&pending[0], (int)pending.size());
+		file->blocks->Update(&pending[0], (int)pending.size());
+	}
+	sqlite_int64 end = p->writeRun->End();
+	int result = span.End(p->writeRun->Flush(file->storage));
+	if (file->header != nullptr)
+	{
+		file->header->Sent();
+		file->blocks->Sent();
+	}
+	if (result != SQLITE_OK)
+	{
+		if (file->header != nullptr)
+		{
+			file->header->Invalidate();
+			file->blocks->Invalidate();
+		}
+		file->sizeKnown = false;
+	}
+	else if (file->sizeKnown && end > file->size)
+	{
+		file->size = end;
+	}
+	return result;
+}
 
+/*
+** Microseconds given by URI parameter zParam of main database zName in
+** milliseconds, or micro if it is absent or out of range.
+*/
+static int WinRTUriMicro(const char *zName, const char *zParam, int micro)
+{
+	sqlite_int64 ms = ::sqlite3_uri_int64(zName, zParam, -1);
+	if (ms < 0 || ms > 0x7FFFFFFF / 1000)
+		return micro;
+	return (int)ms * 1000;
+}
 
 /*
-** Open a file handle.
+** Open a file handle. A main database opened as a URI may override the
+** policy of the VFS with read_timeout_ms, write_timeout_ms,
+** sync_timeout_ms, open_timeout_ms and sync_attempts parameters; they cover
+** its first read, which SQLite makes before a file control can be sent.
 */
 int WinRTOpen(
 	sqlite3_vfs *pVfs,              /* VFS */
@@ -66,6 +425,48 @@ int WinRTOpen(
 	)
 {
 	WinRTFile *p = (WinRTFile*)pFile; /* Populate this structure */
+	WinRTBackend *pBackend = (WinRTBackend*)pVfs->pAppData;
+
+	// SQLite calls xClose on a failed open whenever pMethods is set, so
+	// it is only assigned once the storage is open.
+	p->base.pMethods = nullptr;
+	p->backend = pBackend;
+	p->zName = zName;
+	p->file = nullptr;
+	p->writeRun = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(policyMutex);
+		p->policy = ((WinRTVfs*)pVfs)->policy;
+	}
+
+	if (zName == 0)
+		return SQLITE_IOERR;
+
+	if (flags & SQLITE_OPEN_MAIN_DB)
+	{
+		WinRTIoPolicy policy = p->policy;
+		policy.openMicro = WinRTUriMicro(zName, "open_timeout_ms", policy.openMicro);
+		policy.readMicro = WinRTUriMicro(zName, "read_timeout_ms", policy.readMicro);
+		policy.writeMicro = WinRTUriMicro(zName, "write_timeout_ms", policy.writeMicro);
+		policy.syncMicro = WinRTUriMicro(zName, "sync_timeout_ms", policy.syncMicro);
+		sqlite_int64 attempts = ::sqlite3_uri_int64(zName, "sync_attempts", policy.maxAttempts);
+		if (attempts >= 1 && attempts <= 1000)
+			policy.maxAttempts = (int)attempts;
+		if (::WinRTIoPolicyCheck(&policy) == SQLITE_OK)
+			p->policy = policy;
+	}
+
+	// Connections to the same main database share its storage and caches.
+	WinRTSharedFile *file = nullptr;
+	bool first = false;
+	WinRTIoSpan span(WINRT_IO_OPEN, zName, 0, 0);
+	int rc;
+	{
+		WinRTIoDeadline deadline(p->policy.openMicro);
+		rc = span.End(WinRTSharedFile::Open(pBackend, zName, flags, &file, &first));
+	}
+	if (rc != SQLITE_OK)
+		return rc;
 
 	p->base.pMethods = new sqlite3_io_methods
 	{
@@ -84,29 +485,20 @@ int WinRTOpen(
 		WinRTDeviceCharacteristics     /* xDeviceCharacteristics */
 	};
 
-	if (zName == 0)
-		return SQLITE_IOERR;
-
-	IRandomAccessStream^ stream = nullptr;
-	try
-	{
-		StorageFile^ file = ::GetStorageFileFromPath(zName);
-		if (file == nullptr) return SQLITE_IOERR_ACCESS;
-
-		stream = create_task(
-			file->OpenAsync(
-			flags & SQLITE_OPEN_READONLY ? FileAccessMode::Read : FileAccessMode::ReadWrite
-			)).get();
-	}
-	catch (AccessDeniedException^ ex)
-	{
-		return SQLITE_IOERR_ACCESS;
-	}
-
 	if (pOutFlags)
 		*pOutFlags = flags;
 
-	p->stream = stream;
+	p->file = file;
+	p->writeRun = new WinRTWriteRun();
+	if (file->header != nullptr)
+	{
+		WinRTValidateCaches(file);
+		if (first)
+		{
+			WinRTSharedFile::Retain(file);
+			std::thread(WinRTLoadHotBlocks, pBackend, std::string(zName), file).detach();
+		}
+	}
 	return SQLITE_OK;
 }
 
@@ -117,20 +509,9 @@ int WinRTOpen(
 */
 int WinRTDelete(sqlite3_vfs *pVfs, const char *zPath, int dirSync)
 {
-	try
-	{
-		StorageFile^ file = ::GetStorageFileFromPath(zPath);
-		auto deleteFileTask = create_task(
-			file->DeleteAsync()
-			);
-		//if (dirSync)	
-		deleteFileTask.wait();	// always wait regardless of dirSync (2015-03-16)
-		return SQLITE_OK;
-	}
-	catch (AccessDeniedException^ ex)
-	{
-		return SQLITE_IOERR_ACCESS;
-	}
+	WinRTBackend *pBackend = (WinRTBackend*)pVfs->pAppData;
+	WinRTBlockCache::Forget(pBackend, ::WinRTCanonicalPath(zPath).c_str());
+	return pBackend->Delete(zPath, dirSync);
 }
 
 /*
@@ -214,11 +595,13 @@ int WinRTRandomness(sqlite3_vfs *pVfs, int nByte, char *zByte)
 
 /*
 ** Sleep for at least nMicro microseconds. Return the (approximate) number
-** of microseconds slept for.
+** of microseconds slept for. The shared timer service (WinRTTimer.cpp)
+** keeps SQLite's busy-handler backoff accurate to the microsecond without
+** a timer object per call.
 */
 int WinRTSleep(sqlite3_vfs *pVfs, int nMicro)
 {
-	::complete_after(nMicro / 1000).wait();
+	::WinRTTimerSleep(nMicro);
 	return nMicro;
 }
 
@@ -226,22 +609,26 @@ int WinRTSleep(sqlite3_vfs *pVfs, int nMicro)
 
 
 /*
-** Close a file.
+** Close a file. The handle is released even if the final flush fails, since
+** SQLite does not call xClose again; the flush's error is returned.
 */
 int WinRTClose(sqlite3_file *pFile)
 {
 	WinRTFile *p = (WinRTFile*)pFile;
-	int result = WinRTFlush(p);
-	if (result != SQLITE_OK)
-		return result;
-	delete p->stream;
+	WinRTIoSpan span(WINRT_IO_CLOSE, p->zName, 0, 0);
+	int result = WinRTFlush(p, SQLITE_SYNC_NORMAL);
+	delete p->writeRun;
 	delete p->base.pMethods;
-	p->stream = nullptr;
+	std::vector<sqlite_int64> hot;
+	WinRTSharedFile::Release(p->file, &hot);
+	if (!hot.empty())
+		WinRTSaveHotBlocks(p->backend, p->zName, hot);
+	p->file = nullptr;
+	p->writeRun = nullptr;
 	p->base.pMethods = nullptr;
-	return SQLITE_OK;
+	return span.End(result);
 }
 
-
 /*
 ** Set *pTime to the current UTC time expressed as a Julian day. Return
 ** SQLITE_OK if successful, or an error code otherwise.
@@ -262,7 +649,9 @@ int WinRTCurrentTime(sqlite3_vfs *pVfs, double *pTime)
 
 
 /*
-** Read data from a file.
+** Read data from a file. Reads within page 1 of a main database are served
+** from the shared header cache once it holds them, and other reads from the
+** block cache when it holds every block they cover.
 */
 int WinRTRead(
 	sqlite3_file *pFile,
@@ -273,67 +662,68 @@ int WinRTRead(
 {
 	WinRTFile *p = (WinRTFile*)pFile;
 
-	if (p->stream == nullptr)
-		throw ref new Exception(
-		E_HANDLE,
-		"WinRTVFS Exception: SQLite database file already closed"
-		);
+	if (p->file == nullptr)
+		return WinRTFileClosed();
 
-	IInputStream^ inputStream = p->stream->GetInputStreamAt(
-		iOfst
-		);
-	Buffer^ readBuffer = ref new Buffer(iAmt);
-	IBuffer^ finalBuffer = nullptr;
+	// Pending writes must reach storage before they can be read back.
+	if (p->writeRun->Overlaps(iOfst, iAmt))
+	{
+		int result = WinRTFlushRun(p);
+		if (result != SQLITE_OK)
+			return result;
+	}
 
-	try
+	WinRTIoSpan span(WINRT_IO_READ, p->zName, iOfst, iAmt);
+	WinRTIoDeadline deadline(p->policy.readMicro);
+	WinRTSharedFile *file = p->file;
+	int nRead = 0;
+	if (file->header == nullptr)
 	{
-		auto readTask = create_task(
-			inputStream->ReadAsync(
-			readBuffer,
-			iAmt,
-			InputStreamOptions::ReadAhead)
-			);
-		// always use the returned buffer, not the original buffer!
-		finalBuffer = readTask.get();
+		std::lock_guard<std::mutex> lock(file->mutex);
+		int result = file->storage->Read(zBuf, iAmt, iOfst, &nRead);
+		if (result != SQLITE_OK)
+			return span.End(result);
 	}
-	catch (AccessDeniedException^ ex)
+	else if (file->header->Read(zBuf, iAmt, iOfst, &nRead) || file->blocks->Read(zBuf, iAmt, iOfst, &nRead))
 	{
-		delete readBuffer;
-		return SQLITE_IOERR_ACCESS;
+		span.Cached();
+	}
+	else
+	{
+		// Made without the mutex, so that connections read in parallel and
+		// a read does not wait for another connection's flush. The caches
+		// keep the result only if no write was sent meanwhile.
+		unsigned generation = file->header->Generation();
+		unsigned blockGeneration = file->blocks->Generation();
+		int result = file->Reader()->Read(zBuf, iAmt, iOfst, &nRead);
+		if (result != SQLITE_OK)
+			return span.End(result);
+		if (iOfst == 0)
+			file->header->Fill(generation, zBuf, iAmt, nRead);
+		file->blocks->Fill(blockGeneration, zBuf, iAmt, nRead, iOfst);
 	}
 
-	ComPtr<IBufferByteAccess> bufferByteAccess;
-	reinterpret_cast<IInspectable*>(finalBuffer)->QueryInterface(
-		IID_PPV_ARGS(&bufferByteAccess)
-		);
-	BYTE* pData = nullptr;
-	if (FAILED(
-		bufferByteAccess->Buffer(&pData)
-		))
-		return SQLITE_IOERR;
-
-	::memcpy(zBuf, pData, finalBuffer->Length);
-
-	delete readBuffer;
-
-	if (finalBuffer->Length < (DWORD)iAmt)
+	if (nRead < iAmt)
 	{
 		// must zero out remainder of return buffer if short read
 		::memset(
-			(BYTE*)zBuf + finalBuffer->Length,
+			(char*)zBuf + nRead,
 			0,
-			iAmt - finalBuffer->Length
+			iAmt - nRead
 			);
-		return SQLITE_IOERR_SHORT_READ;
+		return span.End(SQLITE_IOERR_SHORT_READ);
 	}
 	else
 	{
-		return SQLITE_OK;
+		return span.End(SQLITE_OK);
 	}
 }
 
 /*
-** Write data to the file
+** Write data to the file. Writes that continue the previous one are held in
+** p->writeRun and sent to storage together; the run is flushed when a write
+** is not adjacent, and before reads of the same range, truncation, sync,
+** unlock and close.
 */
 int WinRTWrite(
 	sqlite3_file *pFile,
@@ -344,46 +734,17 @@ int WinRTWrite(
 {
 	WinRTFile *p = (WinRTFile*)pFile;
 
-	if (p->stream == nullptr)
-		throw ref new Exception(
-		E_HANDLE,
-		"WinRTVFS Exception: SQLite database file already closed"
-		);
-
-	IOutputStream^ outputStream = p->stream->GetOutputStreamAt(
-		iOfst
-		);
-	Buffer^ writeBuffer = ref new Buffer(iAmt);
-	ComPtr<IBufferByteAccess> bufferByteAccess;
-	reinterpret_cast<IInspectable*>(writeBuffer)->QueryInterface(
-		IID_PPV_ARGS(&bufferByteAccess)
-		);
-	BYTE* pData = nullptr;
-	if (FAILED(
-		bufferByteAccess->Buffer(&pData)
-		))
-		return SQLITE_IOERR;
-
-	::memcpy(pData, zBuf, iAmt);
-	writeBuffer->Length = iAmt;
+	if (p->file == nullptr)
+		return WinRTFileClosed();
 
-	int result = SQLITE_OK;
-	try
-	{
-		auto writeTask = create_task(
-			outputStream->WriteAsync(writeBuffer)
-			);
-		writeTask.wait();
-	}
-	catch (AccessDeniedException^ ex)
-	{
-		result = SQLITE_IOERR_ACCESS;
-	}
-
-	delete outputStream;
-	delete writeBuffer;
+	if (p->writeRun->Append(zBuf, iAmt, iOfst))
+		return SQLITE_OK;
 
-	return result;
+	int result = WinRTFlushRun(p);
+	if (result != SQLITE_OK)
+		return result;
+	p->writeRun->Append(zBuf, iAmt, iOfst);
+	return SQLITE_OK;
 }
 
 /*
@@ -392,12 +753,29 @@ int WinRTWrite(
 int WinRTTruncate(sqlite3_file *pFile, sqlite_int64 size)
 {
 	WinRTFile *p = (WinRTFile*)pFile;
-	if (p->stream == nullptr)
-		throw ref new Exception(
-		E_HANDLE,
-		"WinRTVFS Exception: SQLite database file already closed"
-		);
-	p->stream->Size = size;
+	if (p->file == nullptr)
+		return WinRTFileClosed();
+	int result = WinRTFlushRun(p);
+	if (result != SQLITE_OK)
+		return result;
+
+	WinRTIoSpan span(WINRT_IO_TRUNCATE, p->zName, 0, size);
+	WinRTIoDeadline deadline(p->policy.writeMicro);
+	WinRTSharedFile *file = p->file;
+	std::lock_guard<std::mutex> lock(file->mutex);
+	result = span.End(file->storage->Truncate(size));
+	if (result != SQLITE_OK)
+	{
+		file->sizeKnown = false;
+		return result;
+	}
+	if (file->header != nullptr)
+	{
+		file->header->Truncate(size);
+		file->blocks->Truncate(size);
+	}
+	file->size = size;
+	file->sizeKnown = true;
 	return SQLITE_OK;
 }
 
@@ -407,35 +785,65 @@ int WinRTTruncate(sqlite3_file *pFile, sqlite_int64 size)
 int WinRTSync(sqlite3_file *pFile, int flags)
 {
 	WinRTFile *p = (WinRTFile*)pFile;
-	return WinRTFlush(p);
+	return WinRTFlush(p, flags);
 }
 
 /*
-** Write the size of the file in bytes to *pSize.
+** Write the size of the file in bytes to *pSize. The size is asked of
+** storage once and then kept up to date as connections write and truncate;
+** it is asked again only after another process may have changed the file
+** (see WinRTLock). Writes this connection has not flushed yet are added on.
 */
 int WinRTFileSize(sqlite3_file *pFile, sqlite_int64 *pSize)
 {
 	WinRTFile *p = (WinRTFile*)pFile;
-	if (p->stream == nullptr)
-		throw ref new Exception(
-		E_HANDLE,
-		"WinRTVFS Exception: SQLite database file already closed"
-		);
-	*pSize = p->stream->Size;
+	if (p->file == nullptr)
+		return WinRTFileClosed();
+
+	WinRTSharedFile *file = p->file;
+	sqlite_int64 size;
+	{
+		std::lock_guard<std::mutex> lock(file->mutex);
+		if (!file->sizeKnown)
+		{
+			int result = file->storage->FileSize(&file->size);
+			if (result != SQLITE_OK)
+				return result;
+			file->sizeKnown = true;
+		}
+		size = file->size;
+	}
+	if (!p->writeRun->Empty() && p->writeRun->End() > size)
+		size = p->writeRun->End();
+	*pSize = size;
 	return SQLITE_OK;
 }
 
 /*
-** Locking functions. These are no-ops for WinRT
+** Locking functions. These are no-ops for WinRT, apart from checking the
+** caches and cached size when a read transaction starts, and taking the
+** change token again when a transaction that wrote ends.
 */
 int WinRTLock(sqlite3_file *pFile, int eLock)
 {
-	return SQLITE_OK;
+	WinRTFile *p = (WinRTFile*)pFile;
+	WinRTIoSpan span(WINRT_IO_LOCK, p->zName, eLock, 0);
+	if (eLock == SQLITE_LOCK_SHARED && p->file != nullptr && p->file->header != nullptr)
+		WinRTValidateCaches(p->file);
+	return span.End(SQLITE_OK);
 }
 
 int WinRTUnlock(sqlite3_file *pFile, int eLock)
 {
-	return SQLITE_OK;
+	// End of a transaction: make its writes visible to other connections.
+	WinRTFile *p = (WinRTFile*)pFile;
+	if (p->file == nullptr)
+		return SQLITE_OK;
+	WinRTIoSpan span(WINRT_IO_UNLOCK, p->zName, eLock, 0);
+	int result = WinRTFlushRun(p);
+	if (result == SQLITE_OK && p->file->header != nullptr)
+		WinRTRebaseCaches(p->file);
+	return span.End(result);
 }
 
 int WinRTCheckReservedLock(sqlite3_file *pFile, int *pResOut)
@@ -444,11 +852,18 @@ int WinRTCheckReservedLock(sqlite3_file *pFile, int *pResOut)
 }
 
 /*
-** No file control for this VFS.
+** The only file control is WINRT_FCNTL_IO_POLICY.
 */
 int WinRTFileControl(sqlite3_file *pFile, int op, void *pArg)
 {
-	return SQLITE_NOTFOUND;
+	WinRTFile *p = (WinRTFile*)pFile;
+	if (op != WINRT_FCNTL_IO_POLICY)
+		return SQLITE_NOTFOUND;
+	const WinRTIoPolicy *pPolicy = (const WinRTIoPolicy*)pArg;
+	if (pPolicy == nullptr || ::WinRTIoPolicyCheck(pPolicy) != SQLITE_OK)
+		return SQLITE_MISUSE;
+	p->policy = *pPolicy;
+	return SQLITE_OK;
 }
 
 /*
@@ -465,108 +880,60 @@ int WinRTDeviceCharacteristics(sqlite3_file *pFile)
 }
 
 
-// Creates a task that completes after the specified delay.
+#if SQLITE_OS_WINRT
+// Creates a task that completes after the specified delay, in milliseconds.
 task<void> complete_after(unsigned int timeout)
 {
-	// A task completion event that is set when a timer fires.
 	task_completion_event<void> tce;
-
-	// Create a non-repeating timer.
-	auto fire_once = new timer<int>(timeout, 0, nullptr, false);
-	// Create a call object that sets the completion event after the timer fires.
-	auto callback = new call<int>([tce](int)
+	::WinRTTimerSchedule((int)timeout * 1000, [tce]()
 	{
 		tce.set();
 	});
-
-	// Connect the timer to the callback and start the timer.
-	fire_once->link_target(callback);
-	fire_once->start();
-
-	// Create a task that completes after the completion event is set.
-	task<void> event_set(tce);
-
-	// Create a continuation task that cleans up resources and 
-	// and return that continuation task. 
-	return event_set.then([callback, fire_once]()
-	{
-		delete callback;
-		delete fire_once;
-	});
+	return task<void>(tce);
 }
+#endif
 
 
-int WinRTFlush(WinRTFile *p)
+/*
+** Send the write run and sync, retrying a failed sync as p->policy says,
+** within its deadline. Returns SQLITE_IOERR_ACCESS once it gives up. A sync
+** that reports a write storage had queued (SQLITE_FULL, SQLITE_IOERR_WRITE)
+** failing is not retried, as the write is lost; its error is returned.
+**
+** The header and block caches were given the writes before they were sent,
+** so after a failure they are dropped, to be read again from storage.
+*/
+int WinRTFlush(WinRTFile *p, int flags)
 {
-	int retries = 0;
-	bool success = false;
-	if (p->stream == nullptr)
-		throw ref new Exception(E_HANDLE, "WinRTVFS Exception : SQLite database file already closed");
-	while (!success && retries++ < 10)
+	if (p->file == nullptr)
+		return WinRTFileClosed();
+	int result = WinRTFlushRun(p);
+	if (result != SQLITE_OK)
+		return result;
+	// Timed with its retries and the sleeps between them.
+	WinRTIoSpan span(WINRT_IO_SYNC, p->zName, 0, 0);
+	WinRTIoDeadline deadline(p->policy.syncMicro);
+	WinRTSharedFile *file = p->file;
+	int attempt = 0;
+	do
 	{
-		try
+		std::lock_guard<std::mutex> lock(file->mutex);
+		result = file->storage->Sync(flags);
+		if (result != SQLITE_OK)
 		{
-			create_task(
-				p->stream->FlushAsync()
-				).wait();
-			success = true;
+			if (file->header != nullptr)
+			{
+				file->header->Invalidate();
+				file->blocks->Invalidate();
+			}
+			file->sizeKnown = false;
 		}
-		catch (Exception^ ex)
-		{
-			::WinRTSleep(nullptr, 1000000);
-		}
-	}
-	if (!success)
-		return SQLITE_IOERR_ACCESS;
+	} while (result != SQLITE_OK && result != SQLITE_FULL && result != SQLITE_IOERR_WRITE
+		&& ::WinRTIoRetry(&p->policy, ++attempt) == SQLITE_OK);
+	if (result == SQLITE_FULL || result == SQLITE_IOERR_WRITE)
+		return span.End(result, attempt);
+	if (result != SQLITE_OK)
+		return span.End(SQLITE_IOERR_ACCESS, attempt - 1);
 
-	return SQLITE_OK;
+	return span.End(SQLITE_OK, attempt);
 }
-
-StorageFile^ GetStorageFileFromPath(const char* zPath)
-{
-	int pathLength = ::strlen(zPath);
-	int i;
-
-	for (i = pathLength; i >= 0; i--)
-	{
-		if (zPath[i - 1] == '\\')
-			break;
-	}
-
-	wchar_t* lpwstrPath = new wchar_t[i];
-	int folderPathCount = ::MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, zPath, i, lpwstrPath, i);
-	String^ strFolderPath = ref new String(lpwstrPath, folderPathCount);
-	delete lpwstrPath;
-
-	wchar_t* lpwstrFilename = new wchar_t[pathLength - i];
-	int fileNameCount = ::MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, zPath + i, pathLength - i,
-
-		lpwstrFilename, pathLength - i);
-	String^ strFilePath = ref new String(lpwstrFilename, fileNameCount);
-	delete lpwstrFilename;
-
-	try
-	{
-		StorageFolder^ folder =
-			create_task(
-			StorageFolder::GetFolderFromPathAsync(strFolderPath)
-			).get();
-		if (folder == nullptr)
-			return nullptr;
-
-		StorageFile^ file =
-			create_task(
-			folder->CreateFileAsync(
-			strFilePath,
-			CreationCollisionOption::OpenIfExists
-			)).get();
-		if (file == nullptr)
-			return nullptr;
-
-		return file;
-	}
-	catch (Platform::AccessDeniedException^)
-	{
-		return nullptr;
-	}
-}
\ No newline at end of file
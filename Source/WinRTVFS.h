@@ -10,8 +10,12 @@
 #pragma once
 
 #include "sqlite3.h"
+#include "WinRTStorage.h"
+#include "WinRTWriteRun.h"
+#include "WinRTSharedFile.h"
+#include "WinRTDeadline.h"
 
-
+#if SQLITE_OS_WINRT
 using namespace concurrency;
 using namespace Microsoft::WRL;
 using namespace Platform;
@@ -19,12 +23,22 @@ using namespace Platform::Collections;
 using namespace Windows::Foundation;
 using namespace Windows::Storage;
 using namespace Windows::Storage::Streams;
+#endif
 
 /*
 ** The maximum pathname length supported by this VFS.
 */
 #define MAXPATHNAME 512
 
+/*
+** A VFS registered by WinRTVFSRegister.
+*/
+typedef struct
+{
+	sqlite3_vfs base;               /* Base class. Must be first. */
+	WinRTIoPolicy policy;           /* Given to each file as it opens */
+} WinRTVfs;
+
 /*
 ** When using this VFS, the sqlite3_file* handles that SQLite uses are
 ** actually pointers to instances of type WinRTFile.
@@ -32,9 +46,42 @@ using namespace Windows::Storage::Streams;
 typedef struct
 {
 	sqlite3_file base;              /* Base class. Must be first. */
-	IRandomAccessStream^ stream;
+	WinRTBackend *backend;          /* Backend the file was opened through */
+	const char *zName;              /* Name given to WinRTOpen, valid until close */
+	WinRTSharedFile *file;          /* Storage, caches and size, or 0 once closed */
+	WinRTWriteRun *writeRun;        /* Adjacent writes not yet sent to storage */
+	WinRTIoPolicy policy;           /* Deadlines and retries of its operations */
 } WinRTFile;
 
+/*
+** sqlite3_file_control() opcode that sets the deadlines and retries of one
+** open file to the WinRTIoPolicy pArg points to, e.g. a short read deadline
+** for a database on a removable drive. Journals and other files the
+** connection opens keep the policy of the VFS. To cover the reads SQLite
+** makes while opening, give the policy as URI parameters (WinRTOpen).
+*/
+#define WINRT_FCNTL_IO_POLICY       0x57525401
+
+/*
+** Register a VFS named zName whose files are opened through pBackend.
+*/
+int WinRTVFSRegister(const char *zName, WinRTBackend *pBackend, int makeDefault);
+
+/*
+** Set the deadlines and retries of files the VFS named zVfs opens from now
+** on; files already open keep theirs. Returns SQLITE_MISUSE for a VFS not
+** registered by WinRTVFSRegister or a policy out of range.
+*/
+int WinRTVFSSetIoPolicy(const char *zVfs, const WinRTIoPolicy *pPolicy);
+
+/*
+** Read the first maxBytes of zName, or all of it if smaller, into the block
+** cache of the VFS named zVfs with large sequential reads, so that the first
+** queries after it run from memory. No more than the cache holds is read.
+** Blocks until done; callers run it in the background.
+*/
+int WinRTVFSPrewarm(const char *zVfs, const char *zName, sqlite_int64 maxBytes);
+
 // These are functions that implement the VFS "interface"
 int WinRTOpen(sqlite3_vfs *pVfs, const char *zName, sqlite3_file *pFile, int flags, int *pOutFlags);
 int WinRTDelete(sqlite3_vfs *pVfs, const char *zPath, int dirSync);
@@ -63,8 +110,10 @@ int WinRTSectorSize(sqlite3_file *pFile);
 int WinRTDeviceCharacteristics(sqlite3_file *pFile);
 
 // Helper functions
+int WinRTFlush(WinRTFile *p, int flags);
+#if SQLITE_OS_WINRT
 task<void> complete_after(unsigned int timeout);
-int WinRTFlush(WinRTFile *p);
 StorageFile^ GetStorageFileFromPath(const char* zPath);
+#endif
 
 
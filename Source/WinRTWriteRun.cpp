@@ -0,0 +1,79 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#include "pch.h"
+
+#include <string.h>
+
+#include "WinRTWriteRun.h"
+#include "WinRTMemoryBudget.h"
+
+
+WinRTWriteRun::~WinRTWriteRun()
+{
+	for (Buffer &b : used) Free(b);
+	for (Buffer &b : pool) Free(b);
+}
+
+void WinRTWriteRun::Free(const Buffer &b)
+{
+	delete[] b.zBuf;
+	::WinRTMemoryCharge(WINRT_MEMORY_WRITE_BUFFERS, -b.nAlloc);
+}
+
+bool WinRTWriteRun::Append(const void *zBuf, int iAmt, sqlite_int64 iOfst)
+{
+	if (!vecs.empty() && (iOfst != end || end - start + iAmt > WINRT_WRITE_RUN_BYTES))
+		return false;
+
+	Buffer b = { nullptr, 0 };
+	if (!pool.empty())
+	{
+		b = pool.back();
+		pool.pop_back();
+	}
+	if (b.nAlloc < iAmt)
+	{
+		Free(b);
+		b.zBuf = new char[iAmt];
+		b.nAlloc = iAmt;
+		::WinRTMemoryCharge(WINRT_MEMORY_WRITE_BUFFERS, iAmt);
+	}
+	::memcpy(b.zBuf, zBuf, iAmt);
+	used.push_back(b);
+
+	WinRTIoVec vec = { b.zBuf, iAmt, iOfst, 0 };
+	vecs.push_back(vec);
+	if (vecs.size() == 1)
+		start = iOfst;
+	end = iOfst + iAmt;
+	return true;
+}
+
+int WinRTWriteRun::Flush(WinRTStorage *storage)
+{
+	if (vecs.empty())
+		return SQLITE_OK;
+
+	int rc = storage->WriteBatch(&vecs[0], (int)vecs.size());
+
+	pool.insert(pool.end(), used.begin(), used.end());
+	used.clear();
+	vecs.clear();
+
+	// Memory is short: keep nothing for the next run.
+	unsigned generation = ::WinRTMemoryTrimGeneration();
+	if (generation != trimGeneration)
+	{
+		for (Buffer &b : pool) Free(b);
+		pool.clear();
+		trimGeneration = generation;
+	}
+	return rc;
+}
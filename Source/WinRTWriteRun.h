@@ -0,0 +1,71 @@
+/*
+*		SQLiteRT - A Windows Store runtime extension for SQLite
+*		for storing databases anywhere the app is allowed to access.
+*
+*		© Copyright 2014-2015 Peter Moore (peter@mooreusa.net). All rights reserved.
+*
+*		Licensed under LGPL v3 (https://www.gnu.org/licenses/lgpl.html)
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "WinRTStorage.h"
+
+/*
+** Maximum size of a pending run before it is written out.
+*/
+#define WINRT_WRITE_RUN_BYTES   (1024 * 1024)
+
+/*
+** A run of adjacent writes held back by WinRTWrite so that a commit touching
+** consecutive pages reaches storage as one WriteBatch (one pwritev, one
+** WriteAsync) instead of one call per page.
+**
+** SQLite's buffer is only valid for the duration of xWrite, so each write is
+** copied once into a pooled buffer of its own; the run is handed to storage
+** as a list of those buffers rather than being gathered into one.
+*/
+class WinRTWriteRun
+{
+public:
+	~WinRTWriteRun();
+
+	/*
+	** Add a write to the run. Returns false, without copying, if the write
+	** does not start where the run ends or would make the run too large; the
+	** caller then flushes and tries again.
+	*/
+	bool Append(const void *zBuf, int iAmt, sqlite_int64 iOfst);
+
+	/*
+	** Write the run out and start a new, empty one.
+	*/
+	int Flush(WinRTStorage *storage);
+
+	bool Empty() const { return vecs.empty(); }
+	bool Overlaps(sqlite_int64 iOfst, int iAmt) const
+	{
+		return !vecs.empty() && iOfst < end && iOfst + iAmt > start;
+	}
+	sqlite_int64 Start() const { return start; }
+	sqlite_int64 End() const { return end; }
+	const std::vector<WinRTIoVec> &Pending() const { return vecs; }
+
+private:
+	struct Buffer
+	{
+		char *zBuf;
+		int nAlloc;
+	};
+
+	static void Free(const Buffer &b);
+
+	std::vector<WinRTIoVec> vecs;	// pending writes, in file order
+	std::vector<Buffer> used;		// buffers backing vecs
+	std::vector<Buffer> pool;		// buffers free for reuse
+	sqlite_int64 start = 0;
+	sqlite_int64 end = 0;
+	unsigned trimGeneration = 0;	// WinRTMemoryTrimGeneration when the pool was last freed
+};
@@ -14,5 +14,7 @@
 
 #pragma once
 
+#if SQLITE_OS_WINRT
 #include <collection.h>
-#include <ppltasks.h>
\ No newline at end of file
+#include <ppltasks.h>
+#endif
\ No newline at end of file